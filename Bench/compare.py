@@ -0,0 +1,223 @@
+"""
+Compares RetroFileTool with GNU objcopy and SRecord's srec_cat on the same conversions.
+
+Usage: python compare.py RETROFILETOOL [SIZE_MB] [RUNS]
+
+A SIZE_MB Intel HEX file (default and at most 16, the WDC address space) of random
+data is generated, along with the same data as a raw binary. Each conversion is then
+run through every tool which is installed and can do it, and the median time and the
+peak resident set size of RUNS runs (default 5) are reported. Each output is decoded
+back into an image and checked against the image the conversion should produce, so
+a tool which is fast but wrong stands out.
+
+RetroFileTool has no raw binary or S-record writer, so HEX to BIN is done with its
+WDC binary output, which holds the same flat image with a header, and HEX to S-record
+is skipped for it. objcopy cannot crop or fill an image, so it is skipped for crop/fill.
+Tools which are not installed are skipped, not failed.
+
+On Linux, a process starts with the peak RSS of the process which forked it, so the tools
+are run by a small helper process, started before the data is generated. The peak RSS
+reported is then never less than the helper's own, which is shown first.
+"""
+
+import json
+import os
+import shutil
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+from pipeline import WriteHex
+
+
+def DecodeHex(data):
+   """Decodes Intel HEX records into (addr, bytes) blocks."""
+   blocks, upper = [], 0
+   for line in data.split(b"\n"):
+      line = line.strip()
+      if not line.startswith(b":"):
+         continue
+      rec = bytes.fromhex(line[1:].decode())
+      addr, recType = (rec[1] << 8) | rec[2], rec[3]
+      if recType == 0:
+         blocks.append((upper + addr, rec[4:-1]))
+      elif recType == 2:
+         upper = ((rec[4] << 8) | rec[5]) << 4
+      elif recType == 4:
+         upper = ((rec[4] << 8) | rec[5]) << 16
+   return blocks
+
+
+def DecodeSrec(data):
+   """Decodes Motorola S-records into (addr, bytes) blocks."""
+   blocks = []
+   for line in data.split(b"\n"):
+      line = line.strip()
+      if len(line) < 4 or line[:1] != b"S" or line[1:2] not in b"123":
+         continue
+      rec = bytes.fromhex(line[2:].decode())
+      addrLen = int(line[1:2]) + 1
+      blocks.append((int.from_bytes(rec[1:1 + addrLen], "big"), rec[1 + addrLen:-1]))
+   return blocks
+
+
+def DecodeWdc(data):
+   """Decodes a WDC binary into (addr, bytes) blocks."""
+   blocks, ofs = [], 1
+   while True:
+      addr = int.from_bytes(data[ofs:ofs + 3], "little")
+      n = int.from_bytes(data[ofs + 3:ofs + 6], "little")
+      if n == 0:
+         return blocks
+      blocks.append((addr, data[ofs + 6:ofs + 6 + n]))
+      ofs += 6 + n
+
+
+def DecodeBin(data):
+   """Decodes a raw binary, which starts at address 0, into (addr, bytes) blocks."""
+   return [(0, data)]
+
+
+def Canonical(blocks):
+   """Sorts blocks by address, and joins the adjacent ones, so images can be compared."""
+   runs = []
+   for addr, data in sorted(blocks, key=lambda b: b[0]):
+      if runs and runs[-1][0] + len(runs[-1][1]) == addr:
+         runs[-1][1].extend(data)
+      elif data:
+         runs.append([addr, bytearray(data)])
+   return runs
+
+
+# Runs each command line it reads, and writes back the elapsed time, the exit code, and
+# the peak RSS as ru_maxrss reports it, or None.
+HELPER = """
+import json, os, subprocess, sys, time
+for line in sys.stdin:
+   args = json.loads(line)
+   start = time.perf_counter()
+   proc = subprocess.Popen(args, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+   if hasattr(os, "wait4"):
+      _, status, usage = os.wait4(proc.pid, 0)
+      code, rss = os.waitstatus_to_exitcode(status), usage.ru_maxrss
+   else:
+      code, rss = proc.wait(), None
+   print(json.dumps([time.perf_counter() - start, code, rss]), flush=True)
+"""
+
+
+def StartHelper():
+   """Starts the helper process which runs the tools."""
+   return subprocess.Popen([sys.executable, "-c", HELPER], stdin=subprocess.PIPE,
+      stdout=subprocess.PIPE, text=True)
+
+
+def TimeRun(helper, args):
+   """Runs a tool once. Returns the elapsed time in seconds, and the peak RSS in KB or None."""
+   helper.stdin.write(json.dumps(args) + "\n")
+   helper.stdin.flush()
+   elapsed, code, rss = json.loads(helper.stdout.readline())
+   if code != 0:
+      raise subprocess.CalledProcessError(code, args)
+   if rss is not None and sys.platform == "darwin":
+      rss //= 1024
+   return elapsed, rss
+
+
+def main():
+   if len(sys.argv) < 2:
+      print(__doc__)
+      return 1
+
+   tool = sys.argv[1]
+   size = min(int(sys.argv[2]) if len(sys.argv) > 2 else 16, 16) * 1024 * 1024
+   runs = int(sys.argv[3]) if len(sys.argv) > 3 else 5
+   objcopy, srecCat = shutil.which("objcopy"), shutil.which("srec_cat")
+
+   # The helper is started while this process is still small.
+   helper = StartHelper()
+   _, floor = TimeRun(helper, [sys.executable, "-c", ""])
+
+   print("%d MB of data, median of %d runs. objcopy: %s, srec_cat: %s." %
+      (size >> 20, runs, objcopy or "not found", srecCat or "not found"))
+   print("Peak RSS of an empty run, the least which can be reported: %s.\n" %
+      ("%d MB" % (floor >> 10) if floor is not None else "unknown"))
+
+   with tempfile.TemporaryDirectory() as tmp:
+      inHex, inBin = os.path.join(tmp, "in.hex"), os.path.join(tmp, "in.bin")
+      WriteHex(inHex, size)
+      subprocess.run([tool, "-ifh", inHex, "-ofw", os.path.join(tmp, "in.wdc")],
+         stdout=subprocess.DEVNULL, check=True)
+      with open(os.path.join(tmp, "in.wdc"), "rb") as f:
+         image = Canonical(DecodeWdc(f.read()))
+      with open(inBin, "wb") as f:
+         f.write(image[0][1])
+
+      # Keep 0x1000 up to 64 KB past the end of the data, filling the gap with 0xFF.
+      cropStart, cropEnd = 0x1000, size + 0x10000
+      cropped = [[cropStart, image[0][1][cropStart:] + b"\xFF" * (cropEnd - size)]]
+
+      out = lambda name: os.path.join(tmp, name)
+      conversions = [
+         ("HEX to BIN", image, [
+            ("RetroFileTool", [tool, "-ifh", inHex, "-ofw", out("o.wdc")], out("o.wdc"), DecodeWdc),
+            ("objcopy", [objcopy, "-I", "ihex", "-O", "binary", inHex, out("o.bin")],
+               out("o.bin"), DecodeBin),
+            ("srec_cat", [srecCat, inHex, "-Intel", "-o", out("o.bin"), "-Binary"],
+               out("o.bin"), DecodeBin),
+         ]),
+         ("BIN to HEX", image, [
+            ("RetroFileTool", [tool, "-ifb", inBin + ",A=0", "-ofh", out("o.hex")], out("o.hex"), DecodeHex),
+            ("objcopy", [objcopy, "-I", "binary", "-O", "ihex", inBin, out("o.hex")],
+               out("o.hex"), DecodeHex),
+            ("srec_cat", [srecCat, inBin, "-Binary", "-o", out("o.hex"), "-Intel"],
+               out("o.hex"), DecodeHex),
+         ]),
+         ("HEX to SREC", image, [
+            ("RetroFileTool", None, None, None),
+            ("objcopy", [objcopy, "-I", "ihex", "-O", "srec", inHex, out("o.srec")],
+               out("o.srec"), DecodeSrec),
+            ("srec_cat", [srecCat, inHex, "-Intel", "-o", out("o.srec"), "-Motorola"],
+               out("o.srec"), DecodeSrec),
+         ]),
+         ("crop/fill", cropped, [
+            ("RetroFileTool", [tool, "-ifh", inHex, "-do", "crop 0x%X 0x%X; fill 0xFF" %
+               (cropStart, cropEnd - 1), "-ofh", out("o.hex")], out("o.hex"), DecodeHex),
+            ("objcopy", None, None, None),
+            ("srec_cat", [srecCat, inHex, "-Intel", "-crop", "0x%X" % cropStart,
+               "0x%X" % cropEnd, "-fill", "0xFF", "0x%X" % cropStart, "0x%X" % cropEnd, "-o",
+               out("o.hex"), "-Intel"], out("o.hex"), DecodeHex),
+         ]),
+      ]
+
+      for desc, expected, tools in conversions:
+         for name, args, outPath, decode in tools:
+            if args is None or args[0] is None:
+               print("%-12s %-14s skipped (%s)" % (desc, name,
+                  "cannot do this conversion" if args is None else "not installed"))
+               continue
+
+            try:
+               results = [TimeRun(helper, args) for _ in range(runs)]
+            except subprocess.CalledProcessError as e:
+               print("%-12s %-14s failed (exit code %d)" % (desc, name, e.returncode))
+               continue
+
+            rss = [r for _, r in results if r is not None]
+            with open(outPath, "rb") as f:
+               same = Canonical(decode(f.read())) == expected
+            print("%-12s %-14s %7.3f s  %8s  %s" % (desc, name,
+               statistics.median(t for t, _ in results),
+               "%d MB" % (max(rss) >> 10) if rss else "? MB",
+               "output ok" if same else "OUTPUT DIFFERS"))
+         print()
+
+   helper.stdin.close()
+   helper.wait()
+   return 0
+
+
+if __name__ == "__main__":
+   sys.exit(main())
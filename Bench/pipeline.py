@@ -0,0 +1,101 @@
+"""
+Measures how much the pipelined loader speeds up loading large text inputs.
+
+Usage: python pipeline.py RETROFILETOOL [SIZE_MB] [RUNS]
+
+A SIZE_MB Intel HEX file (default and at most 16, the WDC address space) is
+generated, and converted to TI-TXT and Tektronix extended hex. Then each is
+loaded with one thread (-j 1, which loads serially) and with one thread per CPU
+(which reads, decodes and merges at the same time). Each run crops the image
+to nothing before writing it, so that only the loading differs, and not the
+number of threads which write the output. With a single CPU there is no
+pipeline, so nothing is measured.
+
+On Linux, when run as root, the page cache is dropped before each run so that
+the input is read from disk; otherwise the runs are warm-cache, which hides the
+overlap of reading with decoding.
+"""
+
+import os
+import random
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+
+def WriteHex(path, size):
+   """Writes an Intel HEX file of random data, with 32 bytes per record."""
+   rng = random.Random(1)
+   with open(path, "w") as f:
+      for addr in range(0, size, 32):
+         if addr & 0xFFFF == 0:
+            upper = [2, 0, 0, 4, addr >> 24, (addr >> 16) & 0xFF]
+            f.write(":%s%02X\n" % ("".join("%02X" % b for b in upper), -sum(upper) & 0xFF))
+         data = [rng.randrange(256) for _ in range(min(32, size - addr))]
+         rec = [len(data), (addr >> 8) & 0xFF, addr & 0xFF, 0] + data
+         f.write(":%s%02X\n" % ("".join("%02X" % b for b in rec), -sum(rec) & 0xFF))
+      f.write(":00000001FF\n")
+
+
+def DropCaches():
+   """Drops the page cache, if possible. Returns whether it was dropped."""
+   try:
+      os.sync()
+      with open("/proc/sys/vm/drop_caches", "w") as f:
+         f.write("3\n")
+      return True
+   except OSError:
+      return False
+
+
+def TimeRun(args, cold):
+   """Runs RetroFileTool once, and returns the elapsed time in seconds."""
+   if cold:
+      DropCaches()
+   start = time.perf_counter()
+   subprocess.run(args, stdout=subprocess.DEVNULL, check=True)
+   return time.perf_counter() - start
+
+
+def main():
+   if len(sys.argv) < 2:
+      print(__doc__)
+      return 1
+
+   tool = sys.argv[1]
+   size = min(int(sys.argv[2]) if len(sys.argv) > 2 else 16, 16) * 1024 * 1024
+   runs = int(sys.argv[3]) if len(sys.argv) > 3 else 5
+   cold = DropCaches()
+
+   print("%d CPUs, %s cache, %d MB of data, median of %d runs.\n" %
+      (os.cpu_count(), "cold" if cold else "warm", size >> 20, runs))
+
+   if os.cpu_count() == 1:
+      print("Not applicable: the pipelined loader needs more than one CPU.")
+      return 0
+
+   with tempfile.TemporaryDirectory() as tmp:
+      inputs = [("Intel HEX", "h", os.path.join(tmp, "in.hex"))]
+      WriteHex(inputs[0][2], size)
+      for desc, char, name in (("TI-TXT", "t", "in.txt"), ("Tektronix", "k", "in.tek")):
+         path = os.path.join(tmp, name)
+         subprocess.run([tool, "-ifh", inputs[0][2], "-of" + char, path],
+            stdout=subprocess.DEVNULL, check=True)
+         inputs.append((desc, char, path))
+
+      out = ["-do", "crop 0 0", "-ofw", os.path.join(tmp, "out.wdc")]
+      for desc, char, path in inputs:
+         serial = statistics.median(TimeRun([tool, "-j", "1", "-if" + char, path] + out, cold)
+            for _ in range(runs))
+         piped = statistics.median(TimeRun([tool, "-if" + char, path] + out, cold)
+            for _ in range(runs))
+         print("%-10s %8.1f MB  serial %7.3f s  pipelined %7.3f s  speedup %.2fx" %
+            (desc, os.path.getsize(path) / 1e6, serial, piped, serial / piped))
+
+   return 0
+
+
+if __name__ == "__main__":
+   sys.exit(main())
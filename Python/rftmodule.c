@@ -0,0 +1,1098 @@
+/*********************************************************************//** @file
+CPython extension module over librft, for using it in-process from Python.
+
+   import rft
+
+   ctx = rft.Context()
+   ctx.load("inFile.hex")
+   ctx.load(romBytes, "bin", addr=0x8000)
+   for addr, data in ctx.ranges():
+      ...
+   pap = ctx.write("pap")
+   ctx.write("wdc", "outFile.wdc.bin")
+
+Each range's data is exposed as a read-only memoryview directly over the
+library's memory, so nothing is copied. While any such view is alive, the
+context cannot be loaded into, just like a bytearray cannot be resized while
+it is exported.
+******************************************************************************/
+
+/******************************************************************************
+ Include Files
+******************************************************************************/
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include "librft.h"
+
+/******************************************************************************
+ Module Typedefs and Enums
+******************************************************************************/
+
+/** A conversion context. */
+typedef struct _CONTEXT_OBJECT_ CONTEXT_OBJECT;
+struct _CONTEXT_OBJECT_
+{
+   PyObject_HEAD
+
+   /** The library's context. */
+   RFT_CONTEXT             *pCtx;
+
+   /** The number of buffers currently exported over the context's data. */
+   Py_ssize_t              exports;
+
+   /** Set while the library is working on the context without the GIL. */
+   int                     busy;
+};
+
+/** The data of one range, which memoryviews are made over. */
+typedef struct _RANGE_OBJECT_ RANGE_OBJECT;
+struct _RANGE_OBJECT_
+{
+   PyObject_HEAD
+
+   /** The context which owns the data, kept alive by this object. */
+   CONTEXT_OBJECT          *pOwner;
+
+   /** The range's data. */
+   const U8                *pData;
+
+   /** The length of the range, in bytes. */
+   U32                     len;
+};
+
+/** Maps a file type name to a FILE_TYPE. */
+typedef struct _TYPE_NAME_ TYPE_NAME;
+struct _TYPE_NAME_
+{
+   /** The name used from Python. */
+   const char              *pName;
+
+   /** The file type. */
+   FILE_TYPE               type;
+};
+
+/******************************************************************************
+ Module Variables.
+******************************************************************************/
+
+/** The exception raised when the library fails. */
+static PyObject            *pRftError = NULL;
+
+/** The names of the file types. */
+static const TYPE_NAME     typeNames[] =
+{
+   { "hex",    FILE_TYPE_HEX  },
+   { "bin",    FILE_TYPE_BIN  },
+   { "wdc",    FILE_TYPE_WDC  },
+   { "pap",    FILE_TYPE_PAP  },
+   { "shm",    FILE_TYPE_SHM  },
+   { "memh",   FILE_TYPE_MEMH },
+   { "mif",    FILE_TYPE_MIF  },
+   { "coe",    FILE_TYPE_COE  },
+   { "titxt",  FILE_TYPE_TITXT },
+   { "tek",    FILE_TYPE_TEK  },
+   { "dump",   FILE_TYPE_DUMP },
+   { "nes",    FILE_TYPE_NES  },
+   { "crt",    FILE_TYPE_CRT  },
+   { "omf",    FILE_TYPE_OMF  },
+};
+
+/** The names of the RESULT codes, in order. */
+static const char          *resultNames[] =
+{
+   "OK",
+   "USAGE_SHOWN",
+   "UNSUPPORTED",
+   "INVALID_ARGUMENTS",
+   "CANNOT_OPEN_FILE",
+   "END_OF_FILE",
+   "IO_ERROR",
+   "INVALID_DATA",
+   "MIXED_ADDRESSING_MODES",
+   "INVALID_RECORD_TYPE",
+   "END_RECORD_ERROR",
+   "CHECKSUM_ERROR",
+   "NO_MEMORY",
+   "OVERLAPPING_SEGMENT",
+   "ADDR_OUT_OF_RANGE",
+   "LEN_OUT_OF_RANGE",
+   "BUFFER_TOO_SMALL",
+};
+
+/******************************************************************************
+ Module Function Definitions
+******************************************************************************/
+
+/**************************************************************************//**
+* Raises rft.Error for a failed library call.
+*
+* The exception's arguments are the name of the RESULT, its value, and the
+* error the library reported, which is empty if there is none.
+*
+* @param[in] r The RESULT returned by the library.
+* @param[in] pCtx The context the call failed on, or NULL if it had none.
+*
+* @return NULL, so the caller can return it directly.
+******************************************************************************/
+static PyObject *RaiseResult(RESULT r, const RFT_CONTEXT *pCtx)
+{
+   const char *pName = "UNKNOWN";
+   PyObject *pArgs;
+
+   if ((U32) r < sizeof(resultNames) / sizeof(resultNames[0]))
+   {
+      pName = resultNames[r];
+   }
+
+   pArgs = Py_BuildValue("(sis)", pName, (int) r, pCtx ? RftGetLastError(pCtx) : "");
+   if (pArgs != NULL)
+   {
+      PyErr_SetObject(pRftError, pArgs);
+      Py_DECREF(pArgs);
+   }
+   return NULL;
+}
+
+/**************************************************************************//**
+* Looks up a file type by name.
+*
+* @param[in] pName The name of the file type.
+* @param[out] pType The file type.
+*
+* @return 0 on success, or -1 with a ValueError set.
+******************************************************************************/
+static int GetFileType(const char *pName, FILE_TYPE *pType)
+{
+   U32 i;
+
+   for (i = 0; i < sizeof(typeNames) / sizeof(typeNames[0]); i++)
+   {
+      if (!strcmp(pName, typeNames[i].pName))
+      {
+         *pType = typeNames[i].type;
+         return 0;
+      }
+   }
+
+   PyErr_Format(PyExc_ValueError, "unknown file type: '%s'", pName);
+   return -1;
+}
+
+/**************************************************************************//**
+* Marks a context as being worked on, so it is not used from two threads.
+*
+* @param[in,out] pSelf The context.
+* @param[in] forLoad Non-zero if the work changes the loaded data.
+*
+* @return 0 on success, or -1 with an exception set.
+******************************************************************************/
+static int BeginWork(CONTEXT_OBJECT *pSelf, int forLoad)
+{
+   if (pSelf->busy)
+   {
+      PyErr_SetString(PyExc_RuntimeError, "context is in use by another thread");
+      return -1;
+   }
+
+   if (forLoad && pSelf->exports)
+   {
+      PyErr_SetString(PyExc_BufferError, "cannot load while range memoryviews exist");
+      return -1;
+   }
+
+   pSelf->busy = 1;
+   return 0;
+}
+
+/**************************************************************************//**
+* Exports a range's data as a read-only buffer.
+*
+* @param[in] pObj The RANGE_OBJECT.
+* @param[out] pView The buffer to fill in.
+* @param[in] flags The kind of buffer requested.
+*
+* @return 0 on success, or -1 with an exception set.
+******************************************************************************/
+static int RangeGetBuffer(PyObject *pObj, Py_buffer *pView, int flags)
+{
+   RANGE_OBJECT *pSelf = (RANGE_OBJECT *) pObj;
+
+   if (PyBuffer_FillInfo(pView, pObj, (void *) pSelf->pData, pSelf->len, 1, flags) != 0)
+   {
+      return -1;
+   }
+
+   pSelf->pOwner->exports++;
+   return 0;
+}
+
+/**************************************************************************//**
+* Releases a buffer exported by RangeGetBuffer().
+*
+* @param[in] pObj The RANGE_OBJECT.
+* @param[in] pView The buffer being released.
+*
+* @return None.
+******************************************************************************/
+static void RangeReleaseBuffer(PyObject *pObj, Py_buffer *pView)
+{
+   ((RANGE_OBJECT *) pObj)->pOwner->exports--;
+}
+
+/**************************************************************************//**
+* Destroys a RANGE_OBJECT.
+*
+* @param[in] pObj The RANGE_OBJECT.
+*
+* @return None.
+******************************************************************************/
+static void RangeDealloc(PyObject *pObj)
+{
+   Py_XDECREF(((RANGE_OBJECT *) pObj)->pOwner);
+   Py_TYPE(pObj)->tp_free(pObj);
+}
+
+/** The buffer interface of RANGE_OBJECT. */
+static PyBufferProcs rangeBufferProcs =
+{
+   RangeGetBuffer,
+   RangeReleaseBuffer,
+};
+
+/** The type of RANGE_OBJECT, which is only used to back memoryviews. */
+static PyTypeObject rangeType =
+{
+   PyVarObject_HEAD_INIT(NULL, 0)
+   .tp_name = "rft._RangeData",
+   .tp_basicsize = sizeof(RANGE_OBJECT),
+   .tp_dealloc = RangeDealloc,
+   .tp_as_buffer = &rangeBufferProcs,
+   .tp_flags = Py_TPFLAGS_DEFAULT,
+   .tp_doc = "The data of one range.",
+};
+
+/**************************************************************************//**
+* Creates a context: Context(threads=0, mapping=False, elide=None, min_run=64, dedup=False, sort_run=0).
+*
+* @param[in] pType The Context type.
+* @param[in] pArgs The positional arguments.
+* @param[in] pKwds The keyword arguments.
+*
+* @return The new context, or NULL with an exception set.
+******************************************************************************/
+static PyObject *ContextNew(PyTypeObject *pType, PyObject *pArgs, PyObject *pKwds)
+{
+   static char *kwList[] = { "threads", "mapping", "elide", "min_run", "dedup", "sort_run", NULL };
+   unsigned int numThreads = 0, minRun = 64, sortRun = 0;
+   unsigned long fill = 0;
+   int useMapping = 0, useDedup = 0;
+   PyObject *pElide = Py_None;
+   CONTEXT_OBJECT *pSelf;
+   RESULT r;
+
+   if (!PyArg_ParseTupleAndKeywords(pArgs, pKwds, "|IpOIpI", kwList, &numThreads, &useMapping,
+      &pElide, &minRun, &useDedup, &sortRun))
+   {
+      return NULL;
+   }
+
+   /* elide is the fill value whose runs are left out of outputs, or None. */
+   if (pElide != Py_None)
+   {
+      fill = PyLong_AsUnsignedLong(pElide);
+      if (PyErr_Occurred())
+      {
+         return NULL;
+      }
+
+      if (fill > 0xFF || minRun == 0)
+      {
+         PyErr_SetString(PyExc_ValueError, "elide must be a byte, and min_run at least 1");
+         return NULL;
+      }
+   }
+
+   pSelf = (CONTEXT_OBJECT *) pType->tp_alloc(pType, 0);
+   if (pSelf == NULL)
+   {
+      return NULL;
+   }
+
+   r = RftOpen(&pSelf->pCtx);
+   if (r != OK)
+   {
+      Py_DECREF(pSelf);
+      return RaiseResult(r, NULL);
+   }
+
+   RftSetThreads(pSelf->pCtx, numThreads);
+   RftSetMapping(pSelf->pCtx, useMapping);
+   RftSetDedup(pSelf->pCtx, useDedup);
+   RftSetExternalSort(pSelf->pCtx, sortRun);
+   if (pElide != Py_None)
+   {
+      RftSetElision(pSelf->pCtx, (U8) fill, minRun);
+   }
+
+   return (PyObject *) pSelf;
+}
+
+/**************************************************************************//**
+* Destroys a context.
+*
+* @param[in] pObj The CONTEXT_OBJECT.
+*
+* @return None.
+******************************************************************************/
+static void ContextDealloc(PyObject *pObj)
+{
+   RftClose(((CONTEXT_OBJECT *) pObj)->pCtx);
+   Py_TYPE(pObj)->tp_free(pObj);
+}
+
+/**************************************************************************//**
+* Loads an input: load(src, type=None, addr=None, xform=0).
+*
+* The source may be a path, an open file descriptor (int), or any bytes-like
+* object. The type is detected from the contents when it is not given, and raw
+* binary inputs need an address. For OMF inputs, the address is where the
+* relocatable segments are loaded. xform is the rft.XFORM_ transforms applied to
+* this input as it is loaded.
+*
+* @param[in] pObj The CONTEXT_OBJECT.
+* @param[in] pArgs The positional arguments.
+* @param[in] pKwds The keyword arguments.
+*
+* @return None, or NULL with an exception set.
+******************************************************************************/
+static PyObject *ContextLoad(PyObject *pObj, PyObject *pArgs, PyObject *pKwds)
+{
+   static char *kwList[] = { "src", "type", "addr", "xform", NULL };
+   CONTEXT_OBJECT *pSelf = (CONTEXT_OBJECT *) pObj;
+   PyObject *pSrc, *pAddr = Py_None, *pPath = NULL;
+   const char *pTypeName = NULL, *pDesc;
+   FILE_OPTS_BIN binOpts;
+   FILE_OPTS_OMF omfOpts;
+   const void *pOpts;
+   FILE_TYPE type;
+   Py_buffer buf;
+   RESULT r;
+   unsigned int xform = 0;
+   int fd = -1;
+
+   if (!PyArg_ParseTupleAndKeywords(pArgs, pKwds, "O|zOI", kwList, &pSrc, &pTypeName, &pAddr,
+      &xform))
+   {
+      return NULL;
+   }
+
+   memset(&binOpts, 0, sizeof(binOpts));
+   if (pAddr != Py_None)
+   {
+      binOpts.startAddr = (U32) PyLong_AsUnsignedLong(pAddr);
+      if (PyErr_Occurred())
+      {
+         return NULL;
+      }
+      binOpts.addrSpecified = 1;
+   }
+   omfOpts.loadAddr = binOpts.startAddr;
+   omfOpts.addrSpecified = binOpts.addrSpecified;
+
+   /* Get hold of the source, before doing anything which needs cleaning up. */
+   buf.obj = NULL;
+   if (PyLong_Check(pSrc))
+   {
+      fd = PyLong_AsLong(pSrc);
+      if (PyErr_Occurred())
+      {
+         return NULL;
+      }
+   }
+   else if (PyObject_CheckBuffer(pSrc))
+   {
+      if (PyObject_GetBuffer(pSrc, &buf, PyBUF_SIMPLE) != 0)
+      {
+         return NULL;
+      }
+   }
+   else if (!PyUnicode_FSConverter(pSrc, &pPath))
+   {
+      return NULL;
+   }
+
+   if (pTypeName != NULL)
+   {
+      if (GetFileType(pTypeName, &type) != 0)
+      {
+         goto Done;
+      }
+   }
+   else if (buf.obj != NULL)
+   {
+      /* Only memory inputs can be inspected without consuming them. */
+      if (RftSniff((const U8 *) buf.buf, (U32) buf.len, (U32) buf.len, &type, &pDesc) != OK)
+      {
+         PyErr_Format(PyExc_ValueError, "input looks like %s data, which cannot be loaded", pDesc);
+         goto Done;
+      }
+   }
+   else if (pPath != NULL)
+   {
+      U8 head[4096];
+      U32 len;
+      long fileLen;
+      FILE *inFile = fopen(PyBytes_AS_STRING(pPath), "rb");
+
+      if (!inFile)
+      {
+         PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, pSrc);
+         goto Done;
+      }
+      fseek(inFile, 0, SEEK_END);
+      fileLen = ftell(inFile);
+      fseek(inFile, 0, SEEK_SET);
+      len = (U32) fread(head, 1, sizeof(head), inFile);
+      fclose(inFile);
+
+      if (RftSniff(head, len, fileLen > (long) len ? (U32) fileLen : len, &type, &pDesc) != OK)
+      {
+         PyErr_Format(PyExc_ValueError, "input looks like %s data, which cannot be loaded", pDesc);
+         goto Done;
+      }
+   }
+   else
+   {
+      PyErr_SetString(PyExc_ValueError, "the type must be given for file descriptor inputs");
+      goto Done;
+   }
+
+   if (BeginWork(pSelf, 1) != 0)
+   {
+      goto Done;
+   }
+   pOpts = type == FILE_TYPE_OMF ? (const void *) &omfOpts : (const void *) &binOpts;
+
+   Py_BEGIN_ALLOW_THREADS
+   RftSetTransform(pSelf->pCtx, xform);
+   if (buf.obj != NULL)
+   {
+      r = RftLoadMem(pSelf->pCtx, type, pOpts, (const U8 *) buf.buf, (U32) buf.len);
+   }
+   else if (pPath != NULL)
+   {
+      r = RftLoadFile(pSelf->pCtx, type, pOpts, PyBytes_AS_STRING(pPath));
+   }
+   else
+   {
+      r = RftLoadFd(pSelf->pCtx, type, pOpts, fd);
+   }
+   Py_END_ALLOW_THREADS
+
+   pSelf->busy = 0;
+
+   if (r != OK)
+   {
+      RaiseResult(r, pSelf->pCtx);
+   }
+
+Done:
+   if (buf.obj != NULL)
+   {
+      PyBuffer_Release(&buf);
+   }
+   Py_XDECREF(pPath);
+
+   if (PyErr_Occurred())
+   {
+      return NULL;
+   }
+
+   Py_RETURN_NONE;
+}
+
+/**************************************************************************//**
+* Transforms the whole image in place: transform(xform).
+*
+* @param[in] pObj The CONTEXT_OBJECT.
+* @param[in] pArg The rft.XFORM_ transforms, as an int.
+*
+* @return None, or NULL with an exception set.
+******************************************************************************/
+static PyObject *ContextTransform(PyObject *pObj, PyObject *pArg)
+{
+   CONTEXT_OBJECT *pSelf = (CONTEXT_OBJECT *) pObj;
+   unsigned long xform;
+   RESULT r;
+
+   xform = PyLong_AsUnsignedLong(pArg);
+   if (PyErr_Occurred())
+   {
+      return NULL;
+   }
+
+   /* The data may move, so no views can be held over it. */
+   if (BeginWork(pSelf, 1) != 0)
+   {
+      return NULL;
+   }
+
+   Py_BEGIN_ALLOW_THREADS
+   r = RftTransform(pSelf->pCtx, (U32) xform);
+   Py_END_ALLOW_THREADS
+
+   pSelf->busy = 0;
+
+   if (r != OK)
+   {
+      return RaiseResult(r, pSelf->pCtx);
+   }
+
+   Py_RETURN_NONE;
+}
+
+/**************************************************************************//**
+* Runs a script of crop, fill, poke and crc32 stages over the image: run_script(script).
+*
+* @param[in] pObj The CONTEXT_OBJECT.
+* @param[in] pArg The script, as a str.
+*
+* @return The number of passes over the data, or NULL with an exception set.
+******************************************************************************/
+static PyObject *ContextRunScript(PyObject *pObj, PyObject *pArg)
+{
+   CONTEXT_OBJECT *pSelf = (CONTEXT_OBJECT *) pObj;
+   const char *pScript;
+   U32 numPasses = 0;
+   RESULT r;
+
+   pScript = PyUnicode_AsUTF8(pArg);
+   if (pScript == NULL)
+   {
+      return NULL;
+   }
+
+   /* The ranges are rebuilt, so no views can be held over them. */
+   if (BeginWork(pSelf, 1) != 0)
+   {
+      return NULL;
+   }
+
+   Py_BEGIN_ALLOW_THREADS
+   r = RftRunScript(pSelf->pCtx, pScript, &numPasses);
+   Py_END_ALLOW_THREADS
+
+   pSelf->busy = 0;
+
+   if (r != OK)
+   {
+      return RaiseResult(r, pSelf->pCtx);
+   }
+
+   return PyLong_FromUnsignedLong(numPasses);
+}
+
+/**************************************************************************//**
+* Analyzes the bytes of each range: stats().
+*
+* @param[in] pObj The CONTEXT_OBJECT.
+* @param[in] pUnused Unused.
+*
+* @return A list with a dict per range, holding addr, len, counts (a list of 256
+*    ints), entropy, run_addr, run_len and run_value. NULL with an exception set
+*    on failure.
+******************************************************************************/
+static PyObject *ContextStats(PyObject *pObj, PyObject *pUnused)
+{
+   CONTEXT_OBJECT *pSelf = (CONTEXT_OBJECT *) pObj;
+   RFT_RANGE_STATS *pStats;
+   PyObject *pList, *pCounts, *pDict;
+   U32 numRanges, i, j;
+   RESULT r;
+
+   if (BeginWork(pSelf, 0) != 0)
+   {
+      return NULL;
+   }
+
+   numRanges = RftGetNumRanges(pSelf->pCtx);
+   pStats = (RFT_RANGE_STATS *) PyMem_Malloc((numRanges + 1) * sizeof(RFT_RANGE_STATS));
+   if (pStats == NULL)
+   {
+      pSelf->busy = 0;
+      return PyErr_NoMemory();
+   }
+
+   Py_BEGIN_ALLOW_THREADS
+   r = RftAnalyze(pSelf->pCtx, pStats);
+   Py_END_ALLOW_THREADS
+
+   pSelf->busy = 0;
+
+   if (r != OK)
+   {
+      PyMem_Free(pStats);
+      return RaiseResult(r, pSelf->pCtx);
+   }
+
+   pList = PyList_New(numRanges);
+   for (i = 0; pList != NULL && i < numRanges; i++)
+   {
+      pCounts = PyList_New(256);
+      for (j = 0; pCounts != NULL && j < 256; j++)
+      {
+         PyList_SET_ITEM(pCounts, j, PyLong_FromUnsignedLong(pStats[i].counts[j]));
+      }
+
+      pDict = pCounts == NULL ? NULL : Py_BuildValue("{s:I,s:I,s:N,s:d,s:I,s:I,s:I}",
+         "addr", pStats[i].addr, "len", pStats[i].len, "counts", pCounts,
+         "entropy", pStats[i].entropy, "run_addr", pStats[i].runAddr,
+         "run_len", pStats[i].runLen, "run_value", (unsigned int) pStats[i].runValue);
+      if (pDict == NULL)
+      {
+         Py_CLEAR(pList);
+         break;
+      }
+
+      PyList_SET_ITEM(pList, i, pDict);
+   }
+
+   PyMem_Free(pStats);
+   return pList;
+}
+
+/**************************************************************************//**
+* Gets the loaded ranges: ranges().
+*
+* @param[in] pObj The CONTEXT_OBJECT.
+* @param[in] pUnused Unused.
+*
+* @return A list of (addr, memoryview) tuples in address order, or NULL with an
+*    exception set.
+******************************************************************************/
+static PyObject *ContextRanges(PyObject *pObj, PyObject *pUnused)
+{
+   CONTEXT_OBJECT *pSelf = (CONTEXT_OBJECT *) pObj;
+   PyObject *pList, *pView, *pItem;
+   RANGE_OBJECT *pData;
+   const RANGE *pRange;
+   const U8 *pBytes;
+   RESULT r;
+
+   if (pSelf->busy)
+   {
+      PyErr_SetString(PyExc_RuntimeError, "context is in use by another thread");
+      return NULL;
+   }
+
+   pList = PyList_New(0);
+   if (pList == NULL)
+   {
+      return NULL;
+   }
+
+   for (pRange = RftGetRanges(pSelf->pCtx); pRange; pRange = pRange->pNext)
+   {
+      /* A range must be in one piece to be viewed, which only changes it the first time. */
+      r = RftGetRangeData(pRange, &pBytes);
+      if (r != OK)
+      {
+         Py_DECREF(pList);
+         return RaiseResult(r, NULL);
+      }
+
+      pData = PyObject_New(RANGE_OBJECT, &rangeType);
+      if (pData == NULL)
+      {
+         Py_DECREF(pList);
+         return NULL;
+      }
+      Py_INCREF(pSelf);
+      pData->pOwner = pSelf;
+      pData->pData = pBytes;
+      pData->len = pRange->len;
+
+      pView = PyMemoryView_FromObject((PyObject *) pData);
+      Py_DECREF(pData);
+      if (pView == NULL)
+      {
+         Py_DECREF(pList);
+         return NULL;
+      }
+
+      pItem = Py_BuildValue("(kN)", (unsigned long) pRange->addr, pView);
+      if (pItem == NULL || PyList_Append(pList, pItem) != 0)
+      {
+         Py_XDECREF(pItem);
+         Py_DECREF(pList);
+         return NULL;
+      }
+      Py_DECREF(pItem);
+   }
+
+   return pList;
+}
+
+/**************************************************************************//**
+* Writes an output: write(type, path=None, space=0, width=8, depth=0, base=0,
+*    pad=0xFF, lane=0, lanes=0, big_endian=False, squeeze=False, prg=None,
+*    prg_len=0, chr=None, chr_len=0, mapper=0, submapper=0, vertical=False,
+*    four_screen=False, battery=False, nes2=False, hw_type=0, name=None,
+*    lines=None, chip16k=False, chip_type=0, rec_len=0).
+*
+* The space option applies to shared memory outputs, squeeze to hexdump
+* outputs, pad and the options from prg to nes2 to NES outputs, pad and the
+* options from hw_type to chip_type to C64 cartridge outputs, rec_len to Intel
+* HEX outputs, and the others to the memory initialization outputs.
+*
+* @param[in] pObj The CONTEXT_OBJECT.
+* @param[in] pArgs The positional arguments.
+* @param[in] pKwds The keyword arguments.
+*
+* @return The output as bytes if no path was given, else None. NULL with an
+*    exception set on failure.
+******************************************************************************/
+static PyObject *ContextWrite(PyObject *pObj, PyObject *pArgs, PyObject *pKwds)
+{
+   static char *kwList[] = { "type", "path", "space", "width", "depth", "base", "pad",
+      "lane", "lanes", "big_endian", "squeeze", "prg", "prg_len", "chr", "chr_len", "mapper",
+      "submapper", "vertical", "four_screen", "battery", "nes2", "hw_type", "name", "lines",
+      "chip16k", "chip_type", "rec_len", NULL };
+   CONTEXT_OBJECT *pSelf = (CONTEXT_OBJECT *) pObj;
+   PyObject *pDest = Py_None, *pPath = NULL, *pBytes = NULL, *pPrg = Py_None, *pChr = Py_None;
+   PyObject *pLines = Py_None;
+   const char *pTypeName;
+   FILE_OPTS_SHM shmOpts;
+   FILE_OPTS_MEM memOpts;
+   FILE_OPTS_DUMP dumpOpts;
+   FILE_OPTS_NES nesOpts;
+   FILE_OPTS_CRT crtOpts;
+   FILE_OPTS_HEX hexOpts;
+   const void *pOpts;
+   unsigned char pad = 0xFF;
+   OUTPUT_PLAN plan;
+   FILE_TYPE type;
+   U32 outLen;
+   RESULT r;
+
+   memset(&shmOpts, 0, sizeof(shmOpts));
+   memset(&memOpts, 0, sizeof(memOpts));
+   memset(&dumpOpts, 0, sizeof(dumpOpts));
+   memset(&nesOpts, 0, sizeof(nesOpts));
+   memset(&crtOpts, 0, sizeof(crtOpts));
+   memset(&hexOpts, 0, sizeof(hexOpts));
+   if (!PyArg_ParseTupleAndKeywords(pArgs, pKwds, "s|OIIIIbIIppOIOIIIppppIzOpII", kwList,
+      &pTypeName, &pDest, &shmOpts.addrSpace, &memOpts.wordBits, &memOpts.depth,
+      &memOpts.baseAddr, &pad, &memOpts.lane, &memOpts.numLanes, &memOpts.bigEndian,
+      &dumpOpts.squeeze, &pPrg, &nesOpts.prgLen, &pChr, &nesOpts.chrLen, &nesOpts.mapper,
+      &nesOpts.subMapper, &nesOpts.vertical, &nesOpts.fourScreen, &nesOpts.battery,
+      &nesOpts.nes2, &crtOpts.hwType, &crtOpts.pName, &pLines, &crtOpts.chip16K,
+      &crtOpts.chipType, &hexOpts.recLen))
+   {
+      return NULL;
+   }
+   memOpts.pad = pad;
+   nesOpts.pad = pad;
+   crtOpts.pad = pad;
+
+   /* Without lines, the EXROM and GAME lines are chosen from the chips loaded. */
+   if (pLines != Py_None)
+   {
+      if (!PyArg_ParseTuple(pLines, "II", &crtOpts.exrom, &crtOpts.game))
+      {
+         return NULL;
+      }
+      crtOpts.linesSpecified = 1;
+   }
+
+   /* Without prg, PRG ROM starts at the lowest address loaded, and without chr there is CHR RAM. */
+   if (pPrg != Py_None)
+   {
+      nesOpts.prgAddr = (U32) PyLong_AsUnsignedLong(pPrg);
+      nesOpts.prgAddrSpecified = 1;
+   }
+   if (pChr != Py_None)
+   {
+      nesOpts.chrAddr = (U32) PyLong_AsUnsignedLong(pChr);
+      nesOpts.hasChr = 1;
+   }
+   if (PyErr_Occurred())
+   {
+      return NULL;
+   }
+
+   if (GetFileType(pTypeName, &type) != 0)
+   {
+      return NULL;
+   }
+   pOpts = type == FILE_TYPE_SHM ? (const void *) &shmOpts :
+      type == FILE_TYPE_DUMP ? (const void *) &dumpOpts :
+      type == FILE_TYPE_NES ? (const void *) &nesOpts :
+      type == FILE_TYPE_CRT ? (const void *) &crtOpts :
+      type == FILE_TYPE_HEX ? (const void *) &hexOpts : (const void *) &memOpts;
+
+   if (pDest != Py_None && !PyUnicode_FSConverter(pDest, &pPath))
+   {
+      return NULL;
+   }
+
+   if (type == FILE_TYPE_SHM && pPath == NULL)
+   {
+      PyErr_SetString(PyExc_ValueError, "shared memory outputs need a name");
+      return NULL;
+   }
+
+   if (BeginWork(pSelf, 0) != 0)
+   {
+      Py_XDECREF(pPath);
+      return NULL;
+   }
+
+   /* Plan first, so an output of exactly the right size can be allocated. */
+   Py_BEGIN_ALLOW_THREADS
+   r = RftPlanOutput(pSelf->pCtx, type, pOpts, &plan);
+   Py_END_ALLOW_THREADS
+
+   if (r == OK && pPath == NULL)
+   {
+      pBytes = PyBytes_FromStringAndSize(NULL, plan.outLen);
+      if (pBytes != NULL)
+      {
+         Py_BEGIN_ALLOW_THREADS
+         r = RftWriteMem(pSelf->pCtx, type, pOpts, &plan,
+            (U8 *) PyBytes_AS_STRING(pBytes), plan.outLen, &outLen);
+         Py_END_ALLOW_THREADS
+      }
+   }
+   else if (r == OK)
+   {
+      Py_BEGIN_ALLOW_THREADS
+      r = RftWriteFile(pSelf->pCtx, type, pOpts, &plan, PyBytes_AS_STRING(pPath));
+      Py_END_ALLOW_THREADS
+   }
+
+   RftFreePlan(&plan);
+   pSelf->busy = 0;
+   Py_XDECREF(pPath);
+
+   if (r != OK)
+   {
+      Py_XDECREF(pBytes);
+      return RaiseResult(r, pSelf->pCtx);
+   }
+
+   if (pPath != NULL)
+   {
+      Py_RETURN_NONE;
+   }
+
+   return pBytes;
+}
+
+/**************************************************************************//**
+* Gets the number of data bytes loaded.
+*
+* @param[in] pObj The CONTEXT_OBJECT.
+* @param[in] pClosure Unused.
+*
+* @return The number of data bytes.
+******************************************************************************/
+static PyObject *ContextGetDataBytes(PyObject *pObj, void *pClosure)
+{
+   return PyLong_FromUnsignedLong(RftGetDataBytes(((CONTEXT_OBJECT *) pObj)->pCtx));
+}
+
+/**************************************************************************//**
+* Gets the number of ranges loaded.
+*
+* @param[in] pObj The CONTEXT_OBJECT.
+* @param[in] pClosure Unused.
+*
+* @return The number of ranges.
+******************************************************************************/
+static PyObject *ContextGetNumRanges(PyObject *pObj, void *pClosure)
+{
+   return PyLong_FromUnsignedLong(RftGetNumRanges(((CONTEXT_OBJECT *) pObj)->pCtx));
+}
+
+/**************************************************************************//**
+* Gets the program's execution starting address.
+*
+* @param[in] pObj The CONTEXT_OBJECT.
+* @param[in] pClosure Unused.
+*
+* @return The starting address.
+******************************************************************************/
+static PyObject *ContextGetStartAddr(PyObject *pObj, void *pClosure)
+{
+   return PyLong_FromUnsignedLong(RftGetStartAddr(((CONTEXT_OBJECT *) pObj)->pCtx));
+}
+
+/**************************************************************************//**
+* Gets the statistics of the shared segment payloads.
+*
+* @param[in] pObj The CONTEXT_OBJECT.
+* @param[in] pClosure Unused.
+*
+* @return A dict of the statistics.
+******************************************************************************/
+static PyObject *ContextGetDedupStats(PyObject *pObj, void *pClosure)
+{
+   RFT_DEDUP_STATS stats;
+
+   RftGetDedupStats(((CONTEXT_OBJECT *) pObj)->pCtx, &stats);
+   return Py_BuildValue("{sIsIsIsIsI}", "blobs", stats.numBlobs, "blob_bytes", stats.blobBytes,
+      "shared", stats.numShared, "saved_bytes", stats.savedBytes,
+      "collisions", stats.numCollisions);
+}
+
+/** The methods of Context. */
+static PyMethodDef contextMethods[] =
+{
+   { "load",   (PyCFunction) (void (*)(void)) ContextLoad,  METH_VARARGS | METH_KEYWORDS,
+      "load(src, type=None, addr=None, xform=0)\n\nLoads an input from a path, a file descriptor, or a bytes-like object." },
+   { "run_script", ContextRunScript,                        METH_O,
+      "run_script(script)\n\nRuns crop, fill, poke and crc32 commands over the image, and returns the number of passes." },
+   { "stats",  ContextStats,                                METH_NOARGS,
+      "stats()\n\nReturns the byte histogram, entropy and longest run of each range." },
+   { "transform", ContextTransform,                         METH_O,
+      "transform(xform)\n\nApplies rft.XFORM_ transforms to the whole image, in place." },
+   { "ranges", ContextRanges,                               METH_NOARGS,
+      "ranges()\n\nReturns a list of (addr, memoryview) for the loaded ranges, without copying." },
+   { "write",  (PyCFunction) (void (*)(void)) ContextWrite, METH_VARARGS | METH_KEYWORDS,
+      "write(type, path=None, space=0, width=8, depth=0, base=0, pad=0xFF, lane=0, lanes=0,\n"
+      "      big_endian=False, squeeze=False, prg=None, prg_len=0, chr=None, chr_len=0,\n"
+      "      mapper=0, submapper=0, vertical=False, four_screen=False, battery=False,\n"
+      "      nes2=False, hw_type=0, name=None, lines=None, chip16k=False, chip_type=0,\n"
+      "      rec_len=0)\n\n"
+      "Writes an output to a path, or returns it as bytes.\n\n"
+      "space applies to shared memory outputs; width, depth, base, lane, lanes and\n"
+      "big_endian to $readmemh, MIF and COE outputs; squeeze to hexdump outputs; prg to\n"
+      "nes2 to iNES outputs; hw_type to chip_type, with lines=(EXROM, GAME), to C64\n"
+      "cartridge outputs; and rec_len to Intel HEX outputs. pad fills the gaps of memory\n"
+      "initialization, iNES and C64 cartridge outputs." },
+   { NULL },
+};
+
+/** The attributes of Context. */
+static PyGetSetDef contextGetSet[] =
+{
+   { "data_bytes",   ContextGetDataBytes, NULL, "The number of data bytes loaded.", NULL },
+   { "num_ranges",   ContextGetNumRanges, NULL, "The number of ranges loaded.", NULL },
+   { "start_addr",   ContextGetStartAddr, NULL, "The program's execution starting address.", NULL },
+   { "dedup_stats",  ContextGetDedupStats, NULL, "The statistics of the shared segment payloads.", NULL },
+   { NULL },
+};
+
+/** The type of CONTEXT_OBJECT. */
+static PyTypeObject contextType =
+{
+   PyVarObject_HEAD_INIT(NULL, 0)
+   .tp_name = "rft.Context",
+   .tp_basicsize = sizeof(CONTEXT_OBJECT),
+   .tp_dealloc = ContextDealloc,
+   .tp_flags = Py_TPFLAGS_DEFAULT,
+   .tp_doc = "Context(threads=0, mapping=False, elide=None, min_run=64, dedup=False, sort_run=0)\n\nAn image built from the inputs loaded.",
+   .tp_methods = contextMethods,
+   .tp_getset = contextGetSet,
+   .tp_new = ContextNew,
+};
+
+/**************************************************************************//**
+* Detects the type of an input: sniff(data).
+*
+* @param[in] pSelf The module.
+* @param[in] pArg The first few KB of the input, as a bytes-like object.
+*
+* @return The name of the file type, or NULL with a ValueError set if the input
+*    looks like a format which cannot be loaded.
+******************************************************************************/
+static PyObject *ModuleSniff(PyObject *pSelf, PyObject *pArg)
+{
+   const char *pDesc;
+   FILE_TYPE type;
+   Py_buffer buf;
+   RESULT r;
+   U32 i;
+
+   if (PyObject_GetBuffer(pArg, &buf, PyBUF_SIMPLE) != 0)
+   {
+      return NULL;
+   }
+
+   r = RftSniff((const U8 *) buf.buf, (U32) buf.len, (U32) buf.len, &type, &pDesc);
+   PyBuffer_Release(&buf);
+
+   if (r != OK)
+   {
+      PyErr_Format(PyExc_ValueError, "input looks like %s data, which cannot be loaded", pDesc);
+      return NULL;
+   }
+
+   for (i = 0; typeNames[i].type != type; i++);
+   return PyUnicode_FromString(typeNames[i].pName);
+}
+
+/** The functions of the module. */
+static PyMethodDef moduleMethods[] =
+{
+   { "sniff",  ModuleSniff, METH_O,
+      "sniff(data)\n\nReturns the type of an input, detected from its first few KB." },
+   { NULL },
+};
+
+/** The module definition. */
+static struct PyModuleDef rftModule =
+{
+   PyModuleDef_HEAD_INIT,
+   .m_name = "rft",
+   .m_doc = "In-process access to the RetroFileTool library.",
+   .m_size = -1,
+   .m_methods = moduleMethods,
+};
+
+/******************************************************************************
+ Public Function Definitions
+******************************************************************************/
+
+/**************************************************************************//**
+* Initializes the module.
+*
+* @return The module, or NULL with an exception set.
+******************************************************************************/
+PyMODINIT_FUNC PyInit_rft(void)
+{
+   PyObject *pModule;
+
+   if (PyType_Ready(&rangeType) != 0 || PyType_Ready(&contextType) != 0)
+   {
+      return NULL;
+   }
+
+   pModule = PyModule_Create(&rftModule);
+   if (pModule == NULL)
+   {
+      return NULL;
+   }
+
+   pRftError = PyErr_NewException("rft.Error", NULL, NULL);
+   Py_XINCREF(pRftError);
+   Py_INCREF(&contextType);
+   if (pRftError == NULL ||
+      PyModule_AddObject(pModule, "Error", pRftError) != 0 ||
+      PyModule_AddObject(pModule, "Context", (PyObject *) &contextType) != 0 ||
+      PyModule_AddIntConstant(pModule, "XFORM_SWAP16", RFT_XFORM_SWAP16) != 0 ||
+      PyModule_AddIntConstant(pModule, "XFORM_SWAP32", RFT_XFORM_SWAP32) != 0 ||
+      PyModule_AddIntConstant(pModule, "XFORM_INVERT", RFT_XFORM_INVERT) != 0 ||
+      PyModule_AddIntConstant(pModule, "XFORM_BITREV", RFT_XFORM_BITREV) != 0 ||
+      PyModule_AddIntConstant(pModule, "XFORM_INTERLEAVE", RFT_XFORM_INTERLEAVE) != 0 ||
+      PyModule_AddIntConstant(pModule, "XFORM_DEINTERLEAVE", RFT_XFORM_DEINTERLEAVE) != 0)
+   {
+      Py_DECREF(pModule);
+      return NULL;
+   }
+
+   return pModule;
+}
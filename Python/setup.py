@@ -0,0 +1,24 @@
+# Builds the rft Python extension module, which wraps librft in-process.
+#
+#    python setup.py build_ext --inplace
+
+import os
+from setuptools import setup, Extension
+
+# The path is normalized, as setuptools cannot place object files under "..".
+ROOT = os.path.normpath(os.path.join(os.path.dirname(os.path.abspath(__file__)), ".."))
+
+setup(
+   name="rft",
+   version="1.0",
+   description="In-process access to the RetroFileTool library",
+   ext_modules=[
+      Extension(
+         "rft",
+         sources=["rftmodule.c", os.path.join(ROOT, "librft.c")],
+         include_dirs=[ROOT],
+         # The byte statistics use log() from the maths library.
+         libraries=[] if os.name == "nt" else ["m"],
+      ),
+   ],
+)
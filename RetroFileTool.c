@@ -1,5 +1,7 @@
 /*********************************************************************//** @file
 Utility for converting between various retro file formats.
+
+This is the command line front end of librft, which does all the actual work.
 ******************************************************************************/
 
 /******************************************************************************
@@ -9,13 +11,16 @@ Utility for converting between various retro file formats.
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+
+#include "librft.h"
 
 /******************************************************************************
  Defines
 ******************************************************************************/
 
-/** The maximum number of bytes in each PAP record. */
-#define PAP_REC_LEN                                               24
+/** The number of bytes inspected when auto-detecting an input file's type. */
+#define SNIFF_LEN                                                 4096
 
 /** The application version. */
 #define VER_STR                                                   "1.0"
@@ -24,70 +29,6 @@ Utility for converting between various retro file formats.
  Module Typedefs and Enums
 ******************************************************************************/
 
-/** An unsigned 32-bit integer. Change this to match your platform. */
-typedef unsigned int    U32;
-
-/** An unsigned 16-bit integer. Change this to match your platform. */
-typedef unsigned short  U16;
-
-/** An unsigned 8-bit integer. Change this to match your platform. */
-typedef unsigned char   U8;
-
-/** The different file types supported. */
-typedef enum
-{
-   FILE_TYPE_HEX,
-   FILE_TYPE_BIN,
-   FILE_TYPE_WDC,
-   FILE_TYPE_PAP,
-
-} FILE_TYPE;
-
-/** The different error codes for the return values. */
-typedef enum
-{
-   OK                      = 0,
-   USAGE_SHOWN,
-   UNSUPPORTED,
-   INVALID_ARGUMENTS,
-   CANNOT_OPEN_FILE,
-   END_OF_FILE,
-   IO_ERROR,
-   INVALID_DATA,
-   MIXED_ADDRESSING_MODES,
-   INVALID_RECORD_TYPE,
-   END_RECORD_ERROR,
-   CHECKSUM_ERROR,
-   NO_MEMORY,
-   OVERLAPPING_SEGMENT,
-   ADDR_OUT_OF_RANGE,
-   LEN_OUT_OF_RANGE,
-
-} RESULT;
-
-/** The different types of Intex HEX records. */
-typedef enum
-{
-   REC_DATA                = 0,
-   REC_EOF                 = 1,
-   REC_EXT_SEG_ADDR        = 2,
-   REC_START_SEG_ADDR      = 3,
-   REC_EXT_LIN_ADDR        = 4,
-   REC_START_LIN_ADDR      = 5,
-
-} HEX_RECORD_TYPE;
-
-/** File options for the raw binary file type. */
-typedef struct _FILE_OPTS_BIN_ FILE_OPTS_BIN;
-struct _FILE_OPTS_BIN_
-{
-   /** The starting address of the binary file. */
-   U32                     startAddr;
-
-   /** Whether or not the address was specified. */
-   int                     addrSpecified;
-};
-
 /** Describes a file for conversion. */
 typedef struct _DATA_FILE_ DATA_FILE;
 struct _DATA_FILE_
@@ -101,73 +42,118 @@ struct _DATA_FILE_
    /** Options for this file. */
    void                    *pOpts;
 
+   /** The RFT_XFORM_ transforms applied to this file as it is loaded. */
+   U32                     xform;
+
    /** The next file in the list of files. */
    struct _DATA_FILE_      *pNext;
 };
 
-/** Describes a single contiguous region of memory. */
-typedef struct _SEGMENT_ SEGMENT;
-struct _SEGMENT_
+/** A transform, as named on the command line. */
+typedef struct _XFORM_NAME_ XFORM_NAME;
+struct _XFORM_NAME_
 {
-   /** The starting address of the segment. */
-   U32                     addr;
-
-   /** The length of the segment, in bytes. */
-   U32                     len;
-
-   /** The next segment is adjacent to this one. */
-   SEGMENT*                pNext;
+   /** The name of the transform. */
+   const char              *pName;
 
-   /** The actual segment data. */
-   U8                      data[];
+   /** The RFT_XFORM_ transform. */
+   U32                     xform;
 };
 
-/** A collection of SEGMENTS which make up a contiguous range in memory. */
-typedef struct _RANGE_ RANGE;
-struct _RANGE_
+/** An input file type, as selected on the command line. */
+typedef struct _IN_TYPE_ IN_TYPE;
+struct _IN_TYPE_
 {
-   /** The starting address of the range. */
-   U32                     addr;
-
-   /** The length of the range, in bytes. */
-   U32                     len;
-
-   /** The first segment in this range. */
-   SEGMENT                 *pSegStart;
+   /** The letter which follows -if. */
+   char                    letter;
 
-   /** The last segment in this range. */
-   SEGMENT                 *pSegEnd;
+   /** The file type. */
+   FILE_TYPE               type;
 
-   /** The next range, which is not necessarily adjacent. */
-   RANGE                   *pNext;
+   /** A description of the file type, with its article. */
+   const char              *pDesc;
 };
 
 /******************************************************************************
  Module Variables.
 ******************************************************************************/
 
-/** All the ranges contained within the input files. */
-static RANGE               *pAllRanges = NULL;
-
-/** The number of contiguous ranges allocated so far. */
-static U16                 numRanges = 0;
-
-/** The number of data bytes in the image. */
-static U32                 dataBytes = 0;
-
-/** The program's execution starting address. */
-static U32                 startAddr = 0;
-
 /** The input files. */
 static DATA_FILE           *pInFiles = NULL;
 
 /** The output file. */
 static DATA_FILE           *pOutFile = NULL;
 
+/** Whether the output file is written through a memory mapping. */
+static int                 useMapping = 0;
+
+/** The number of threads to use, or 0 to use one per CPU. */
+static U32                 numThreads = 0;
+
+/** The fill value whose long runs are left out of the output. */
+static U32                 elideFill = 0;
+
+/** The shortest run of the fill value left out of the output, or 0 to write everything. */
+static U32                 elideMinRun = 0;
+
+/** Whether identical blocks of the inputs share memory. */
+static int                 useDedup = 0;
+
+/** The size of the sorted runs of an external sort, in KB, or 0 to load records in place. */
+static U32                 sortRunKB = 0;
+
+/** The transforms applied to the input files which follow -xf. */
+static U32                 inXform = 0;
+
+/** The transforms applied to the whole image before it is written. */
+static U32                 outXform = 0;
+
+/** Whether the byte statistics of each range are reported. */
+static int                 showStats = 0;
+
+/** The script run over the image before it is written, from -script and -do, or NULL. */
+static char                *pScript = NULL;
+
+/** The names of the transforms, in the order they are applied. */
+static const XFORM_NAME    xformNames[] =
+{
+   { "deinterleave",       RFT_XFORM_DEINTERLEAVE  },
+   { "swap16",             RFT_XFORM_SWAP16        },
+   { "swap32",             RFT_XFORM_SWAP32        },
+   { "bitrev",             RFT_XFORM_BITREV        },
+   { "invert",             RFT_XFORM_INVERT        },
+   { "interleave",         RFT_XFORM_INTERLEAVE    },
+};
+
+/** The input file types. */
+static const IN_TYPE       inTypes[] =
+{
+   { 'h',   FILE_TYPE_HEX,    "an Intel HEX"             },
+   { 'b',   FILE_TYPE_BIN,    "a raw binary"             },
+   { 't',   FILE_TYPE_TITXT,  "a TI-TXT"                 },
+   { 'k',   FILE_TYPE_TEK,    "a Tektronix extended hex" },
+   { 'o',   FILE_TYPE_OMF,    "an Apple IIgs OMF"        },
+};
+
 /******************************************************************************
  Module Function Definitions
 ******************************************************************************/
 
+/**************************************************************************//**
+* Gets an input file type.
+*
+* @param[in] type The file type.
+*
+* @return The input file type, which is always found for the loadable types.
+******************************************************************************/
+static const IN_TYPE *GetInType(FILE_TYPE type)
+{
+   U32 i;
+
+   for (i = 0; inTypes[i].type != type; i++);
+   return &inTypes[i];
+}
+
 /**************************************************************************//**
 * Displays the program's usage.
 *
@@ -178,23 +164,68 @@ static void PrintUsage(void)
    printf("Supported input file formats:\n");
    printf("   * HEX: Intel HEX\n");
    printf("   * BIN: Raw binary\n");
+   printf("   * TI-TXT: Texas Instruments text\n");
+   printf("   * TEK: Tektronix extended hex\n");
+   printf("   * OMF: Apple IIgs OMF load file, relocated as it is loaded\n");
    printf("\n");
 
    printf("Supported output file formats:\n");
+   printf("   * HEX: Intel HEX, in a canonical form\n");
    printf("   * PAP: MOS Technology paper tape (KIM-1)\n");
+   printf("   * TI-TXT: Texas Instruments text\n");
+   printf("   * TEK: Tektronix extended hex\n");
    printf("   * WDC: WDC binary\n");
+   printf("   * SHM: Flat image in shared memory, for attached emulators\n");
+   printf("   * MEMH: Verilog $readmemh memory initialization\n");
+   printf("   * MIF: Intel (Altera) memory initialization\n");
+   printf("   * COE: Xilinx memory initialization\n");
+   printf("   * DUMP: Hexdump, like hexdump -C\n");
+   printf("   * NES: iNES and NES 2.0 ROM\n");
+   printf("   * CRT: C64 cartridge image\n");
    printf("\n");
 
    printf("Usage: RetroFileTool [GLOBAL_OPTIONS] \\\n");
-   printf("   [-if{h | b} INPUT_FILE[,IN_FILE_OPTS] ...] \\\n");
-   printf("   -of{p | w} OUTPUT_FILE[,OUT_FILE_OPTS]\n");
+   printf("   [-if[h | b | t | k | o] INPUT_FILE[,IN_FILE_OPTS] ...] \\\n");
+   printf("   -of{h | p | w | s | t | k | v | m | c | d | n | r} OUTPUT_FILE[,OUT_FILE_OPTS]\n");
    printf("\n");
 
-   printf("GLOBAL_OPTIONS    Currently none supported.\n");
+   printf("GLOBAL_OPTIONS\n");
+   printf("   -map           Write the output file through a memory mapping of the file.\n");
+   printf("   -j THREADS     The number of threads used to load the inputs and write the output\n");
+   printf("                  (default: one per CPU).\n");
+   printf("   -elide FILL[,MIN_RUN]\n");
+   printf("                  Leave runs of at least MIN_RUN bytes (default: 64) of the value FILL\n");
+   printf("                  out of Intel HEX, PAP, WDC, TI-TXT and Tektronix extended hex outputs.\n");
+   printf("   -dedup         Store identical blocks of the inputs only once, and report the savings.\n");
+   printf("   -extsort RUN_KB\n");
+   printf("                  Sort the records of text inputs by address in runs of RUN_KB KB on disk\n");
+   printf("                  before merging them, for huge inputs whose records are out of order.\n");
+   printf("   -xf XFORM[+XFORM...]\n");
+   printf("                  Transform the input files which follow, each on its own, as they are\n");
+   printf("                  loaded (-xf none stops). XFORM is one of swap16, swap32, invert,\n");
+   printf("                  bitrev, interleave or deinterleave. They are applied in the order\n");
+   printf("                  deinterleave, swap16, swap32, bitrev, invert, interleave.\n");
+   printf("   -oxf XFORM[+XFORM...]\n");
+   printf("                  Transform the whole image before it is written.\n");
+   printf("   -stats         Report the entropy, the longest run, the share of 0x00 and 0xFF\n");
+   printf("                  bytes, and the most common values of each range.\n");
+   printf("   -script FILE   Run the commands in FILE over the image before it is written.\n");
+   printf("   -do COMMANDS   Run COMMANDS, separated by ';', over the image before it is written:\n");
+   printf("                    crop START END           Keep only the data from START to END.\n");
+   printf("                    fill VALUE [START END]   Fill the gaps from START to END (default:\n");
+   printf("                                             the last crop, or all the data) with VALUE.\n");
+   printf("                    poke ADDR BYTE...        Write bytes at ADDR.\n");
+   printf("                    crc32 START END -> ADDR  Store the CRC-32 of START to END at ADDR,\n");
+   printf("                                             least significant byte first.\n");
+   printf("                  Ranges include END. The commands are run before -oxf.\n");
    printf("\n");
 
+   printf("-if               The input file type is detected from its contents.\n");
    printf("-ifh              The input file is of type Intel HEX.\n");
    printf("-ifb              The input file is of type raw binary.\n");
+   printf("-ift              The input file is of type TI-TXT.\n");
+   printf("-ifk              The input file is of type Tektronix extended hex.\n");
+   printf("-ifo              The input file is an Apple IIgs OMF load file.\n");
    printf("INPUT_FILE        The input file name.\n");
    printf("IN_FILE_OPTS      Options for this input file.\n");
    printf("\n");
@@ -207,21 +238,81 @@ static void PrintUsage(void)
    printf("For raw binary files:\n");
    printf("   A=ADDR         The starting address of the file.\n");
    printf("\n");
+   printf("For TI-TXT and Tektronix extended hex files:\n");
+   printf("   No options currently supported.\n");
+   printf("\n");
+   printf("For Apple IIgs OMF load files:\n");
+   printf("   A=ADDR         Where the relocatable segments are loaded (default: 0x020000).\n");
+   printf("\n");
 
+   printf("-ofh              The output file is of type Intel HEX.\n");
    printf("-ofp              The output file is of type MOS paper tape.\n");
    printf("-ofw              The output file is of type WDC binary.\n");
+   printf("-ofs              The output is published to a shared memory object.\n");
+   printf("-oft              The output file is of type TI-TXT.\n");
+   printf("-ofk              The output file is of type Tektronix extended hex.\n");
+   printf("-ofv              The output file is of type Verilog $readmemh.\n");
+   printf("-ofm              The output file is of type Intel MIF.\n");
+   printf("-ofc              The output file is of type Xilinx COE.\n");
+   printf("-ofd              The output file is a hexdump, like hexdump -C, for debugging.\n");
+   printf("-ofn              The output file is an iNES or NES 2.0 ROM.\n");
+   printf("-ofr              The output file is a C64 cartridge (CRT) image.\n");
    printf("OUTPUT_FILE       The output file name.\n");
    printf("\n");
 
    printf("OUT_FILE_OPTS     Options for this output file.\n");
    printf("\n");
 
+   printf("For Intel HEX files, which are written in a canonical form:\n");
+   printf("   R=LEN          The number of data bytes in each record, from 1 to 255 (default: 16).\n");
+   printf("\n");
    printf("For MOS paper tape files:\n");
    printf("   No options currently supported.\n");
    printf("\n");
    printf("For WDC binary files:\n");
    printf("   No options currently supported.\n");
    printf("\n");
+   printf("For TI-TXT and Tektronix extended hex files:\n");
+   printf("   No options currently supported.\n");
+   printf("\n");
+   printf("For shared memory outputs, OUTPUT_FILE is the name of the object:\n");
+   printf("   S=64K | S=16M  The size of the flat address space (default: the smallest that fits).\n");
+   printf("\n");
+   printf("For $readmemh, MIF and COE files, which hold one word per line:\n");
+   printf("   W=BITS         The word width: 8, 16, 32 or 64 bits (default: 8).\n");
+   printf("   D=DEPTH        The number of words (default: enough to hold the data).\n");
+   printf("   B=ADDR         The address of the first byte of the first word (default: 0).\n");
+   printf("   P=VALUE        The value of bytes which hold no data (default: 0xFF).\n");
+   printf("   L=LANE/LANES   Only write every LANES-th byte, starting at byte LANE (e.g. L=1/2).\n");
+   printf("   BE             Make the first byte of each word the most significant.\n");
+   printf("\n");
+   printf("For hexdump files:\n");
+   printf("   S              Write each run of identical lines as its first line and a \"*\".\n");
+   printf("\n");
+   printf("For iNES and NES 2.0 files, which hold PRG ROM and CHR ROM from windows of the image:\n");
+   printf("   PRG=ADDR[/SIZE]\n");
+   printf("                  Where PRG ROM starts (default: the lowest address loaded), and its\n");
+   printf("                  size, in whole 16 KB banks (default: enough for the data before CHR ROM).\n");
+   printf("   CHR=ADDR[/SIZE]\n");
+   printf("                  Where CHR ROM starts, and its size, in whole 8 KB banks (default:\n");
+   printf("                  enough for the data). Without it, the cartridge has CHR RAM.\n");
+   printf("   M=MAPPER[.SUB] The mapper, and the submapper for NES 2.0 (default: 0).\n");
+   printf("   V              Mirror the nametables vertically (default: horizontally).\n");
+   printf("   4S             The cartridge provides four-screen nametable memory.\n");
+   printf("   BAT            The cartridge has battery-backed PRG RAM.\n");
+   printf("   NES2           Write an NES 2.0 header, for mappers over 255 or ROMs over 4 MB.\n");
+   printf("   P=VALUE        The value of bytes which hold no data (default: 0xFF).\n");
+   printf("\n");
+   printf("For C64 cartridge files, whose addresses are BANK * 0x10000 plus $8000 - $BFFF or $E000 - $FFFF:\n");
+   printf("   T=TYPE         The hardware type, such as 32 for EasyFlash (default: 0, generic).\n");
+   printf("   N=NAME         The name of the cartridge.\n");
+   printf("   LINES=EXROM/GAME\n");
+   printf("                  The levels of the EXROM and GAME lines (default: 1/0 with chips at\n");
+   printf("                  $E000, else 0/0 with chips at $A000, else 0/1).\n");
+   printf("   16K            Write $8000 - $BFFF of each bank as one 16 KB chip, not two 8 KB ones.\n");
+   printf("   RAM | FLASH    The type of the chips (default: ROM).\n");
+   printf("   P=VALUE        The value of bytes which hold no data (default: 0xFF).\n");
+   printf("\n");
 
    printf("Multiple input files are supported, and the types may be freely mixed.\n");
    printf("For example, you can input several different binary files into one output\n");
@@ -233,778 +324,770 @@ static void PrintUsage(void)
    printf("Examples:\n");
    printf("\n");
    printf("RetroFileTool -ifh inFile.hex -ofp outFile.pap\n");
+   printf("RetroFileTool -if inFile.hex -ofp outFile.pap\n");
    printf("RetroFileTool -ifb inFile.bin,A=0x200 -ofw outFile.wdc.bin\n");
+   printf("RetroFileTool -ifh inFile.hex -ofs retroImage,S=64K\n");
+   printf("RetroFileTool -ifh rom.hex -ofm rom.mif,B=0xE000,D=8192\n");
+   printf("RetroFileTool -ifh rom.hex -ofd rom.txt,S\n");
+   printf("RetroFileTool -ifh messy.hex -ofh canonical.hex,R=32\n");
+   printf("RetroFileTool -ifo PROGRAM.S16,A=0x030000 -ofw program.wdc.bin\n");
+   printf("RetroFileTool -ifb prg.bin,A=0 -ifb chr.bin,A=0x100000 -ofn game.nes,CHR=0x100000,M=1,V\n");
+   printf("RetroFileTool -ifh banks.hex -ofr game.crt,T=32,N=GAME,FLASH\n");
+   printf("RetroFileTool -extsort 65536 -ifh shuffled.hex -ofw outFile.wdc.bin\n");
+   printf("RetroFileTool -xf interleave -ifb even_odd.bin,A=0 -oxf swap16 -ofw outFile.wdc.bin\n");
+   printf("RetroFileTool -ifh rom.hex -do \"crop 0x8000 0xFFFF; fill 0xFF; crc32 0x8000 0xFFFB -> 0xFFFC\" -ofw rom.wdc\n");
    printf("RetroFileTool -ifb inFile1.bin,A=0x200 -ifb inFile2.bin,A=0x8000 -ifh inFile3.hex -ofw outFile.wdc.bin\n");
    printf("\n");
 }
 
 /**************************************************************************//**
-* Reads an ASCII-encoded byte from the given file.
+* Parses a numeric options as a U32, supporting 0x and $.
 *
-* @param[in] inFile The file from which to read.
-* @param[in] pU8 The data will be stored here.
-* @param[in] pChkSum A checksum variable to update, or NULL to not update anything.
+* @param[in] strDesc A description of the option being parsed.
+* @param[in] str The numeric string to parse.
+* @param[out] pU32 The parsed value is stored here.
 *
 * @return An RESULT indicating success or failure.
 ******************************************************************************/
-static RESULT LoadU8(FILE* inFile, U8* pU8, U8* pChkSum)
+RESULT ParseOptU32(const char *strDesc, const char *str, U32 *pU32)
 {
-   int i, inByte[2];
+   char *pNext;
+   int radix = 0;
 
-   for (i = 0; i < 2; i++)
+   if (str[0] == '$')
    {
-      inByte[i] = fgetc(inFile);
-      if (inByte[i] == EOF)
-      {
-         printf("Unexpected end of file.\n");
-         return END_OF_FILE;
-      }
-      else if (inByte[i] >= '0' && inByte[i] <= '9')
-      {
-         inByte[i] -= '0';
-      }
-      else if (inByte[i] >= 'a' && inByte[i] <= 'f')
-      {
-         inByte[i] = (inByte[i] - 'a') + 10;
-      }
-      else if (inByte[i] >= 'A' && inByte[i] <= 'F')
-      {
-         inByte[i] = (inByte[i] - 'A') + 10;
-      }
-      else
-      {
-         printf("Invalid hex byte value.\n");
-         return INVALID_DATA;
-      }
+      str++;
+      radix = 16;
+   }
+
+   *pU32 = strtol(str, &pNext, radix);
+   if (errno != 0)
+   {
+      printf("Invalid %s: \"%s\"\n", strDesc, str);
+      return INVALID_ARGUMENTS;
    }
 
-   *pU8 = (inByte[0] << 4) | inByte[1];
-   if (pChkSum != NULL) *pChkSum += *pU8;
+   if (pNext == str)
+   {
+      printf("Invalid or unspecified %s: \"%s\"\n", strDesc, str);
+      return INVALID_ARGUMENTS;
+   }
 
    return OK;
 }
 
 /**************************************************************************//**
-* Reads an ASCII-encoded U16 from the given file, in MSB.
+* Parses options for binary files.
+*
+* @param[in,out] pInFile The input file being processed.
 *
-* @param[in] inFile The file from which to read.
-* @param[in] pU16 The data will be stored here.
-* @param[in] pChkSum A checksum variable to update, or NULL to not update anything.
+* Use strtok() to gain access to each option.
 *
 * @return An RESULT indicating success or failure.
 ******************************************************************************/
-static RESULT LoadU16(FILE* inFile, U16* pU16, U8* pChkSum)
+RESULT ParseBinOpts(DATA_FILE *pInFile)
 {
+   FILE_OPTS_BIN *pOpts;
+   char *opt;
    RESULT r;
-   U8 b1, b2;
 
-   r = LoadU8(inFile, &b1, pChkSum);
-   if (r != OK)
+   pOpts = (FILE_OPTS_BIN *) malloc(sizeof(FILE_OPTS_BIN));
+   if (pOpts == NULL)
    {
-      return r;
+      return NO_MEMORY;
    }
+   memset(pOpts, 0, sizeof(*pOpts));
+   pInFile->pOpts = pOpts;
 
-   r = LoadU8(inFile, &b2, pChkSum);
-   if (r != OK)
+   while ((opt = strtok(NULL, ",")) != NULL)
    {
-      return r;
+      if (!(strncmp(opt, "A=", 2)))
+      {
+         r = ParseOptU32("start address", &opt[2], &pOpts->startAddr);
+         if (r != OK)
+         {
+            return r;
+         }
+
+         pOpts->addrSpecified = 1;
+      }
+      else
+      {
+         printf("Invalid binary file option: \"%s\"\n", opt);
+         return INVALID_ARGUMENTS;
+      }
+   }
+
+   if (!pOpts->addrSpecified)
+   {
+      printf("ERROR: Missing start address (A=<ADDR>).\n");
+      return INVALID_ARGUMENTS;
    }
 
-   *pU16 = (b1 << 8) | b2;
    return OK;
 }
 
 /**************************************************************************//**
-* Reads an ASCII-encoded U32 from the given file, in MSB.
+* Parses options for Intel hex files.
+*
+* @param[in,out] pInFile The input file being processed.
 *
-* @param[in] inFile The file from which to read.
-* @param[in] pU32 The data will be stored here.
-* @param[in] pChkSum A checksum variable to update, or NULL to not update anything.
+* Use strtok() to gain access to each option.
 *
 * @return An RESULT indicating success or failure.
 ******************************************************************************/
-static RESULT LoadU32(FILE* inFile, U32* pU32, U8* pChkSum)
+RESULT ParseHexOpts(DATA_FILE *pInFile)
 {
-   RESULT r;
-   int i;
-   U8 b;
+   char *opt;
 
-   *pU32 = 0;
-   for (i = 0; i < 4; i++)
+   while ((opt = strtok(NULL, ",")) != NULL)
    {
-      r = LoadU8(inFile, &b, pChkSum);
-      if (r != OK)
-      {
-         return r;
-      }
-      *pU32 = ((*pU32) << 8) | b;
+      printf("Invalid HEX file option: \"%s\"\n", opt);
+      return INVALID_ARGUMENTS;
    }
 
    return OK;
 }
 
 /**************************************************************************//**
-* Concatenates any contiguous ranges.
+* Parses options for Intel hex output files.
 *
-* Two ranges may grow to be adjacent, so concatenate them if so.
+* @param[in,out] pOutFile The output file being processed.
 *
-* @return None.
+* Use strtok() to gain access to each option.
+*
+* @return An RESULT indicating success or failure.
 ******************************************************************************/
-static void CombineRanges(void)
+RESULT ParseHexOutOpts(DATA_FILE *pOutFile)
 {
-   RANGE* pRange = pAllRanges;
-   RANGE* pNext = pRange->pNext;
+   FILE_OPTS_HEX *pOpts;
+   char *opt;
+   RESULT r;
 
-   while (pRange && pNext)
+   pOpts = (FILE_OPTS_HEX *) malloc(sizeof(FILE_OPTS_HEX));
+   if (pOpts == NULL)
+   {
+      return NO_MEMORY;
+   }
+   memset(pOpts, 0, sizeof(*pOpts));
+   pOutFile->pOpts = pOpts;
+
+   while ((opt = strtok(NULL, ",")) != NULL)
    {
-      if (pRange->addr + pRange->len == pNext->addr)
+      if (!(strncmp(opt, "R=", 2)))
       {
-         numRanges--;
-         pRange->len += pNext->len;
-         pRange->pSegEnd->pNext = pNext->pSegStart;
-         pRange->pSegEnd = pNext->pSegEnd;
-         pRange->pNext = pNext->pNext;
-         free(pNext);
+         r = ParseOptU32("record length", &opt[2], &pOpts->recLen);
+         if (r != OK)
+         {
+            return r;
+         }
+
+         if (pOpts->recLen == 0 || pOpts->recLen > 255)
+         {
+            printf("ERROR: The record length must be from 1 to 255 bytes.\n");
+            return INVALID_ARGUMENTS;
+         }
       }
-      pRange = pRange->pNext;
-      if (pRange)
+      else
       {
-         pNext = pRange->pNext;
+         printf("Invalid HEX file option: \"%s\"\n", opt);
+         return INVALID_ARGUMENTS;
       }
    }
+
+   return OK;
 }
 
 /**************************************************************************//**
-* Adds a new segment into the data structures.
+* Parses options for MOS PAP files.
+*
+* @param[in,out] pInFile The input file being processed.
 *
-* @param[in] pSeg The segment to add.
+* Use strtok() to gain access to each option.
 *
 * @return An RESULT indicating success or failure.
 ******************************************************************************/
-static RESULT AddSegment(SEGMENT* pSeg)
+RESULT ParsePapOpts(DATA_FILE *pInFile)
 {
-   RANGE *pRange, *pTemp, **ppPrev;
-   U32 segStart, segEnd, rangeStart, rangeEnd;
+   char *opt;
 
-   if (pSeg->len == 0)
+   while ((opt = strtok(NULL, ",")) != NULL)
    {
-      return OK;
+      printf("Invalid PAP file option: \"%s\"\n", opt);
+      return INVALID_ARGUMENTS;
    }
 
-   dataBytes += pSeg->len;
-
-   segStart = pSeg->addr;
-   segEnd = segStart + pSeg->len - 1;
-
-   /* See if the segment is adjacent to any existing ranges. */
-   pRange = pAllRanges;
-   while (pRange)
-   {
-      rangeStart = pRange->addr;
-      rangeEnd = rangeStart + pRange->len - 1;
-
-      /* Make sure the new segment does not overlap an existing range. */
-      if ((segStart >= rangeStart && segStart <= rangeEnd) ||
-         (segEnd >= rangeStart && segEnd <= rangeEnd))
-      {
-         printf("ERROR: A segment overlaps a previous segment.\n");
-         return OVERLAPPING_SEGMENT;
-      }
-
-      /* See if the new segment is contiguous with an existing range. */
-      if ((segEnd + 1) == rangeStart)
-      {
-         /* The new segment immediately preceeds this range. */
-         pRange->addr = pSeg->addr;
-         pRange->len += pSeg->len;
-         pSeg->pNext = pRange->pSegStart;
-         pRange->pSegStart = pSeg;
-
-         return OK;
-      }
-      else if ((rangeEnd + 1) == segStart)
-      {
-         /* The new segment immediately follows this range. */
-         pRange->len += pSeg->len;
-         pRange->pSegEnd->pNext = pSeg;
-         pRange->pSegEnd = pSeg;
-         pSeg->pNext = NULL;
-
-         return OK;
-      }
-
-      pRange = pRange->pNext;
-   }
+   return OK;
+}
 
-   /* The segment is a new range, so create one. */
-   numRanges++;
-   pRange = (RANGE*)malloc(sizeof(RANGE));
-   if (pRange == NULL)
-   {
-      printf("ERROR: Out of memory.\n");
-      return NO_MEMORY;
-   }
+/**************************************************************************//**
+* Parses options for WDC binary files.
+*
+* @param[in,out] pInFile The input file being processed.
+*
+* Use strtok() to gain access to each option.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+RESULT ParseWdcOpts(DATA_FILE *pInFile)
+{
+   char *opt;
 
-   /* Fill in the new range data. */
-   pRange->addr = pSeg->addr;
-   pRange->len = pSeg->len;
-   pRange->pSegStart = pSeg;
-   pRange->pSegEnd = pSeg;
-   pSeg->pNext = NULL;
-
-   /* Insert the new range and maintain sorted order. */
-   ppPrev = &pAllRanges;
-   pTemp = *ppPrev;
-   while (pTemp && pTemp->addr < pRange->addr)
+   while ((opt = strtok(NULL, ",")) != NULL)
    {
-      ppPrev = &pTemp->pNext;
-      pTemp = pTemp->pNext;
+      printf("Invalid WDC file option: \"%s\"\n", opt);
+      return INVALID_ARGUMENTS;
    }
-   *ppPrev = pRange;
-   pRange->pNext = pTemp;
 
    return OK;
 }
 
 /**************************************************************************//**
-* Loads a raw binary file into RAM.
+* Parses options for TI-TXT files.
 *
-* @param[in] inFile The file object to read from.
-* @param[in] pOpts The file options for this file type.
+* Use strtok() to gain access to each option.
 *
 * @return An RESULT indicating success or failure.
 ******************************************************************************/
-static RESULT LoadBinFile(FILE* inFile, FILE_OPTS_BIN *pOpts)
+RESULT ParseTiTxtOpts(void)
 {
-   SEGMENT* pSeg;
-   long numBytes;
-   RESULT r;
-
-   printf("a raw binary file, addr=0x%0X.\n", pOpts->startAddr);
-
-   /* Get the size of the binary file to load. */
-   fseek(inFile, 0, SEEK_END);
-   numBytes = ftell(inFile);
-
-   /* Seek back to the beginning. */
-   fseek(inFile, 0, SEEK_SET);
+   char *opt;
 
-   /* Allocate a new segment to hold the data. */
-   pSeg = (SEGMENT*)malloc(sizeof(SEGMENT) + numBytes);
-   if (pSeg == NULL)
+   while ((opt = strtok(NULL, ",")) != NULL)
    {
-      return NO_MEMORY;
+      printf("Invalid TI-TXT file option: \"%s\"\n", opt);
+      return INVALID_ARGUMENTS;
    }
 
-   /* Set the segment's info. */
-   pSeg->addr = pOpts->startAddr;
-   pSeg->len = numBytes;
+   return OK;
+}
 
-   /* Read the data into the segment. */
-   if (!fread(pSeg->data, numBytes, 1, inFile))
-   {
-      printf("File read error.\n");
-      return IO_ERROR;
-   }
+/**************************************************************************//**
+* Parses options for Tektronix extended hex files.
+*
+* Use strtok() to gain access to each option.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+RESULT ParseTekOpts(void)
+{
+   char *opt;
 
-   /* Add the new segment into our data structures. */
-   r = AddSegment(pSeg);
-   if (r != OK)
+   while ((opt = strtok(NULL, ",")) != NULL)
    {
-      return r;
+      printf("Invalid Tektronix extended hex file option: \"%s\"\n", opt);
+      return INVALID_ARGUMENTS;
    }
 
    return OK;
 }
 
 /**************************************************************************//**
-* Loads an Intel HEX file into RAM.
+* Parses options for Apple IIgs OMF load files.
+*
+* @param[in,out] pInFile The input file being processed.
 *
-* @param[in] inFile The file object to read from.
+* Use strtok() to gain access to each option.
 *
 * @return An RESULT indicating success or failure.
 ******************************************************************************/
-static RESULT LoadHexFile(FILE* inFile)
+RESULT ParseOmfOpts(DATA_FILE *pInFile)
 {
+   FILE_OPTS_OMF *pOpts;
+   char *opt;
    RESULT r;
-   char inChar;
-   U8 recType, byteCount;
-   U8 chkSumActual, chkSumFile;
-   U16 addr16, extAddr = 0, segAddr = 0;
-   U32 i;
-   SEGMENT* pSeg;
-   U8 endRecordFound = 0;
 
-   printf("an Intel HEX file.\n");
-
-   while (1)
+   pOpts = (FILE_OPTS_OMF *) malloc(sizeof(FILE_OPTS_OMF));
+   if (pOpts == NULL)
    {
-      /* Find a record, which always starts with a ':'. */
-      while (((inChar = fgetc(inFile)) != ':') && !feof(inFile));
-      if (inChar == EOF)
-      {
-         break;
-      }
+      return NO_MEMORY;
+   }
+   memset(pOpts, 0, sizeof(*pOpts));
+   pInFile->pOpts = pOpts;
 
-      /* There should only be one end record at the very last entry. */
-      if (endRecordFound)
+   while ((opt = strtok(NULL, ",")) != NULL)
+   {
+      if (!(strncmp(opt, "A=", 2)))
       {
-         printf("Multiple end records encountered.\n");
-         return END_RECORD_ERROR;
+         r = ParseOptU32("load address", &opt[2], &pOpts->loadAddr);
+         if (r != OK)
+         {
+            return r;
+         }
+
+         pOpts->addrSpecified = 1;
+      }
+      else
+      {
+         printf("Invalid Apple IIgs OMF file option: \"%s\"\n", opt);
+         return INVALID_ARGUMENTS;
       }
+   }
 
-      chkSumActual = 0;
+   return OK;
+}
 
-      /* Read the byte count. */
-      r = LoadU8(inFile, &byteCount, &chkSumActual);
-      if (r != OK)
+/**************************************************************************//**
+* Parses options for hexdump outputs.
+*
+* @param[in,out] pInFile The output file being processed.
+*
+* Use strtok() to gain access to each option.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+RESULT ParseDumpOpts(DATA_FILE *pInFile)
+{
+   FILE_OPTS_DUMP *pOpts;
+   char *opt;
+
+   pOpts = (FILE_OPTS_DUMP *) malloc(sizeof(FILE_OPTS_DUMP));
+   if (pOpts == NULL)
+   {
+      return NO_MEMORY;
+   }
+   memset(pOpts, 0, sizeof(*pOpts));
+   pInFile->pOpts = pOpts;
+
+   while ((opt = strtok(NULL, ",")) != NULL)
+   {
+      if (!strcmp(opt, "S"))
       {
-         return r;
+         pOpts->squeeze = 1;
       }
-
-      /* Read the 16-bit address. */
-      r = LoadU16(inFile, &addr16, &chkSumActual);
-      if (r != OK)
+      else
       {
-         return r;
+         printf("Invalid hexdump file option: \"%s\"\n", opt);
+         return INVALID_ARGUMENTS;
       }
+   }
 
-      /* Read the record type. */
-      r = LoadU8(inFile, &recType, &chkSumActual);
-      if (r != OK)
+   return OK;
+}
+
+/**************************************************************************//**
+* Parses options for shared memory outputs.
+*
+* @param[in,out] pInFile The output file being processed.
+*
+* Use strtok() to gain access to each option.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+RESULT ParseShmOpts(DATA_FILE *pInFile)
+{
+   FILE_OPTS_SHM *pOpts;
+   char *opt;
+
+   pOpts = (FILE_OPTS_SHM *) malloc(sizeof(FILE_OPTS_SHM));
+   if (pOpts == NULL)
+   {
+      return NO_MEMORY;
+   }
+   memset(pOpts, 0, sizeof(*pOpts));
+   pInFile->pOpts = pOpts;
+
+   while ((opt = strtok(NULL, ",")) != NULL)
+   {
+      if (!strcmp(opt, "S=64K"))
       {
-         return r;
+         pOpts->addrSpace = SHM_SPACE_64K;
       }
-
-      /* Handle the record. */
-      switch (recType)
+      else if (!strcmp(opt, "S=16M"))
       {
-         case REC_DATA:
-         {
-            /* Allocate a new segment to hold the data. */
-            pSeg = (SEGMENT*)malloc(sizeof(SEGMENT) + byteCount);
-            if (pSeg == NULL)
-            {
-               printf("Out of memory.\n");
-               return NO_MEMORY;
-            }
-
-            /* Set the segment's info depending on which addressing mode is used. */
-            if (segAddr != 0)
-            {
-               pSeg->addr = (segAddr << 4) + addr16;
-            }
-            else
-            {
-               pSeg->addr = (extAddr << 16) | addr16;
-            }
-            pSeg->len = byteCount;
+         pOpts->addrSpace = SHM_SPACE_16M;
+      }
+      else
+      {
+         printf("Invalid shared memory option: \"%s\"\n", opt);
+         return INVALID_ARGUMENTS;
+      }
+   }
 
-            /* Read the data into the segment. */
-            for (i = 0; i < byteCount; i++)
-            {
-               r = LoadU8(inFile, &pSeg->data[i], &chkSumActual);
-               if (r != OK)
-               {
-                  return r;
-               }
-            }
+   return OK;
+}
 
-            /* Add the new segment into our data structures. */
-            r = AddSegment(pSeg);
-            if (r != OK)
-            {
-               return r;
-            }
+/**************************************************************************//**
+* Parses options for the memory initialization outputs: $readmemh, MIF and COE.
+*
+* @param[in,out] pInFile The output file being processed.
+*
+* Use strtok() to gain access to each option.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+RESULT ParseMemOpts(DATA_FILE *pInFile)
+{
+   FILE_OPTS_MEM *pOpts;
+   char *opt, *pSlash;
+   U32 pad;
+   RESULT r = OK;
 
-            break;
-         }
+   pOpts = (FILE_OPTS_MEM *) malloc(sizeof(FILE_OPTS_MEM));
+   if (pOpts == NULL)
+   {
+      return NO_MEMORY;
+   }
+   memset(pOpts, 0, sizeof(*pOpts));
+   pOpts->pad = 0xFF;
+   pInFile->pOpts = pOpts;
 
-         case REC_EOF:
+   while ((opt = strtok(NULL, ",")) != NULL)
+   {
+      if (!strncmp(opt, "W=", 2))
+      {
+         r = ParseOptU32("word width", &opt[2], &pOpts->wordBits);
+      }
+      else if (!strncmp(opt, "D=", 2))
+      {
+         r = ParseOptU32("depth", &opt[2], &pOpts->depth);
+      }
+      else if (!strncmp(opt, "B=", 2))
+      {
+         r = ParseOptU32("base address", &opt[2], &pOpts->baseAddr);
+      }
+      else if (!strncmp(opt, "P=", 2))
+      {
+         r = ParseOptU32("pad value", &opt[2], &pad);
+         pOpts->pad = (U8) pad;
+      }
+      else if (!strncmp(opt, "L=", 2) && (pSlash = strchr(opt, '/')) != NULL)
+      {
+         *pSlash = '\0';
+         r = ParseOptU32("byte lane", &opt[2], &pOpts->lane);
+         if (r == OK)
          {
-            endRecordFound = 1;
-            break;
+            r = ParseOptU32("number of byte lanes", pSlash + 1, &pOpts->numLanes);
          }
+      }
+      else if (!strcmp(opt, "BE"))
+      {
+         pOpts->bigEndian = 1;
+      }
+      else
+      {
+         printf("Invalid memory initialization file option: \"%s\"\n", opt);
+         return INVALID_ARGUMENTS;
+      }
 
-         case REC_EXT_SEG_ADDR:
-         {
-            /* Make sure the extAddr is 0. Any given HEX file may only use segment addressing
-            or extended linear addressing, but not both. */
-            if (extAddr != 0)
-            {
-                  printf("ERROR: Both segment addressing and linear addressing used. Only one type or the other is supported.\n");
-                  return MIXED_ADDRESSING_MODES;
-            }
-
-            /* Read the 16-bit segment address. */
-            r = LoadU16(inFile, &segAddr, &chkSumActual);
-            if (r != OK)
-            {
-                  return r;
-            }
-            break;
-         }
+      if (r != OK)
+      {
+         return r;
+      }
+   }
 
-         case REC_START_SEG_ADDR:
-         {
-            U16 startSeg, startOfs;
+   return OK;
+}
 
-            /* Read the 16-bit segment of the starting address. */
-            r = LoadU16(inFile, &startSeg, &chkSumActual);
-            if (r != OK)
-            {
-               return r;
-            }
+/**************************************************************************//**
+* Parses options for iNES and NES 2.0 outputs.
+*
+* @param[in,out] pInFile The output file being processed.
+*
+* Use strtok() to gain access to each option.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+RESULT ParseNesOpts(DATA_FILE *pInFile)
+{
+   FILE_OPTS_NES *pOpts;
+   char *opt, *pSep;
+   U32 pad;
+   RESULT r = OK;
 
-            /* Read the 16-bit offset of the starting address with the segment. */
-            r = LoadU16(inFile, &startOfs, &chkSumActual);
-            if (r != OK)
-            {
-               return r;
-            }
+   pOpts = (FILE_OPTS_NES *) malloc(sizeof(FILE_OPTS_NES));
+   if (pOpts == NULL)
+   {
+      return NO_MEMORY;
+   }
+   memset(pOpts, 0, sizeof(*pOpts));
+   pOpts->pad = 0xFF;
+   pInFile->pOpts = pOpts;
 
-            /* Compute the 32-bit starting address using the segment and offset. */
-            startAddr = (startSeg << 4) + startOfs;
-            break;
+   while ((opt = strtok(NULL, ",")) != NULL)
+   {
+      if (!strncmp(opt, "PRG=", 4) || !strncmp(opt, "CHR=", 4))
+      {
+         /* The size is optional, and fits the data when it is left out. */
+         if ((pSep = strchr(opt, '/')) != NULL)
+         {
+            *pSep = '\0';
          }
 
-         case REC_EXT_LIN_ADDR:
+         if (opt[0] == 'P')
          {
-            /* Make sure the segAddr is 0. Any given HEX file may only use segment addressing
-            or extended linear addressing, but not both. */
-            if (segAddr != 0)
+            pOpts->prgAddrSpecified = 1;
+            r = ParseOptU32("PRG ROM address", &opt[4], &pOpts->prgAddr);
+            if (r == OK && pSep)
             {
-               printf("ERROR: Both segment addressing and linear addressing used. Only one type or the other is supported.\n");
-               return MIXED_ADDRESSING_MODES;
+               r = ParseOptU32("PRG ROM size", pSep + 1, &pOpts->prgLen);
             }
-
-            /* Read the upper 16-bits of the address. */
-            r = LoadU16(inFile, &extAddr, &chkSumActual);
-            if (r != OK)
-            {
-               return r;
-            }
-            break;
          }
-
-         case REC_START_LIN_ADDR:
+         else
          {
-            /* Read the 32-bit starting address. */
-            r = LoadU32(inFile, &startAddr, &chkSumActual);
-            if (r != OK)
+            pOpts->hasChr = 1;
+            r = ParseOptU32("CHR ROM address", &opt[4], &pOpts->chrAddr);
+            if (r == OK && pSep)
             {
-               return r;
+               r = ParseOptU32("CHR ROM size", pSep + 1, &pOpts->chrLen);
             }
-            break;
+         }
+      }
+      else if (!strncmp(opt, "M=", 2))
+      {
+         if ((pSep = strchr(opt, '.')) != NULL)
+         {
+            *pSep = '\0';
          }
 
-         default:
+         r = ParseOptU32("mapper", &opt[2], &pOpts->mapper);
+         if (r == OK && pSep)
          {
-            printf("ERROR: Invalid record type: %i.\n", recType);
-            return INVALID_RECORD_TYPE;
+            r = ParseOptU32("submapper", pSep + 1, &pOpts->subMapper);
          }
       }
-
-      /* Read the checksum. */
-      r = LoadU8(inFile, &chkSumFile, NULL);
-      if (r != OK)
+      else if (!strncmp(opt, "P=", 2))
       {
-         return r;
+         r = ParseOptU32("pad value", &opt[2], &pad);
+         pOpts->pad = (U8) pad;
       }
-
-      /* Validate the checksum. */
-      if (((~chkSumActual + 1) & 0xFF) != chkSumFile)
+      else if (!strcmp(opt, "V"))
       {
-         printf("ERROR: Checksum error.\n");
-         return CHECKSUM_ERROR;
+         pOpts->vertical = 1;
+      }
+      else if (!strcmp(opt, "4S"))
+      {
+         pOpts->fourScreen = 1;
+      }
+      else if (!strcmp(opt, "BAT"))
+      {
+         pOpts->battery = 1;
+      }
+      else if (!strcmp(opt, "NES2"))
+      {
+         pOpts->nes2 = 1;
+      }
+      else
+      {
+         printf("Invalid NES file option: \"%s\"\n", opt);
+         return INVALID_ARGUMENTS;
       }
-   }
 
-   /* Make sure and end record was processed. */
-   if (endRecordFound == 0)
-   {
-      printf("ERROR: No end record was found.\n");
-      return END_RECORD_ERROR;
+      if (r != OK)
+      {
+         return r;
+      }
    }
 
    return OK;
 }
 
 /**************************************************************************//**
-* Write the loaded input data as a WDC binary format file.
+* Parses options for C64 cartridge (CRT) outputs.
 *
-* @param[in] outFile The file object to write to.
+* @param[in,out] pInFile The output file being processed.
+*
+* Use strtok() to gain access to each option.
 *
 * @return An RESULT indicating success or failure.
 ******************************************************************************/
-static RESULT WriteWdcFile(FILE *outFile)
+RESULT ParseCrtOpts(DATA_FILE *pInFile)
 {
-   SEGMENT *pSeg = NULL;
-   U8 outVal[3];
-   RANGE *pRange;
+   FILE_OPTS_CRT *pOpts;
+   char *opt, *pSlash;
+   U32 pad;
+   RESULT r = OK;
 
-   /* Write the header. */
-   if (fprintf(outFile, "Z") != 1)
+   pOpts = (FILE_OPTS_CRT *) malloc(sizeof(FILE_OPTS_CRT));
+   if (pOpts == NULL)
    {
-      printf("Error writing output file.\n");
-      return IO_ERROR;
+      return NO_MEMORY;
    }
+   memset(pOpts, 0, sizeof(*pOpts));
+   pOpts->pad = 0xFF;
+   pInFile->pOpts = pOpts;
 
-   /* Write each range. */
-   pRange = pAllRanges;
-   while (pRange)
+   while ((opt = strtok(NULL, ",")) != NULL)
    {
-      /* Ensure the address is within the range we can output. */
-      if (pRange->addr >> 24)
+      if (!strncmp(opt, "T=", 2))
       {
-         printf("ERROR: Address out of range.\n");
-         return ADDR_OUT_OF_RANGE;
+         r = ParseOptU32("hardware type", &opt[2], &pOpts->hwType);
       }
-
-      /* Write the address. */
-      outVal[2] = pRange->addr >> 16;
-      outVal[1] = pRange->addr >> 8;
-      outVal[0] = pRange->addr >> 0;
-      if (!fwrite(outVal, sizeof(outVal), 1, outFile))
+      else if (!strncmp(opt, "N=", 2))
       {
-         printf("Error writing output file.\n");
-         return IO_ERROR;
+         pOpts->pName = &opt[2];
       }
-
-      /* Ensure the length is within the range we can output. */
-      if (pRange->len >> 24)
+      else if (!strncmp(opt, "LINES=", 6) && (pSlash = strchr(opt, '/')) != NULL)
       {
-         printf("ERROR: Length out of range.\n");
-         return LEN_OUT_OF_RANGE;
+         *pSlash = '\0';
+         pOpts->linesSpecified = 1;
+         r = ParseOptU32("EXROM line", &opt[6], &pOpts->exrom);
+         if (r == OK)
+         {
+            r = ParseOptU32("GAME line", pSlash + 1, &pOpts->game);
+         }
       }
-
-      /* Write the length. */
-      outVal[2] = pRange->len >> 16;
-      outVal[1] = pRange->len >> 8;
-      outVal[0] = pRange->len >> 0;
-      if (!fwrite(outVal, sizeof(outVal), 1, outFile))
+      else if (!strcmp(opt, "16K"))
       {
-         printf("Error writing output file.\n");
-         return IO_ERROR;
+         pOpts->chip16K = 1;
       }
-
-      /* Set up the starting segment for this range. */
-      pSeg = pRange->pSegStart;
-
-      /* Write the data for seach segment in this range. */
-      while (pSeg)
+      else if (!strcmp(opt, "RAM"))
       {
-         if (!fwrite(pSeg->data, pSeg->len, 1, outFile))
-         {
-            printf("Error writing output file.\n");
-            return IO_ERROR;
-         }
-
-         /* Move to the next segment. */
-         pSeg = pSeg->pNext;
-      };
-
-      /* Move to the next range. */
-      pRange = pRange->pNext;
-   }
-
-   /* Write the end record -- an address and size of 0. */
-   memset(outVal, 0, sizeof(outVal));
-   if (!fwrite(outVal, sizeof(outVal), 1, outFile))
-   {
-      printf("Error writing output file.\n");
-      return IO_ERROR;
-   }
+         pOpts->chipType = 1;
+      }
+      else if (!strcmp(opt, "FLASH"))
+      {
+         pOpts->chipType = 2;
+      }
+      else if (!strncmp(opt, "P=", 2))
+      {
+         r = ParseOptU32("pad value", &opt[2], &pad);
+         pOpts->pad = (U8) pad;
+      }
+      else
+      {
+         printf("Invalid C64 cartridge file option: \"%s\"\n", opt);
+         return INVALID_ARGUMENTS;
+      }
 
-   if (!fwrite(outVal, sizeof(outVal), 1, outFile))
-   {
-      printf("Error writing output file.\n");
-      return IO_ERROR;
+      if (r != OK)
+      {
+         return r;
+      }
    }
 
-   printf("File written as WDC binary file.\n");
    return OK;
 }
 
 /**************************************************************************//**
-* Write the loaded input data as a PAP format file.
+* Determines the type of an input file by inspecting its first few KB.
 *
-* @param[in] outFile The file object to write to.
+* Only the first SNIFF_LEN bytes are read, so this is cheap even for huge
+* files. Anything which is not recognized is treated as raw binary.
+*
+* @param[in,out] pInFile The input file, whose type is set on success.
 *
 * @return An RESULT indicating success or failure.
 ******************************************************************************/
-static RESULT WritePapFile(FILE *outFile)
+RESULT SniffFileType(DATA_FILE *pInFile)
 {
-   SEGMENT* pSeg = NULL;
-   U32 papRecords = 0;
-   RANGE* pRange;
-   U16 chkSum;
-   U8* pData;
-
-   /* Write each range. */
-   pRange = pAllRanges;
-   while (pRange)
+   static U8 buf[SNIFF_LEN];
+   const char *pDesc;
+   FILE *inFile;
+   long fileLen;
+   U32 len;
+
+   inFile = fopen(pInFile->pName, "rb");
+   if (!inFile)
    {
-      /* Set up the starting segment for this range. */
-      pSeg = pRange->pSegStart;
-      pData = &pSeg->data[0];
-
-      /* Write each byte in the current range. */
-      while (pRange->len)
-      {
-         U32 papRecLen;
-
-         /* Determine the length of the PAP record to write. */
-         papRecLen = pRange->len < PAP_REC_LEN ? pRange->len : PAP_REC_LEN;
-
-         /* Write the record start char, the record length, and the address. */
-         if (fprintf(outFile, ";%02X%02X%02X", papRecLen, (pRange->addr >> 8) & 0xFF,
-               pRange->addr & 0xFF) < 0)
-         {
-               printf("Error writing output file.\n");
-               return IO_ERROR;
-         }
-
-         /* Initialize the checkSum. All hex-formatted data is included. */
-         chkSum = papRecLen + (pRange->addr & 0xFF) + ((pRange->addr >> 8) & 0xFF);
-
-         /* Move to the next PAP record. */
-         pRange->len -= papRecLen;
-         pRange->addr += papRecLen;
-
-         /* Write the data for this PAP record. */
-         while (papRecLen--)
-         {
-            /* Update the checkSum. */
-            chkSum += *pData;
-
-            /* Write the current byte and move to the next one. */
-            if (fprintf(outFile, "%02X", *(pData++)) < 0)
-            {
-               printf("Error writing output file.\n");
-               return IO_ERROR;
-            }
-
-            /* See if we've reached the end of the current segment. */
-            if ((--pSeg->len) == 0)
-            {
-               /* Move to the next segment. */
-               pSeg = pSeg->pNext;
-               pData = &pSeg->data[0];
-            }
-         }
-
-         /* Write the checksum and the record footer. */
-         if (fprintf(outFile, "%02X%02X\r\n\0\0\0\0\0\0", (chkSum >> 8) & 0xFF,
-               chkSum & 0xFF) < 0)
-         {
-            printf("Error writing output file.\n");
-            return IO_ERROR;
-         }
+      printf("Unable to open the input file \"%s\".\n", pInFile->pName);
+      return CANNOT_OPEN_FILE;
+   }
 
-         /* We have completed a PAP record. */
-         papRecords++;
-      }
+   fseek(inFile, 0, SEEK_END);
+   fileLen = ftell(inFile);
+   fseek(inFile, 0, SEEK_SET);
 
-      /* Move to the next range. */
-      pRange = pRange->pNext;
-   }
+   len = (U32) fread(buf, 1, sizeof(buf), inFile);
+   fclose(inFile);
 
-   /* Write the end record. */
-   chkSum = ((papRecords >> 8) & 0xFF) + (papRecords & 0xFF);
-   if (fprintf(outFile, ";00%02X%02X%02X%02X\r\n\0\0\0\0\0\0",
-      (papRecords >> 8) & 0xFF, papRecords & 0xFF,
-      (chkSum >> 8) & 0xFF, chkSum & 0xFF) < 0)
+   if (RftSniff(buf, len, fileLen > (long) len ? (U32) fileLen : len,
+      &pInFile->type, &pDesc) != OK)
    {
-      printf("Error writing output file.\n");
-      return IO_ERROR;
+      printf("ERROR: \"%s\" looks like %s data, which cannot be loaded.\n",
+         pInFile->pName, pDesc);
+      printf("Specify the input file type explicitly to override the detection.\n");
+      return UNSUPPORTED;
    }
 
-   printf("File written as PAP file.\n");
+   printf("Detected \"%s\" as %s file.\n", pInFile->pName, GetInType(pInFile->type)->pDesc);
    return OK;
 }
 
 /**************************************************************************//**
-* Parses a numeric options as a U32, supporting 0x and $.
+* Parses the fill elision options.
 *
-* @param[in] strDesc A description of the option being parsed.
-* @param[in] str The numeric string to parse.
-* @param[out] pU32 The parsed value is stored here.
+* @param[in] str The options, as FILL[,MIN_RUN].
 *
 * @return An RESULT indicating success or failure.
 ******************************************************************************/
-RESULT ParseOptU32(const char *strDesc, const char *str, U32 *pU32)
+RESULT ParseElideOpts(char *str)
 {
-   char *pNext;
-   int radix = 0;
+   char *opt;
+   RESULT r;
 
-   if (str[0] == '$')
+   r = ParseOptU32("fill value", strtok(str, ","), &elideFill);
+   if (r != OK)
    {
-      str++;
-      radix = 16;
+      return r;
    }
 
-   *pU32 = strtol(str, &pNext, radix);
-   if (errno != 0)
+   if (elideFill > 0xFF)
    {
-      printf("Invalid %s: \"%s\"\n", strDesc, str);
+      printf("ERROR: The fill value must be a byte.\n");
       return INVALID_ARGUMENTS;
    }
 
-   if (pNext == str)
+   elideMinRun = 64;
+   if ((opt = strtok(NULL, ",")) != NULL)
    {
-      printf("Invalid or unspecified %s: \"%s\"\n", strDesc, str);
-      return INVALID_ARGUMENTS;
+      r = ParseOptU32("minimum run", opt, &elideMinRun);
+      if (r != OK)
+      {
+         return r;
+      }
+
+      if (elideMinRun == 0)
+      {
+         printf("ERROR: The minimum run must be at least 1 byte.\n");
+         return INVALID_ARGUMENTS;
+      }
    }
 
    return OK;
 }
 
 /**************************************************************************//**
-* Parses options for binary files.
+* Parses a list of transforms.
 *
-* @param[in,out] pInFile The input file being processed.
-*
-* Use strtok() to gain access to each option.
+* @param[in] str The transforms, as XFORM[+XFORM...], or "none".
+* @param[out] pXform The RFT_XFORM_ transforms are stored here.
 *
 * @return An RESULT indicating success or failure.
 ******************************************************************************/
-RESULT ParseBinOpts(DATA_FILE *pInFile)
+RESULT ParseXformOpts(char *str, U32 *pXform)
 {
-   FILE_OPTS_BIN *pOpts;
    char *opt;
-   RESULT r;
+   U32 i;
 
-   pOpts = (FILE_OPTS_BIN *) malloc(sizeof(FILE_OPTS_BIN));
-   if (pOpts == NULL)
+   *pXform = 0;
+   if (!strcmp(str, "none"))
    {
-      return NO_MEMORY;
+      return OK;
    }
-   memset(pOpts, 0, sizeof(*pOpts));
-   pInFile->pOpts = pOpts;
 
-   while ((opt = strtok(NULL, ",")) != NULL)
+   for (opt = strtok(str, "+"); opt != NULL; opt = strtok(NULL, "+"))
    {
-      if (!(strncmp(opt, "A=", 2)))
+      for (i = 0; i < sizeof(xformNames) / sizeof(xformNames[0]); i++)
       {
-         r = ParseOptU32("start address", &opt[2], &pOpts->startAddr);
-         if (r != OK)
+         if (!strcmp(opt, xformNames[i].pName))
          {
-            return r;
+            break;
          }
-
-         pOpts->addrSpecified = 1;
       }
-      else
+
+      if (i == sizeof(xformNames) / sizeof(xformNames[0]))
       {
-         printf("Invalid binary file option: \"%s\"\n", opt);
+         printf("ERROR: Invalid transform: \"%s\"\n", opt);
          return INVALID_ARGUMENTS;
       }
+
+      *pXform |= xformNames[i].xform;
    }
 
-   if (!pOpts->addrSpecified)
+   if ((*pXform & RFT_XFORM_INTERLEAVE) && (*pXform & RFT_XFORM_DEINTERLEAVE))
    {
-      printf("ERROR: Missing start address (A=<ADDR>).\n");
+      printf("ERROR: A file cannot be both interleaved and deinterleaved.\n");
       return INVALID_ARGUMENTS;
    }
 
@@ -1012,68 +1095,141 @@ RESULT ParseBinOpts(DATA_FILE *pInFile)
 }
 
 /**************************************************************************//**
-* Parses options for Intel hex files.
+* Adds commands to the end of the script run over the image.
 *
-* @param[in,out] pInFile The input file being processed.
-*
-* Use strtok() to gain access to each option.
+* @param[in] pText The commands.
+* @param[in] len The length of the commands, in bytes.
 *
 * @return An RESULT indicating success or failure.
 ******************************************************************************/
-RESULT ParseHexOpts(DATA_FILE *pInFile)
+RESULT AppendScript(const char *pText, size_t len)
 {
-   char *opt;
+   size_t oldLen = pScript ? strlen(pScript) : 0;
+   char *pNew;
 
-   while ((opt = strtok(NULL, ",")) != NULL)
+   /* Each part ends its last line, so the next cannot run on from a comment. */
+   pNew = (char *) realloc(pScript, oldLen + len + 2);
+   if (pNew == NULL)
    {
-      printf("Invalid HEX file option: \"%s\"\n", opt);
-      return INVALID_ARGUMENTS;
+      printf("ERROR: Out of memory.\n");
+      return NO_MEMORY;
    }
 
+   memcpy(&pNew[oldLen], pText, len);
+   pNew[oldLen + len] = '\n';
+   pNew[oldLen + len + 1] = '\0';
+   pScript = pNew;
+
    return OK;
 }
 
 /**************************************************************************//**
-* Parses options for MOS PAP files.
+* Adds the commands of a script file to the end of the script run over the image.
 *
-* @param[in,out] pInFile The input file being processed.
-*
-* Use strtok() to gain access to each option.
+* @param[in] pName The name of the script file.
 *
 * @return An RESULT indicating success or failure.
 ******************************************************************************/
-RESULT ParsePapOpts(DATA_FILE *pInFile)
+RESULT ReadScriptFile(const char *pName)
 {
-   char *opt;
+   FILE *pFile;
+   char *pText;
+   long len;
+   RESULT r;
 
-   while ((opt = strtok(NULL, ",")) != NULL)
+   pFile = fopen(pName, "rb");
+   if (pFile == NULL)
+   {
+      printf("ERROR: Unable to open the script file \"%s\".\n", pName);
+      return CANNOT_OPEN_FILE;
+   }
+
+   fseek(pFile, 0, SEEK_END);
+   len = ftell(pFile);
+   fseek(pFile, 0, SEEK_SET);
+
+   pText = (char *) malloc(len > 0 ? len : 1);
+   if (pText == NULL)
+   {
+      printf("ERROR: Out of memory.\n");
+      fclose(pFile);
+      return NO_MEMORY;
+   }
+
+   if (len > 0 && fread(pText, len, 1, pFile) != 1)
+   {
+      printf("ERROR: Unable to read the script file \"%s\".\n", pName);
+      r = IO_ERROR;
+   }
+   else
    {
-      printf("Invalid PAP file option: \"%s\"\n", opt);
-      return INVALID_ARGUMENTS;
+      r = AppendScript(pText, len > 0 ? len : 0);
    }
 
-   return OK;
+   free(pText);
+   fclose(pFile);
+   return r;
 }
 
 /**************************************************************************//**
-* Parses options for WDC binary files.
-*
-* @param[in,out] pInFile The input file being processed.
+* Reports the byte statistics of each range.
 *
-* Use strtok() to gain access to each option.
+* @param[in] pCtx The conversion context.
 *
 * @return An RESULT indicating success or failure.
 ******************************************************************************/
-RESULT ParseWdcOpts(DATA_FILE *pInFile)
+RESULT PrintStats(const RFT_CONTEXT *pCtx)
 {
-   char *opt;
+   RFT_RANGE_STATS *pStats, *pRange;
+   U32 top[4], i, j, k;
+   RESULT r;
 
-   while ((opt = strtok(NULL, ",")) != NULL)
+   pStats = (RFT_RANGE_STATS *) malloc((RftGetNumRanges(pCtx) + 1) * sizeof(RFT_RANGE_STATS));
+   if (pStats == NULL)
    {
-      printf("Invalid WDC file option: \"%s\"\n", opt);
-      return INVALID_ARGUMENTS;
+      return NO_MEMORY;
+   }
+
+   r = RftAnalyze(pCtx, pStats);
+   if (r != OK)
+   {
+      free(pStats);
+      return r;
+   }
+
+   printf("\nStatistics:\n");
+   for (pRange = pStats; pRange < pStats + RftGetNumRanges(pCtx); pRange++)
+   {
+      printf("0x%04X - 0x%04X: entropy %.3f bits/byte, 0x00 %.1f%%, 0xFF %.1f%%.\n",
+         pRange->addr, pRange->addr + pRange->len - 1, pRange->entropy,
+         pRange->counts[0x00] * 100.0 / pRange->len, pRange->counts[0xFF] * 100.0 / pRange->len);
+      printf("   Longest run: %u bytes of 0x%02X at 0x%04X.\n",
+         pRange->runLen, pRange->runValue, pRange->runAddr);
+
+      /* Find the most common values, most common first. */
+      for (k = 0; k < 4; k++)
+      {
+         top[k] = 256;
+         for (i = 0; i < 256; i++)
+         {
+            for (j = 0; j < k && top[j] != i; j++);
+            if (j == k && pRange->counts[i] &&
+               (top[k] == 256 || pRange->counts[i] > pRange->counts[top[k]]))
+            {
+               top[k] = i;
+            }
+         }
+      }
+
+      printf("   Most common:");
+      for (k = 0; k < 4 && top[k] != 256; k++)
+      {
+         printf("%s 0x%02X (%u)", k ? "," : "", top[k], pRange->counts[top[k]]);
+      }
+      printf(".\n");
    }
 
+   free(pStats);
    return OK;
 }
 
@@ -1088,7 +1244,7 @@ RESULT ParseWdcOpts(DATA_FILE *pInFile)
 RESULT ParseParams(int argc, char* argv[])
 {
    DATA_FILE *pLastInFile = NULL;
-   char *arg;
+   char *arg, typeChar;
    RESULT r;
 
    while (arg = *(++argv))
@@ -1104,6 +1260,7 @@ RESULT ParseParams(int argc, char* argv[])
             return NO_MEMORY;
          }
          memset(pInFile, 0, sizeof(*pInFile));
+         pInFile->xform = inXform;
 
          // Add the new input file to the end of the list.
          if (pLastInFile == NULL)
@@ -1126,8 +1283,20 @@ RESULT ParseParams(int argc, char* argv[])
          /* Extract the file name (strip off any options). */
          pInFile->pName = strtok(fileStr, ",");
 
-         /* Determine the file type. */
-         switch (arg[3])
+         /* Determine the file type, inspecting the file if it was not specified. */
+         typeChar = arg[3];
+         if (typeChar == '\0')
+         {
+            r = SniffFileType(pInFile);
+            if (r != OK)
+            {
+               return r;
+            }
+
+            typeChar = GetInType(pInFile->type)->letter;
+         }
+
+         switch (typeChar)
          {
             case 'h':
                pInFile->type = FILE_TYPE_HEX;
@@ -1151,6 +1320,39 @@ RESULT ParseParams(int argc, char* argv[])
 
                break;
 
+            case 't':
+               pInFile->type = FILE_TYPE_TITXT;
+
+               r = ParseTiTxtOpts();
+               if (r != OK)
+               {
+                  return r;
+               }
+
+               break;
+
+            case 'k':
+               pInFile->type = FILE_TYPE_TEK;
+
+               r = ParseTekOpts();
+               if (r != OK)
+               {
+                  return r;
+               }
+
+               break;
+
+            case 'o':
+               pInFile->type = FILE_TYPE_OMF;
+
+               r = ParseOmfOpts(pInFile);
+               if (r != OK)
+               {
+                  return r;
+               }
+
+               break;
+
             default:
                printf("ERROR: Invalid input file type: '%c'\n", arg[3]);
                return INVALID_ARGUMENTS;
@@ -1209,12 +1411,184 @@ RESULT ParseParams(int argc, char* argv[])
 
                break;
 
+            case 's':
+               pOutFile->type = FILE_TYPE_SHM;
+               r = ParseShmOpts(pOutFile);
+               if (r != OK)
+               {
+                  return r;
+               }
+
+               break;
+
+            case 't':
+               pOutFile->type = FILE_TYPE_TITXT;
+               r = ParseTiTxtOpts();
+               if (r != OK)
+               {
+                  return r;
+               }
+
+               break;
+
+            case 'h':
+               pOutFile->type = FILE_TYPE_HEX;
+               r = ParseHexOutOpts(pOutFile);
+               if (r != OK)
+               {
+                  return r;
+               }
+
+               break;
+
+            case 'k':
+               pOutFile->type = FILE_TYPE_TEK;
+               r = ParseTekOpts();
+               if (r != OK)
+               {
+                  return r;
+               }
+
+               break;
+
+            case 'v':
+            case 'm':
+            case 'c':
+               pOutFile->type = arg[3] == 'v' ? FILE_TYPE_MEMH :
+                  (arg[3] == 'm' ? FILE_TYPE_MIF : FILE_TYPE_COE);
+               r = ParseMemOpts(pOutFile);
+               if (r != OK)
+               {
+                  return r;
+               }
+
+               break;
+
+            case 'd':
+               pOutFile->type = FILE_TYPE_DUMP;
+               r = ParseDumpOpts(pOutFile);
+               if (r != OK)
+               {
+                  return r;
+               }
+
+               break;
+
+            case 'n':
+               pOutFile->type = FILE_TYPE_NES;
+               r = ParseNesOpts(pOutFile);
+               if (r != OK)
+               {
+                  return r;
+               }
+
+               break;
+
+            case 'r':
+               pOutFile->type = FILE_TYPE_CRT;
+               r = ParseCrtOpts(pOutFile);
+               if (r != OK)
+               {
+                  return r;
+               }
+
+               break;
+
             default:
                printf("ERROR: Invalid output file type: '%c'\n", arg[3]);
                return INVALID_ARGUMENTS;
                break;
          }
       }
+      else if (!strcmp(arg, "-map"))
+      {
+         useMapping = 1;
+      }
+      else if (!strcmp(arg, "-j"))
+      {
+         if (*(argv + 1) == NULL)
+         {
+            printf("ERROR: Missing thread count.\n");
+            return INVALID_ARGUMENTS;
+         }
+
+         r = ParseOptU32("thread count", *(++argv), &numThreads);
+         if (r != OK)
+         {
+            return r;
+         }
+      }
+      else if (!strcmp(arg, "-dedup"))
+      {
+         useDedup = 1;
+      }
+      else if (!strcmp(arg, "-stats"))
+      {
+         showStats = 1;
+      }
+      else if (!strcmp(arg, "-extsort"))
+      {
+         if (*(argv + 1) == NULL)
+         {
+            printf("ERROR: Missing run size.\n");
+            return INVALID_ARGUMENTS;
+         }
+
+         r = ParseOptU32("run size", *(++argv), &sortRunKB);
+         if (r != OK)
+         {
+            return r;
+         }
+
+         if (sortRunKB == 0 || sortRunKB > 0x3FFFFF)
+         {
+            printf("ERROR: The run size must be from 1 to 4194303 KB.\n");
+            return INVALID_ARGUMENTS;
+         }
+      }
+      else if (!strcmp(arg, "-xf") || !strcmp(arg, "-oxf"))
+      {
+         if (*(argv + 1) == NULL)
+         {
+            printf("ERROR: Missing transform.\n");
+            return INVALID_ARGUMENTS;
+         }
+
+         r = ParseXformOpts(*(++argv), arg[1] == 'x' ? &inXform : &outXform);
+         if (r != OK)
+         {
+            return r;
+         }
+      }
+      else if (!strcmp(arg, "-script") || !strcmp(arg, "-do"))
+      {
+         if (*(argv + 1) == NULL)
+         {
+            printf("ERROR: Missing script.\n");
+            return INVALID_ARGUMENTS;
+         }
+
+         argv++;
+         r = arg[1] == 's' ? ReadScriptFile(*argv) : AppendScript(*argv, strlen(*argv));
+         if (r != OK)
+         {
+            return r;
+         }
+      }
+      else if (!strcmp(arg, "-elide"))
+      {
+         if (*(argv + 1) == NULL)
+         {
+            printf("ERROR: Missing fill value.\n");
+            return INVALID_ARGUMENTS;
+         }
+
+         r = ParseElideOpts(*(++argv));
+         if (r != OK)
+         {
+            return r;
+         }
+      }
       else
       {
          printf("ERROR: Unsupported option \"%s\"\n", arg);
@@ -1251,8 +1625,14 @@ RESULT ParseParams(int argc, char* argv[])
 ******************************************************************************/
 int main(int argc, char* argv[])
 {
+   RFT_CONTEXT *pCtx;
+   OUTPUT_PLAN plan;
+   RFT_DEDUP_STATS dedupStats;
+   const RANGE* pRange;
+   DATA_FILE *pInFile;
+   RFT_INPUT *pInputs;
    RESULT r;
-   RANGE* pRange;
+   U32 i, numInputs, numPasses;
 
    printf("Retro file conversion utility, Timothy Alicie, 2017-2022, v" VER_STR ".\n\n");
 
@@ -1268,87 +1648,140 @@ int main(int argc, char* argv[])
       return r;
    }
 
-   /* Load each input file. */
-   do
+   r = RftOpen(&pCtx);
+   if (r != OK)
+   {
+      return r;
+   }
+
+   RftSetThreads(pCtx, numThreads);
+   RftSetMapping(pCtx, useMapping);
+   RftSetElision(pCtx, (U8) elideFill, elideMinRun);
+   RftSetDedup(pCtx, useDedup);
+   RftSetExternalSort(pCtx, sortRunKB * 1024);
+
+   /* Load the input files, all at once. */
+   for (pInFile = pInFiles, numInputs = 0; pInFile; pInFile = pInFile->pNext)
+   {
+      numInputs++;
+   }
+
+   pInputs = (RFT_INPUT *) malloc(numInputs * sizeof(RFT_INPUT));
+   if (pInputs == NULL)
    {
-      printf("Loading \"%s\" as ", pInFiles->pName);
+      printf("ERROR: Out of memory.\n");
+      RftClose(pCtx);
+      return NO_MEMORY;
+   }
+
+   for (pInFile = pInFiles, i = 0; pInFile; pInFile = pInFile->pNext, i++)
+   {
+      printf("Loading \"%s\" as ", pInFile->pName);
 
-      FILE* inFile = fopen(pInFiles->pName, "rb");
-      if (!inFile)
+      if (pInFile->type == FILE_TYPE_BIN)
       {
-          printf("Unable to open the input file \"%s\".\n", pInFiles->pName);
-          return CANNOT_OPEN_FILE;
+         printf("a raw binary file, addr=0x%0X.\n",
+            ((FILE_OPTS_BIN *) pInFile->pOpts)->startAddr);
       }
-
-      switch (pInFiles->type)
+      else
       {
-         case FILE_TYPE_HEX:
-            r = LoadHexFile(inFile);
-            if (r != OK)
-            {
-               return r;
-            }
+         printf("%s file.\n", GetInType(pInFile->type)->pDesc);
+      }
 
-            break;
+      pInputs[i].type = pInFile->type;
+      pInputs[i].pOpts = pInFile->pOpts;
+      pInputs[i].pName = pInFile->pName;
+      pInputs[i].xform = pInFile->xform;
+   }
 
-         case FILE_TYPE_BIN:
-            r = LoadBinFile(inFile, (FILE_OPTS_BIN *) pInFiles->pOpts);
-            if (r != OK)
-            {
-               return r;
-            }
+   r = RftLoadFiles(pCtx, pInputs, numInputs);
+   free(pInputs);
+   if (r != OK)
+   {
+      RftClose(pCtx);
+      return r;
+   }
 
-            break;
+   if (pScript)
+   {
+      r = RftRunScript(pCtx, pScript, &numPasses);
+      free(pScript);
+      if (r != OK)
+      {
+         RftClose(pCtx);
+         return r;
+      }
+
+      printf("\nRan the script in %u pass%s over the data.\n", numPasses,
+         numPasses == 1 ? "" : "es");
+   }
+
+   if (outXform)
+   {
+      r = RftTransform(pCtx, outXform);
+      if (r != OK)
+      {
+         RftClose(pCtx);
+         return r;
       }
+   }
 
-      fclose(inFile);
+   if (showStats)
+   {
+      r = PrintStats(pCtx);
+      if (r != OK)
+      {
+         RftClose(pCtx);
+         return r;
+      }
+   }
 
-      /* Concatenate any ranges that have become contiguous. */
-      CombineRanges();
+   if (useDedup)
+   {
+      RftGetDedupStats(pCtx, &dedupStats);
+      printf("\nDeduplicated %u blocks, saving %u bytes (%u distinct blocks hold %u bytes).\n",
+         dedupStats.numShared, dedupStats.savedBytes, dedupStats.numBlobs, dedupStats.blobBytes);
+   }
 
-   } while (pInFiles = pInFiles->pNext);
+   /* Plan the output before opening it, so that errors are found before writing. */
+   r = RftPlanOutput(pCtx, pOutFile->type, pOutFile->pOpts, &plan);
+   if (r != OK)
+   {
+      RftFreePlan(&plan);
+      RftClose(pCtx);
+      return r;
+   }
 
    printf("\nRanges:\n");
-   pRange = pAllRanges;
+   pRange = RftGetRanges(pCtx);
+   i = 0;
    while (pRange)
    {
-      printf("0x%04X - 0x%04X: %u bytes.\n",
-         pRange->addr, pRange->addr + pRange->len - 1, pRange->len);
+      printf("0x%04X - 0x%04X: %u bytes, output at offset %u.\n",
+         pRange->addr, pRange->addr + pRange->len - 1, pRange->len, plan.pRangeOfs[i++]);
       pRange = pRange->pNext;
    }
 
-   printf("\nWriting \"%s\"...\n", pOutFile->pName);
-
-   FILE* outFile = fopen(pOutFile->pName, "w+b");
-   if (!outFile)
+   if (plan.elidedRuns)
    {
-      printf("Unable to open the output file \"%s\".\n", pOutFile->pName);
-      return CANNOT_OPEN_FILE;
+      printf("\nElided %u fill bytes in %u runs, saving %u output bytes.\n",
+         plan.elidedBytes, plan.elidedRuns, plan.savedLen);
    }
 
-   /* Write the output file. */
-   switch (pOutFile->type)
+   printf("\nWriting \"%s\" (%u bytes", pOutFile->pName, plan.outLen);
+   if (plan.numRecords)
    {
-      case FILE_TYPE_PAP:
-         r = WritePapFile(outFile);
-         if (r != OK)
-         {
-            return r;
-         }
-
-         break;
-
-      case FILE_TYPE_WDC:
-         r = WriteWdcFile(outFile);
-         if (r != OK)
-         {
-            return r;
-         }
-
-         break;
+      printf(", %u data records", plan.numRecords);
    }
+   printf(")...\n");
 
-   fclose(outFile);
+   r = RftWriteFile(pCtx, pOutFile->type, pOutFile->pOpts, &plan, pOutFile->pName);
+   if (r == OK && pOutFile->type != FILE_TYPE_SHM)
+   {
+      printf("File written as %s file.\n", RftGetFormatDesc(pOutFile->type));
+   }
 
-   return OK;
+   RftFreePlan(&plan);
+   RftClose(pCtx);
+   return r;
 }
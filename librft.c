@@ -0,0 +1,11057 @@
+/*********************************************************************//** @file
+The RetroFileTool library (librft): loaders and writers for retro file formats.
+******************************************************************************/
+
+/******************************************************************************
+ Include Files
+******************************************************************************/
+
+/* Declare the POSIX functions used here, such as fileno(), ftruncate() and
+posix_fallocate(), even when building with a strict -std=c99 or -std=c11. Large
+files are used on 32-bit systems, so file sizes and offsets are 64-bit. */
+#ifndef _WIN32
+#define _POSIX_C_SOURCE                                           200809L
+#define _FILE_OFFSET_BITS                                         64
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <stdarg.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <fcntl.h>
+#include <io.h>
+#include <process.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+/* SSE2 is always available on x64, so the transforms use it wherever the compiler does. */
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define USE_SSE2
+#include <emmintrin.h>
+#endif
+
+#include "librft.h"
+
+/******************************************************************************
+ Defines
+******************************************************************************/
+
+/** The longest error message kept by a context, including its terminator. */
+#define ERROR_MSG_LEN                                             256
+
+/** The number of data bytes in each independently written chunk of an output file.
+Must be a multiple of PAP_REC_LEN, TI_LINE_LEN and TEK_REC_LEN, so that chunks
+hold whole records. Intel HEX chunks are cut down to a whole number of records. */
+#define OUT_CHUNK_LEN                                             (PAP_REC_LEN * 2048)
+
+/** The number of words in each independently written chunk of a memory
+initialization output. */
+#define MEM_CHUNK_WORDS                                           4096
+
+/** The number of lines in each chunk of a hexdump output. */
+#define DUMP_CHUNK_LINES                                          4096
+
+/** The number of bytes on each line of a hexdump output. */
+#define DUMP_LINE_BYTES                                           16
+
+/** The length of each line of a hexdump output: an address, the bytes in hex, and the
+bytes as ASCII. */
+#define DUMP_LINE_LEN                                             79
+
+/** The length of the line which marks a gap between ranges in a hexdump output. */
+#define DUMP_GAP_LEN                                              28
+
+/** Marks a hexdump chunk whose first line repeats the line before it. */
+#define DUMP_REPEAT                                               0x01
+
+/** Marks a hexdump chunk which follows a repeated line, so a "*" has already been written. */
+#define DUMP_SQUEEZED                                             0x02
+
+/** Marks a hexdump chunk whose repeated lines are squeezed. */
+#define DUMP_SQUEEZE                                              0x04
+
+/** The maximum number of bytes in each line of a TI-TXT file. */
+#define TI_LINE_LEN                                               16
+
+/** The maximum number of bytes in each Tektronix extended hex record. */
+#define TEK_REC_LEN                                               32
+
+/** The number of data bytes in each record of an Intel HEX output, by default. */
+#define HEX_REC_LEN                                               16
+
+/** The most data bytes an Intel HEX record can hold. */
+#define HEX_MAX_REC_LEN                                           255
+
+/** The length of an Intel HEX record and its CR LF, given the number of data bytes it holds. */
+#define HEX_RECORD_LEN(numBytes)                                  (13 + (numBytes) * 2)
+
+/** The maximum number of threads used for parallel work. */
+#define MAX_THREADS                                               64
+
+/** The initial number of tasks each worker's deques can hold. Must be a power of two. */
+#define TASK_DEQUE_LEN                                            64
+
+/** The most tasks taken from another worker at once. */
+#define MAX_STEAL                                                 32
+
+/** The number of bytes read at a time from a file descriptor. */
+#define FD_READ_LEN                                               0x10000
+
+/** The number of records queued between the parser and the merger of a pipelined load. */
+#define PIPE_QUEUE_LEN                                            1024
+
+/** The maximum number of data bytes in each record queued by a pipelined load. */
+#define PIPE_REC_LEN                                              256
+
+/** The most sorted runs an external sort keeps on disk, and merges at once. */
+#define MAX_SORT_RUNS                                             64
+
+/** The maximum number of data bytes in each record of a sorted run. */
+#define SORT_REC_LEN                                              256
+
+/** The most data bytes an external sort puts in each segment it builds. */
+#define SORT_SEG_LEN                                              0x10000
+
+/** The number of segments a run of an input's segments first has room for. */
+#define RUN_LEN                                                   256
+
+/** The most data bytes a loader joins into each segment. */
+#define RUN_SEG_LEN                                               0x10000
+
+/** The most bytes one poke of a script can write. */
+#define SCRIPT_POKE_LEN                                           64
+
+/** The block of data a script's pass copies and checks at a time, while it is in the cache. */
+#define SCRIPT_BLOCK_LEN                                          0x10000
+
+/** The length of the header of an NES file. */
+#define NES_HEADER_LEN                                            16
+
+/** The size of each PRG ROM bank of an NES file. */
+#define NES_PRG_BANK_LEN                                          0x4000
+
+/** The size of each CHR ROM bank of an NES file. */
+#define NES_CHR_BANK_LEN                                          0x2000
+
+/** The length of the header of a C64 cartridge file. */
+#define CRT_HEADER_LEN                                            0x40
+
+/** The length of the header of each CHIP packet of a C64 cartridge file. */
+#define CRT_CHIP_HEADER_LEN                                       0x10
+
+/** The length of the fixed part of an Apple IIgs OMF segment header, up to DISPDATA. */
+#define OMF_HEADER_LEN                                            0x2C
+
+/** Where the relocatable segments of an Apple IIgs OMF load file are loaded by default (bank 2). */
+#define OMF_LOAD_ADDR                                             0x020000
+
+/** The size of the 65816's address space, which OMF segments are loaded into. */
+#define OMF_ADDR_SPACE                                            0x1000000
+
+/** The number of relocation patches an OMF loader first makes room for. */
+#define OMF_PATCHES_LEN                                           1024
+
+/** The most bytes one OMF relocation patches. */
+#define OMF_MAX_PATCH_LEN                                         4
+
+/** The most pieces a gathered write collects before writing them. */
+#define GATHER_MAX_PIECES                                         256
+
+/** The length of the block of padding every padding piece of a gathered write points into. */
+#define GATHER_PAD_LEN                                            0x10000
+
+/** Identifies a shared memory image ("RFTS"). */
+#define SHM_MAGIC                                                 0x53544652
+
+/** The version of the shared memory image layout. */
+#define SHM_VERSION                                               1
+
+/** Tells whether a file mode is that of a regular file, where the C library does not. */
+#ifndef S_ISREG
+#define S_ISREG(mode)                                             (((mode) & S_IFMT) == S_IFREG)
+#endif
+
+/** Orders memory accesses, so readers of shared memory see consistent data. */
+#ifdef _MSC_VER
+#define MEMORY_BARRIER()                                          MemoryBarrier()
+#else
+#define MEMORY_BARRIER()                                          __sync_synchronize()
+#endif
+
+/**
+* Atomically adds to a counter, giving the new value, atomically reads a
+* counter, atomically swaps a value in, and atomically clears a value once all
+* the writes before it are done.
+*/
+#ifdef _MSC_VER
+#define ATOMIC_ADD(p, val)                                        (InterlockedExchangeAdd((p), (val)) + (val))
+#define ATOMIC_LOAD(p)                                            InterlockedExchangeAdd((p), 0)
+#define ATOMIC_SWAP(p, val)                                       InterlockedExchange((p), (val))
+#define ATOMIC_CLEAR(p)                                           InterlockedExchange((p), 0)
+#else
+#define ATOMIC_ADD(p, val)                                        __sync_add_and_fetch((p), (val))
+#define ATOMIC_LOAD(p)                                            __sync_add_and_fetch((p), 0)
+#define ATOMIC_SWAP(p, val)                                       __sync_lock_test_and_set((p), (val))
+#define ATOMIC_CLEAR(p)                                           __sync_lock_release(p)
+#endif
+
+/**
+* Atomically reads a value, seeing every write made before it was published,
+* and atomically publishes a value once all the writes before it are done. The
+* values must be 32-bit on Windows.
+*/
+#ifdef _MSC_VER
+#define ATOMIC_LOAD_ACQUIRE(p)                                    InterlockedCompareExchange((volatile LONG *) (p), 0, 0)
+#define ATOMIC_STORE_RELEASE(p, val)                              InterlockedExchange((volatile LONG *) (p), (LONG) (val))
+#else
+#define ATOMIC_LOAD_ACQUIRE(p)                                    __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define ATOMIC_STORE_RELEASE(p, val)                              __atomic_store_n((p), (val), __ATOMIC_RELEASE)
+#endif
+
+/** Declares the entry point of a thread. */
+#ifdef _WIN32
+#define THREAD_FUNC(name)                                         DWORD WINAPI name(LPVOID pArg)
+#else
+#define THREAD_FUNC(name)                                         void *name(void *pArg)
+#endif
+
+/** Declares a variable which each thread has its own copy of. */
+#ifdef _MSC_VER
+#define THREAD_LOCAL                                              __declspec(thread)
+#else
+#define THREAD_LOCAL                                              __thread
+#endif
+
+/** Gives up the rest of a thread's time slice, while it waits on another thread. */
+#ifdef _WIN32
+#define THREAD_YIELD()                                            SwitchToThread()
+#else
+#define THREAD_YIELD()                                            sched_yield()
+#endif
+
+/** Takes and releases a mutex, and waits on and wakes a condition variable guarded by one. */
+#ifdef _WIN32
+#define MUTEX_INIT(p)                                             InitializeCriticalSection(p)
+#define MUTEX_FREE(p)                                             DeleteCriticalSection(p)
+#define MUTEX_LOCK(p)                                             EnterCriticalSection(p)
+#define MUTEX_UNLOCK(p)                                           LeaveCriticalSection(p)
+#define COND_INIT(p)                                              InitializeConditionVariable(p)
+#define COND_FREE(p)
+#define COND_WAIT(p, pMutex)                                      SleepConditionVariableCS(p, pMutex, INFINITE)
+#define COND_SIGNAL(p)                                            WakeConditionVariable(p)
+#define COND_BROADCAST(p)                                         WakeAllConditionVariable(p)
+#else
+#define MUTEX_INIT(p)                                             pthread_mutex_init(p, NULL)
+#define MUTEX_FREE(p)                                             pthread_mutex_destroy(p)
+#define MUTEX_LOCK(p)                                             pthread_mutex_lock(p)
+#define MUTEX_UNLOCK(p)                                           pthread_mutex_unlock(p)
+#define COND_INIT(p)                                              pthread_cond_init(p, NULL)
+#define COND_FREE(p)                                              pthread_cond_destroy(p)
+#define COND_WAIT(p, pMutex)                                      pthread_cond_wait(p, pMutex)
+#define COND_SIGNAL(p)                                            pthread_cond_signal(p)
+#define COND_BROADCAST(p)                                         pthread_cond_broadcast(p)
+#endif
+
+/** Reads from and writes to file descriptors. */
+#ifdef _WIN32
+#define FD_READ(fd, pBuf, len)                                    _read(fd, pBuf, len)
+#define FD_WRITE(fd, pBuf, len)                                   _write(fd, pBuf, len)
+#else
+#define FD_READ(fd, pBuf, len)                                    read(fd, pBuf, len)
+#define FD_WRITE(fd, pBuf, len)                                   write(fd, pBuf, len)
+#endif
+
+/******************************************************************************
+ Module Typedefs and Enums
+******************************************************************************/
+
+/** An unsigned 64-bit integer. Change this to match your platform. */
+typedef unsigned long long U64;
+
+/** The different types of Intex HEX records. */
+typedef enum
+{
+   REC_DATA                = 0,
+   REC_EOF                 = 1,
+   REC_EXT_SEG_ADDR        = 2,
+   REC_START_SEG_ADDR      = 3,
+   REC_EXT_LIN_ADDR        = 4,
+   REC_START_LIN_ADDR      = 5,
+
+} HEX_RECORD_TYPE;
+
+/** The types of Apple IIgs OMF records found in load files. */
+typedef enum
+{
+   OMF_END                 = 0x00,
+   OMF_CONST_LAST          = 0xDF,
+   OMF_RELOC               = 0xE2,
+   OMF_INTERSEG            = 0xE3,
+   OMF_DS                  = 0xF1,
+   OMF_LCONST              = 0xF2,
+   OMF_CRELOC              = 0xF5,
+   OMF_CINTERSEG           = 0xF6,
+   OMF_SUPER               = 0xF7,
+
+} OMF_RECORD_TYPE;
+
+/** The kinds of Apple IIgs OMF segments which hold nothing to load into memory. */
+typedef enum
+{
+   OMF_KIND_CODE           = 0x00,
+   OMF_KIND_JUMP_TABLE     = 0x02,
+   OMF_KIND_PATHNAME       = 0x04,
+   OMF_KIND_LIB_DICT       = 0x08,
+
+} OMF_KIND;
+
+/** A thread, the entry point of a thread, a mutex and a condition variable. */
+#ifdef _WIN32
+typedef HANDLE             THREAD;
+typedef LPTHREAD_START_ROUTINE THREAD_ENTRY;
+typedef CRITICAL_SECTION   MUTEX;
+typedef CONDITION_VARIABLE COND;
+#else
+typedef pthread_t          THREAD;
+typedef void               *(*THREAD_ENTRY)(void *);
+typedef pthread_mutex_t    MUTEX;
+typedef pthread_cond_t     COND;
+#endif
+
+/** A segment payload which is shared by every segment holding the same bytes. */
+typedef struct _BLOB_ BLOB;
+struct _BLOB_
+{
+   /** The hash of the payload. */
+   U32                     hash;
+
+   /** The length of the payload, in bytes. */
+   U32                     len;
+
+   /** The next payload in the same hash bucket. */
+   BLOB                    *pNext;
+
+   /** The payload. */
+   U8                      data[];
+};
+
+/** A segment loaded from an input, or once its run is sorted, a chain of adjacent segments. */
+typedef struct _RUN_ENTRY_ RUN_ENTRY;
+struct _RUN_ENTRY_
+{
+   /** The starting address, kept here so sorting need not follow pSegStart. */
+   U32                     addr;
+
+   /** The length of the chain, in bytes. */
+   U32                     len;
+
+   /** The order the segment was loaded in, within its input. */
+   U32                     seq;
+
+   /** The first segment of the chain. */
+   SEGMENT                 *pSegStart;
+
+   /** The last segment of the chain. */
+   SEGMENT                 *pSegEnd;
+};
+
+/**
+* The segments loaded from one input.
+*
+* Segments are only appended while the input loads, so a run needs no lock.
+* Once the input is loaded, the run is sorted by address and its adjacent
+* segments are chained together, and then it is merged into the image with
+* the runs of any inputs loaded alongside it: see MergeSegRuns().
+*/
+typedef struct _SEG_RUN_ SEG_RUN;
+struct _SEG_RUN_
+{
+   /** The segments, in the order they were loaded until the run is sorted. */
+   RUN_ENTRY               *pEntries;
+
+   /** The number of entries. */
+   U32                     numEntries;
+
+   /** The number of entries there is room for. */
+   U32                     maxEntries;
+
+   /** The next entry to merge, once the run is sorted. */
+   U32                     next;
+
+   /** The index of the input, which orders runs holding segments at the same address. */
+   U32                     input;
+
+   /** The segment being built from adjacent records, with room for RUN_SEG_LEN bytes, or NULL. */
+   SEGMENT                 *pPending;
+
+   /** The context whose shared payloads the run's segments use, or NULL to give each
+   segment its own data. */
+   RFT_CONTEXT             *pInternCtx;
+
+   /** Guards pInternCtx's shared payloads, when other runs use them at the same time, or NULL. */
+   volatile long           *pInternLock;
+};
+
+/** The state of a conversion. */
+struct _RFT_CONTEXT_
+{
+   /** All the ranges contained within the input files. */
+   RANGE                   *pAllRanges;
+
+   /** The number of contiguous ranges allocated so far. */
+   U32                     numRanges;
+
+   /** The number of data bytes in the image. */
+   U32                     dataBytes;
+
+   /** The program's execution starting address. */
+   U32                     startAddr;
+
+   /** The number of threads to use, or 0 to use one per CPU. */
+   U32                     numThreads;
+
+   /** Whether output files are written through a memory mapping. */
+   int                     useMapping;
+
+   /** The shortest run of the fill value which is left out of outputs, or 0 to write everything. */
+   U32                     elideMinRun;
+
+   /** The fill value whose long runs are left out of outputs. */
+   U8                      elideFill;
+
+   /** Whether identical segment payloads share memory. */
+   int                     useDedup;
+
+   /** The hash table of shared payloads, when useDedup is set. */
+   BLOB                    **ppBlobs;
+
+   /** The number of buckets in ppBlobs, which is a power of two. */
+   U32                     numBuckets;
+
+   /** The statistics of the shared payloads. */
+   RFT_DEDUP_STATS         dedup;
+
+   /** The size of each sorted run of an external sort, or 0 to load records in place. */
+   U32                     sortRunLen;
+
+   /** The RFT_XFORM_ transforms applied to each input as it is loaded. */
+   U32                     xform;
+
+   /** The segments of the input being loaded, until they are merged into the ranges. */
+   SEG_RUN                 run;
+
+   /** The first error reported by the last operation on the context, without its
+   "ERROR: " prefix, or empty if there was none. */
+   char                    lastError[ERROR_MSG_LEN];
+
+   /** Set once an error of the current operation has claimed lastError. */
+   volatile long           hasError;
+};
+
+/** A cursor over an input file's contents in memory. */
+typedef struct _IN_BUF_ IN_BUF;
+struct _IN_BUF_
+{
+   /** The next byte to read. */
+   const U8                *pCur;
+
+   /** Just past the last byte. */
+   const U8                *pEnd;
+
+   /** The pipelined load which is still reading the input, or NULL if it is all in memory. */
+   struct _PIPE_           *pPipe;
+};
+
+/** A segment of an Apple IIgs OMF load file. */
+typedef struct _OMF_SEG_ OMF_SEG;
+struct _OMF_SEG_
+{
+   /** The segment's first record. */
+   const U8                *pBody;
+
+   /** Just past the segment's last byte. */
+   const U8                *pEnd;
+
+   /** The segment's number, which inter-segment relocations refer to it by. */
+   U32                     segNum;
+
+   /** The address the segment is loaded at. */
+   U32                     addr;
+
+   /** The length of the segment in memory, including its reserved space. */
+   U32                     len;
+
+   /** The offset of the segment's entry point. */
+   U32                     entry;
+
+   /** The type of the segment, from its KIND. */
+   U32                     kind;
+
+   /** Whether the segment is loaded into memory. */
+   int                     loaded;
+};
+
+/** A relocation patch of an Apple IIgs OMF segment. */
+typedef struct _OMF_PATCH_ OMF_PATCH;
+struct _OMF_PATCH_
+{
+   /** The offset of the patch in the segment. */
+   U32                     ofs;
+
+   /** The address the patch refers to, before it is shifted. */
+   U32                     val;
+
+   /** The position of the patch in the segment's relocation dictionary. */
+   U32                     seq;
+
+   /** The number of bytes patched. */
+   U8                      numBytes;
+
+   /** The number of bits the address is shifted left, or right when negative. */
+   signed char             shift;
+};
+
+/** An Apple IIgs OMF load file being loaded. */
+typedef struct _OMF_FILE_ OMF_FILE;
+struct _OMF_FILE_
+{
+   /** The file's segments. */
+   OMF_SEG                 *pSegs;
+
+   /** The number of segments in pSegs. */
+   U32                     numSegs;
+
+   /** The relocation patches of the segment being loaded. */
+   OMF_PATCH               *pPatches;
+
+   /** The number of patches in pPatches. */
+   U32                     numPatches;
+
+   /** The number of patches pPatches has room for. */
+   U32                     maxPatches;
+};
+
+/** A record passed from the parser to the merger of a pipelined load. */
+typedef struct _PIPE_REC_ PIPE_REC;
+struct _PIPE_REC_
+{
+   /** The address of the data, or the starting address. */
+   U32                     addr;
+
+   /** The length of the data, in bytes. */
+   U32                     len;
+
+   /** Whether this is the program's execution starting address, rather than data. */
+   int                     isStart;
+
+   /** The data. */
+   U8                      data[PIPE_REC_LEN];
+};
+
+/**
+* The state shared by the stages of a pipelined load.
+*
+* A reader thread fills the input buffer, a parser thread decodes it as it
+* arrives, and the caller merges the decoded records into the image. Each pair
+* of stages is joined by a single-producer, single-consumer queue: the input
+* buffer (numRead), and the ring of records (head and tail). Each index is only
+* written by one side, and is published with ATOMIC_STORE_RELEASE(), so no locks
+* are needed while data flows. A stage which has to wait for another sleeps on
+* wake, and is woken by WakePipe().
+*/
+typedef struct _PIPE_ PIPE;
+struct _PIPE_
+{
+   /** The input file, or NULL if the input is already in memory. */
+   FILE                    *pFile;
+
+   /** The input's contents, which are filled in by the reader. */
+   const U8                *pBuf;
+
+   /** The length of the input, in bytes. */
+   U32                     len;
+
+   /** The number of bytes read so far. Only written by the reader. */
+   U32                     numRead;
+
+   /** Set by the reader once it is done. */
+   U32                     readDone;
+
+   /** The result of the reader, once readDone is set. */
+   RESULT                  readResult;
+
+   /** The type of the input. */
+   FILE_TYPE               type;
+
+   /** The ring of decoded records. */
+   PIPE_REC                *pRecs;
+
+   /** The number of records taken by the merger. Only written by the merger. */
+   U32                     head;
+
+   /** The number of records added by the parser. Only written by the parser. */
+   U32                     tail;
+
+   /** Set by the parser once it is done. */
+   U32                     parseDone;
+
+   /** The result of the parser, once parseDone is set. */
+   RESULT                  parseResult;
+
+   /** Set with the result of the first stage which fails, to stop the other stages. */
+   U32                     stopResult;
+
+   /** Guards the sleeping of stages which wait for another. */
+   MUTEX                   waitLock;
+
+   /** Wakes the stages which wait for another. */
+   COND                    wake;
+
+   /** The number of stages sleeping, or about to sleep, on wake. */
+   volatile long           numWaiting;
+
+   /** The context which the stages report errors to, or NULL. */
+   RFT_CONTEXT             *pReportCtx;
+};
+
+/**
+* The header at the start of a shared memory image.
+*
+* It is followed by the range bitmap, which has one bit per address (LSB first)
+* that is set when the address holds loaded data, and then the flat image itself.
+* The generation is odd while an update is in progress, so a reader should
+* sample it before and after copying, and retry if it was odd or changed.
+*/
+typedef struct _SHM_HEADER_ SHM_HEADER;
+struct _SHM_HEADER_
+{
+   /** Always SHM_MAGIC. */
+   U32                     magic;
+
+   /** Always SHM_VERSION. */
+   U32                     version;
+
+   /** Incremented before and after every update of the image. */
+   volatile U32            generation;
+
+   /** The size of the flat address space, in bytes. */
+   U32                     addrSpace;
+
+   /** The offset of the range bitmap from the start of the header. */
+   U32                     bitmapOfs;
+
+   /** The offset of the flat image from the start of the header. */
+   U32                     imageOfs;
+
+   /** The program's execution starting address. */
+   U32                     startAddr;
+
+   /** The number of data bytes in the image. */
+   U32                     dataBytes;
+
+   /** The number of contiguous ranges in the image. */
+   U32                     numRanges;
+};
+
+/** The limits of what an output format can represent. */
+typedef struct _FORMAT_CAPS_ FORMAT_CAPS;
+struct _FORMAT_CAPS_
+{
+   /** The output file type. */
+   FILE_TYPE               type;
+
+   /** A description of the format. */
+   const char              *pDesc;
+
+   /** The number of address bits the format can represent. */
+   U32                     addrBits;
+
+   /** The maximum length of one block of data, or 0 for no limit. Longer ranges
+   are written as several blocks. */
+   U32                     maxBlockLen;
+};
+
+/** A part of a range, which is written to a known offset in the output file. */
+typedef struct _OUT_CHUNK_ OUT_CHUNK;
+struct _OUT_CHUNK_
+{
+   /** The address of the chunk's first byte. */
+   U32                     addr;
+
+   /** The length of the chunk, in bytes. */
+   U32                     len;
+
+   /** The segment which holds the chunk's first byte. */
+   SEGMENT                 *pSeg;
+
+   /** The offset of the chunk's first byte within pSeg. */
+   U32                     segOfs;
+
+   /** The offset in the output file where this chunk's output starts. */
+   U32                     outOfs;
+
+   /** The length of the block which starts with this chunk, or 0 if the chunk
+   continues a block. */
+   U32                     blockLen;
+
+   /** For hexdump outputs, the number of bytes between the previous range and this
+   one, when the chunk starts a range which has a gap line before it. */
+   U32                     gapLen;
+
+   /** For hexdump outputs, the DUMP_ flags of the chunk. */
+   U32                     dumpFlags;
+
+   /** For Intel HEX outputs, whether the chunk starts with an extended linear address
+   record, as it is the first in a new 64 KB page. */
+   int                     extAddr;
+};
+
+/** The layout of a memory initialization format, which has one word per line. */
+typedef struct _MEM_FORMAT_ MEM_FORMAT;
+struct _MEM_FORMAT_
+{
+   /** The output file type. */
+   FILE_TYPE               type;
+
+   /** The file header, given the word width and the depth. */
+   const char              *pHeader;
+
+   /** Written at the start of each line before its address, or NULL for no address. */
+   const char              *pAddrPrefix;
+
+   /** Written between each line's address and its word. */
+   const char              *pAddrSuffix;
+
+   /** Ends each line but the last. */
+   const char              *pLineEnd;
+
+   /** Ends the last line. Must be the same length as pLineEnd. */
+   const char              *pLastLineEnd;
+
+   /** The file trailer. */
+   const char              *pTrailer;
+};
+
+/** A part of a range which is written to an output, between runs of the fill value. */
+typedef struct _OUT_SPAN_ OUT_SPAN;
+struct _OUT_SPAN_
+{
+   /** The address of the span's first byte. */
+   U32                     addr;
+
+   /** The length of the span, in bytes. */
+   U32                     len;
+
+   /** The segment which holds the span's first byte. */
+   SEGMENT                 *pSeg;
+
+   /** The offset of the span's first byte within pSeg. */
+   U32                     segOfs;
+
+   /** The index of the range which holds the span. */
+   U32                     range;
+};
+
+/** The work given to one thread writing an output file. */
+typedef struct _RENDER_JOB_ RENDER_JOB;
+struct _RENDER_JOB_
+{
+   /** The type of the output file. */
+   FILE_TYPE               type;
+
+   /** The start of the output file's contents. */
+   U8                      *pOut;
+
+   /** The plan of the output file. */
+   const OUTPUT_PLAN       *pPlan;
+};
+
+/** A piece of an output written by a gathered write, laid out like a struct iovec. */
+#ifdef _WIN32
+typedef struct _GATHER_PIECE_ GATHER_PIECE;
+struct _GATHER_PIECE_
+{
+   /** The piece's data. */
+   void                    *iov_base;
+
+   /** The length of the piece, in bytes. */
+   size_t                  iov_len;
+};
+#else
+typedef struct iovec       GATHER_PIECE;
+#endif
+
+/** Collects the pieces of an output straight from the segments, and writes them a batch
+at a time, so the output is never copied into one buffer. */
+typedef struct _GATHER_ GATHER;
+struct _GATHER_
+{
+   /** The file descriptor written to. */
+   int                     fd;
+
+   /** The number of bytes gathered so far. */
+   U32                     ofs;
+
+   /** The number of pieces waiting to be written. */
+   U32                     numPieces;
+
+   /** The pieces waiting to be written. */
+   GATHER_PIECE            pieces[GATHER_MAX_PIECES];
+
+   /** A block of the pad value. */
+   U8                      pad[GATHER_PAD_LEN];
+};
+
+/** The work given to the threads analyzing the ranges. */
+typedef struct _ANALYZE_JOB_ ANALYZE_JOB;
+struct _ANALYZE_JOB_
+{
+   /** The ranges, in order. */
+   const RANGE             **ppRanges;
+
+   /** Receives the statistics of each range. */
+   RFT_RANGE_STATS         *pStats;
+};
+
+/** A record held in the buffer of an external sort. */
+typedef struct _SORT_REC_ SORT_REC;
+struct _SORT_REC_
+{
+   /** The address of the data. */
+   U32                     addr;
+
+   /** The length of the data, in bytes. */
+   U32                     len;
+
+   /** The offset of the data in the buffer, which also keeps the sort stable. */
+   U32                     ofs;
+};
+
+/** The state of an external sort, which loads records in address order. */
+typedef struct _SORTER_ SORTER;
+struct _SORTER_
+{
+   /** The conversion context. */
+   RFT_CONTEXT             *pCtx;
+
+   /** The data of the records of the current run. */
+   U8                      *pBuf;
+
+   /** The number of bytes used in pBuf. */
+   U32                     used;
+
+   /** The records of the current run. */
+   SORT_REC                *pRecs;
+
+   /** The number of records in the current run. */
+   U32                     numRecs;
+
+   /** The most records each run can hold. */
+   U32                     maxRecs;
+
+   /** The sorted runs written so far. */
+   FILE                    *pRuns[MAX_SORT_RUNS];
+
+   /** The number of runs written. */
+   U32                     numRuns;
+};
+
+/** The next record of each sorted run, while the runs are merged. */
+typedef struct _SORT_CURSOR_ SORT_CURSOR;
+struct _SORT_CURSOR_
+{
+   /** The run being read. */
+   FILE                    *pFile;
+
+   /** The address of the record. */
+   U32                     addr;
+
+   /** The length of the record, in bytes. */
+   U32                     len;
+
+   /** The record's data. */
+   U8                      data[SORT_REC_LEN];
+};
+
+/** Joins the records coming out of an external sort into large segments. */
+typedef struct _SORT_SINK_ SORT_SINK;
+struct _SORT_SINK_
+{
+   /** The conversion context. */
+   RFT_CONTEXT             *pCtx;
+
+   /** The address of the segment being built. */
+   U32                     addr;
+
+   /** The length of the segment being built, in bytes. */
+   U32                     len;
+
+   /** The data of the segment being built. */
+   U8                      data[SORT_SEG_LEN];
+};
+
+/** The loading of one input of a LOAD_JOB. */
+typedef struct _INPUT_LOADER_ INPUT_LOADER;
+struct _INPUT_LOADER_
+{
+   /** The job which the input is part of. */
+   struct _LOAD_JOB_       *pJob;
+
+   /** The segments of the input. */
+   SEG_RUN                 run;
+
+   /** The program's execution starting address, if the input has one. */
+   U32                     startAddr;
+
+   /** Whether the input has a starting address. */
+   int                     hasStart;
+
+   /** The result of loading the input. */
+   RESULT                  r;
+};
+
+/** The work given to the threads loading several inputs at once. */
+typedef struct _LOAD_JOB_ LOAD_JOB;
+struct _LOAD_JOB_
+{
+   /** The conversion context. */
+   RFT_CONTEXT             *pCtx;
+
+   /** The inputs. */
+   const RFT_INPUT         *pInputs;
+
+   /** The loading of each input. */
+   INPUT_LOADER            *pLoaders;
+
+   /** Guards the context's shared payloads, when deduplicating. */
+   volatile long           internLock;
+};
+
+/** The kinds of stage of a script. */
+typedef enum
+{
+   STAGE_CROP,
+   STAGE_FILL,
+   STAGE_POKE,
+   STAGE_CRC32
+
+} STAGE_TYPE;
+
+/** What the addresses of a span hold, at some point of a script. */
+typedef enum
+{
+   SPAN_ABSENT,
+   SPAN_SOURCE,
+   SPAN_FILL,
+   SPAN_LITERAL
+
+} SPAN_KIND;
+
+/** The contents of a span of addresses, at some point of a script. */
+typedef struct _SPAN_STATE_ SPAN_STATE;
+struct _SPAN_STATE_
+{
+   /** What the span holds. */
+   SPAN_KIND               kind;
+
+   /** The value of every byte, for SPAN_FILL. */
+   U8                      fill;
+
+   /** The bytes, for SPAN_LITERAL. */
+   const U8                *pLiteral;
+};
+
+/** One stage of a script. */
+typedef struct _STAGE_ STAGE;
+struct _STAGE_
+{
+   /** The kind of stage. */
+   STAGE_TYPE              type;
+
+   /** The line of the script the stage is on. */
+   U32                     line;
+
+   /** The first address the stage keeps, fills, writes or checks. */
+   U32                     start;
+
+   /** One past the last address the stage keeps, fills, writes or checks. */
+   U64                     end;
+
+   /** The address a crc32 is stored at. */
+   U32                     target;
+
+   /** The fill value. */
+   U8                      fill;
+
+   /** The bytes poked, or the crc32 stored. */
+   U8                      data[SCRIPT_POKE_LEN];
+
+   /** The running crc32. */
+   U32                     crc;
+
+   /** Whether a crc32 reads the span being walked, and what it holds when it does. */
+   int                     reading;
+   SPAN_STATE              seen;
+
+   /** Where the crc32 is stored in the new image, once it is placed. */
+   U8                      *pOut;
+};
+
+/** A position in the data of an image, which only moves forward. */
+typedef struct _SRC_CURSOR_ SRC_CURSOR;
+struct _SRC_CURSOR_
+{
+   /** The range at or after the position. */
+   const RANGE             *pRange;
+
+   /** The segment of pRange which holds the position. */
+   const SEGMENT           *pSeg;
+
+   /** The address of pSeg. */
+   U32                     segAddr;
+};
+
+/** A run of addresses which hold data after a pass of a script. */
+typedef struct _SCRIPT_RUN_ SCRIPT_RUN;
+struct _SCRIPT_RUN_
+{
+   /** The first address. */
+   U32                     addr;
+
+   /** The number of addresses. */
+   U64                     len;
+};
+
+/** An input file mapped into memory. */
+typedef struct _IN_MAP_ IN_MAP;
+struct _IN_MAP_
+{
+   /** The contents of the file. */
+   const U8                *pData;
+
+   /** The length of the file, in bytes, which may be 4 GB or more on 64-bit systems. */
+   size_t                  len;
+
+#ifdef _WIN32
+   /** The open file. */
+   HANDLE                  hFile;
+
+   /** The mapping of the file. */
+   HANDLE                  hMap;
+#endif
+};
+
+/**
+* The priorities of scheduled tasks, lowest first.
+*
+* Workers run the highest priority task queued anywhere in the pool before any
+* lower priority task, so when several conversions share the pool, work which
+* finishes a conversion and releases its memory (writing) is preferred over
+* work which starts one (loading).
+*/
+typedef enum
+{
+   TASK_PRIO_LOAD,
+   TASK_PRIO_ANALYZE,
+   TASK_PRIO_WRITE,
+   NUM_TASK_PRIOS
+
+} TASK_PRIO;
+
+/** The tasks queued by one caller of the scheduler, which it waits for together. */
+typedef struct _TASK_GROUP_ TASK_GROUP;
+struct _TASK_GROUP_
+{
+   /** The priority of the tasks. */
+   TASK_PRIO               prio;
+
+   /** The number of workers the tasks are dealt out to, besides the caller. If 0,
+   the caller runs each task as it is queued. */
+   U32                     numWorkers;
+
+   /** The number of tasks queued or running. */
+   volatile long           numPending;
+
+   /** Chooses the first worker the caller steals from, while it waits. */
+   U32                     seed;
+
+   /** The context which the tasks report errors to, or NULL. */
+   RFT_CONTEXT             *pReportCtx;
+};
+
+/** A unit of work run by the scheduler. */
+typedef struct _TASK_ TASK;
+struct _TASK_
+{
+   /** Does the work. */
+   void                    (*pfnRun)(void *pArg, U32 index);
+
+   /** Passed to pfnRun. */
+   void                    *pArg;
+
+   /** Passed to pfnRun, to tell apart the tasks which share pArg. */
+   U32                     index;
+
+   /** The group which queued the task. */
+   TASK_GROUP              *pGroup;
+};
+
+/**
+* A worker's queue of tasks of one priority.
+*
+* The worker adds and takes tasks at the bottom, and other workers steal from
+* the top, so thieves take the oldest tasks, which tend to be the largest
+* blocks of work left.
+*/
+typedef struct _TASK_DEQUE_ TASK_DEQUE;
+struct _TASK_DEQUE_
+{
+   /** The ring of tasks. */
+   TASK                    *pTasks;
+
+   /** The size of the ring, which is a power of two. */
+   U32                     size;
+
+   /** The count of tasks ever taken from the top. */
+   U32                     top;
+
+   /** The count of tasks ever added at the bottom. */
+   U32                     bottom;
+};
+
+/** A worker thread of the scheduler, with its own deques. */
+typedef struct _WORKER_ WORKER;
+struct _WORKER_
+{
+   /** Guards the deques, which are only held for a few instructions at a time. */
+   volatile long           lock;
+
+   /** The tasks queued on this worker, by priority. */
+   TASK_DEQUE              deques[NUM_TASK_PRIOS];
+
+   /** Chooses the first worker to steal from. */
+   U32                     seed;
+};
+
+/**
+* The work-stealing task scheduler, which is the one thread pool that runs the
+* parallel parts of loading, analysis and writing, for every context.
+*
+* Its workers are started as they are first needed, and then sleep whenever
+* there is nothing to run. Each caller queues a group of tasks on the workers,
+* and runs tasks itself until its group is done. Each worker runs its own
+* highest priority task, and when it runs out, steals half of another worker's
+* oldest tasks of the highest priority queued.
+*
+* Pipelined loads run their stages on threads of their own instead, as the
+* stages wait on one another, and so could hold every worker of the pool while
+* the stage they wait for is still queued.
+*/
+typedef struct _SCHED_ SCHED;
+struct _SCHED_
+{
+   /** The workers. */
+   WORKER                  workers[MAX_THREADS];
+
+   /** The number of workers started. */
+   volatile long           numWorkers;
+
+   /** The number of tasks queued of each priority, which are not yet taken to run. */
+   volatile long           numQueued[NUM_TASK_PRIOS];
+
+   /** Guards starting the workers. */
+   volatile long           startLock;
+
+   /** Whether idleLock and idleCond have been set up. */
+   int                     started;
+
+   /** Guards the sleeping of idle workers, and of callers waiting for their tasks. */
+   MUTEX                   idleLock;
+
+   /** Wakes the idle workers and waiting callers, when a task is queued or a group
+   is done. */
+   COND                    idleCond;
+};
+
+/** A signature which identifies a file format by its leading bytes. */
+typedef struct _MAGIC_SIG_ MAGIC_SIG;
+struct _MAGIC_SIG_
+{
+   /** The signature bytes, which must appear at the start of the file. */
+   const char              *pSig;
+
+   /** The length of the signature, in bytes. */
+   U32                     len;
+
+   /** A description of the file format. */
+   const char              *pDesc;
+};
+
+/******************************************************************************
+ Module Variables.
+******************************************************************************/
+
+/** The ASCII hex digits. */
+static const char          hexDigits[] = "0123456789ABCDEF";
+
+/** The ASCII hex digits of hexdump outputs, which are lower case, like hexdump -C. */
+static const char          dumpDigits[] = "0123456789abcdef";
+
+/** An empty line of a hexdump output, which each line is written over. */
+static const char          dumpLine[DUMP_LINE_LEN + 1] =
+   "          " "                        " " " "                        " " |                |\n";
+
+/** The limits of each output format. */
+static const FORMAT_CAPS   formatCaps[] =
+{
+   { FILE_TYPE_HEX,  "Intel HEX",      32,   0           },
+   { FILE_TYPE_PAP,  "PAP",            16,   0           },
+   { FILE_TYPE_WDC,  "WDC binary",     24,   0xFFFFFF    },
+   { FILE_TYPE_SHM,  "shared memory",  24,   0           },
+   { FILE_TYPE_MEMH, "$readmemh",      32,   0           },
+   { FILE_TYPE_MIF,  "MIF",            32,   0           },
+   { FILE_TYPE_COE,  "COE",            32,   0           },
+   { FILE_TYPE_TITXT,"TI-TXT",         32,   0           },
+   { FILE_TYPE_TEK,  "Tektronix extended hex", 32, 0     },
+   { FILE_TYPE_DUMP, "hexdump",        32,   0           },
+   { FILE_TYPE_NES,  "iNES",           32,   0           },
+   { FILE_TYPE_CRT,  "C64 cartridge",  32,   0           },
+};
+
+/** The layouts of the memory initialization formats. */
+static const MEM_FORMAT    memFormats[] =
+{
+   {
+      FILE_TYPE_MEMH,
+      "// WIDTH=%u, DEPTH=%u\n",
+      NULL, NULL, "\n", "\n",
+      "",
+   },
+   {
+      FILE_TYPE_MIF,
+      "WIDTH=%u;\nDEPTH=%u;\n\nADDRESS_RADIX=HEX;\nDATA_RADIX=HEX;\n\nCONTENT BEGIN\n",
+      "\t", " : ", ";\n", ";\n",
+      "END;\n",
+   },
+   {
+      FILE_TYPE_COE,
+      "; WIDTH=%u, DEPTH=%u\nmemory_initialization_radix=16;\nmemory_initialization_vector=\n",
+      NULL, NULL, ",\n", ";\n",
+      "",
+   },
+};
+
+/** Signatures of binary formats which are recognized, but cannot be loaded. */
+static const MAGIC_SIG     magicSigs[] =
+{
+   { "\x7F" "ELF",             4, "ELF object"         },
+   { "\x1F\x8B",               2, "gzip compressed"    },
+   { "BZh",                    3, "bzip2 compressed"   },
+   { "\xFD" "7zXZ\x00",        6, "xz compressed"      },
+   { "7z\xBC\xAF\x27\x1C",     6, "7-Zip archive"      },
+   { "PK\x03\x04",             4, "ZIP archive"        },
+   { "!<arch>\n",              8, "ar archive"         },
+};
+
+/**
+* The CRC-32 tables for eight bytes at a time. The first is the usual table of
+* the reflected polynomial 0xEDB88320, and each of the others advances the one
+* before it by another zero byte.
+*/
+static const U32           crcTables[8][256] =
+{
+   {
+      0x00000000, 0x77073096, 0xEE0E612C, 0x990951BA, 0x076DC419, 0x706AF48F, 0xE963A535, 0x9E6495A3,
+      0x0EDB8832, 0x79DCB8A4, 0xE0D5E91E, 0x97D2D988, 0x09B64C2B, 0x7EB17CBD, 0xE7B82D07, 0x90BF1D91,
+      0x1DB71064, 0x6AB020F2, 0xF3B97148, 0x84BE41DE, 0x1ADAD47D, 0x6DDDE4EB, 0xF4D4B551, 0x83D385C7,
+      0x136C9856, 0x646BA8C0, 0xFD62F97A, 0x8A65C9EC, 0x14015C4F, 0x63066CD9, 0xFA0F3D63, 0x8D080DF5,
+      0x3B6E20C8, 0x4C69105E, 0xD56041E4, 0xA2677172, 0x3C03E4D1, 0x4B04D447, 0xD20D85FD, 0xA50AB56B,
+      0x35B5A8FA, 0x42B2986C, 0xDBBBC9D6, 0xACBCF940, 0x32D86CE3, 0x45DF5C75, 0xDCD60DCF, 0xABD13D59,
+      0x26D930AC, 0x51DE003A, 0xC8D75180, 0xBFD06116, 0x21B4F4B5, 0x56B3C423, 0xCFBA9599, 0xB8BDA50F,
+      0x2802B89E, 0x5F058808, 0xC60CD9B2, 0xB10BE924, 0x2F6F7C87, 0x58684C11, 0xC1611DAB, 0xB6662D3D,
+      0x76DC4190, 0x01DB7106, 0x98D220BC, 0xEFD5102A, 0x71B18589, 0x06B6B51F, 0x9FBFE4A5, 0xE8B8D433,
+      0x7807C9A2, 0x0F00F934, 0x9609A88E, 0xE10E9818, 0x7F6A0DBB, 0x086D3D2D, 0x91646C97, 0xE6635C01,
+      0x6B6B51F4, 0x1C6C6162, 0x856530D8, 0xF262004E, 0x6C0695ED, 0x1B01A57B, 0x8208F4C1, 0xF50FC457,
+      0x65B0D9C6, 0x12B7E950, 0x8BBEB8EA, 0xFCB9887C, 0x62DD1DDF, 0x15DA2D49, 0x8CD37CF3, 0xFBD44C65,
+      0x4DB26158, 0x3AB551CE, 0xA3BC0074, 0xD4BB30E2, 0x4ADFA541, 0x3DD895D7, 0xA4D1C46D, 0xD3D6F4FB,
+      0x4369E96A, 0x346ED9FC, 0xAD678846, 0xDA60B8D0, 0x44042D73, 0x33031DE5, 0xAA0A4C5F, 0xDD0D7CC9,
+      0x5005713C, 0x270241AA, 0xBE0B1010, 0xC90C2086, 0x5768B525, 0x206F85B3, 0xB966D409, 0xCE61E49F,
+      0x5EDEF90E, 0x29D9C998, 0xB0D09822, 0xC7D7A8B4, 0x59B33D17, 0x2EB40D81, 0xB7BD5C3B, 0xC0BA6CAD,
+      0xEDB88320, 0x9ABFB3B6, 0x03B6E20C, 0x74B1D29A, 0xEAD54739, 0x9DD277AF, 0x04DB2615, 0x73DC1683,
+      0xE3630B12, 0x94643B84, 0x0D6D6A3E, 0x7A6A5AA8, 0xE40ECF0B, 0x9309FF9D, 0x0A00AE27, 0x7D079EB1,
+      0xF00F9344, 0x8708A3D2, 0x1E01F268, 0x6906C2FE, 0xF762575D, 0x806567CB, 0x196C3671, 0x6E6B06E7,
+      0xFED41B76, 0x89D32BE0, 0x10DA7A5A, 0x67DD4ACC, 0xF9B9DF6F, 0x8EBEEFF9, 0x17B7BE43, 0x60B08ED5,
+      0xD6D6A3E8, 0xA1D1937E, 0x38D8C2C4, 0x4FDFF252, 0xD1BB67F1, 0xA6BC5767, 0x3FB506DD, 0x48B2364B,
+      0xD80D2BDA, 0xAF0A1B4C, 0x36034AF6, 0x41047A60, 0xDF60EFC3, 0xA867DF55, 0x316E8EEF, 0x4669BE79,
+      0xCB61B38C, 0xBC66831A, 0x256FD2A0, 0x5268E236, 0xCC0C7795, 0xBB0B4703, 0x220216B9, 0x5505262F,
+      0xC5BA3BBE, 0xB2BD0B28, 0x2BB45A92, 0x5CB36A04, 0xC2D7FFA7, 0xB5D0CF31, 0x2CD99E8B, 0x5BDEAE1D,
+      0x9B64C2B0, 0xEC63F226, 0x756AA39C, 0x026D930A, 0x9C0906A9, 0xEB0E363F, 0x72076785, 0x05005713,
+      0x95BF4A82, 0xE2B87A14, 0x7BB12BAE, 0x0CB61B38, 0x92D28E9B, 0xE5D5BE0D, 0x7CDCEFB7, 0x0BDBDF21,
+      0x86D3D2D4, 0xF1D4E242, 0x68DDB3F8, 0x1FDA836E, 0x81BE16CD, 0xF6B9265B, 0x6FB077E1, 0x18B74777,
+      0x88085AE6, 0xFF0F6A70, 0x66063BCA, 0x11010B5C, 0x8F659EFF, 0xF862AE69, 0x616BFFD3, 0x166CCF45,
+      0xA00AE278, 0xD70DD2EE, 0x4E048354, 0x3903B3C2, 0xA7672661, 0xD06016F7, 0x4969474D, 0x3E6E77DB,
+      0xAED16A4A, 0xD9D65ADC, 0x40DF0B66, 0x37D83BF0, 0xA9BCAE53, 0xDEBB9EC5, 0x47B2CF7F, 0x30B5FFE9,
+      0xBDBDF21C, 0xCABAC28A, 0x53B39330, 0x24B4A3A6, 0xBAD03605, 0xCDD70693, 0x54DE5729, 0x23D967BF,
+      0xB3667A2E, 0xC4614AB8, 0x5D681B02, 0x2A6F2B94, 0xB40BBE37, 0xC30C8EA1, 0x5A05DF1B, 0x2D02EF8D,
+   },
+   {
+      0x00000000, 0x191B3141, 0x32366282, 0x2B2D53C3, 0x646CC504, 0x7D77F445, 0x565AA786, 0x4F4196C7,
+      0xC8D98A08, 0xD1C2BB49, 0xFAEFE88A, 0xE3F4D9CB, 0xACB54F0C, 0xB5AE7E4D, 0x9E832D8E, 0x87981CCF,
+      0x4AC21251, 0x53D92310, 0x78F470D3, 0x61EF4192, 0x2EAED755, 0x37B5E614, 0x1C98B5D7, 0x05838496,
+      0x821B9859, 0x9B00A918, 0xB02DFADB, 0xA936CB9A, 0xE6775D5D, 0xFF6C6C1C, 0xD4413FDF, 0xCD5A0E9E,
+      0x958424A2, 0x8C9F15E3, 0xA7B24620, 0xBEA97761, 0xF1E8E1A6, 0xE8F3D0E7, 0xC3DE8324, 0xDAC5B265,
+      0x5D5DAEAA, 0x44469FEB, 0x6F6BCC28, 0x7670FD69, 0x39316BAE, 0x202A5AEF, 0x0B07092C, 0x121C386D,
+      0xDF4636F3, 0xC65D07B2, 0xED705471, 0xF46B6530, 0xBB2AF3F7, 0xA231C2B6, 0x891C9175, 0x9007A034,
+      0x179FBCFB, 0x0E848DBA, 0x25A9DE79, 0x3CB2EF38, 0x73F379FF, 0x6AE848BE, 0x41C51B7D, 0x58DE2A3C,
+      0xF0794F05, 0xE9627E44, 0xC24F2D87, 0xDB541CC6, 0x94158A01, 0x8D0EBB40, 0xA623E883, 0xBF38D9C2,
+      0x38A0C50D, 0x21BBF44C, 0x0A96A78F, 0x138D96CE, 0x5CCC0009, 0x45D73148, 0x6EFA628B, 0x77E153CA,
+      0xBABB5D54, 0xA3A06C15, 0x888D3FD6, 0x91960E97, 0xDED79850, 0xC7CCA911, 0xECE1FAD2, 0xF5FACB93,
+      0x7262D75C, 0x6B79E61D, 0x4054B5DE, 0x594F849F, 0x160E1258, 0x0F152319, 0x243870DA, 0x3D23419B,
+      0x65FD6BA7, 0x7CE65AE6, 0x57CB0925, 0x4ED03864, 0x0191AEA3, 0x188A9FE2, 0x33A7CC21, 0x2ABCFD60,
+      0xAD24E1AF, 0xB43FD0EE, 0x9F12832D, 0x8609B26C, 0xC94824AB, 0xD05315EA, 0xFB7E4629, 0xE2657768,
+      0x2F3F79F6, 0x362448B7, 0x1D091B74, 0x04122A35, 0x4B53BCF2, 0x52488DB3, 0x7965DE70, 0x607EEF31,
+      0xE7E6F3FE, 0xFEFDC2BF, 0xD5D0917C, 0xCCCBA03D, 0x838A36FA, 0x9A9107BB, 0xB1BC5478, 0xA8A76539,
+      0x3B83984B, 0x2298A90A, 0x09B5FAC9, 0x10AECB88, 0x5FEF5D4F, 0x46F46C0E, 0x6DD93FCD, 0x74C20E8C,
+      0xF35A1243, 0xEA412302, 0xC16C70C1, 0xD8774180, 0x9736D747, 0x8E2DE606, 0xA500B5C5, 0xBC1B8484,
+      0x71418A1A, 0x685ABB5B, 0x4377E898, 0x5A6CD9D9, 0x152D4F1E, 0x0C367E5F, 0x271B2D9C, 0x3E001CDD,
+      0xB9980012, 0xA0833153, 0x8BAE6290, 0x92B553D1, 0xDDF4C516, 0xC4EFF457, 0xEFC2A794, 0xF6D996D5,
+      0xAE07BCE9, 0xB71C8DA8, 0x9C31DE6B, 0x852AEF2A, 0xCA6B79ED, 0xD37048AC, 0xF85D1B6F, 0xE1462A2E,
+      0x66DE36E1, 0x7FC507A0, 0x54E85463, 0x4DF36522, 0x02B2F3E5, 0x1BA9C2A4, 0x30849167, 0x299FA026,
+      0xE4C5AEB8, 0xFDDE9FF9, 0xD6F3CC3A, 0xCFE8FD7B, 0x80A96BBC, 0x99B25AFD, 0xB29F093E, 0xAB84387F,
+      0x2C1C24B0, 0x350715F1, 0x1E2A4632, 0x07317773, 0x4870E1B4, 0x516BD0F5, 0x7A468336, 0x635DB277,
+      0xCBFAD74E, 0xD2E1E60F, 0xF9CCB5CC, 0xE0D7848D, 0xAF96124A, 0xB68D230B, 0x9DA070C8, 0x84BB4189,
+      0x03235D46, 0x1A386C07, 0x31153FC4, 0x280E0E85, 0x674F9842, 0x7E54A903, 0x5579FAC0, 0x4C62CB81,
+      0x8138C51F, 0x9823F45E, 0xB30EA79D, 0xAA1596DC, 0xE554001B, 0xFC4F315A, 0xD7626299, 0xCE7953D8,
+      0x49E14F17, 0x50FA7E56, 0x7BD72D95, 0x62CC1CD4, 0x2D8D8A13, 0x3496BB52, 0x1FBBE891, 0x06A0D9D0,
+      0x5E7EF3EC, 0x4765C2AD, 0x6C48916E, 0x7553A02F, 0x3A1236E8, 0x230907A9, 0x0824546A, 0x113F652B,
+      0x96A779E4, 0x8FBC48A5, 0xA4911B66, 0xBD8A2A27, 0xF2CBBCE0, 0xEBD08DA1, 0xC0FDDE62, 0xD9E6EF23,
+      0x14BCE1BD, 0x0DA7D0FC, 0x268A833F, 0x3F91B27E, 0x70D024B9, 0x69CB15F8, 0x42E6463B, 0x5BFD777A,
+      0xDC656BB5, 0xC57E5AF4, 0xEE530937, 0xF7483876, 0xB809AEB1, 0xA1129FF0, 0x8A3FCC33, 0x9324FD72,
+   },
+   {
+      0x00000000, 0x01C26A37, 0x0384D46E, 0x0246BE59, 0x0709A8DC, 0x06CBC2EB, 0x048D7CB2, 0x054F1685,
+      0x0E1351B8, 0x0FD13B8F, 0x0D9785D6, 0x0C55EFE1, 0x091AF964, 0x08D89353, 0x0A9E2D0A, 0x0B5C473D,
+      0x1C26A370, 0x1DE4C947, 0x1FA2771E, 0x1E601D29, 0x1B2F0BAC, 0x1AED619B, 0x18ABDFC2, 0x1969B5F5,
+      0x1235F2C8, 0x13F798FF, 0x11B126A6, 0x10734C91, 0x153C5A14, 0x14FE3023, 0x16B88E7A, 0x177AE44D,
+      0x384D46E0, 0x398F2CD7, 0x3BC9928E, 0x3A0BF8B9, 0x3F44EE3C, 0x3E86840B, 0x3CC03A52, 0x3D025065,
+      0x365E1758, 0x379C7D6F, 0x35DAC336, 0x3418A901, 0x3157BF84, 0x3095D5B3, 0x32D36BEA, 0x331101DD,
+      0x246BE590, 0x25A98FA7, 0x27EF31FE, 0x262D5BC9, 0x23624D4C, 0x22A0277B, 0x20E69922, 0x2124F315,
+      0x2A78B428, 0x2BBADE1F, 0x29FC6046, 0x283E0A71, 0x2D711CF4, 0x2CB376C3, 0x2EF5C89A, 0x2F37A2AD,
+      0x709A8DC0, 0x7158E7F7, 0x731E59AE, 0x72DC3399, 0x7793251C, 0x76514F2B, 0x7417F172, 0x75D59B45,
+      0x7E89DC78, 0x7F4BB64F, 0x7D0D0816, 0x7CCF6221, 0x798074A4, 0x78421E93, 0x7A04A0CA, 0x7BC6CAFD,
+      0x6CBC2EB0, 0x6D7E4487, 0x6F38FADE, 0x6EFA90E9, 0x6BB5866C, 0x6A77EC5B, 0x68315202, 0x69F33835,
+      0x62AF7F08, 0x636D153F, 0x612BAB66, 0x60E9C151, 0x65A6D7D4, 0x6464BDE3, 0x662203BA, 0x67E0698D,
+      0x48D7CB20, 0x4915A117, 0x4B531F4E, 0x4A917579, 0x4FDE63FC, 0x4E1C09CB, 0x4C5AB792, 0x4D98DDA5,
+      0x46C49A98, 0x4706F0AF, 0x45404EF6, 0x448224C1, 0x41CD3244, 0x400F5873, 0x4249E62A, 0x438B8C1D,
+      0x54F16850, 0x55330267, 0x5775BC3E, 0x56B7D609, 0x53F8C08C, 0x523AAABB, 0x507C14E2, 0x51BE7ED5,
+      0x5AE239E8, 0x5B2053DF, 0x5966ED86, 0x58A487B1, 0x5DEB9134, 0x5C29FB03, 0x5E6F455A, 0x5FAD2F6D,
+      0xE1351B80, 0xE0F771B7, 0xE2B1CFEE, 0xE373A5D9, 0xE63CB35C, 0xE7FED96B, 0xE5B86732, 0xE47A0D05,
+      0xEF264A38, 0xEEE4200F, 0xECA29E56, 0xED60F461, 0xE82FE2E4, 0xE9ED88D3, 0xEBAB368A, 0xEA695CBD,
+      0xFD13B8F0, 0xFCD1D2C7, 0xFE976C9E, 0xFF5506A9, 0xFA1A102C, 0xFBD87A1B, 0xF99EC442, 0xF85CAE75,
+      0xF300E948, 0xF2C2837F, 0xF0843D26, 0xF1465711, 0xF4094194, 0xF5CB2BA3, 0xF78D95FA, 0xF64FFFCD,
+      0xD9785D60, 0xD8BA3757, 0xDAFC890E, 0xDB3EE339, 0xDE71F5BC, 0xDFB39F8B, 0xDDF521D2, 0xDC374BE5,
+      0xD76B0CD8, 0xD6A966EF, 0xD4EFD8B6, 0xD52DB281, 0xD062A404, 0xD1A0CE33, 0xD3E6706A, 0xD2241A5D,
+      0xC55EFE10, 0xC49C9427, 0xC6DA2A7E, 0xC7184049, 0xC25756CC, 0xC3953CFB, 0xC1D382A2, 0xC011E895,
+      0xCB4DAFA8, 0xCA8FC59F, 0xC8C97BC6, 0xC90B11F1, 0xCC440774, 0xCD866D43, 0xCFC0D31A, 0xCE02B92D,
+      0x91AF9640, 0x906DFC77, 0x922B422E, 0x93E92819, 0x96A63E9C, 0x976454AB, 0x9522EAF2, 0x94E080C5,
+      0x9FBCC7F8, 0x9E7EADCF, 0x9C381396, 0x9DFA79A1, 0x98B56F24, 0x99770513, 0x9B31BB4A, 0x9AF3D17D,
+      0x8D893530, 0x8C4B5F07, 0x8E0DE15E, 0x8FCF8B69, 0x8A809DEC, 0x8B42F7DB, 0x89044982, 0x88C623B5,
+      0x839A6488, 0x82580EBF, 0x801EB0E6, 0x81DCDAD1, 0x8493CC54, 0x8551A663, 0x8717183A, 0x86D5720D,
+      0xA9E2D0A0, 0xA820BA97, 0xAA6604CE, 0xABA46EF9, 0xAEEB787C, 0xAF29124B, 0xAD6FAC12, 0xACADC625,
+      0xA7F18118, 0xA633EB2F, 0xA4755576, 0xA5B73F41, 0xA0F829C4, 0xA13A43F3, 0xA37CFDAA, 0xA2BE979D,
+      0xB5C473D0, 0xB40619E7, 0xB640A7BE, 0xB782CD89, 0xB2CDDB0C, 0xB30FB13B, 0xB1490F62, 0xB08B6555,
+      0xBBD72268, 0xBA15485F, 0xB853F606, 0xB9919C31, 0xBCDE8AB4, 0xBD1CE083, 0xBF5A5EDA, 0xBE9834ED,
+   },
+   {
+      0x00000000, 0xB8BC6765, 0xAA09C88B, 0x12B5AFEE, 0x8F629757, 0x37DEF032, 0x256B5FDC, 0x9DD738B9,
+      0xC5B428EF, 0x7D084F8A, 0x6FBDE064, 0xD7018701, 0x4AD6BFB8, 0xF26AD8DD, 0xE0DF7733, 0x58631056,
+      0x5019579F, 0xE8A530FA, 0xFA109F14, 0x42ACF871, 0xDF7BC0C8, 0x67C7A7AD, 0x75720843, 0xCDCE6F26,
+      0x95AD7F70, 0x2D111815, 0x3FA4B7FB, 0x8718D09E, 0x1ACFE827, 0xA2738F42, 0xB0C620AC, 0x087A47C9,
+      0xA032AF3E, 0x188EC85B, 0x0A3B67B5, 0xB28700D0, 0x2F503869, 0x97EC5F0C, 0x8559F0E2, 0x3DE59787,
+      0x658687D1, 0xDD3AE0B4, 0xCF8F4F5A, 0x7733283F, 0xEAE41086, 0x525877E3, 0x40EDD80D, 0xF851BF68,
+      0xF02BF8A1, 0x48979FC4, 0x5A22302A, 0xE29E574F, 0x7F496FF6, 0xC7F50893, 0xD540A77D, 0x6DFCC018,
+      0x359FD04E, 0x8D23B72B, 0x9F9618C5, 0x272A7FA0, 0xBAFD4719, 0x0241207C, 0x10F48F92, 0xA848E8F7,
+      0x9B14583D, 0x23A83F58, 0x311D90B6, 0x89A1F7D3, 0x1476CF6A, 0xACCAA80F, 0xBE7F07E1, 0x06C36084,
+      0x5EA070D2, 0xE61C17B7, 0xF4A9B859, 0x4C15DF3C, 0xD1C2E785, 0x697E80E0, 0x7BCB2F0E, 0xC377486B,
+      0xCB0D0FA2, 0x73B168C7, 0x6104C729, 0xD9B8A04C, 0x446F98F5, 0xFCD3FF90, 0xEE66507E, 0x56DA371B,
+      0x0EB9274D, 0xB6054028, 0xA4B0EFC6, 0x1C0C88A3, 0x81DBB01A, 0x3967D77F, 0x2BD27891, 0x936E1FF4,
+      0x3B26F703, 0x839A9066, 0x912F3F88, 0x299358ED, 0xB4446054, 0x0CF80731, 0x1E4DA8DF, 0xA6F1CFBA,
+      0xFE92DFEC, 0x462EB889, 0x549B1767, 0xEC277002, 0x71F048BB, 0xC94C2FDE, 0xDBF98030, 0x6345E755,
+      0x6B3FA09C, 0xD383C7F9, 0xC1366817, 0x798A0F72, 0xE45D37CB, 0x5CE150AE, 0x4E54FF40, 0xF6E89825,
+      0xAE8B8873, 0x1637EF16, 0x048240F8, 0xBC3E279D, 0x21E91F24, 0x99557841, 0x8BE0D7AF, 0x335CB0CA,
+      0xED59B63B, 0x55E5D15E, 0x47507EB0, 0xFFEC19D5, 0x623B216C, 0xDA874609, 0xC832E9E7, 0x708E8E82,
+      0x28ED9ED4, 0x9051F9B1, 0x82E4565F, 0x3A58313A, 0xA78F0983, 0x1F336EE6, 0x0D86C108, 0xB53AA66D,
+      0xBD40E1A4, 0x05FC86C1, 0x1749292F, 0xAFF54E4A, 0x322276F3, 0x8A9E1196, 0x982BBE78, 0x2097D91D,
+      0x78F4C94B, 0xC048AE2E, 0xD2FD01C0, 0x6A4166A5, 0xF7965E1C, 0x4F2A3979, 0x5D9F9697, 0xE523F1F2,
+      0x4D6B1905, 0xF5D77E60, 0xE762D18E, 0x5FDEB6EB, 0xC2098E52, 0x7AB5E937, 0x680046D9, 0xD0BC21BC,
+      0x88DF31EA, 0x3063568F, 0x22D6F961, 0x9A6A9E04, 0x07BDA6BD, 0xBF01C1D8, 0xADB46E36, 0x15080953,
+      0x1D724E9A, 0xA5CE29FF, 0xB77B8611, 0x0FC7E174, 0x9210D9CD, 0x2AACBEA8, 0x38191146, 0x80A57623,
+      0xD8C66675, 0x607A0110, 0x72CFAEFE, 0xCA73C99B, 0x57A4F122, 0xEF189647, 0xFDAD39A9, 0x45115ECC,
+      0x764DEE06, 0xCEF18963, 0xDC44268D, 0x64F841E8, 0xF92F7951, 0x41931E34, 0x5326B1DA, 0xEB9AD6BF,
+      0xB3F9C6E9, 0x0B45A18C, 0x19F00E62, 0xA14C6907, 0x3C9B51BE, 0x842736DB, 0x96929935, 0x2E2EFE50,
+      0x2654B999, 0x9EE8DEFC, 0x8C5D7112, 0x34E11677, 0xA9362ECE, 0x118A49AB, 0x033FE645, 0xBB838120,
+      0xE3E09176, 0x5B5CF613, 0x49E959FD, 0xF1553E98, 0x6C820621, 0xD43E6144, 0xC68BCEAA, 0x7E37A9CF,
+      0xD67F4138, 0x6EC3265D, 0x7C7689B3, 0xC4CAEED6, 0x591DD66F, 0xE1A1B10A, 0xF3141EE4, 0x4BA87981,
+      0x13CB69D7, 0xAB770EB2, 0xB9C2A15C, 0x017EC639, 0x9CA9FE80, 0x241599E5, 0x36A0360B, 0x8E1C516E,
+      0x866616A7, 0x3EDA71C2, 0x2C6FDE2C, 0x94D3B949, 0x090481F0, 0xB1B8E695, 0xA30D497B, 0x1BB12E1E,
+      0x43D23E48, 0xFB6E592D, 0xE9DBF6C3, 0x516791A6, 0xCCB0A91F, 0x740CCE7A, 0x66B96194, 0xDE0506F1,
+   },
+   {
+      0x00000000, 0x3D6029B0, 0x7AC05360, 0x47A07AD0, 0xF580A6C0, 0xC8E08F70, 0x8F40F5A0, 0xB220DC10,
+      0x30704BC1, 0x0D106271, 0x4AB018A1, 0x77D03111, 0xC5F0ED01, 0xF890C4B1, 0xBF30BE61, 0x825097D1,
+      0x60E09782, 0x5D80BE32, 0x1A20C4E2, 0x2740ED52, 0x95603142, 0xA80018F2, 0xEFA06222, 0xD2C04B92,
+      0x5090DC43, 0x6DF0F5F3, 0x2A508F23, 0x1730A693, 0xA5107A83, 0x98705333, 0xDFD029E3, 0xE2B00053,
+      0xC1C12F04, 0xFCA106B4, 0xBB017C64, 0x866155D4, 0x344189C4, 0x0921A074, 0x4E81DAA4, 0x73E1F314,
+      0xF1B164C5, 0xCCD14D75, 0x8B7137A5, 0xB6111E15, 0x0431C205, 0x3951EBB5, 0x7EF19165, 0x4391B8D5,
+      0xA121B886, 0x9C419136, 0xDBE1EBE6, 0xE681C256, 0x54A11E46, 0x69C137F6, 0x2E614D26, 0x13016496,
+      0x9151F347, 0xAC31DAF7, 0xEB91A027, 0xD6F18997, 0x64D15587, 0x59B17C37, 0x1E1106E7, 0x23712F57,
+      0x58F35849, 0x659371F9, 0x22330B29, 0x1F532299, 0xAD73FE89, 0x9013D739, 0xD7B3ADE9, 0xEAD38459,
+      0x68831388, 0x55E33A38, 0x124340E8, 0x2F236958, 0x9D03B548, 0xA0639CF8, 0xE7C3E628, 0xDAA3CF98,
+      0x3813CFCB, 0x0573E67B, 0x42D39CAB, 0x7FB3B51B, 0xCD93690B, 0xF0F340BB, 0xB7533A6B, 0x8A3313DB,
+      0x0863840A, 0x3503ADBA, 0x72A3D76A, 0x4FC3FEDA, 0xFDE322CA, 0xC0830B7A, 0x872371AA, 0xBA43581A,
+      0x9932774D, 0xA4525EFD, 0xE3F2242D, 0xDE920D9D, 0x6CB2D18D, 0x51D2F83D, 0x167282ED, 0x2B12AB5D,
+      0xA9423C8C, 0x9422153C, 0xD3826FEC, 0xEEE2465C, 0x5CC29A4C, 0x61A2B3FC, 0x2602C92C, 0x1B62E09C,
+      0xF9D2E0CF, 0xC4B2C97F, 0x8312B3AF, 0xBE729A1F, 0x0C52460F, 0x31326FBF, 0x7692156F, 0x4BF23CDF,
+      0xC9A2AB0E, 0xF4C282BE, 0xB362F86E, 0x8E02D1DE, 0x3C220DCE, 0x0142247E, 0x46E25EAE, 0x7B82771E,
+      0xB1E6B092, 0x8C869922, 0xCB26E3F2, 0xF646CA42, 0x44661652, 0x79063FE2, 0x3EA64532, 0x03C66C82,
+      0x8196FB53, 0xBCF6D2E3, 0xFB56A833, 0xC6368183, 0x74165D93, 0x49767423, 0x0ED60EF3, 0x33B62743,
+      0xD1062710, 0xEC660EA0, 0xABC67470, 0x96A65DC0, 0x248681D0, 0x19E6A860, 0x5E46D2B0, 0x6326FB00,
+      0xE1766CD1, 0xDC164561, 0x9BB63FB1, 0xA6D61601, 0x14F6CA11, 0x2996E3A1, 0x6E369971, 0x5356B0C1,
+      0x70279F96, 0x4D47B626, 0x0AE7CCF6, 0x3787E546, 0x85A73956, 0xB8C710E6, 0xFF676A36, 0xC2074386,
+      0x4057D457, 0x7D37FDE7, 0x3A978737, 0x07F7AE87, 0xB5D77297, 0x88B75B27, 0xCF1721F7, 0xF2770847,
+      0x10C70814, 0x2DA721A4, 0x6A075B74, 0x576772C4, 0xE547AED4, 0xD8278764, 0x9F87FDB4, 0xA2E7D404,
+      0x20B743D5, 0x1DD76A65, 0x5A7710B5, 0x67173905, 0xD537E515, 0xE857CCA5, 0xAFF7B675, 0x92979FC5,
+      0xE915E8DB, 0xD475C16B, 0x93D5BBBB, 0xAEB5920B, 0x1C954E1B, 0x21F567AB, 0x66551D7B, 0x5B3534CB,
+      0xD965A31A, 0xE4058AAA, 0xA3A5F07A, 0x9EC5D9CA, 0x2CE505DA, 0x11852C6A, 0x562556BA, 0x6B457F0A,
+      0x89F57F59, 0xB49556E9, 0xF3352C39, 0xCE550589, 0x7C75D999, 0x4115F029, 0x06B58AF9, 0x3BD5A349,
+      0xB9853498, 0x84E51D28, 0xC34567F8, 0xFE254E48, 0x4C059258, 0x7165BBE8, 0x36C5C138, 0x0BA5E888,
+      0x28D4C7DF, 0x15B4EE6F, 0x521494BF, 0x6F74BD0F, 0xDD54611F, 0xE03448AF, 0xA794327F, 0x9AF41BCF,
+      0x18A48C1E, 0x25C4A5AE, 0x6264DF7E, 0x5F04F6CE, 0xED242ADE, 0xD044036E, 0x97E479BE, 0xAA84500E,
+      0x4834505D, 0x755479ED, 0x32F4033D, 0x0F942A8D, 0xBDB4F69D, 0x80D4DF2D, 0xC774A5FD, 0xFA148C4D,
+      0x78441B9C, 0x4524322C, 0x028448FC, 0x3FE4614C, 0x8DC4BD5C, 0xB0A494EC, 0xF704EE3C, 0xCA64C78C,
+   },
+   {
+      0x00000000, 0xCB5CD3A5, 0x4DC8A10B, 0x869472AE, 0x9B914216, 0x50CD91B3, 0xD659E31D, 0x1D0530B8,
+      0xEC53826D, 0x270F51C8, 0xA19B2366, 0x6AC7F0C3, 0x77C2C07B, 0xBC9E13DE, 0x3A0A6170, 0xF156B2D5,
+      0x03D6029B, 0xC88AD13E, 0x4E1EA390, 0x85427035, 0x9847408D, 0x531B9328, 0xD58FE186, 0x1ED33223,
+      0xEF8580F6, 0x24D95353, 0xA24D21FD, 0x6911F258, 0x7414C2E0, 0xBF481145, 0x39DC63EB, 0xF280B04E,
+      0x07AC0536, 0xCCF0D693, 0x4A64A43D, 0x81387798, 0x9C3D4720, 0x57619485, 0xD1F5E62B, 0x1AA9358E,
+      0xEBFF875B, 0x20A354FE, 0xA6372650, 0x6D6BF5F5, 0x706EC54D, 0xBB3216E8, 0x3DA66446, 0xF6FAB7E3,
+      0x047A07AD, 0xCF26D408, 0x49B2A6A6, 0x82EE7503, 0x9FEB45BB, 0x54B7961E, 0xD223E4B0, 0x197F3715,
+      0xE82985C0, 0x23755665, 0xA5E124CB, 0x6EBDF76E, 0x73B8C7D6, 0xB8E41473, 0x3E7066DD, 0xF52CB578,
+      0x0F580A6C, 0xC404D9C9, 0x4290AB67, 0x89CC78C2, 0x94C9487A, 0x5F959BDF, 0xD901E971, 0x125D3AD4,
+      0xE30B8801, 0x28575BA4, 0xAEC3290A, 0x659FFAAF, 0x789ACA17, 0xB3C619B2, 0x35526B1C, 0xFE0EB8B9,
+      0x0C8E08F7, 0xC7D2DB52, 0x4146A9FC, 0x8A1A7A59, 0x971F4AE1, 0x5C439944, 0xDAD7EBEA, 0x118B384F,
+      0xE0DD8A9A, 0x2B81593F, 0xAD152B91, 0x6649F834, 0x7B4CC88C, 0xB0101B29, 0x36846987, 0xFDD8BA22,
+      0x08F40F5A, 0xC3A8DCFF, 0x453CAE51, 0x8E607DF4, 0x93654D4C, 0x58399EE9, 0xDEADEC47, 0x15F13FE2,
+      0xE4A78D37, 0x2FFB5E92, 0xA96F2C3C, 0x6233FF99, 0x7F36CF21, 0xB46A1C84, 0x32FE6E2A, 0xF9A2BD8F,
+      0x0B220DC1, 0xC07EDE64, 0x46EAACCA, 0x8DB67F6F, 0x90B34FD7, 0x5BEF9C72, 0xDD7BEEDC, 0x16273D79,
+      0xE7718FAC, 0x2C2D5C09, 0xAAB92EA7, 0x61E5FD02, 0x7CE0CDBA, 0xB7BC1E1F, 0x31286CB1, 0xFA74BF14,
+      0x1EB014D8, 0xD5ECC77D, 0x5378B5D3, 0x98246676, 0x852156CE, 0x4E7D856B, 0xC8E9F7C5, 0x03B52460,
+      0xF2E396B5, 0x39BF4510, 0xBF2B37BE, 0x7477E41B, 0x6972D4A3, 0xA22E0706, 0x24BA75A8, 0xEFE6A60D,
+      0x1D661643, 0xD63AC5E6, 0x50AEB748, 0x9BF264ED, 0x86F75455, 0x4DAB87F0, 0xCB3FF55E, 0x006326FB,
+      0xF135942E, 0x3A69478B, 0xBCFD3525, 0x77A1E680, 0x6AA4D638, 0xA1F8059D, 0x276C7733, 0xEC30A496,
+      0x191C11EE, 0xD240C24B, 0x54D4B0E5, 0x9F886340, 0x828D53F8, 0x49D1805D, 0xCF45F2F3, 0x04192156,
+      0xF54F9383, 0x3E134026, 0xB8873288, 0x73DBE12D, 0x6EDED195, 0xA5820230, 0x2316709E, 0xE84AA33B,
+      0x1ACA1375, 0xD196C0D0, 0x5702B27E, 0x9C5E61DB, 0x815B5163, 0x4A0782C6, 0xCC93F068, 0x07CF23CD,
+      0xF6999118, 0x3DC542BD, 0xBB513013, 0x700DE3B6, 0x6D08D30E, 0xA65400AB, 0x20C07205, 0xEB9CA1A0,
+      0x11E81EB4, 0xDAB4CD11, 0x5C20BFBF, 0x977C6C1A, 0x8A795CA2, 0x41258F07, 0xC7B1FDA9, 0x0CED2E0C,
+      0xFDBB9CD9, 0x36E74F7C, 0xB0733DD2, 0x7B2FEE77, 0x662ADECF, 0xAD760D6A, 0x2BE27FC4, 0xE0BEAC61,
+      0x123E1C2F, 0xD962CF8A, 0x5FF6BD24, 0x94AA6E81, 0x89AF5E39, 0x42F38D9C, 0xC467FF32, 0x0F3B2C97,
+      0xFE6D9E42, 0x35314DE7, 0xB3A53F49, 0x78F9ECEC, 0x65FCDC54, 0xAEA00FF1, 0x28347D5F, 0xE368AEFA,
+      0x16441B82, 0xDD18C827, 0x5B8CBA89, 0x90D0692C, 0x8DD55994, 0x46898A31, 0xC01DF89F, 0x0B412B3A,
+      0xFA1799EF, 0x314B4A4A, 0xB7DF38E4, 0x7C83EB41, 0x6186DBF9, 0xAADA085C, 0x2C4E7AF2, 0xE712A957,
+      0x15921919, 0xDECECABC, 0x585AB812, 0x93066BB7, 0x8E035B0F, 0x455F88AA, 0xC3CBFA04, 0x089729A1,
+      0xF9C19B74, 0x329D48D1, 0xB4093A7F, 0x7F55E9DA, 0x6250D962, 0xA90C0AC7, 0x2F987869, 0xE4C4ABCC,
+   },
+   {
+      0x00000000, 0xA6770BB4, 0x979F1129, 0x31E81A9D, 0xF44F2413, 0x52382FA7, 0x63D0353A, 0xC5A73E8E,
+      0x33EF4E67, 0x959845D3, 0xA4705F4E, 0x020754FA, 0xC7A06A74, 0x61D761C0, 0x503F7B5D, 0xF64870E9,
+      0x67DE9CCE, 0xC1A9977A, 0xF0418DE7, 0x56368653, 0x9391B8DD, 0x35E6B369, 0x040EA9F4, 0xA279A240,
+      0x5431D2A9, 0xF246D91D, 0xC3AEC380, 0x65D9C834, 0xA07EF6BA, 0x0609FD0E, 0x37E1E793, 0x9196EC27,
+      0xCFBD399C, 0x69CA3228, 0x582228B5, 0xFE552301, 0x3BF21D8F, 0x9D85163B, 0xAC6D0CA6, 0x0A1A0712,
+      0xFC5277FB, 0x5A257C4F, 0x6BCD66D2, 0xCDBA6D66, 0x081D53E8, 0xAE6A585C, 0x9F8242C1, 0x39F54975,
+      0xA863A552, 0x0E14AEE6, 0x3FFCB47B, 0x998BBFCF, 0x5C2C8141, 0xFA5B8AF5, 0xCBB39068, 0x6DC49BDC,
+      0x9B8CEB35, 0x3DFBE081, 0x0C13FA1C, 0xAA64F1A8, 0x6FC3CF26, 0xC9B4C492, 0xF85CDE0F, 0x5E2BD5BB,
+      0x440B7579, 0xE27C7ECD, 0xD3946450, 0x75E36FE4, 0xB044516A, 0x16335ADE, 0x27DB4043, 0x81AC4BF7,
+      0x77E43B1E, 0xD19330AA, 0xE07B2A37, 0x460C2183, 0x83AB1F0D, 0x25DC14B9, 0x14340E24, 0xB2430590,
+      0x23D5E9B7, 0x85A2E203, 0xB44AF89E, 0x123DF32A, 0xD79ACDA4, 0x71EDC610, 0x4005DC8D, 0xE672D739,
+      0x103AA7D0, 0xB64DAC64, 0x87A5B6F9, 0x21D2BD4D, 0xE47583C3, 0x42028877, 0x73EA92EA, 0xD59D995E,
+      0x8BB64CE5, 0x2DC14751, 0x1C295DCC, 0xBA5E5678, 0x7FF968F6, 0xD98E6342, 0xE86679DF, 0x4E11726B,
+      0xB8590282, 0x1E2E0936, 0x2FC613AB, 0x89B1181F, 0x4C162691, 0xEA612D25, 0xDB8937B8, 0x7DFE3C0C,
+      0xEC68D02B, 0x4A1FDB9F, 0x7BF7C102, 0xDD80CAB6, 0x1827F438, 0xBE50FF8C, 0x8FB8E511, 0x29CFEEA5,
+      0xDF879E4C, 0x79F095F8, 0x48188F65, 0xEE6F84D1, 0x2BC8BA5F, 0x8DBFB1EB, 0xBC57AB76, 0x1A20A0C2,
+      0x8816EAF2, 0x2E61E146, 0x1F89FBDB, 0xB9FEF06F, 0x7C59CEE1, 0xDA2EC555, 0xEBC6DFC8, 0x4DB1D47C,
+      0xBBF9A495, 0x1D8EAF21, 0x2C66B5BC, 0x8A11BE08, 0x4FB68086, 0xE9C18B32, 0xD82991AF, 0x7E5E9A1B,
+      0xEFC8763C, 0x49BF7D88, 0x78576715, 0xDE206CA1, 0x1B87522F, 0xBDF0599B, 0x8C184306, 0x2A6F48B2,
+      0xDC27385B, 0x7A5033EF, 0x4BB82972, 0xEDCF22C6, 0x28681C48, 0x8E1F17FC, 0xBFF70D61, 0x198006D5,
+      0x47ABD36E, 0xE1DCD8DA, 0xD034C247, 0x7643C9F3, 0xB3E4F77D, 0x1593FCC9, 0x247BE654, 0x820CEDE0,
+      0x74449D09, 0xD23396BD, 0xE3DB8C20, 0x45AC8794, 0x800BB91A, 0x267CB2AE, 0x1794A833, 0xB1E3A387,
+      0x20754FA0, 0x86024414, 0xB7EA5E89, 0x119D553D, 0xD43A6BB3, 0x724D6007, 0x43A57A9A, 0xE5D2712E,
+      0x139A01C7, 0xB5ED0A73, 0x840510EE, 0x22721B5A, 0xE7D525D4, 0x41A22E60, 0x704A34FD, 0xD63D3F49,
+      0xCC1D9F8B, 0x6A6A943F, 0x5B828EA2, 0xFDF58516, 0x3852BB98, 0x9E25B02C, 0xAFCDAAB1, 0x09BAA105,
+      0xFFF2D1EC, 0x5985DA58, 0x686DC0C5, 0xCE1ACB71, 0x0BBDF5FF, 0xADCAFE4B, 0x9C22E4D6, 0x3A55EF62,
+      0xABC30345, 0x0DB408F1, 0x3C5C126C, 0x9A2B19D8, 0x5F8C2756, 0xF9FB2CE2, 0xC813367F, 0x6E643DCB,
+      0x982C4D22, 0x3E5B4696, 0x0FB35C0B, 0xA9C457BF, 0x6C636931, 0xCA146285, 0xFBFC7818, 0x5D8B73AC,
+      0x03A0A617, 0xA5D7ADA3, 0x943FB73E, 0x3248BC8A, 0xF7EF8204, 0x519889B0, 0x6070932D, 0xC6079899,
+      0x304FE870, 0x9638E3C4, 0xA7D0F959, 0x01A7F2ED, 0xC400CC63, 0x6277C7D7, 0x539FDD4A, 0xF5E8D6FE,
+      0x647E3AD9, 0xC209316D, 0xF3E12BF0, 0x55962044, 0x90311ECA, 0x3646157E, 0x07AE0FE3, 0xA1D90457,
+      0x579174BE, 0xF1E67F0A, 0xC00E6597, 0x66796E23, 0xA3DE50AD, 0x05A95B19, 0x34414184, 0x92364A30,
+   },
+   {
+      0x00000000, 0xCCAA009E, 0x4225077D, 0x8E8F07E3, 0x844A0EFA, 0x48E00E64, 0xC66F0987, 0x0AC50919,
+      0xD3E51BB5, 0x1F4F1B2B, 0x91C01CC8, 0x5D6A1C56, 0x57AF154F, 0x9B0515D1, 0x158A1232, 0xD92012AC,
+      0x7CBB312B, 0xB01131B5, 0x3E9E3656, 0xF23436C8, 0xF8F13FD1, 0x345B3F4F, 0xBAD438AC, 0x767E3832,
+      0xAF5E2A9E, 0x63F42A00, 0xED7B2DE3, 0x21D12D7D, 0x2B142464, 0xE7BE24FA, 0x69312319, 0xA59B2387,
+      0xF9766256, 0x35DC62C8, 0xBB53652B, 0x77F965B5, 0x7D3C6CAC, 0xB1966C32, 0x3F196BD1, 0xF3B36B4F,
+      0x2A9379E3, 0xE639797D, 0x68B67E9E, 0xA41C7E00, 0xAED97719, 0x62737787, 0xECFC7064, 0x205670FA,
+      0x85CD537D, 0x496753E3, 0xC7E85400, 0x0B42549E, 0x01875D87, 0xCD2D5D19, 0x43A25AFA, 0x8F085A64,
+      0x562848C8, 0x9A824856, 0x140D4FB5, 0xD8A74F2B, 0xD2624632, 0x1EC846AC, 0x9047414F, 0x5CED41D1,
+      0x299DC2ED, 0xE537C273, 0x6BB8C590, 0xA712C50E, 0xADD7CC17, 0x617DCC89, 0xEFF2CB6A, 0x2358CBF4,
+      0xFA78D958, 0x36D2D9C6, 0xB85DDE25, 0x74F7DEBB, 0x7E32D7A2, 0xB298D73C, 0x3C17D0DF, 0xF0BDD041,
+      0x5526F3C6, 0x998CF358, 0x1703F4BB, 0xDBA9F425, 0xD16CFD3C, 0x1DC6FDA2, 0x9349FA41, 0x5FE3FADF,
+      0x86C3E873, 0x4A69E8ED, 0xC4E6EF0E, 0x084CEF90, 0x0289E689, 0xCE23E617, 0x40ACE1F4, 0x8C06E16A,
+      0xD0EBA0BB, 0x1C41A025, 0x92CEA7C6, 0x5E64A758, 0x54A1AE41, 0x980BAEDF, 0x1684A93C, 0xDA2EA9A2,
+      0x030EBB0E, 0xCFA4BB90, 0x412BBC73, 0x8D81BCED, 0x8744B5F4, 0x4BEEB56A, 0xC561B289, 0x09CBB217,
+      0xAC509190, 0x60FA910E, 0xEE7596ED, 0x22DF9673, 0x281A9F6A, 0xE4B09FF4, 0x6A3F9817, 0xA6959889,
+      0x7FB58A25, 0xB31F8ABB, 0x3D908D58, 0xF13A8DC6, 0xFBFF84DF, 0x37558441, 0xB9DA83A2, 0x7570833C,
+      0x533B85DA, 0x9F918544, 0x111E82A7, 0xDDB48239, 0xD7718B20, 0x1BDB8BBE, 0x95548C5D, 0x59FE8CC3,
+      0x80DE9E6F, 0x4C749EF1, 0xC2FB9912, 0x0E51998C, 0x04949095, 0xC83E900B, 0x46B197E8, 0x8A1B9776,
+      0x2F80B4F1, 0xE32AB46F, 0x6DA5B38C, 0xA10FB312, 0xABCABA0B, 0x6760BA95, 0xE9EFBD76, 0x2545BDE8,
+      0xFC65AF44, 0x30CFAFDA, 0xBE40A839, 0x72EAA8A7, 0x782FA1BE, 0xB485A120, 0x3A0AA6C3, 0xF6A0A65D,
+      0xAA4DE78C, 0x66E7E712, 0xE868E0F1, 0x24C2E06F, 0x2E07E976, 0xE2ADE9E8, 0x6C22EE0B, 0xA088EE95,
+      0x79A8FC39, 0xB502FCA7, 0x3B8DFB44, 0xF727FBDA, 0xFDE2F2C3, 0x3148F25D, 0xBFC7F5BE, 0x736DF520,
+      0xD6F6D6A7, 0x1A5CD639, 0x94D3D1DA, 0x5879D144, 0x52BCD85D, 0x9E16D8C3, 0x1099DF20, 0xDC33DFBE,
+      0x0513CD12, 0xC9B9CD8C, 0x4736CA6F, 0x8B9CCAF1, 0x8159C3E8, 0x4DF3C376, 0xC37CC495, 0x0FD6C40B,
+      0x7AA64737, 0xB60C47A9, 0x3883404A, 0xF42940D4, 0xFEEC49CD, 0x32464953, 0xBCC94EB0, 0x70634E2E,
+      0xA9435C82, 0x65E95C1C, 0xEB665BFF, 0x27CC5B61, 0x2D095278, 0xE1A352E6, 0x6F2C5505, 0xA386559B,
+      0x061D761C, 0xCAB77682, 0x44387161, 0x889271FF, 0x825778E6, 0x4EFD7878, 0xC0727F9B, 0x0CD87F05,
+      0xD5F86DA9, 0x19526D37, 0x97DD6AD4, 0x5B776A4A, 0x51B26353, 0x9D1863CD, 0x1397642E, 0xDF3D64B0,
+      0x83D02561, 0x4F7A25FF, 0xC1F5221C, 0x0D5F2282, 0x079A2B9B, 0xCB302B05, 0x45BF2CE6, 0x89152C78,
+      0x50353ED4, 0x9C9F3E4A, 0x121039A9, 0xDEBA3937, 0xD47F302E, 0x18D530B0, 0x965A3753, 0x5AF037CD,
+      0xFF6B144A, 0x33C114D4, 0xBD4E1337, 0x71E413A9, 0x7B211AB0, 0xB78B1A2E, 0x39041DCD, 0xF5AE1D53,
+      0x2C8E0FFF, 0xE0240F61, 0x6EAB0882, 0xA201081C, 0xA8C40105, 0x646E019B, 0xEAE10678, 0x264B06E6,
+   },
+};
+
+/** The value of each ASCII hex digit plus 0x10, or 0 for any other character. */
+static const U8            hexValues[256] =
+{
+   ['0'] = 0x10, ['1'] = 0x11, ['2'] = 0x12, ['3'] = 0x13, ['4'] = 0x14,
+   ['5'] = 0x15, ['6'] = 0x16, ['7'] = 0x17, ['8'] = 0x18, ['9'] = 0x19,
+   ['A'] = 0x1A, ['B'] = 0x1B, ['C'] = 0x1C, ['D'] = 0x1D, ['E'] = 0x1E, ['F'] = 0x1F,
+   ['a'] = 0x1A, ['b'] = 0x1B, ['c'] = 0x1C, ['d'] = 0x1D, ['e'] = 0x1E, ['f'] = 0x1F,
+};
+
+/** The context whose operation this thread is working on, which errors are reported to, or NULL. */
+static THREAD_LOCAL RFT_CONTEXT *pReportCtx = NULL;
+
+/** The scheduler shared by every context. */
+static SCHED               sched;
+
+/** The scheduler's worker which this thread is, or NULL for any other thread. */
+static THREAD_LOCAL WORKER *pCurWorker = NULL;
+
+/******************************************************************************
+ Module Function Definitions
+******************************************************************************/
+
+/**************************************************************************//**
+* Reports an error. It is printed, and the first error of an operation on a
+* context is also kept, for RftGetLastError().
+*
+* @param[in] pFmt The printf() format of the message, which ends with a new line.
+*
+* @return None.
+******************************************************************************/
+static void ReportError(const char *pFmt, ...)
+{
+   RFT_CONTEXT *pCtx = pReportCtx;
+   char *pMsg;
+   va_list args;
+   size_t len;
+
+   va_start(args, pFmt);
+   vprintf(pFmt, args);
+   va_end(args);
+
+   /* Only the first error is kept, as the others tend to follow from it. */
+   if (pCtx == NULL || ATOMIC_SWAP(&pCtx->hasError, 1))
+   {
+      return;
+   }
+
+   pMsg = pCtx->lastError;
+   va_start(args, pFmt);
+   vsnprintf(pMsg, ERROR_MSG_LEN, pFmt, args);
+   va_end(args);
+
+   len = strlen(pMsg);
+   if (len && pMsg[len - 1] == '\n')
+   {
+      pMsg[--len] = '\0';
+   }
+
+   if (!strncmp(pMsg, "ERROR: ", 7))
+   {
+      memmove(pMsg, pMsg + 7, len - 7 + 1);
+   }
+}
+
+/**************************************************************************//**
+* Counts the hex digits at the start of a buffer.
+*
+* @param[in] pBuf The buffer to examine.
+* @param[in] len The number of bytes available in the buffer.
+*
+* @return The number of leading bytes which are ASCII hex digits.
+******************************************************************************/
+static U32 CountHexDigits(const U8 *pBuf, U32 len)
+{
+   U32 i;
+
+   for (i = 0; i < len; i++)
+   {
+      if (!((pBuf[i] >= '0' && pBuf[i] <= '9') ||
+         (pBuf[i] >= 'a' && pBuf[i] <= 'f') ||
+         (pBuf[i] >= 'A' && pBuf[i] <= 'F')))
+      {
+         break;
+      }
+   }
+
+   return i;
+}
+
+/**************************************************************************//**
+* Wakes the stages of a pipelined load which sleep waiting for another, after
+* this stage has published a change.
+*
+* @param[in,out] pPipe The pipelined load.
+*
+* @return None.
+******************************************************************************/
+static void WakePipe(PIPE *pPipe)
+{
+   /* The change must be visible before looking for sleepers, as a stage which is
+   about to sleep looks for the change only after counting itself. */
+   MEMORY_BARRIER();
+   if (ATOMIC_LOAD_ACQUIRE(&pPipe->numWaiting) != 0)
+   {
+      MUTEX_LOCK(&pPipe->waitLock);
+      COND_BROADCAST(&pPipe->wake);
+      MUTEX_UNLOCK(&pPipe->waitLock);
+   }
+}
+
+/**************************************************************************//**
+* Sleeps until another stage of a pipelined load changes a value from the one
+* this stage last saw, sets a done flag, or stops the load.
+*
+* @param[in,out] pPipe The pipelined load.
+* @param[in] pValue The value to wait on.
+* @param[in] seen The value last seen.
+* @param[in] pDone The done flag to wait on, or NULL.
+*
+* @return None.
+******************************************************************************/
+static void WaitPipe(PIPE *pPipe, U32 *pValue, U32 seen, U32 *pDone)
+{
+   /* Counting this stage is a full barrier, so either the change is seen below, or the
+   stage which makes it sees this one waiting, and wakes it under the lock. */
+   MUTEX_LOCK(&pPipe->waitLock);
+   ATOMIC_ADD(&pPipe->numWaiting, 1);
+
+   while (ATOMIC_LOAD_ACQUIRE(pValue) == seen &&
+      (pDone == NULL || !ATOMIC_LOAD_ACQUIRE(pDone)) &&
+      ATOMIC_LOAD_ACQUIRE(&pPipe->stopResult) == OK)
+   {
+      COND_WAIT(&pPipe->wake, &pPipe->waitLock);
+   }
+
+   ATOMIC_ADD(&pPipe->numWaiting, -1);
+   MUTEX_UNLOCK(&pPipe->waitLock);
+}
+
+/**************************************************************************//**
+* Stops the other stages of a pipelined load, after one has failed.
+*
+* @param[in,out] pPipe The pipelined load.
+* @param[in] r The result of the stage which failed.
+*
+* @return None.
+******************************************************************************/
+static void StopPipe(PIPE *pPipe, RESULT r)
+{
+   ATOMIC_STORE_RELEASE(&pPipe->stopResult, (U32) r);
+   WakePipe(pPipe);
+}
+
+/**************************************************************************//**
+* Waits for more of an input which is still being read by a pipelined load.
+*
+* Only whole lines are made available, so that no field is split across a
+* read. Input which is all in memory never has any more.
+*
+* @param[in,out] pIn The input, whose end is moved up.
+*
+* @return Non-zero if there is more input to decode.
+******************************************************************************/
+static int MoreInput(IN_BUF *pIn)
+{
+   PIPE *pPipe = pIn->pPipe;
+   const U8 *pEnd;
+   U32 done, numRead;
+
+   if (pPipe == NULL)
+   {
+      return 0;
+   }
+
+   while (ATOMIC_LOAD_ACQUIRE(&pPipe->stopResult) == OK)
+   {
+      /* Once the reader is done, the length it read is final. */
+      done = ATOMIC_LOAD_ACQUIRE(&pPipe->readDone);
+      numRead = ATOMIC_LOAD_ACQUIRE(&pPipe->numRead);
+      pEnd = pPipe->pBuf + numRead;
+
+      if (done)
+      {
+         pIn->pEnd = pEnd;
+         break;
+      }
+
+      /* Hand over everything up to the last new line read. */
+      while (pEnd > pIn->pEnd && pEnd[-1] != '\n')
+      {
+         pEnd--;
+      }
+
+      if (pEnd > pIn->pEnd)
+      {
+         pIn->pEnd = pEnd;
+         break;
+      }
+
+      WaitPipe(pPipe, &pPipe->numRead, numRead, &pPipe->readDone);
+   }
+
+   return pIn->pCur < pIn->pEnd;
+}
+
+/**************************************************************************//**
+* Reads an ASCII-encoded byte from the given input.
+*
+* @param[in,out] pIn The input from which to read.
+* @param[in] pU8 The data will be stored here.
+* @param[in] pChkSum A checksum variable to update, or NULL to not update anything.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+static RESULT LoadU8(IN_BUF* pIn, U8* pU8, U8* pChkSum)
+{
+   U8 hi, lo;
+
+   if (pIn->pEnd - pIn->pCur < 2)
+   {
+      ReportError("Unexpected end of file.\n");
+      return END_OF_FILE;
+   }
+
+   hi = hexValues[pIn->pCur[0]];
+   lo = hexValues[pIn->pCur[1]];
+   if (!hi || !lo)
+   {
+      ReportError("Invalid hex byte value.\n");
+      return INVALID_DATA;
+   }
+   pIn->pCur += 2;
+
+   *pU8 = (U8) ((hi << 4) | (lo & 0xF));
+   if (pChkSum != NULL) *pChkSum += *pU8;
+
+   return OK;
+}
+
+/**************************************************************************//**
+* Reads an ASCII-encoded U16 from the given input, in MSB.
+*
+* @param[in,out] pIn The input from which to read.
+* @param[in] pU16 The data will be stored here.
+* @param[in] pChkSum A checksum variable to update, or NULL to not update anything.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+static RESULT LoadU16(IN_BUF* pIn, U16* pU16, U8* pChkSum)
+{
+   RESULT r;
+   U8 b1, b2;
+
+   r = LoadU8(pIn, &b1, pChkSum);
+   if (r != OK)
+   {
+      return r;
+   }
+
+   r = LoadU8(pIn, &b2, pChkSum);
+   if (r != OK)
+   {
+      return r;
+   }
+
+   *pU16 = (b1 << 8) | b2;
+   return OK;
+}
+
+/**************************************************************************//**
+* Reads an ASCII-encoded U32 from the given input, in MSB.
+*
+* @param[in,out] pIn The input from which to read.
+* @param[in] pU32 The data will be stored here.
+* @param[in] pChkSum A checksum variable to update, or NULL to not update anything.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+static RESULT LoadU32(IN_BUF* pIn, U32* pU32, U8* pChkSum)
+{
+   RESULT r;
+   int i;
+   U8 b;
+
+   *pU32 = 0;
+   for (i = 0; i < 4; i++)
+   {
+      r = LoadU8(pIn, &b, pChkSum);
+      if (r != OK)
+      {
+         return r;
+      }
+      *pU32 = ((*pU32) << 8) | b;
+   }
+
+   return OK;
+}
+
+/**************************************************************************//**
+* Allocates a segment which holds its own data.
+*
+* @param[in] len The length of the segment's data, in bytes.
+*
+* @return The new segment, or NULL if there is not enough memory.
+******************************************************************************/
+static SEGMENT *AllocSegment(U32 len)
+{
+   SEGMENT *pSeg;
+
+   pSeg = (SEGMENT *) malloc(sizeof(SEGMENT) + len);
+   if (pSeg != NULL)
+   {
+      pSeg->len = len;
+      pSeg->pNext = NULL;
+      pSeg->pData = (U8 *) (pSeg + 1);
+   }
+
+   return pSeg;
+}
+
+/**************************************************************************//**
+* Computes the FNV-1a hash of a segment payload.
+*
+* @param[in] pData The payload.
+* @param[in] len The length of the payload, in bytes.
+*
+* @return The hash.
+******************************************************************************/
+static U32 HashData(const U8 *pData, U32 len)
+{
+   U32 hash = 2166136261u;
+
+   while (len--)
+   {
+      hash = (hash ^ *pData++) * 16777619u;
+   }
+
+   return hash;
+}
+
+/**************************************************************************//**
+* Takes a spin lock, such as the lock on a worker's deques.
+*
+* @param[in,out] pLock The lock.
+*
+* @return None.
+******************************************************************************/
+static void AcquireLock(volatile long *pLock)
+{
+   while (ATOMIC_SWAP(pLock, 1))
+   {
+      THREAD_YIELD();
+   }
+}
+
+/**************************************************************************//**
+* Releases a spin lock taken with AcquireLock().
+*
+* @param[in,out] pLock The lock.
+*
+* @return None.
+******************************************************************************/
+static void ReleaseLock(volatile long *pLock)
+{
+   ATOMIC_CLEAR(pLock);
+}
+
+/**************************************************************************//**
+* Doubles the number of buckets in the table of shared payloads.
+*
+* @param[in,out] pCtx The conversion context.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+static RESULT GrowBlobTable(RFT_CONTEXT *pCtx)
+{
+   U32 numBuckets = pCtx->numBuckets ? pCtx->numBuckets * 2 : 1024, i;
+   BLOB **ppBlobs, *pBlob, *pNext;
+
+   ppBlobs = (BLOB **) calloc(numBuckets, sizeof(BLOB *));
+   if (ppBlobs == NULL)
+   {
+      ReportError("ERROR: Out of memory.\n");
+      return NO_MEMORY;
+   }
+
+   for (i = 0; i < pCtx->numBuckets; i++)
+   {
+      for (pBlob = pCtx->ppBlobs[i]; pBlob; pBlob = pNext)
+      {
+         pNext = pBlob->pNext;
+         pBlob->pNext = ppBlobs[pBlob->hash & (numBuckets - 1)];
+         ppBlobs[pBlob->hash & (numBuckets - 1)] = pBlob;
+      }
+   }
+
+   free(pCtx->ppBlobs);
+   pCtx->ppBlobs = ppBlobs;
+   pCtx->numBuckets = numBuckets;
+
+   return OK;
+}
+
+/**************************************************************************//**
+* Finds the shared copy of a segment payload, adding one if it is new.
+*
+* Payloads are matched by hash, and then compared byte for byte, so a hash
+* collision never merges different data.
+*
+* @param[in,out] pCtx The conversion context.
+* @param[in] pData The payload.
+* @param[in] len The length of the payload, in bytes.
+* @param[out] ppShared The shared copy of the payload.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+static RESULT InternData(RFT_CONTEXT *pCtx, const U8 *pData, U32 len, const U8 **ppShared)
+{
+   U32 hash = HashData(pData, len);
+   BLOB *pBlob, **ppBucket;
+   RESULT r;
+
+   if (pCtx->dedup.numBlobs >= pCtx->numBuckets)
+   {
+      r = GrowBlobTable(pCtx);
+      if (r != OK)
+      {
+         return r;
+      }
+   }
+
+   ppBucket = &pCtx->ppBlobs[hash & (pCtx->numBuckets - 1)];
+   for (pBlob = *ppBucket; pBlob; pBlob = pBlob->pNext)
+   {
+      if (pBlob->hash != hash || pBlob->len != len)
+      {
+         continue;
+      }
+
+      if (memcmp(pBlob->data, pData, len) == 0)
+      {
+         pCtx->dedup.numShared++;
+         pCtx->dedup.savedBytes += len;
+         *ppShared = pBlob->data;
+         return OK;
+      }
+
+      pCtx->dedup.numCollisions++;
+   }
+
+   pBlob = (BLOB *) malloc(sizeof(BLOB) + len);
+   if (pBlob == NULL)
+   {
+      ReportError("ERROR: Out of memory.\n");
+      return NO_MEMORY;
+   }
+
+   pBlob->hash = hash;
+   pBlob->len = len;
+   memcpy(pBlob->data, pData, len);
+   pBlob->pNext = *ppBucket;
+   *ppBucket = pBlob;
+
+   pCtx->dedup.numBlobs++;
+   pCtx->dedup.blobBytes += len;
+   *ppShared = pBlob->data;
+
+   return OK;
+}
+
+/**************************************************************************//**
+* Appends a segment to a run.
+*
+* @param[in,out] pRun The run.
+* @param[in] pSeg The segment, which the run takes on success.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+static RESULT AppendSegment(SEG_RUN *pRun, SEGMENT *pSeg)
+{
+   RUN_ENTRY *pEntry, *pNew;
+   U32 maxEntries;
+
+   if (pRun->numEntries == pRun->maxEntries)
+   {
+      maxEntries = pRun->maxEntries ? pRun->maxEntries * 2 : RUN_LEN;
+      pNew = (RUN_ENTRY *) realloc(pRun->pEntries, maxEntries * sizeof(RUN_ENTRY));
+      if (pNew == NULL)
+      {
+         ReportError("ERROR: Out of memory.\n");
+         return NO_MEMORY;
+      }
+      pRun->pEntries = pNew;
+      pRun->maxEntries = maxEntries;
+   }
+
+   pEntry = &pRun->pEntries[pRun->numEntries];
+   pEntry->addr = pSeg->addr;
+   pEntry->len = pSeg->len;
+   pEntry->seq = pRun->numEntries++;
+   pEntry->pSegStart = pSeg;
+   pEntry->pSegEnd = pSeg;
+
+   return OK;
+}
+
+/**************************************************************************//**
+* Appends a segment which refers to a shared payload to a run.
+*
+* @param[in,out] pRun The run.
+* @param[in] addr The address of the data.
+* @param[in] pShared The shared payload.
+* @param[in] len The length of the data, in bytes.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+static RESULT AppendShared(SEG_RUN *pRun, U32 addr, const U8 *pShared, U32 len)
+{
+   SEGMENT *pSeg;
+   RESULT r;
+
+   pSeg = AllocSegment(0);
+   if (pSeg == NULL)
+   {
+      ReportError("ERROR: Out of memory.\n");
+      return NO_MEMORY;
+   }
+
+   pSeg->addr = addr;
+   pSeg->len = len;
+   pSeg->pData = (U8 *) pShared;
+
+   r = AppendSegment(pRun, pSeg);
+   if (r != OK)
+   {
+      free(pSeg);
+   }
+
+   return r;
+}
+
+/**************************************************************************//**
+* Appends the segment being built from adjacent records to its run, giving
+* back the room it was not needed for. With deduplication, the segment's data
+* is replaced by its shared payload.
+*
+* @param[in,out] pRun The run.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+static RESULT FlushPending(SEG_RUN *pRun)
+{
+   SEGMENT *pSeg = pRun->pPending, *pSmall;
+   const U8 *pShared;
+   RESULT r;
+
+   if (pSeg == NULL)
+   {
+      return OK;
+   }
+   pRun->pPending = NULL;
+
+   if (pRun->pInternCtx != NULL)
+   {
+      if (pRun->pInternLock != NULL)
+      {
+         AcquireLock(pRun->pInternLock);
+      }
+      r = InternData(pRun->pInternCtx, pSeg->pData, pSeg->len, &pShared);
+      if (pRun->pInternLock != NULL)
+      {
+         ReleaseLock(pRun->pInternLock);
+      }
+
+      if (r == OK)
+      {
+         r = AppendShared(pRun, pSeg->addr, pShared, pSeg->len);
+      }
+
+      free(pSeg);
+      return r;
+   }
+
+   pSmall = (SEGMENT *) realloc(pSeg, sizeof(SEGMENT) + pSeg->len);
+   if (pSmall != NULL)
+   {
+      pSeg = pSmall;
+      pSeg->pData = (U8 *) (pSeg + 1);
+   }
+
+   r = AppendSegment(pRun, pSeg);
+   if (r != OK)
+   {
+      free(pSeg);
+   }
+
+   return r;
+}
+
+/**************************************************************************//**
+* Appends a copy of a decoded block of data to a run. Blocks which follow on
+* from each other are joined into large segments, so the run holds few entries.
+*
+* With deduplication, the segments are filled to exactly RUN_SEG_LEN bytes, so
+* that the same data is cut into the same payloads however its records were
+* split. Otherwise, a block too long for one segment gets a segment of its own.
+*
+* @param[in,out] pRun The run.
+* @param[in] addr The address of the data.
+* @param[in] pData The data.
+* @param[in] len The length of the data, in bytes.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+static RESULT AppendRecord(SEG_RUN *pRun, U32 addr, const U8 *pData, U32 len)
+{
+   int dedup = pRun->pInternCtx != NULL;
+   SEGMENT *pSeg;
+   U32 take;
+   RESULT r;
+
+   while (len)
+   {
+      pSeg = pRun->pPending;
+      if (pSeg == NULL || addr != pSeg->addr + pSeg->len || pSeg->len == RUN_SEG_LEN ||
+         (!dedup && pSeg->len + len > RUN_SEG_LEN))
+      {
+         r = FlushPending(pRun);
+         if (r != OK)
+         {
+            return r;
+         }
+
+         pSeg = AllocSegment(!dedup && len > RUN_SEG_LEN ? len : RUN_SEG_LEN);
+         if (pSeg == NULL)
+         {
+            ReportError("ERROR: Out of memory.\n");
+            return NO_MEMORY;
+         }
+
+         pSeg->addr = addr;
+         pSeg->len = 0;
+         pRun->pPending = pSeg;
+      }
+
+      take = dedup && len > RUN_SEG_LEN - pSeg->len ? RUN_SEG_LEN - pSeg->len : len;
+      memcpy(&pSeg->pData[pSeg->len], pData, take);
+      pSeg->len += take;
+      addr += take;
+      pData += take;
+      len -= take;
+   }
+
+   return OK;
+}
+
+/**************************************************************************//**
+* Adds a decoded block of data to a context. This is the visitor used when
+* loading inputs into a context.
+*
+* The block joins the run of the input being loaded, which is merged into the
+* ranges once the whole input is loaded: see FinishLoad().
+*
+* @param[in,out] pUser The conversion context.
+* @param[in] addr The address of the data.
+* @param[in] pData The data.
+* @param[in] len The length of the data, in bytes.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+static RESULT AddRecord(void *pUser, U32 addr, const U8 *pData, U32 len)
+{
+   RFT_CONTEXT *pCtx = (RFT_CONTEXT *) pUser;
+
+   return AppendRecord(&pCtx->run, addr, pData, len);
+}
+
+/**************************************************************************//**
+* Compares two entries of a run by address, and then by the order they were
+* loaded in.
+*
+* @param[in] pA The first RUN_ENTRY.
+* @param[in] pB The second RUN_ENTRY.
+*
+* @return Less than, equal to, or greater than zero, as for qsort().
+******************************************************************************/
+static int CompareRunEntries(const void *pA, const void *pB)
+{
+   const RUN_ENTRY *pEntryA = (const RUN_ENTRY *) pA;
+   const RUN_ENTRY *pEntryB = (const RUN_ENTRY *) pB;
+
+   if (pEntryA->addr != pEntryB->addr)
+   {
+      return pEntryA->addr < pEntryB->addr ? -1 : 1;
+   }
+
+   return pEntryA->seq < pEntryB->seq ? -1 : (pEntryA->seq > pEntryB->seq);
+}
+
+/**************************************************************************//**
+* Sorts a run once its input is loaded, and chains each segment to the one
+* before it when they are adjacent.
+*
+* Most inputs are already in address order, and are only checked. Segments
+* which overlap are left apart, for MergeSegRuns() to report.
+*
+* @param[in,out] pRun The run.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+static RESULT SortSegRun(SEG_RUN *pRun)
+{
+   RUN_ENTRY *pEntries, *pLast;
+   U32 i, n;
+   RESULT r;
+
+   r = FlushPending(pRun);
+   if (r != OK)
+   {
+      return r;
+   }
+
+   pEntries = pRun->pEntries;
+   for (i = 1; i < pRun->numEntries && pEntries[i - 1].addr <= pEntries[i].addr; i++);
+   if (i < pRun->numEntries)
+   {
+      qsort(pEntries, pRun->numEntries, sizeof(RUN_ENTRY), CompareRunEntries);
+   }
+
+   for (i = 0, n = 0; i < pRun->numEntries; i++)
+   {
+      pEntries[i].pSegEnd->pNext = NULL;
+      pLast = n ? &pEntries[n - 1] : NULL;
+
+      if (pLast && (U64) pLast->addr + pLast->len == pEntries[i].addr)
+      {
+         pLast->len += pEntries[i].len;
+         pLast->pSegEnd->pNext = pEntries[i].pSegStart;
+         pLast->pSegEnd = pEntries[i].pSegEnd;
+      }
+      else
+      {
+         pEntries[n++] = pEntries[i];
+      }
+   }
+
+   pRun->numEntries = n;
+   pRun->next = 0;
+
+   return OK;
+}
+
+/**************************************************************************//**
+* Releases the memory held by a run, leaving it empty.
+*
+* @param[in,out] pRun The run.
+* @param[in] freeSegs Non-zero to release the segments too, which is only done
+*    when they have not been merged into a context.
+*
+* @return None.
+******************************************************************************/
+static void FreeSegRun(SEG_RUN *pRun, int freeSegs)
+{
+   SEGMENT *pSeg, *pNext;
+   U32 i;
+
+   for (i = 0; freeSegs && i < pRun->numEntries; i++)
+   {
+      for (pSeg = pRun->pEntries[i].pSegStart; pSeg; pSeg = pNext)
+      {
+         pNext = pSeg == pRun->pEntries[i].pSegEnd ? NULL : pSeg->pNext;
+         free(pSeg);
+      }
+   }
+
+   free(pRun->pEntries);
+   free(pRun->pPending);
+
+   pRun->pEntries = NULL;
+   pRun->numEntries = 0;
+   pRun->maxEntries = 0;
+   pRun->next = 0;
+   pRun->pPending = NULL;
+}
+
+/**************************************************************************//**
+* Compares the next entries of two sorted runs being merged, by address and
+* then by the order of their inputs.
+*
+* @param[in] pA The first run.
+* @param[in] pB The second run.
+*
+* @return Non-zero if the first run's entry comes first.
+******************************************************************************/
+static int RunPrecedes(const SEG_RUN *pA, const SEG_RUN *pB)
+{
+   U32 addrA = pA->pEntries[pA->next].addr, addrB = pB->pEntries[pB->next].addr;
+
+   return addrA < addrB || (addrA == addrB && pA->input < pB->input);
+}
+
+/**************************************************************************//**
+* Restores the heap order of the sorted runs being merged, from one run down.
+*
+* @param[in,out] ppHeap The runs, as a heap ordered by their next entries.
+* @param[in] num The number of runs in the heap.
+* @param[in] i The run which may be out of order.
+*
+* @return None.
+******************************************************************************/
+static void SiftRun(SEG_RUN **ppHeap, U32 num, U32 i)
+{
+   SEG_RUN *pRun = ppHeap[i];
+   U32 child;
+
+   while ((child = i * 2 + 1) < num)
+   {
+      if (child + 1 < num && RunPrecedes(ppHeap[child + 1], ppHeap[child]))
+      {
+         child++;
+      }
+
+      if (!RunPrecedes(ppHeap[child], pRun))
+      {
+         break;
+      }
+
+      ppHeap[i] = ppHeap[child];
+      i = child;
+   }
+
+   ppHeap[i] = pRun;
+}
+
+/**************************************************************************//**
+* Starts a k-way merge of sorted runs, from their first entries.
+*
+* @param[in,out] ppRuns The runs, which are reordered into a heap.
+* @param[in] numRuns The number of runs.
+*
+* @return The number of runs in the heap, which leaves out the empty ones.
+******************************************************************************/
+static U32 StartRunMerge(SEG_RUN **ppRuns, U32 numRuns)
+{
+   SEG_RUN *pTemp;
+   U32 i, num = 0;
+
+   /* Empty runs are moved past the end of the heap. */
+   for (i = 0; i < numRuns; i++)
+   {
+      ppRuns[i]->next = 0;
+      if (ppRuns[i]->numEntries)
+      {
+         pTemp = ppRuns[num];
+         ppRuns[num++] = ppRuns[i];
+         ppRuns[i] = pTemp;
+      }
+   }
+
+   for (i = num; i-- > 0; )
+   {
+      SiftRun(ppRuns, num, i);
+   }
+
+   return num;
+}
+
+/**************************************************************************//**
+* Takes the next entry of a k-way merge of sorted runs.
+*
+* @param[in,out] ppHeap The runs, as a heap ordered by their next entries.
+*    A run which runs out is moved past the end of the heap.
+* @param[in,out] pNum The number of runs in the heap, which must not be 0.
+* @param[out] ppRun The run which the entry came from.
+*
+* @return The entry.
+******************************************************************************/
+static RUN_ENTRY *NextRunEntry(SEG_RUN **ppHeap, U32 *pNum, const SEG_RUN **ppRun)
+{
+   SEG_RUN *pRun = ppHeap[0];
+   RUN_ENTRY *pEntry = &pRun->pEntries[pRun->next++];
+
+   if (pRun->next == pRun->numEntries)
+   {
+      ppHeap[0] = ppHeap[--(*pNum)];
+      ppHeap[*pNum] = pRun;
+   }
+   if (*pNum)
+   {
+      SiftRun(ppHeap, *pNum, 0);
+   }
+
+   *ppRun = pRun;
+   return pEntry;
+}
+
+/**************************************************************************//**
+* Merges sorted runs into a context's ranges, with a k-way merge.
+*
+* The runs and the ranges already loaded are walked together in address order,
+* and then by input order, so the image built and any overlap reported do not
+* depend on the order the runs were loaded in. The first walk checks for
+* overlaps and counts the ranges needed, so that nothing can fail in the
+* second, which joins adjacent segments and ranges as it goes.
+*
+* @param[in,out] pCtx The conversion context.
+* @param[in,out] ppRuns The sorted runs, which are reordered. The context takes
+*    their segments on success.
+* @param[in] numRuns The number of runs.
+* @param[in] pInputs The inputs which the runs came from, to name in messages,
+*    or NULL for a single input which has no name.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+static RESULT MergeSegRuns(RFT_CONTEXT *pCtx, SEG_RUN **ppRuns, U32 numRuns,
+   const RFT_INPUT *pInputs)
+{
+   RANGE *pRange, *pNext, *pFree = NULL, *pLast = NULL, **ppPrev;
+   const SEG_RUN *pRun, *pPrevRun = NULL;
+   RUN_ENTRY *pEntry;
+   U64 end, prevEnd = 0;
+   U32 num, numNew = 0, addr, len;
+   int havePrev = 0;
+
+   num = StartRunMerge(ppRuns, numRuns);
+   pRange = pCtx->pAllRanges;
+   while (num || pRange)
+   {
+      if (pRange && (num == 0 || pRange->addr <= ppRuns[0]->pEntries[ppRuns[0]->next].addr))
+      {
+         pRun = NULL;
+         addr = pRange->addr;
+         len = pRange->len;
+         pRange = pRange->pNext;
+      }
+      else
+      {
+         pEntry = NextRunEntry(ppRuns, &num, &pRun);
+         addr = pEntry->addr;
+         len = pEntry->len;
+      }
+
+      if (havePrev && addr < prevEnd)
+      {
+         if (pInputs == NULL)
+         {
+            ReportError("ERROR: A segment at 0x%X overlaps a previous segment.\n", addr);
+         }
+         else if (pRun && pPrevRun && pRun->input == pPrevRun->input)
+         {
+            ReportError("ERROR: Two segments of \"%s\" overlap at 0x%X.\n",
+               pInputs[pRun->input].pName, addr);
+         }
+         else if (pRun && pPrevRun)
+         {
+            ReportError("ERROR: A segment of \"%s\" at 0x%X overlaps a segment of \"%s\".\n",
+               pInputs[pRun->input].pName, addr, pInputs[pPrevRun->input].pName);
+         }
+         else
+         {
+            ReportError("ERROR: A segment of \"%s\" at 0x%X overlaps a segment loaded before.\n",
+               pInputs[(pRun ? pRun : pPrevRun)->input].pName, addr);
+         }
+         return OVERLAPPING_SEGMENT;
+      }
+
+      /* A segment which does not follow on from what came before starts a new range. */
+      end = (U64) addr + len;
+      if (pRun && (!havePrev || addr != prevEnd))
+      {
+         numNew++;
+      }
+
+      havePrev = 1;
+      pPrevRun = pRun;
+      prevEnd = end;
+   }
+
+   /* Allocate the new ranges up front, so that running out of memory changes nothing. */
+   while (numNew--)
+   {
+      pNext = (RANGE *) malloc(sizeof(RANGE));
+      if (pNext == NULL)
+      {
+         ReportError("ERROR: Out of memory.\n");
+         for (; pFree; pFree = pNext)
+         {
+            pNext = pFree->pNext;
+            free(pFree);
+         }
+         return NO_MEMORY;
+      }
+      pNext->pNext = pFree;
+      pFree = pNext;
+   }
+
+   num = StartRunMerge(ppRuns, numRuns);
+   pRange = pCtx->pAllRanges;
+   ppPrev = &pCtx->pAllRanges;
+   while (num || pRange)
+   {
+      if (pRange && (num == 0 || pRange->addr <= ppRuns[0]->pEntries[ppRuns[0]->next].addr))
+      {
+         pNext = pRange->pNext;
+
+         /* A range loaded before which now follows on from the last one joins it. */
+         if (pLast && pLast->addr + pLast->len == pRange->addr)
+         {
+            pLast->len += pRange->len;
+            pLast->pSegEnd->pNext = pRange->pSegStart;
+            pLast->pSegEnd = pRange->pSegEnd;
+            pCtx->numRanges--;
+            free(pRange);
+         }
+         else
+         {
+            *ppPrev = pRange;
+            ppPrev = &pRange->pNext;
+            pLast = pRange;
+         }
+
+         pRange = pNext;
+         continue;
+      }
+
+      pEntry = NextRunEntry(ppRuns, &num, &pRun);
+      pCtx->dataBytes += pEntry->len;
+
+      if (pLast && pLast->addr + pLast->len == pEntry->addr)
+      {
+         pLast->len += pEntry->len;
+         pLast->pSegEnd->pNext = pEntry->pSegStart;
+         pLast->pSegEnd = pEntry->pSegEnd;
+         continue;
+      }
+
+      pLast = pFree;
+      pFree = pFree->pNext;
+      pLast->addr = pEntry->addr;
+      pLast->len = pEntry->len;
+      pLast->pSegStart = pEntry->pSegStart;
+      pLast->pSegEnd = pEntry->pSegEnd;
+      *ppPrev = pLast;
+      ppPrev = &pLast->pNext;
+      pCtx->numRanges++;
+   }
+   *ppPrev = NULL;
+
+   return OK;
+}
+
+/**************************************************************************//**
+* Sets the program's execution starting address of a context.
+*
+* @param[in,out] pUser The conversion context.
+* @param[in] addr The starting address.
+*
+* @return OK.
+******************************************************************************/
+static RESULT SetStartAddr(void *pUser, U32 addr)
+{
+   ((RFT_CONTEXT *) pUser)->startAddr = addr;
+   return OK;
+}
+
+/**************************************************************************//**
+* Loads a raw binary file.
+*
+* @param[in] pIn The input to read from.
+* @param[in] pOpts The file options for this file type.
+* @param[in] pVisitor Receives the data.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+static RESULT LoadBinFile(IN_BUF* pIn, const FILE_OPTS_BIN *pOpts, const RFT_VISITOR *pVisitor)
+{
+   if (pOpts == NULL || !pOpts->addrSpecified)
+   {
+      ReportError("ERROR: Missing start address (A=<ADDR>).\n");
+      return INVALID_ARGUMENTS;
+   }
+
+   if (pIn->pCur == pIn->pEnd)
+   {
+      return OK;
+   }
+
+   /* The whole file is one block of data. */
+   return pVisitor->pfnData(pVisitor->pUser, pOpts->startAddr, pIn->pCur,
+      (U32) (pIn->pEnd - pIn->pCur));
+}
+
+/**************************************************************************//**
+* Loads an Intel HEX file.
+*
+* Each record is decoded into a buffer on the stack, and is passed to the
+* visitor once its checksum has been validated.
+*
+* @param[in] pIn The input to read from.
+* @param[in] pVisitor Receives the data.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+static RESULT LoadHexFile(IN_BUF* pIn, const RFT_VISITOR *pVisitor)
+{
+   RESULT r;
+   const U8 *pRec;
+   U8 recType, byteCount;
+   U8 chkSumActual, chkSumFile;
+   U16 addr16, extAddr = 0, segAddr = 0;
+   U32 i, addr = 0, recStart = 0;
+   U8 data[255];
+   U8 endRecordFound = 0;
+
+   while (1)
+   {
+      /* Find a record, which always starts with a ':'. */
+      pRec = (const U8 *) memchr(pIn->pCur, ':', pIn->pEnd - pIn->pCur);
+      if (pRec == NULL)
+      {
+         pIn->pCur = pIn->pEnd;
+         if (MoreInput(pIn))
+         {
+            continue;
+         }
+         break;
+      }
+      pIn->pCur = pRec + 1;
+
+      /* There should only be one end record at the very last entry. */
+      if (endRecordFound)
+      {
+         ReportError("Multiple end records encountered.\n");
+         return END_RECORD_ERROR;
+      }
+
+      chkSumActual = 0;
+
+      /* Read the byte count. */
+      r = LoadU8(pIn, &byteCount, &chkSumActual);
+      if (r != OK)
+      {
+         return r;
+      }
+
+      /* Read the 16-bit address. */
+      r = LoadU16(pIn, &addr16, &chkSumActual);
+      if (r != OK)
+      {
+         return r;
+      }
+
+      /* Read the record type. */
+      r = LoadU8(pIn, &recType, &chkSumActual);
+      if (r != OK)
+      {
+         return r;
+      }
+
+      /* Handle the record. */
+      switch (recType)
+      {
+         case REC_DATA:
+         {
+            /* Compute the address depending on which addressing mode is used. */
+            if (segAddr != 0)
+            {
+               addr = (segAddr << 4) + addr16;
+            }
+            else
+            {
+               addr = (extAddr << 16) | addr16;
+            }
+
+            /* Read the data. */
+            for (i = 0; i < byteCount; i++)
+            {
+               r = LoadU8(pIn, &data[i], &chkSumActual);
+               if (r != OK)
+               {
+                  return r;
+               }
+            }
+
+            break;
+         }
+
+         case REC_EOF:
+         {
+            endRecordFound = 1;
+            break;
+         }
+
+         case REC_EXT_SEG_ADDR:
+         {
+            /* Make sure the extAddr is 0. Any given HEX file may only use segment addressing
+            or extended linear addressing, but not both. */
+            if (extAddr != 0)
+            {
+                  ReportError("ERROR: Both segment addressing and linear addressing used. Only one type or the other is supported.\n");
+                  return MIXED_ADDRESSING_MODES;
+            }
+
+            /* Read the 16-bit segment address. */
+            r = LoadU16(pIn, &segAddr, &chkSumActual);
+            if (r != OK)
+            {
+                  return r;
+            }
+            break;
+         }
+
+         case REC_START_SEG_ADDR:
+         {
+            U16 startSeg, startOfs;
+
+            /* Read the 16-bit segment of the starting address. */
+            r = LoadU16(pIn, &startSeg, &chkSumActual);
+            if (r != OK)
+            {
+               return r;
+            }
+
+            /* Read the 16-bit offset of the starting address with the segment. */
+            r = LoadU16(pIn, &startOfs, &chkSumActual);
+            if (r != OK)
+            {
+               return r;
+            }
+
+            /* Compute the 32-bit starting address using the segment and offset. */
+            recStart = (startSeg << 4) + startOfs;
+            break;
+         }
+
+         case REC_EXT_LIN_ADDR:
+         {
+            /* Make sure the segAddr is 0. Any given HEX file may only use segment addressing
+            or extended linear addressing, but not both. */
+            if (segAddr != 0)
+            {
+               ReportError("ERROR: Both segment addressing and linear addressing used. Only one type or the other is supported.\n");
+               return MIXED_ADDRESSING_MODES;
+            }
+
+            /* Read the upper 16-bits of the address. */
+            r = LoadU16(pIn, &extAddr, &chkSumActual);
+            if (r != OK)
+            {
+               return r;
+            }
+            break;
+         }
+
+         case REC_START_LIN_ADDR:
+         {
+            /* Read the 32-bit starting address. */
+            r = LoadU32(pIn, &recStart, &chkSumActual);
+            if (r != OK)
+            {
+               return r;
+            }
+            break;
+         }
+
+         default:
+         {
+            ReportError("ERROR: Invalid record type: %i.\n", recType);
+            return INVALID_RECORD_TYPE;
+         }
+      }
+
+      /* Read the checksum. */
+      r = LoadU8(pIn, &chkSumFile, NULL);
+      if (r != OK)
+      {
+         return r;
+      }
+
+      /* Validate the checksum. */
+      if (((~chkSumActual + 1) & 0xFF) != chkSumFile)
+      {
+         ReportError("ERROR: Checksum error.\n");
+         return CHECKSUM_ERROR;
+      }
+
+      /* Pass the validated record on. */
+      if (recType == REC_DATA && byteCount)
+      {
+         r = pVisitor->pfnData(pVisitor->pUser, addr, data, byteCount);
+      }
+      else if ((recType == REC_START_SEG_ADDR || recType == REC_START_LIN_ADDR) &&
+         pVisitor->pfnStart != NULL)
+      {
+         r = pVisitor->pfnStart(pVisitor->pUser, recStart);
+      }
+
+      if (r != OK)
+      {
+         return r;
+      }
+   }
+
+   /* Make sure and end record was processed. */
+   if (endRecordFound == 0)
+   {
+      ReportError("ERROR: No end record was found.\n");
+      return END_RECORD_ERROR;
+   }
+
+   return OK;
+}
+
+/**************************************************************************//**
+* Passes the data collected from a text format on to a visitor.
+*
+* @param[in] pVisitor Receives the data.
+* @param[in,out] pAddr The address of the data, which is advanced past it.
+* @param[in] pData The data.
+* @param[in,out] pLen The length of the data, which is reset to 0.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+static RESULT FlushData(const RFT_VISITOR *pVisitor, U32 *pAddr, const U8 *pData, U32 *pLen)
+{
+   RESULT r = OK;
+
+   if (*pLen)
+   {
+      r = pVisitor->pfnData(pVisitor->pUser, *pAddr, pData, *pLen);
+      *pAddr += *pLen;
+      *pLen = 0;
+   }
+
+   return r;
+}
+
+/**************************************************************************//**
+* Loads a TI-TXT file.
+*
+* The file holds "@ADDR" lines, each followed by lines of hex bytes separated
+* by white space, and ends with a "q". The bytes are collected into blocks of
+* up to 256 bytes before being passed to the visitor.
+*
+* @param[in] pIn The input to read from.
+* @param[in] pVisitor Receives the data.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+static RESULT LoadTiTxtFile(IN_BUF* pIn, const RFT_VISITOR *pVisitor)
+{
+   RESULT r;
+   U32 addr = 0, len = 0;
+   U8 data[256], c;
+   int addrFound = 0;
+
+   while (pIn->pCur < pIn->pEnd || MoreInput(pIn))
+   {
+      c = *pIn->pCur;
+
+      if (c == ' ' || c == '\t' || c == '\r' || c == '\n')
+      {
+         pIn->pCur++;
+      }
+      else if (c == '@')
+      {
+         /* A new address starts a new block. */
+         r = FlushData(pVisitor, &addr, data, &len);
+         if (r != OK)
+         {
+            return r;
+         }
+
+         pIn->pCur++;
+         if (pIn->pCur == pIn->pEnd || !hexValues[*pIn->pCur])
+         {
+            ReportError("ERROR: Invalid address.\n");
+            return INVALID_DATA;
+         }
+
+         for (addr = 0; pIn->pCur < pIn->pEnd && hexValues[*pIn->pCur]; pIn->pCur++)
+         {
+            addr = (addr << 4) | (hexValues[*pIn->pCur] & 0xF);
+         }
+         addrFound = 1;
+      }
+      else if (c == 'q' || c == 'Q')
+      {
+         return FlushData(pVisitor, &addr, data, &len);
+      }
+      else if (!addrFound)
+      {
+         ReportError("ERROR: Data found before the first address.\n");
+         return INVALID_DATA;
+      }
+      else
+      {
+         r = LoadU8(pIn, &data[len++], NULL);
+         if (r != OK)
+         {
+            return r;
+         }
+
+         if (len == sizeof(data))
+         {
+            r = FlushData(pVisitor, &addr, data, &len);
+            if (r != OK)
+            {
+               return r;
+            }
+         }
+      }
+   }
+
+   ReportError("ERROR: No end record was found.\n");
+   return END_RECORD_ERROR;
+}
+
+/**************************************************************************//**
+* Reads a number of ASCII hex digits from the given input, in MSB.
+*
+* Tektronix extended hex checksums are the sum of the values of the digits,
+* rather than of the bytes.
+*
+* @param[in,out] pIn The input from which to read.
+* @param[in] numDigits The number of digits to read, at most 8.
+* @param[out] pVal The value read.
+* @param[in,out] pChkSum A checksum variable to update.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+static RESULT LoadDigits(IN_BUF* pIn, U32 numDigits, U32* pVal, U8* pChkSum)
+{
+   U8 digit;
+
+   if ((size_t) (pIn->pEnd - pIn->pCur) < numDigits)
+   {
+      ReportError("Unexpected end of file.\n");
+      return END_OF_FILE;
+   }
+
+   for (*pVal = 0; numDigits--; pIn->pCur++)
+   {
+      digit = hexValues[*pIn->pCur];
+      if (!digit)
+      {
+         ReportError("Invalid hex digit.\n");
+         return INVALID_DATA;
+      }
+
+      *pVal = (*pVal << 4) | (digit & 0xF);
+      *pChkSum += digit & 0xF;
+   }
+
+   return OK;
+}
+
+/**************************************************************************//**
+* Loads a Tektronix extended hex file.
+*
+* Each record is "%", the record length, type and checksum, then the address
+* length and address, then any data. Symbol records are skipped.
+*
+* @param[in] pIn The input to read from.
+* @param[in] pVisitor Receives the data.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+static RESULT LoadTekFile(IN_BUF* pIn, const RFT_VISITOR *pVisitor)
+{
+   RESULT r;
+   const U8 *pRec;
+   U32 recLen, recType, chkSumFile, addrLen, addr, val, dataLen, i;
+   U8 chkSumActual, unused = 0;
+   U8 data[128];
+
+   while (1)
+   {
+      /* Find a record, which always starts with a '%'. */
+      pRec = (const U8 *) memchr(pIn->pCur, '%', pIn->pEnd - pIn->pCur);
+      if (pRec == NULL)
+      {
+         pIn->pCur = pIn->pEnd;
+         if (MoreInput(pIn))
+         {
+            continue;
+         }
+         break;
+      }
+      pIn->pCur = pRec + 1;
+
+      chkSumActual = 0;
+
+      /* Read the record length, the record type, and the checksum. */
+      r = LoadDigits(pIn, 2, &recLen, &chkSumActual);
+      if (r == OK) r = LoadDigits(pIn, 1, &recType, &chkSumActual);
+      if (r == OK) r = LoadDigits(pIn, 2, &chkSumFile, &unused);
+      if (r != OK)
+      {
+         return r;
+      }
+
+      /* Symbol records hold no data. */
+      if (recType == 3)
+      {
+         pIn->pCur = pRec + 1 + recLen > pIn->pEnd ? pIn->pEnd : pRec + 1 + recLen;
+         continue;
+      }
+
+      /* Read the address. */
+      r = LoadDigits(pIn, 1, &addrLen, &chkSumActual);
+      if (r == OK && (addrLen == 0 || addrLen > 8 || recLen < 6 + addrLen || ((recLen - 6 - addrLen) & 1)))
+      {
+         ReportError("ERROR: Invalid record length.\n");
+         r = INVALID_DATA;
+      }
+      if (r == OK) r = LoadDigits(pIn, addrLen, &addr, &chkSumActual);
+      if (r != OK)
+      {
+         return r;
+      }
+
+      /* Read the data. */
+      dataLen = (recLen - 6 - addrLen) / 2;
+      for (i = 0; i < dataLen; i++)
+      {
+         r = LoadDigits(pIn, 2, &val, &chkSumActual);
+         if (r != OK)
+         {
+            return r;
+         }
+         data[i] = (U8) val;
+      }
+
+      /* Validate the checksum. */
+      if (chkSumActual != chkSumFile)
+      {
+         ReportError("ERROR: Checksum error.\n");
+         return CHECKSUM_ERROR;
+      }
+
+      switch (recType)
+      {
+         case 6:
+         {
+            if (dataLen)
+            {
+               r = pVisitor->pfnData(pVisitor->pUser, addr, data, dataLen);
+            }
+            break;
+         }
+
+         case 8:
+         {
+            /* The termination record holds the starting address, and ends the file. */
+            if (pVisitor->pfnStart != NULL)
+            {
+               return pVisitor->pfnStart(pVisitor->pUser, addr);
+            }
+            return OK;
+         }
+
+         default:
+         {
+            ReportError("ERROR: Invalid record type: %u.\n", recType);
+            return INVALID_RECORD_TYPE;
+         }
+      }
+
+      if (r != OK)
+      {
+         return r;
+      }
+   }
+
+   ReportError("ERROR: No end record was found.\n");
+   return END_RECORD_ERROR;
+}
+
+/**************************************************************************//**
+* Reads a little-endian value.
+*
+* @param[in] pIn Where to read the value.
+* @param[in] numBytes The number of bytes to read.
+*
+* @return The value.
+******************************************************************************/
+static U32 GetLittleEndian(const U8 *pIn, U32 numBytes)
+{
+   U32 val = 0;
+
+   while (numBytes--)
+   {
+      val = (val << 8) | pIn[numBytes];
+   }
+
+   return val;
+}
+
+/**************************************************************************//**
+* Writes a little-endian value.
+*
+* @param[out] pOut Where to write the value.
+* @param[in] val The value.
+* @param[in] numBytes The number of bytes to write.
+*
+* @return None.
+******************************************************************************/
+static void PutLittleEndian(U8 *pOut, U32 val, U32 numBytes)
+{
+   while (numBytes--)
+   {
+      *(pOut++) = (U8) val;
+      val >>= 8;
+   }
+}
+
+/**************************************************************************//**
+* Reads the segment headers of an Apple IIgs OMF load file, and chooses where
+* each segment is loaded.
+*
+* Segments with an ORG are loaded there. The others are loaded one after
+* another from the load address, each aligned to its ALIGN, and moved up to
+* the next boundary of its BANKSIZE rather than crossing one.
+*
+* @param[in] pIn The input to read from.
+* @param[in] pOpts The file options for this file type.
+* @param[out] pOmf The file's segments.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+static RESULT ReadOmfHeaders(const IN_BUF *pIn, const FILE_OPTS_OMF *pOpts, OMF_FILE *pOmf)
+{
+   const U8 *pHdr;
+   OMF_SEG *pSeg;
+   U32 i, segLen, version, bankSize, org, align, dispData;
+   U64 addr, next;
+
+   /* Count the segments, so that they can be kept in one array. */
+   for (pHdr = pIn->pCur; pHdr < pIn->pEnd; pHdr += segLen)
+   {
+      if (pIn->pEnd - pHdr < OMF_HEADER_LEN)
+      {
+         ReportError("ERROR: Truncated OMF segment header.\n");
+         return INVALID_DATA;
+      }
+
+      version = pHdr[0x0F];
+      segLen = GetLittleEndian(&pHdr[0x00], 4);
+      if (version == 1)
+      {
+         segLen = segLen > 0xFFFFFFFF / 512 ? 0 : segLen * 512;
+      }
+      else if (version != 2)
+      {
+         ReportError("ERROR: Unsupported OMF version: %u.\n", version);
+         return UNSUPPORTED;
+      }
+
+      if (segLen < OMF_HEADER_LEN || segLen > (U64) (pIn->pEnd - pHdr))
+      {
+         ReportError("ERROR: Invalid OMF segment length: %u.\n", segLen);
+         return INVALID_DATA;
+      }
+
+      pOmf->numSegs++;
+   }
+
+   pOmf->pSegs = (OMF_SEG *) calloc(pOmf->numSegs ? pOmf->numSegs : 1, sizeof(OMF_SEG));
+   if (pOmf->pSegs == NULL)
+   {
+      ReportError("ERROR: Out of memory.\n");
+      return NO_MEMORY;
+   }
+
+   next = pOpts != NULL && pOpts->addrSpecified ? pOpts->loadAddr : OMF_LOAD_ADDR;
+
+   for (pHdr = pIn->pCur, i = 0; i < pOmf->numSegs; pHdr = pSeg->pEnd, i++)
+   {
+      pSeg = &pOmf->pSegs[i];
+
+      version = pHdr[0x0F];
+      segLen = GetLittleEndian(&pHdr[0x00], 4) * (version == 1 ? 512 : 1);
+      pSeg->pEnd = pHdr + segLen;
+
+      if (pHdr[0x0E] != 4 || pHdr[0x20] != 0)
+      {
+         ReportError("ERROR: OMF numbers must be 4 bytes long, least significant byte first.\n");
+         return UNSUPPORTED;
+      }
+
+      dispData = GetLittleEndian(&pHdr[0x2A], 2);
+      if (dispData < OMF_HEADER_LEN || dispData > segLen)
+      {
+         ReportError("ERROR: Invalid OMF segment data offset: 0x%X.\n", dispData);
+         return INVALID_DATA;
+      }
+      pSeg->pBody = pHdr + dispData;
+
+      pSeg->len = GetLittleEndian(&pHdr[0x08], 4);
+      pSeg->segNum = GetLittleEndian(&pHdr[0x22], 2);
+      pSeg->entry = GetLittleEndian(&pHdr[0x24], 4);
+      bankSize = GetLittleEndian(&pHdr[0x10], 4);
+      org = GetLittleEndian(&pHdr[0x18], 4);
+      align = GetLittleEndian(&pHdr[0x1C], 4);
+
+      /* Version 1 keeps the KIND in one byte, and version 2 adds a skip flag. */
+      if (version == 1)
+      {
+         pSeg->kind = pHdr[0x0C] & 0x1F;
+         pSeg->loaded = 1;
+      }
+      else
+      {
+         pSeg->kind = pHdr[0x14] & 0x1F;
+         pSeg->loaded = !(pHdr[0x15] & 0x02);
+      }
+
+      if (pSeg->kind == OMF_KIND_JUMP_TABLE || pSeg->kind == OMF_KIND_PATHNAME ||
+         pSeg->kind == OMF_KIND_LIB_DICT)
+      {
+         pSeg->loaded = 0;
+      }
+
+      if (!pSeg->loaded)
+      {
+         continue;
+      }
+
+      if (align & (align - 1))
+      {
+         ReportError("ERROR: Invalid OMF segment alignment: 0x%X.\n", align);
+         return INVALID_DATA;
+      }
+
+      if (org != 0)
+      {
+         addr = org;
+      }
+      else
+      {
+         addr = align > 1 ? (next + align - 1) & ~(U64) (align - 1) : next;
+         if (bankSize != 0 && pSeg->len != 0 && pSeg->len <= bankSize &&
+            addr / bankSize != (addr + pSeg->len - 1) / bankSize)
+         {
+            addr = (addr / bankSize + 1) * bankSize;
+         }
+         next = addr + pSeg->len;
+      }
+
+      /* The 65816 has 24-bit addresses, which also bounds how much is built in memory. */
+      if (addr + pSeg->len > OMF_ADDR_SPACE)
+      {
+         ReportError("ERROR: OMF segment %u does not fit in the 24-bit address space.\n",
+            pSeg->segNum);
+         return ADDR_OUT_OF_RANGE;
+      }
+      pSeg->addr = (U32) addr;
+   }
+
+   return OK;
+}
+
+/**************************************************************************//**
+* Finds the address of a segment of an Apple IIgs OMF load file.
+*
+* @param[in] pOmf The file.
+* @param[in] segNum The number of the segment.
+* @param[out] pAddr The address the segment is loaded at.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+static RESULT FindOmfSeg(const OMF_FILE *pOmf, U32 segNum, U32 *pAddr)
+{
+   U32 i;
+
+   for (i = 0; i < pOmf->numSegs; i++)
+   {
+      if (pOmf->pSegs[i].segNum == segNum && pOmf->pSegs[i].loaded)
+      {
+         *pAddr = pOmf->pSegs[i].addr;
+         return OK;
+      }
+   }
+
+   ReportError("ERROR: Relocation to OMF segment %u, which is not loaded.\n", segNum);
+   return INVALID_DATA;
+}
+
+/**************************************************************************//**
+* Adds a relocation patch to the segment being loaded from an Apple IIgs OMF
+* load file.
+*
+* @param[in,out] pOmf The file.
+* @param[in] pSeg The segment being loaded.
+* @param[in] ofs The offset of the patch in the segment.
+* @param[in] val The address the patch refers to, before it is shifted.
+* @param[in] numBytes The number of bytes patched.
+* @param[in] shift The number of bits the address is shifted left, or right when negative.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+static RESULT AddOmfPatch(OMF_FILE *pOmf, const OMF_SEG *pSeg, U32 ofs, U32 val,
+   U32 numBytes, U8 shift)
+{
+   OMF_PATCH *pPatches, *pPatch;
+
+   if (numBytes == 0 || numBytes > OMF_MAX_PATCH_LEN || ofs > pSeg->len ||
+      numBytes > pSeg->len - ofs)
+   {
+      ReportError("ERROR: Invalid OMF relocation at offset 0x%X of segment %u.\n", ofs,
+         pSeg->segNum);
+      return INVALID_DATA;
+   }
+
+   if (pOmf->numPatches == pOmf->maxPatches)
+   {
+      pPatches = (OMF_PATCH *) realloc(pOmf->pPatches, (pOmf->maxPatches ?
+         pOmf->maxPatches * 2 : OMF_PATCHES_LEN) * sizeof(OMF_PATCH));
+      if (pPatches == NULL)
+      {
+         ReportError("ERROR: Out of memory.\n");
+         return NO_MEMORY;
+      }
+      pOmf->pPatches = pPatches;
+      pOmf->maxPatches = pOmf->maxPatches ? pOmf->maxPatches * 2 : OMF_PATCHES_LEN;
+   }
+
+   pPatch = &pOmf->pPatches[pOmf->numPatches];
+   pPatch->ofs = ofs;
+   pPatch->val = val;
+   pPatch->seq = pOmf->numPatches++;
+   pPatch->numBytes = (U8) numBytes;
+   pPatch->shift = (signed char) shift;
+
+   return OK;
+}
+
+/**************************************************************************//**
+* Adds the relocation patches of a SUPER record of an Apple IIgs OMF load file.
+*
+* The patches are listed by 256-byte page, and each refers to the offset
+* already held at the patched bytes. Only the relocations within the file are
+* supported: RELOC2, RELOC3, INTERSEG1, and INTERSEG13 to INTERSEG36.
+*
+* @param[in,out] pOmf The file.
+* @param[in] pSeg The segment being loaded.
+* @param[in] pImage The segment's data, so far.
+* @param[in] pRec The SUPER record's subrecords, after its type.
+* @param[in] len The length of the subrecords, in bytes.
+* @param[in] superType The type of the SUPER record.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+static RESULT AddOmfSuper(OMF_FILE *pOmf, const OMF_SEG *pSeg, const U8 *pImage,
+   const U8 *pRec, U32 len, U32 superType)
+{
+   const U8 *pEnd = pRec + len;
+   U32 page = 0, count, ofs, numBytes, segNum = 0, base = pSeg->addr, val;
+   U8 shift = 0;
+   RESULT r;
+
+   /* RELOC2 and RELOC3 are within the segment, and INTERSEG13 to INTERSEG36 name
+   the segment in their type. INTERSEG1 names it in the third patched byte. */
+   if (superType <= 2)
+   {
+      numBytes = superType == 0 ? 2 : 3;
+   }
+   else if (superType >= 14 && superType <= 37)
+   {
+      numBytes = 2;
+      segNum = superType < 26 ? superType - 13 : superType - 25;
+      shift = superType < 26 ? 0 : (U8) -16;
+      r = FindOmfSeg(pOmf, segNum, &base);
+      if (r != OK)
+      {
+         return r;
+      }
+   }
+   else
+   {
+      ReportError("ERROR: Unsupported OMF SUPER record type: %u.\n", superType);
+      return UNSUPPORTED;
+   }
+
+   while (pRec < pEnd)
+   {
+      count = *(pRec++);
+
+      /* A count with the top bit set skips pages with no patches. */
+      if (count & 0x80)
+      {
+         page += count & 0x7F;
+         continue;
+      }
+
+      if ((U32) (pEnd - pRec) < count + 1)
+      {
+         ReportError("ERROR: Truncated OMF SUPER record.\n");
+         return INVALID_DATA;
+      }
+
+      for (count++; count; count--)
+      {
+         ofs = page * 256 + *(pRec++);
+         if (ofs > pSeg->len || numBytes > pSeg->len - ofs)
+         {
+            ReportError("ERROR: Invalid OMF relocation at offset 0x%X of segment %u.\n", ofs,
+               pSeg->segNum);
+            return INVALID_DATA;
+         }
+
+         val = GetLittleEndian(&pImage[ofs], 2);
+         if (superType == 1)
+         {
+            val = GetLittleEndian(&pImage[ofs], 3);
+         }
+         else if (superType == 2)
+         {
+            r = FindOmfSeg(pOmf, pImage[ofs + 2], &base);
+            if (r != OK)
+            {
+               return r;
+            }
+         }
+
+         r = AddOmfPatch(pOmf, pSeg, ofs, base + val, numBytes, shift);
+         if (r != OK)
+         {
+            return r;
+         }
+      }
+      page++;
+   }
+
+   return OK;
+}
+
+/**************************************************************************//**
+* Orders the relocation patches of an Apple IIgs OMF segment by offset, and
+* then by position, for qsort().
+*
+* @param[in] pA The first OMF_PATCH.
+* @param[in] pB The second OMF_PATCH.
+*
+* @return Less than, equal to, or greater than zero, as for qsort().
+******************************************************************************/
+static int CompareOmfPatches(const void *pA, const void *pB)
+{
+   const OMF_PATCH *pPatchA = (const OMF_PATCH *) pA, *pPatchB = (const OMF_PATCH *) pB;
+
+   if (pPatchA->ofs != pPatchB->ofs)
+   {
+      return pPatchA->ofs < pPatchB->ofs ? -1 : 1;
+   }
+
+   return pPatchA->seq < pPatchB->seq ? -1 : (pPatchA->seq > pPatchB->seq);
+}
+
+/**************************************************************************//**
+* Builds the data of a segment of an Apple IIgs OMF load file, relocated to
+* its address.
+*
+* The data records are copied as they are read, and the relocation
+* dictionary is collected into a list of patches. The list is sorted by
+* offset, and applied in one pass over the data.
+*
+* @param[in,out] pOmf The file.
+* @param[in] pSeg The segment.
+* @param[out] pImage The segment's data, which is pSeg->len bytes long and all zeros.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+static RESULT LoadOmfSeg(OMF_FILE *pOmf, const OMF_SEG *pSeg, U8 *pImage)
+{
+   const U8 *pRec = pSeg->pBody;
+   const OMF_PATCH *pPatch;
+   U32 op, recLen, dataLen, base, val, pc = 0, i;
+   RESULT r = OK;
+
+   pOmf->numPatches = 0;
+
+   while (r == OK)
+   {
+      if (pRec >= pSeg->pEnd)
+      {
+         ReportError("ERROR: OMF segment %u has no END record.\n", pSeg->segNum);
+         return END_RECORD_ERROR;
+      }
+
+      /* Work out the length of the record, and of any data it holds. */
+      op = *pRec;
+      dataLen = 0;
+      switch (op)
+      {
+         case OMF_END:
+            recLen = 1;
+            break;
+
+         case OMF_RELOC:
+            recLen = 11;
+            break;
+
+         case OMF_INTERSEG:
+            recLen = 15;
+            break;
+
+         case OMF_DS:
+            recLen = 5;
+            break;
+
+         case OMF_CRELOC:
+            recLen = 7;
+            break;
+
+         case OMF_CINTERSEG:
+            recLen = 8;
+            break;
+
+         case OMF_LCONST:
+         case OMF_SUPER:
+            recLen = 5;
+            if (pSeg->pEnd - pRec >= 5)
+            {
+               dataLen = GetLittleEndian(&pRec[1], 4);
+            }
+            break;
+
+         default:
+            if (op > OMF_CONST_LAST)
+            {
+               ReportError("ERROR: Unsupported OMF record type: 0x%02X.\n", op);
+               return INVALID_RECORD_TYPE;
+            }
+            recLen = 1;
+            dataLen = op;
+            break;
+      }
+
+      if ((U64) recLen + dataLen > (U64) (pSeg->pEnd - pRec))
+      {
+         ReportError("ERROR: Truncated OMF record in segment %u.\n", pSeg->segNum);
+         return INVALID_DATA;
+      }
+
+      switch (op)
+      {
+         case OMF_END:
+            break;
+
+         case OMF_DS:
+            /* Reserved space is left as zeros. */
+            dataLen = GetLittleEndian(&pRec[1], 4);
+            if (dataLen > pSeg->len - pc)
+            {
+               ReportError("ERROR: OMF segment %u holds more than its length.\n", pSeg->segNum);
+               return INVALID_DATA;
+            }
+            pc += dataLen;
+            dataLen = 0;
+            break;
+
+         case OMF_LCONST:
+         default:
+            if (dataLen > pSeg->len - pc)
+            {
+               ReportError("ERROR: OMF segment %u holds more than its length.\n", pSeg->segNum);
+               return INVALID_DATA;
+            }
+            memcpy(&pImage[pc], &pRec[recLen], dataLen);
+            pc += dataLen;
+            break;
+
+         case OMF_RELOC:
+            r = AddOmfPatch(pOmf, pSeg, GetLittleEndian(&pRec[3], 4),
+               pSeg->addr + GetLittleEndian(&pRec[7], 4), pRec[1], pRec[2]);
+            break;
+
+         case OMF_CRELOC:
+            r = AddOmfPatch(pOmf, pSeg, GetLittleEndian(&pRec[3], 2),
+               pSeg->addr + GetLittleEndian(&pRec[5], 2), pRec[1], pRec[2]);
+            break;
+
+         case OMF_INTERSEG:
+            if (GetLittleEndian(&pRec[7], 2) != 1)
+            {
+               ReportError("ERROR: Relocations to other OMF files are not supported.\n");
+               return UNSUPPORTED;
+            }
+            r = FindOmfSeg(pOmf, GetLittleEndian(&pRec[9], 2), &base);
+            if (r == OK)
+            {
+               r = AddOmfPatch(pOmf, pSeg, GetLittleEndian(&pRec[3], 4),
+                  base + GetLittleEndian(&pRec[11], 4), pRec[1], pRec[2]);
+            }
+            break;
+
+         case OMF_CINTERSEG:
+            r = FindOmfSeg(pOmf, pRec[5], &base);
+            if (r == OK)
+            {
+               r = AddOmfPatch(pOmf, pSeg, GetLittleEndian(&pRec[3], 2),
+                  base + GetLittleEndian(&pRec[6], 2), pRec[1], pRec[2]);
+            }
+            break;
+
+         case OMF_SUPER:
+            if (dataLen == 0)
+            {
+               ReportError("ERROR: Truncated OMF SUPER record.\n");
+               return INVALID_DATA;
+            }
+            r = AddOmfSuper(pOmf, pSeg, pImage, &pRec[6], dataLen - 1, pRec[5]);
+            break;
+      }
+
+      if (op == OMF_END)
+      {
+         break;
+      }
+      pRec += recLen + dataLen;
+   }
+
+   if (r != OK)
+   {
+      return r;
+   }
+
+   /* Apply the patches in order of offset, so the data is walked once from start to end. */
+   if (pOmf->numPatches > 1)
+   {
+      qsort(pOmf->pPatches, pOmf->numPatches, sizeof(OMF_PATCH), CompareOmfPatches);
+   }
+   for (i = 0; i < pOmf->numPatches; i++)
+   {
+      pPatch = &pOmf->pPatches[i];
+      val = pPatch->shift >= 0 ? pPatch->val << (pPatch->shift & 31) :
+         pPatch->val >> (-pPatch->shift & 31);
+      PutLittleEndian(&pImage[pPatch->ofs], val, pPatch->numBytes);
+   }
+
+   return OK;
+}
+
+/**************************************************************************//**
+* Loads an Apple IIgs OMF load file.
+*
+* Each segment is relocated to the address chosen for it, and passed to the
+* visitor as one block of data. The starting address is the entry point of
+* the first code segment.
+*
+* @param[in] pIn The input to read from.
+* @param[in] pOpts The file options for this file type.
+* @param[in] pVisitor Receives the data.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+static RESULT LoadOmfFile(IN_BUF* pIn, const FILE_OPTS_OMF *pOpts, const RFT_VISITOR *pVisitor)
+{
+   OMF_FILE omf;
+   OMF_SEG *pSeg;
+   U8 *pImage;
+   int startFound = 0;
+   U32 i;
+   RESULT r;
+
+   memset(&omf, 0, sizeof(omf));
+
+   r = ReadOmfHeaders(pIn, pOpts, &omf);
+
+   for (i = 0; r == OK && i < omf.numSegs; i++)
+   {
+      pSeg = &omf.pSegs[i];
+      if (!pSeg->loaded)
+      {
+         continue;
+      }
+
+      pImage = (U8 *) calloc(pSeg->len ? pSeg->len : 1, 1);
+      if (pImage == NULL)
+      {
+         ReportError("ERROR: Out of memory.\n");
+         r = NO_MEMORY;
+         break;
+      }
+
+      r = LoadOmfSeg(&omf, pSeg, pImage);
+      if (r == OK && pSeg->len)
+      {
+         r = pVisitor->pfnData(pVisitor->pUser, pSeg->addr, pImage, pSeg->len);
+      }
+      free(pImage);
+
+      if (r == OK && !startFound && pSeg->kind == OMF_KIND_CODE)
+      {
+         startFound = 1;
+         if (pVisitor->pfnStart != NULL)
+         {
+            r = pVisitor->pfnStart(pVisitor->pUser, pSeg->addr + pSeg->entry);
+         }
+      }
+   }
+
+   free(omf.pSegs);
+   free(omf.pPatches);
+   pIn->pCur = pIn->pEnd;
+
+   return r;
+}
+
+/**************************************************************************//**
+* Reads the whole contents of a file descriptor into a new segment.
+*
+* @param[in] fd The file descriptor to read.
+* @param[out] ppSeg The segment holding the data. The caller must free it.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+static RESULT ReadFdData(int fd, SEGMENT **ppSeg)
+{
+   SEGMENT *pSeg = NULL, *pNew;
+   U32 len = 0, size = 0;
+   int n;
+
+   do
+   {
+      /* Grow the segment as needed, since the size may not be known up front. */
+      if (len + FD_READ_LEN > size)
+      {
+         if (size > 0x80000000 - FD_READ_LEN)
+         {
+            ReportError("ERROR: The input is 4 GB or more, which is too large to load.\n");
+            free(pSeg);
+            return LEN_OUT_OF_RANGE;
+         }
+
+         size = size ? size * 2 : FD_READ_LEN;
+         pNew = (SEGMENT *) realloc(pSeg, sizeof(SEGMENT) + size);
+         if (pNew == NULL)
+         {
+            ReportError("ERROR: Out of memory.\n");
+            free(pSeg);
+            return NO_MEMORY;
+         }
+         pSeg = pNew;
+         pSeg->pData = (U8 *) (pSeg + 1);
+      }
+
+      n = FD_READ(fd, &pSeg->pData[len], FD_READ_LEN);
+      if (n < 0)
+      {
+         ReportError("File read error.\n");
+         free(pSeg);
+         return IO_ERROR;
+      }
+      len += n;
+   } while (n > 0);
+
+   pSeg->len = len;
+   pSeg->pNext = NULL;
+   *ppSeg = pSeg;
+
+   return OK;
+}
+
+/**************************************************************************//**
+* Opens an input file, and gets its size.
+*
+* The file is read into memory whole, so it must be less than 4 GB. Larger text
+* inputs can be loaded with an external sort, which maps them instead.
+*
+* @param[in] pName The name of the file to open.
+* @param[out] ppFile The open file. The caller must close it.
+* @param[out] pLen The size of the file, in bytes.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+static RESULT OpenInputFile(const char *pName, FILE **ppFile, U32 *pLen)
+{
+   FILE *inFile;
+   long long size;
+
+   inFile = fopen(pName, "rb");
+   if (!inFile)
+   {
+      ReportError("Unable to open the input file \"%s\".\n", pName);
+      return CANNOT_OPEN_FILE;
+   }
+
+   /* Get the size of the file to load. */
+#ifdef _WIN32
+   _fseeki64(inFile, 0, SEEK_END);
+   size = _ftelli64(inFile);
+#else
+   fseeko(inFile, 0, SEEK_END);
+   size = ftello(inFile);
+#endif
+   fseek(inFile, 0, SEEK_SET);
+
+   if (size < 0)
+   {
+      ReportError("File read error.\n");
+      fclose(inFile);
+      return IO_ERROR;
+   }
+
+   if (size > 0xFFFFFFFF)
+   {
+      ReportError("ERROR: \"%s\" is 4 GB or more, which is too large to load. Text inputs "
+         "this large can be loaded with an external sort.\n", pName);
+      fclose(inFile);
+      return LEN_OUT_OF_RANGE;
+   }
+
+   *pLen = (U32) size;
+   *ppFile = inFile;
+   return OK;
+}
+
+/**************************************************************************//**
+* Reads a whole file into a new segment.
+*
+* @param[in] pName The name of the file to read.
+* @param[out] ppSeg The segment holding the data. The caller must free it.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+static RESULT ReadFileData(const char *pName, SEGMENT **ppSeg)
+{
+   SEGMENT *pSeg;
+   FILE *inFile;
+   U32 numBytes;
+   RESULT r;
+
+   r = OpenInputFile(pName, &inFile, &numBytes);
+   if (r != OK)
+   {
+      return r;
+   }
+
+   /* Allocate a new segment to hold the data. */
+   pSeg = AllocSegment(numBytes);
+   if (pSeg == NULL)
+   {
+      ReportError("ERROR: Out of memory.\n");
+      fclose(inFile);
+      return NO_MEMORY;
+   }
+
+   /* Read the data into the segment. */
+   if (numBytes && !fread(pSeg->pData, numBytes, 1, inFile))
+   {
+      ReportError("File read error.\n");
+      fclose(inFile);
+      free(pSeg);
+      return IO_ERROR;
+   }
+
+   fclose(inFile);
+   *ppSeg = pSeg;
+
+   return OK;
+}
+
+/**************************************************************************//**
+* Decodes an input, passing each record to a visitor.
+*
+* @param[in] type The type of the input.
+* @param[in] pOpts The file options for this file type.
+* @param[in] pIn The input to decode.
+* @param[in] pVisitor Receives the decoded records.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+static RESULT VisitInput(FILE_TYPE type, const void *pOpts, IN_BUF *pIn,
+   const RFT_VISITOR *pVisitor)
+{
+   switch (type)
+   {
+      case FILE_TYPE_HEX:
+         return LoadHexFile(pIn, pVisitor);
+
+      case FILE_TYPE_BIN:
+         return LoadBinFile(pIn, (const FILE_OPTS_BIN *) pOpts, pVisitor);
+
+      case FILE_TYPE_TITXT:
+         return LoadTiTxtFile(pIn, pVisitor);
+
+      case FILE_TYPE_TEK:
+         return LoadTekFile(pIn, pVisitor);
+
+      case FILE_TYPE_OMF:
+         return LoadOmfFile(pIn, (const FILE_OPTS_OMF *) pOpts, pVisitor);
+
+      default:
+         ReportError("ERROR: %s files cannot be loaded.\n", RftGetFormatDesc(type));
+         return UNSUPPORTED;
+   }
+}
+
+/**************************************************************************//**
+* Gets the number of threads to use for parallel work.
+*
+* @param[in] numThreads The number of threads requested, or 0 for one per CPU.
+*
+* @return The number of threads, which is at least 1.
+******************************************************************************/
+static U32 GetNumThreads(U32 numThreads)
+{
+   long n = numThreads;
+
+   if (n == 0)
+   {
+#ifdef _WIN32
+      SYSTEM_INFO sysInfo;
+      GetSystemInfo(&sysInfo);
+      n = sysInfo.dwNumberOfProcessors;
+#else
+      n = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+   }
+
+   return n < 1 ? 1 : (n > MAX_THREADS ? MAX_THREADS : (U32) n);
+}
+
+/**************************************************************************//**
+* Starts a thread.
+*
+* @param[out] pThread The thread started.
+* @param[in] pfnThread The thread's entry point.
+* @param[in] pArg Passed to the thread.
+*
+* @return Non-zero if the thread was started.
+******************************************************************************/
+static int StartThread(THREAD *pThread, THREAD_ENTRY pfnThread, void *pArg)
+{
+#ifdef _WIN32
+   *pThread = CreateThread(NULL, 0, pfnThread, pArg, 0, NULL);
+   return *pThread != NULL;
+#else
+   return pthread_create(pThread, NULL, pfnThread, pArg) == 0;
+#endif
+}
+
+/**************************************************************************//**
+* Waits for a thread to finish.
+*
+* @param[in] thread The thread.
+*
+* @return None.
+******************************************************************************/
+static void JoinThread(THREAD thread)
+{
+#ifdef _WIN32
+   WaitForSingleObject(thread, INFINITE);
+   CloseHandle(thread);
+#else
+   pthread_join(thread, NULL);
+#endif
+}
+
+/**************************************************************************//**
+* Detaches a thread, which is never waited for.
+*
+* @param[in] thread The thread.
+*
+* @return None.
+******************************************************************************/
+static void DetachThread(THREAD thread)
+{
+#ifdef _WIN32
+   CloseHandle(thread);
+#else
+   pthread_detach(thread);
+#endif
+}
+
+/**************************************************************************//**
+* Adds tasks to the bottom of a deque, growing it as needed. The caller must
+* hold the lock of the deque's worker.
+*
+* @param[in,out] pDeque The deque.
+* @param[in] pTasks The tasks to add.
+* @param[in] numTasks The number of tasks.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+static RESULT PushTasks(TASK_DEQUE *pDeque, const TASK *pTasks, U32 numTasks)
+{
+   U32 count = pDeque->bottom - pDeque->top, size, i;
+   TASK *pNew;
+
+   if (count + numTasks > pDeque->size)
+   {
+      for (size = pDeque->size ? pDeque->size : TASK_DEQUE_LEN; size < count + numTasks; size *= 2);
+
+      pNew = (TASK *) malloc(size * sizeof(TASK));
+      if (pNew == NULL)
+      {
+         ReportError("ERROR: Out of memory.\n");
+         return NO_MEMORY;
+      }
+
+      /* Unwrap the ring into the new one. */
+      for (i = 0; i < count; i++)
+      {
+         pNew[i] = pDeque->pTasks[(pDeque->top + i) & (pDeque->size - 1)];
+      }
+
+      free(pDeque->pTasks);
+      pDeque->pTasks = pNew;
+      pDeque->size = size;
+      pDeque->top = 0;
+      pDeque->bottom = count;
+   }
+
+   for (i = 0; i < numTasks; i++)
+   {
+      pDeque->pTasks[pDeque->bottom++ & (pDeque->size - 1)] = pTasks[i];
+   }
+
+   return OK;
+}
+
+/**************************************************************************//**
+* Takes the newest task of a priority from a worker's own deque.
+*
+* @param[in,out] pWorker The worker.
+* @param[in] prio The priority.
+* @param[out] pTask The task taken.
+*
+* @return Non-zero if a task was taken.
+******************************************************************************/
+static int PopTask(WORKER *pWorker, TASK_PRIO prio, TASK *pTask)
+{
+   TASK_DEQUE *pDeque = &pWorker->deques[prio];
+   int found = 0;
+
+   AcquireLock(&pWorker->lock);
+   if (pDeque->bottom != pDeque->top)
+   {
+      *pTask = pDeque->pTasks[--pDeque->bottom & (pDeque->size - 1)];
+      found = 1;
+   }
+   ReleaseLock(&pWorker->lock);
+
+   return found;
+}
+
+/**************************************************************************//**
+* Runs a task, reporting errors to its group's context, and wakes the caller
+* waiting for the group once its last task is done.
+*
+* @param[in] pTask The task.
+*
+* @return None.
+******************************************************************************/
+static void RunTask(const TASK *pTask)
+{
+   RFT_CONTEXT *pPrevCtx = pReportCtx;
+   TASK_GROUP *pGroup = pTask->pGroup;
+
+   pReportCtx = pGroup->pReportCtx;
+   pTask->pfnRun(pTask->pArg, pTask->index);
+   pReportCtx = pPrevCtx;
+
+   /* The group may be gone as soon as it is done, so it is not touched after this. */
+   if (ATOMIC_ADD(&pGroup->numPending, -1) == 0)
+   {
+      MUTEX_LOCK(&sched.idleLock);
+      COND_BROADCAST(&sched.idleCond);
+      MUTEX_UNLOCK(&sched.idleLock);
+   }
+}
+
+/**************************************************************************//**
+* Steals half of another worker's oldest tasks of a priority. The first is
+* returned to run, and the rest are queued on the thief.
+*
+* Only one lock is held at a time, so workers can steal from each other freely.
+* A thread which is not a worker has nowhere to queue tasks, so only steals one.
+*
+* @param[in,out] pThief The worker which is out of work, or NULL.
+* @param[in] prio The priority.
+* @param[in,out] pSeed Chooses the first worker to steal from.
+* @param[out] pTask The task to run.
+*
+* @return Non-zero if a task was stolen.
+******************************************************************************/
+static int StealTasks(WORKER *pThief, TASK_PRIO prio, U32 *pSeed, TASK *pTask)
+{
+   U32 numWorkers = (U32) ATOMIC_LOAD_ACQUIRE(&sched.numWorkers);
+   TASK stolen[MAX_STEAL];
+   TASK_DEQUE *pDeque;
+   WORKER *pVictim;
+   U32 i, j, n, start;
+
+   if (numWorkers == 0)
+   {
+      return 0;
+   }
+
+   *pSeed = *pSeed * 1103515245 + 12345;
+   start = (*pSeed >> 16) % numWorkers;
+
+   for (i = 0; i < numWorkers; i++)
+   {
+      pVictim = &sched.workers[(start + i) % numWorkers];
+      if (pVictim == pThief)
+      {
+         continue;
+      }
+
+      /* Take half, rounding up so that a single task can be stolen. */
+      pDeque = &pVictim->deques[prio];
+      AcquireLock(&pVictim->lock);
+      n = (pDeque->bottom - pDeque->top + 1) / 2;
+      n = n > MAX_STEAL ? MAX_STEAL : n;
+      n = pThief == NULL && n > 1 ? 1 : n;
+      for (j = 0; j < n; j++)
+      {
+         stolen[j] = pDeque->pTasks[pDeque->top++ & (pDeque->size - 1)];
+      }
+      ReleaseLock(&pVictim->lock);
+
+      if (n == 0)
+      {
+         continue;
+      }
+
+      /* If the rest cannot be queued, they are run here instead. */
+      if (n > 1)
+      {
+         AcquireLock(&pThief->lock);
+         if (PushTasks(&pThief->deques[prio], &stolen[1], n - 1) != OK)
+         {
+            ReleaseLock(&pThief->lock);
+            for (j = 1; j < n; j++)
+            {
+               ATOMIC_ADD(&sched.numQueued[prio], -1);
+               RunTask(&stolen[j]);
+            }
+         }
+         else
+         {
+            ReleaseLock(&pThief->lock);
+         }
+      }
+
+      *pTask = stolen[0];
+      return 1;
+   }
+
+   return 0;
+}
+
+/**************************************************************************//**
+* Takes the highest priority task queued anywhere in the scheduler, from the
+* worker's own deques first, and then from the other workers.
+*
+* @param[in,out] pWorker The worker looking for a task, or NULL if the thread
+*    is not a worker.
+* @param[in,out] pSeed Chooses the first worker to steal from.
+* @param[out] pTask The task taken.
+*
+* @return Non-zero if a task was taken.
+******************************************************************************/
+static int FindTask(WORKER *pWorker, U32 *pSeed, TASK *pTask)
+{
+   int prio;
+
+   for (prio = NUM_TASK_PRIOS - 1; prio >= 0; prio--)
+   {
+      if (ATOMIC_LOAD_ACQUIRE(&sched.numQueued[prio]) != 0 &&
+         ((pWorker != NULL && PopTask(pWorker, (TASK_PRIO) prio, pTask)) ||
+         StealTasks(pWorker, (TASK_PRIO) prio, pSeed, pTask)))
+      {
+         ATOMIC_ADD(&sched.numQueued[prio], -1);
+         return 1;
+      }
+   }
+
+   return 0;
+}
+
+/**************************************************************************//**
+* Determines whether any task is queued in the scheduler.
+*
+* @return Non-zero if a task is queued.
+******************************************************************************/
+static int AnyTaskQueued(void)
+{
+   int prio;
+
+   for (prio = 0; prio < NUM_TASK_PRIOS; prio++)
+   {
+      if (ATOMIC_LOAD(&sched.numQueued[prio]) != 0)
+      {
+         return 1;
+      }
+   }
+
+   return 0;
+}
+
+/**************************************************************************//**
+* Runs the scheduler's tasks, for as long as the process runs.
+*
+* @param[in] pArg The WORKER.
+*
+* @return 0.
+******************************************************************************/
+static THREAD_FUNC(WorkerThread)
+{
+   WORKER *pWorker = (WORKER *) pArg;
+   TASK task;
+
+   pCurWorker = pWorker;
+
+   while (1)
+   {
+      if (FindTask(pWorker, &pWorker->seed, &task))
+      {
+         RunTask(&task);
+         continue;
+      }
+
+      /* Sleep until a task is queued. */
+      MUTEX_LOCK(&sched.idleLock);
+      while (!AnyTaskQueued())
+      {
+         COND_WAIT(&sched.idleCond, &sched.idleLock);
+      }
+      MUTEX_UNLOCK(&sched.idleLock);
+   }
+
+   return 0;
+}
+
+/**************************************************************************//**
+* Starts the scheduler's workers, up to the number asked for. Workers which
+* are already running are kept, as they may be running other callers' tasks.
+*
+* @param[in] numWorkers The number of workers wanted.
+*
+* @return The number of workers running, which may be fewer than asked for if a
+* thread could not be started, or more if another caller asked for more.
+******************************************************************************/
+static U32 SchedStart(U32 numWorkers)
+{
+   WORKER *pWorker;
+   THREAD thread;
+   U32 n;
+
+   AcquireLock(&sched.startLock);
+
+   if (!sched.started)
+   {
+      MUTEX_INIT(&sched.idleLock);
+      COND_INIT(&sched.idleCond);
+      sched.started = 1;
+   }
+
+   numWorkers = numWorkers > MAX_THREADS ? MAX_THREADS : numWorkers;
+   for (n = (U32) sched.numWorkers; n < numWorkers; n++)
+   {
+      pWorker = &sched.workers[n];
+      pWorker->seed = n * 2654435761u + 1;
+      if (!StartThread(&thread, WorkerThread, pWorker))
+      {
+         break;
+      }
+
+      DetachThread(thread);
+      ATOMIC_ADD(&sched.numWorkers, 1);
+   }
+
+   n = (U32) sched.numWorkers;
+   ReleaseLock(&sched.startLock);
+
+   return n;
+}
+
+/**************************************************************************//**
+* Begins a group of tasks on the scheduler, starting its workers if needed.
+*
+* @param[out] pGroup The group.
+* @param[in] prio The priority of the group's tasks.
+* @param[in] numThreads The number of threads to run the tasks on, including the
+*    caller of SchedWait().
+*
+* @return None.
+******************************************************************************/
+static void SchedBegin(TASK_GROUP *pGroup, TASK_PRIO prio, U32 numThreads)
+{
+   U32 numWorkers = 0;
+
+   if (numThreads > 1)
+   {
+      numWorkers = SchedStart(numThreads - 1);
+      numWorkers = numWorkers < numThreads - 1 ? numWorkers : numThreads - 1;
+   }
+
+   pGroup->prio = prio;
+   pGroup->numWorkers = numWorkers;
+   pGroup->numPending = 0;
+   pGroup->seed = 1;
+   pGroup->pReportCtx = pReportCtx;
+}
+
+/**************************************************************************//**
+* Queues a task of a group on a worker. A task queued by a running task is
+* queued on the worker running it.
+*
+* @param[in,out] pGroup The group.
+* @param[in] worker The index of the worker which should run the task, if no
+*    other worker steals it first. It is taken modulo the group's numWorkers.
+* @param[in] pfnRun Does the work.
+* @param[in] pArg Passed to pfnRun.
+* @param[in] index Passed to pfnRun.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+static RESULT SchedSubmit(TASK_GROUP *pGroup, U32 worker,
+   void (*pfnRun)(void *pArg, U32 index), void *pArg, U32 index)
+{
+   WORKER *pWorker;
+   TASK task;
+   RESULT r;
+
+   if (pGroup->numWorkers == 0)
+   {
+      pfnRun(pArg, index);
+      return OK;
+   }
+
+   pWorker = pCurWorker ? pCurWorker : &sched.workers[worker % pGroup->numWorkers];
+
+   task.pfnRun = pfnRun;
+   task.pArg = pArg;
+   task.index = index;
+   task.pGroup = pGroup;
+
+   ATOMIC_ADD(&pGroup->numPending, 1);
+
+   AcquireLock(&pWorker->lock);
+   r = PushTasks(&pWorker->deques[pGroup->prio], &task, 1);
+   ReleaseLock(&pWorker->lock);
+
+   if (r != OK)
+   {
+      ATOMIC_ADD(&pGroup->numPending, -1);
+      return r;
+   }
+
+   /* Counted under the idle lock, so a thread about to sleep cannot miss it. Every
+   sleeper is woken, as a waiting caller may go on without taking the task. */
+   MUTEX_LOCK(&sched.idleLock);
+   ATOMIC_ADD(&sched.numQueued[pGroup->prio], 1);
+   COND_BROADCAST(&sched.idleCond);
+   MUTEX_UNLOCK(&sched.idleLock);
+
+   return OK;
+}
+
+/**************************************************************************//**
+* Waits for all of a group's tasks to be done, running the highest priority
+* tasks in the scheduler meanwhile, whichever group they belong to.
+*
+* @param[in,out] pGroup The group.
+*
+* @return None.
+******************************************************************************/
+static void SchedWait(TASK_GROUP *pGroup)
+{
+   U32 *pSeed = pCurWorker ? &pCurWorker->seed : &pGroup->seed;
+   TASK task;
+
+   while (ATOMIC_LOAD_ACQUIRE(&pGroup->numPending) != 0)
+   {
+      if (FindTask(pCurWorker, pSeed, &task))
+      {
+         RunTask(&task);
+         continue;
+      }
+
+      /* The group's last tasks are running elsewhere, so sleep until they are done,
+      or until there is another task to run meanwhile. */
+      MUTEX_LOCK(&sched.idleLock);
+      while (!AnyTaskQueued() && ATOMIC_LOAD(&pGroup->numPending) != 0)
+      {
+         COND_WAIT(&sched.idleCond, &sched.idleLock);
+      }
+      MUTEX_UNLOCK(&sched.idleLock);
+   }
+}
+
+/**************************************************************************//**
+* The reader stage of a pipelined load, which reads the input file a block at a time.
+*
+* @param[in] pArg The PIPE.
+*
+* @return 0.
+******************************************************************************/
+static THREAD_FUNC(ReadThread)
+{
+   PIPE *pPipe = (PIPE *) pArg;
+   U32 numRead = 0, n;
+
+   pReportCtx = pPipe->pReportCtx;
+   pPipe->readResult = OK;
+   while (numRead < pPipe->len && ATOMIC_LOAD_ACQUIRE(&pPipe->stopResult) == OK)
+   {
+      n = pPipe->len - numRead < FD_READ_LEN ? pPipe->len - numRead : FD_READ_LEN;
+      if (fread((U8 *) &pPipe->pBuf[numRead], n, 1, pPipe->pFile) != 1)
+      {
+         ReportError("File read error.\n");
+         pPipe->readResult = IO_ERROR;
+         break;
+      }
+
+      /* Publish the block only once it has been read. */
+      numRead += n;
+      ATOMIC_STORE_RELEASE(&pPipe->numRead, numRead);
+      WakePipe(pPipe);
+   }
+
+   ATOMIC_STORE_RELEASE(&pPipe->readDone, 1);
+   WakePipe(pPipe);
+
+   return 0;
+}
+
+/**************************************************************************//**
+* Queues a record for the merger stage of a pipelined load, waiting for room.
+*
+* @param[in,out] pPipe The pipelined load.
+* @param[in] isStart Whether the record is the starting address, rather than data.
+* @param[in] addr The address of the data, or the starting address.
+* @param[in] pData The data.
+* @param[in] len The length of the data, in bytes, which is at most PIPE_REC_LEN.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+static RESULT PushRecord(PIPE *pPipe, int isStart, U32 addr, const U8 *pData, U32 len)
+{
+   U32 tail = pPipe->tail, head;
+   PIPE_REC *pRec;
+   RESULT r;
+
+   while ((head = ATOMIC_LOAD_ACQUIRE(&pPipe->head)) == tail - PIPE_QUEUE_LEN)
+   {
+      r = (RESULT) ATOMIC_LOAD_ACQUIRE(&pPipe->stopResult);
+      if (r != OK)
+      {
+         return r;
+      }
+      WaitPipe(pPipe, &pPipe->head, head, NULL);
+   }
+
+   /* The merger must not see the record until it is complete. */
+   pRec = &pPipe->pRecs[tail % PIPE_QUEUE_LEN];
+   pRec->isStart = isStart;
+   pRec->addr = addr;
+   pRec->len = len;
+   memcpy(pRec->data, pData, len);
+   ATOMIC_STORE_RELEASE(&pPipe->tail, tail + 1);
+   WakePipe(pPipe);
+
+   return OK;
+}
+
+/**************************************************************************//**
+* Passes decoded data from the parser stage of a pipelined load to the merger.
+*
+* @param[in,out] pUser The PIPE.
+* @param[in] addr The address of the data.
+* @param[in] pData The data.
+* @param[in] len The length of the data, in bytes.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+static RESULT PipeData(void *pUser, U32 addr, const U8 *pData, U32 len)
+{
+   U32 take;
+   RESULT r;
+
+   for (; len; addr += take, pData += take, len -= take)
+   {
+      take = len < PIPE_REC_LEN ? len : PIPE_REC_LEN;
+      r = PushRecord((PIPE *) pUser, 0, addr, pData, take);
+      if (r != OK)
+      {
+         return r;
+      }
+   }
+
+   return OK;
+}
+
+/**************************************************************************//**
+* Passes the starting address from the parser stage of a pipelined load to the merger.
+*
+* @param[in,out] pUser The PIPE.
+* @param[in] addr The starting address.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+static RESULT PipeStart(void *pUser, U32 addr)
+{
+   return PushRecord((PIPE *) pUser, 1, addr, NULL, 0);
+}
+
+/**************************************************************************//**
+* The parser stage of a pipelined load, which decodes the input as it is read.
+*
+* @param[in] pArg The PIPE.
+*
+* @return 0.
+******************************************************************************/
+static THREAD_FUNC(ParseThread)
+{
+   PIPE *pPipe = (PIPE *) pArg;
+   RFT_VISITOR visitor;
+   IN_BUF in;
+   RESULT r;
+
+   pReportCtx = pPipe->pReportCtx;
+
+   visitor.pfnData = PipeData;
+   visitor.pfnStart = PipeStart;
+   visitor.pUser = pPipe;
+
+   in.pCur = pPipe->pBuf;
+   in.pEnd = pPipe->pBuf;
+   in.pPipe = pPipe;
+
+   r = VisitInput(pPipe->type, NULL, &in, &visitor);
+
+   /* Nothing more will be decoded, so the reader can stop too. */
+   if (r != OK)
+   {
+      StopPipe(pPipe, r);
+   }
+
+   pPipe->parseResult = r;
+   ATOMIC_STORE_RELEASE(&pPipe->parseDone, 1);
+   WakePipe(pPipe);
+
+   return 0;
+}
+
+/**************************************************************************//**
+* Takes the decoded records from the parser stage of a pipelined load, and
+* merges them into the image.
+*
+* @param[in,out] pCtx The conversion context.
+* @param[in,out] pPipe The pipelined load.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+static RESULT MergeRecords(RFT_CONTEXT *pCtx, PIPE *pPipe)
+{
+   U32 head = pPipe->head, tail, done;
+   PIPE_REC *pRec;
+   RESULT r;
+
+   while (1)
+   {
+      /* The parser only finishes after queueing its last record, so once it is done,
+      the records queued are final. */
+      done = ATOMIC_LOAD_ACQUIRE(&pPipe->parseDone);
+      tail = ATOMIC_LOAD_ACQUIRE(&pPipe->tail);
+      if (head == tail)
+      {
+         if (done)
+         {
+            return pPipe->parseResult;
+         }
+
+         WaitPipe(pPipe, &pPipe->tail, tail, &pPipe->parseDone);
+         continue;
+      }
+
+      pRec = &pPipe->pRecs[head % PIPE_QUEUE_LEN];
+      if (pRec->isStart)
+      {
+         r = SetStartAddr(pCtx, pRec->addr);
+      }
+      else
+      {
+         r = AddRecord(pCtx, pRec->addr, pRec->data, pRec->len);
+      }
+
+      if (r != OK)
+      {
+         return r;
+      }
+
+      /* The parser may reuse the record once it has been merged. */
+      ATOMIC_STORE_RELEASE(&pPipe->head, ++head);
+      WakePipe(pPipe);
+   }
+}
+
+/**************************************************************************//**
+* Loads a text input as a pipeline, so that reading, decoding and merging
+* the records into the image all overlap.
+*
+* @param[in,out] pCtx The conversion context.
+* @param[in] type The type of the input, which must be a text format.
+* @param[in] pFile The input file, or NULL if the input is already in memory.
+* @param[in] pBuf The input's contents, or NULL to read them from pFile.
+* @param[in] len The length of the input, in bytes.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+static RESULT LoadPipelined(RFT_CONTEXT *pCtx, FILE_TYPE type, FILE *pFile, const U8 *pBuf, U32 len)
+{
+   THREAD reader, parser;
+   int readerStarted = 0;
+   U8 *pOwned = NULL;
+   RFT_VISITOR visitor;
+   PIPE pipe;
+   IN_BUF in;
+   RESULT r;
+
+   memset(&pipe, 0, sizeof(pipe));
+   MUTEX_INIT(&pipe.waitLock);
+   COND_INIT(&pipe.wake);
+   pipe.pReportCtx = pReportCtx;
+   pipe.pFile = pFile;
+   pipe.len = len;
+   pipe.type = type;
+
+   pipe.pRecs = (PIPE_REC *) malloc(PIPE_QUEUE_LEN * sizeof(PIPE_REC));
+   if (pBuf == NULL)
+   {
+      pBuf = pOwned = (U8 *) malloc(len ? len : 1);
+   }
+   if (pipe.pRecs == NULL || pBuf == NULL)
+   {
+      ReportError("ERROR: Out of memory.\n");
+      COND_FREE(&pipe.wake);
+      MUTEX_FREE(&pipe.waitLock);
+      free(pipe.pRecs);
+      free(pOwned);
+      return NO_MEMORY;
+   }
+   pipe.pBuf = pBuf;
+
+   /* Start reading, unless the input is already in memory. If the reader cannot be
+   started, read everything up front. */
+   if (pFile == NULL)
+   {
+      pipe.numRead = len;
+      pipe.readDone = 1;
+   }
+   else if (!(readerStarted = StartThread(&reader, ReadThread, &pipe)))
+   {
+      ReadThread(&pipe);
+   }
+
+   /* Decode in another thread while merging here. If the parser cannot be started,
+   decode and merge here as the input arrives. */
+   if (StartThread(&parser, ParseThread, &pipe))
+   {
+      r = MergeRecords(pCtx, &pipe);
+      if (r != OK)
+      {
+         StopPipe(&pipe, r);
+      }
+      JoinThread(parser);
+   }
+   else
+   {
+      visitor.pfnData = AddRecord;
+      visitor.pfnStart = SetStartAddr;
+      visitor.pUser = pCtx;
+
+      in.pCur = pipe.pBuf;
+      in.pEnd = pipe.pBuf;
+      in.pPipe = &pipe;
+      r = VisitInput(type, NULL, &in, &visitor);
+      if (r != OK)
+      {
+         StopPipe(&pipe, r);
+      }
+   }
+
+   if (readerStarted)
+   {
+      JoinThread(reader);
+   }
+
+   /* A read error explains any decoding error which follows it. */
+   if (pipe.readResult != OK)
+   {
+      r = pipe.readResult;
+   }
+
+   COND_FREE(&pipe.wake);
+   MUTEX_FREE(&pipe.waitLock);
+   free(pipe.pRecs);
+   free(pOwned);
+
+   return r;
+}
+
+/**************************************************************************//**
+* Determines whether an input type is a text format, made of records.
+*
+* @param[in] type The type of the input.
+*
+* @return Non-zero for a text format.
+******************************************************************************/
+static int IsTextType(FILE_TYPE type)
+{
+   return type == FILE_TYPE_HEX || type == FILE_TYPE_TITXT || type == FILE_TYPE_TEK;
+}
+
+/**************************************************************************//**
+* Orders the records of an external sort by address, and then by position.
+*
+* @param[in] pA The first SORT_REC.
+* @param[in] pB The second SORT_REC.
+*
+* @return Less than, equal to, or greater than 0, as for qsort().
+******************************************************************************/
+static int CompareSortRecs(const void *pA, const void *pB)
+{
+   const SORT_REC *pRecA = (const SORT_REC *) pA, *pRecB = (const SORT_REC *) pB;
+
+   if (pRecA->addr != pRecB->addr)
+   {
+      return pRecA->addr < pRecB->addr ? -1 : 1;
+   }
+
+   return pRecA->ofs < pRecB->ofs ? -1 : (pRecA->ofs > pRecB->ofs);
+}
+
+/**************************************************************************//**
+* Appends a record to a sorted run on disk. This is the visitor used when
+* merging runs into a larger run.
+*
+* @param[in,out] pUser The run's FILE.
+* @param[in] addr The address of the data.
+* @param[in] pData The data.
+* @param[in] len The length of the data, in bytes, which is at most SORT_REC_LEN.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+static RESULT WriteRunRecord(void *pUser, U32 addr, const U8 *pData, U32 len)
+{
+   U32 header[2];
+
+   header[0] = addr;
+   header[1] = len;
+   if (fwrite(header, sizeof(header), 1, (FILE *) pUser) != 1 ||
+      fwrite(pData, len, 1, (FILE *) pUser) != 1)
+   {
+      ReportError("ERROR: Unable to write a sorted run.\n");
+      return IO_ERROR;
+   }
+
+   return OK;
+}
+
+/**************************************************************************//**
+* Reads the next record of a sorted run.
+*
+* @param[in,out] pCursor The run, which receives the record.
+*
+* @return OK, END_OF_FILE once the run is finished, or another RESULT on failure.
+******************************************************************************/
+static RESULT ReadRunRecord(SORT_CURSOR *pCursor)
+{
+   U32 header[2];
+
+   if (fread(header, sizeof(header), 1, pCursor->pFile) != 1)
+   {
+      return feof(pCursor->pFile) ? END_OF_FILE : IO_ERROR;
+   }
+
+   pCursor->addr = header[0];
+   pCursor->len = header[1];
+   if (pCursor->len > SORT_REC_LEN || fread(pCursor->data, pCursor->len, 1, pCursor->pFile) != 1)
+   {
+      ReportError("ERROR: Unable to read a sorted run.\n");
+      return IO_ERROR;
+   }
+
+   return OK;
+}
+
+/**************************************************************************//**
+* Restores the heap order of a k-way merge, moving a cursor down from a position.
+*
+* @param[in,out] ppHeap The heap of cursors, ordered by address.
+* @param[in] num The number of cursors in the heap.
+* @param[in] i The position of the cursor which may be out of order.
+*
+* @return None.
+******************************************************************************/
+static void SiftDown(SORT_CURSOR **ppHeap, U32 num, U32 i)
+{
+   SORT_CURSOR *pTemp;
+   U32 child;
+
+   while ((child = i * 2 + 1) < num)
+   {
+      if (child + 1 < num && ppHeap[child + 1]->addr < ppHeap[child]->addr)
+      {
+         child++;
+      }
+
+      if (ppHeap[i]->addr <= ppHeap[child]->addr)
+      {
+         break;
+      }
+
+      pTemp = ppHeap[i];
+      ppHeap[i] = ppHeap[child];
+      ppHeap[child] = pTemp;
+      i = child;
+   }
+}
+
+/**************************************************************************//**
+* Merges sorted runs on disk, passing their records to a visitor in address order.
+*
+* @param[in] ppRuns The runs, which are read from their start.
+* @param[in] numRuns The number of runs.
+* @param[in] pVisitor Receives the records.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+static RESULT MergeRuns(FILE **ppRuns, U32 numRuns, const RFT_VISITOR *pVisitor)
+{
+   SORT_CURSOR *pCursors, *ppHeap[MAX_SORT_RUNS];
+   U32 numHeap = 0, i;
+   RESULT r = OK;
+
+   pCursors = (SORT_CURSOR *) malloc(numRuns * sizeof(SORT_CURSOR));
+   if (pCursors == NULL)
+   {
+      ReportError("ERROR: Out of memory.\n");
+      return NO_MEMORY;
+   }
+
+   /* Start with the first record of each run. */
+   for (i = 0; i < numRuns && r == OK; i++)
+   {
+      rewind(ppRuns[i]);
+      pCursors[i].pFile = ppRuns[i];
+      r = ReadRunRecord(&pCursors[i]);
+      if (r == OK)
+      {
+         ppHeap[numHeap++] = &pCursors[i];
+      }
+      else if (r == END_OF_FILE)
+      {
+         r = OK;
+      }
+   }
+
+   for (i = numHeap / 2; i-- > 0; )
+   {
+      SiftDown(ppHeap, numHeap, i);
+   }
+
+   /* Repeatedly pass on the lowest record, and replace it with the next from its run. */
+   while (numHeap && r == OK)
+   {
+      r = pVisitor->pfnData(pVisitor->pUser, ppHeap[0]->addr, ppHeap[0]->data, ppHeap[0]->len);
+      if (r == OK)
+      {
+         r = ReadRunRecord(ppHeap[0]);
+         if (r == END_OF_FILE)
+         {
+            ppHeap[0] = ppHeap[--numHeap];
+            r = OK;
+         }
+         SiftDown(ppHeap, numHeap, 0);
+      }
+   }
+
+   free(pCursors);
+   return r;
+}
+
+/**************************************************************************//**
+* Sorts the records in the buffer of an external sort, and writes them to disk
+* as a new run. When there are too many runs, they are first merged into one.
+*
+* @param[in,out] pSorter The external sort.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+static RESULT FlushRun(SORTER *pSorter)
+{
+   RFT_VISITOR visitor;
+   FILE *pRun;
+   U32 i;
+   RESULT r = OK;
+
+   qsort(pSorter->pRecs, pSorter->numRecs, sizeof(SORT_REC), CompareSortRecs);
+
+   pRun = tmpfile();
+   if (pRun == NULL)
+   {
+      ReportError("ERROR: Unable to create a temporary file for a sorted run.\n");
+      return IO_ERROR;
+   }
+
+   visitor.pfnData = WriteRunRecord;
+   visitor.pfnStart = NULL;
+   visitor.pUser = pRun;
+
+   /* Keep the number of open runs bounded by merging them all into one. */
+   if (pSorter->numRuns == MAX_SORT_RUNS)
+   {
+      r = MergeRuns(pSorter->pRuns, pSorter->numRuns, &visitor);
+      for (i = 0; i < pSorter->numRuns; i++)
+      {
+         fclose(pSorter->pRuns[i]);
+      }
+      pSorter->pRuns[0] = pRun;
+      pSorter->numRuns = 1;
+
+      pRun = tmpfile();
+      if (r == OK && pRun == NULL)
+      {
+         ReportError("ERROR: Unable to create a temporary file for a sorted run.\n");
+         r = IO_ERROR;
+      }
+      visitor.pUser = pRun;
+   }
+
+   for (i = 0; i < pSorter->numRecs && r == OK; i++)
+   {
+      r = WriteRunRecord(pRun, pSorter->pRecs[i].addr, &pSorter->pBuf[pSorter->pRecs[i].ofs],
+         pSorter->pRecs[i].len);
+   }
+
+   if (pRun != NULL)
+   {
+      pSorter->pRuns[pSorter->numRuns++] = pRun;
+   }
+
+   pSorter->numRecs = 0;
+   pSorter->used = 0;
+
+   return r;
+}
+
+/**************************************************************************//**
+* Adds a decoded record to an external sort. This is the visitor used when
+* loading inputs with an external sort.
+*
+* @param[in,out] pUser The SORTER.
+* @param[in] addr The address of the data.
+* @param[in] pData The data.
+* @param[in] len The length of the data, in bytes.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+static RESULT SortRecord(void *pUser, U32 addr, const U8 *pData, U32 len)
+{
+   SORTER *pSorter = (SORTER *) pUser;
+   SORT_REC *pRec;
+   U32 take;
+   RESULT r;
+
+   for (; len; addr += take, pData += take, len -= take)
+   {
+      take = len < SORT_REC_LEN ? len : SORT_REC_LEN;
+
+      if (pSorter->used + take > pSorter->pCtx->sortRunLen || pSorter->numRecs == pSorter->maxRecs)
+      {
+         r = FlushRun(pSorter);
+         if (r != OK)
+         {
+            return r;
+         }
+      }
+
+      pRec = &pSorter->pRecs[pSorter->numRecs++];
+      pRec->addr = addr;
+      pRec->len = take;
+      pRec->ofs = pSorter->used;
+      memcpy(&pSorter->pBuf[pSorter->used], pData, take);
+      pSorter->used += take;
+   }
+
+   return OK;
+}
+
+/**************************************************************************//**
+* Passes the starting address through an external sort.
+*
+* @param[in,out] pUser The SORTER.
+* @param[in] addr The starting address.
+*
+* @return OK.
+******************************************************************************/
+static RESULT SortStart(void *pUser, U32 addr)
+{
+   return SetStartAddr(((SORTER *) pUser)->pCtx, addr);
+}
+
+/**************************************************************************//**
+* Adds the segment built by a SORT_SINK to the image.
+*
+* @param[in,out] pSink The sink.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+static RESULT FlushSink(SORT_SINK *pSink)
+{
+   RESULT r;
+
+   r = AddRecord(pSink->pCtx, pSink->addr, pSink->data, pSink->len);
+   pSink->len = 0;
+
+   return r;
+}
+
+/**************************************************************************//**
+* Receives the records coming out of an external sort, in address order, and
+* joins adjacent ones into large segments.
+*
+* @param[in,out] pUser The SORT_SINK.
+* @param[in] addr The address of the data.
+* @param[in] pData The data.
+* @param[in] len The length of the data, in bytes.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+static RESULT SinkRecord(void *pUser, U32 addr, const U8 *pData, U32 len)
+{
+   SORT_SINK *pSink = (SORT_SINK *) pUser;
+   RESULT r;
+
+   /* A record which overlaps the segment being built starts another, which
+   MergeSegRuns() then reports, naming the input. */
+   if (pSink->len && (addr != pSink->addr + pSink->len || pSink->len + len > SORT_SEG_LEN))
+   {
+      r = FlushSink(pSink);
+      if (r != OK)
+      {
+         return r;
+      }
+   }
+
+   if (pSink->len == 0)
+   {
+      pSink->addr = addr;
+   }
+
+   memcpy(&pSink->data[pSink->len], pData, len);
+   pSink->len += len;
+
+   return OK;
+}
+
+/**************************************************************************//**
+* Loads a text input with an external sort.
+*
+* The records are decoded into fixed-size sorted runs on disk, which are then
+* merged by address into the image, joining adjacent records into large
+* segments. So however out of order the input is, each record is placed
+* without searching the ranges, and memory is bounded by the run size.
+*
+* @param[in,out] pCtx The conversion context.
+* @param[in] type The type of the input, which must be a text format.
+* @param[in] pBuf The input's contents.
+* @param[in] len The length of the input, in bytes, which may be 4 GB or more.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+static RESULT LoadSorted(RFT_CONTEXT *pCtx, FILE_TYPE type, const U8 *pBuf, size_t len)
+{
+   RFT_VISITOR visitor, sinkVisitor;
+   SORT_SINK *pSink;
+   SORTER sorter;
+   IN_BUF in;
+   U32 i;
+   RESULT r;
+
+   memset(&sorter, 0, sizeof(sorter));
+   sorter.pCtx = pCtx;
+   sorter.maxRecs = pCtx->sortRunLen / 16 + 1;
+   sorter.pBuf = (U8 *) malloc(pCtx->sortRunLen);
+   sorter.pRecs = (SORT_REC *) malloc(sorter.maxRecs * sizeof(SORT_REC));
+   pSink = (SORT_SINK *) malloc(sizeof(SORT_SINK));
+   if (sorter.pBuf == NULL || sorter.pRecs == NULL || pSink == NULL)
+   {
+      ReportError("ERROR: Out of memory.\n");
+      free(sorter.pBuf);
+      free(sorter.pRecs);
+      free(pSink);
+      return NO_MEMORY;
+   }
+
+   pSink->pCtx = pCtx;
+   pSink->len = 0;
+
+   visitor.pfnData = SortRecord;
+   visitor.pfnStart = SortStart;
+   visitor.pUser = &sorter;
+
+   sinkVisitor.pfnData = SinkRecord;
+   sinkVisitor.pfnStart = NULL;
+   sinkVisitor.pUser = pSink;
+
+   in.pCur = pBuf;
+   in.pEnd = pBuf + len;
+   in.pPipe = NULL;
+   r = VisitInput(type, NULL, &in, &visitor);
+
+   if (r == OK && sorter.numRuns == 0)
+   {
+      /* Everything fit in one run, so it never needs to go to disk. */
+      qsort(sorter.pRecs, sorter.numRecs, sizeof(SORT_REC), CompareSortRecs);
+      for (i = 0; i < sorter.numRecs && r == OK; i++)
+      {
+         r = SinkRecord(pSink, sorter.pRecs[i].addr, &sorter.pBuf[sorter.pRecs[i].ofs],
+            sorter.pRecs[i].len);
+      }
+   }
+   else if (r == OK)
+   {
+      r = FlushRun(&sorter);
+      if (r == OK)
+      {
+         r = MergeRuns(sorter.pRuns, sorter.numRuns, &sinkVisitor);
+      }
+   }
+
+   if (r == OK && pSink->len)
+   {
+      r = FlushSink(pSink);
+   }
+
+   for (i = 0; i < sorter.numRuns; i++)
+   {
+      fclose(sorter.pRuns[i]);
+   }
+   free(sorter.pBuf);
+   free(sorter.pRecs);
+   free(pSink);
+
+   return r;
+}
+
+/**************************************************************************//**
+* Maps an input file into memory, so that it can be decoded without reading it
+* all into the heap.
+*
+* @param[in] pName The name of the file.
+* @param[out] pMap The mapping.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+static RESULT MapInputFile(const char *pName, IN_MAP *pMap)
+{
+#ifdef _WIN32
+   LARGE_INTEGER size;
+
+   pMap->hFile = CreateFileA(pName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+      FILE_ATTRIBUTE_NORMAL, NULL);
+   if (pMap->hFile == INVALID_HANDLE_VALUE)
+   {
+      ReportError("Unable to open the input file \"%s\".\n", pName);
+      return CANNOT_OPEN_FILE;
+   }
+
+   if (!GetFileSizeEx(pMap->hFile, &size))
+   {
+      ReportError("File read error.\n");
+      CloseHandle(pMap->hFile);
+      return IO_ERROR;
+   }
+
+   if ((U64) size.QuadPart > (size_t) -1)
+   {
+      ReportError("ERROR: \"%s\" is too large to map into memory.\n", pName);
+      CloseHandle(pMap->hFile);
+      return LEN_OUT_OF_RANGE;
+   }
+
+   pMap->len = (size_t) size.QuadPart;
+   pMap->pData = NULL;
+   pMap->hMap = NULL;
+   if (pMap->len == 0)
+   {
+      return OK;
+   }
+
+   pMap->hMap = CreateFileMappingA(pMap->hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+   pMap->pData = pMap->hMap ? (const U8 *) MapViewOfFile(pMap->hMap, FILE_MAP_READ, 0, 0, 0) : NULL;
+   if (pMap->pData == NULL)
+   {
+      ReportError("Unable to map the input file \"%s\".\n", pName);
+      if (pMap->hMap) CloseHandle(pMap->hMap);
+      CloseHandle(pMap->hFile);
+      return IO_ERROR;
+   }
+#else
+   struct stat st;
+   int fd;
+
+   fd = open(pName, O_RDONLY);
+   if (fd < 0)
+   {
+      ReportError("Unable to open the input file \"%s\".\n", pName);
+      return CANNOT_OPEN_FILE;
+   }
+
+   if (fstat(fd, &st) != 0)
+   {
+      ReportError("File read error.\n");
+      close(fd);
+      return IO_ERROR;
+   }
+
+   if ((U64) st.st_size > (size_t) -1)
+   {
+      ReportError("ERROR: \"%s\" is too large to map into memory.\n", pName);
+      close(fd);
+      return LEN_OUT_OF_RANGE;
+   }
+
+   pMap->len = (size_t) st.st_size;
+   pMap->pData = NULL;
+   if (pMap->len != 0)
+   {
+      pMap->pData = (const U8 *) mmap(NULL, pMap->len, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (pMap->pData == (const U8 *) MAP_FAILED)
+      {
+         ReportError("Unable to map the input file \"%s\".\n", pName);
+         close(fd);
+         return IO_ERROR;
+      }
+   }
+
+   /* The mapping stays valid once the file is closed. */
+   close(fd);
+#endif
+
+   return OK;
+}
+
+/**************************************************************************//**
+* Releases a mapping of an input file.
+*
+* @param[in] pMap The mapping.
+*
+* @return None.
+******************************************************************************/
+static void UnmapInputFile(IN_MAP *pMap)
+{
+#ifdef _WIN32
+   if (pMap->pData != NULL)
+   {
+      UnmapViewOfFile(pMap->pData);
+   }
+   if (pMap->hMap != NULL)
+   {
+      CloseHandle(pMap->hMap);
+   }
+   CloseHandle(pMap->hFile);
+#else
+   if (pMap->pData != NULL)
+   {
+      munmap((void *) pMap->pData, pMap->len);
+   }
+#endif
+}
+
+/**************************************************************************//**
+* Determines whether an input is loaded as a pipeline.
+*
+* @param[in] pCtx The conversion context.
+* @param[in] type The type of the input.
+*
+* @return Non-zero to load the input as a pipeline.
+******************************************************************************/
+static int UsePipeline(const RFT_CONTEXT *pCtx, FILE_TYPE type)
+{
+   return IsTextType(type) && GetNumThreads(pCtx->numThreads) > 1;
+}
+
+/**************************************************************************//**
+* Writes a byte as two ASCII hex digits.
+*
+* @param[in] pOut Where to write the digits.
+* @param[in] val The byte to write.
+*
+* @return A pointer just past the digits written.
+******************************************************************************/
+static U8 *PutHex(U8 *pOut, U8 val)
+{
+   pOut[0] = hexDigits[val >> 4];
+   pOut[1] = hexDigits[val & 0xF];
+   return pOut + 2;
+}
+
+/**************************************************************************//**
+* Determines whether an output type is written with a gathered write, because
+* it is only headers and padding around copies of the data.
+*
+* @param[in] type The type of the output.
+*
+* @return Non-zero for a gathered output.
+******************************************************************************/
+static int IsGatheredType(FILE_TYPE type)
+{
+   return type == FILE_TYPE_NES || type == FILE_TYPE_CRT;
+}
+
+/**************************************************************************//**
+* Gets the limits of an output format.
+*
+* @param[in] type The output file type.
+*
+* @return The format's limits, or NULL if the type cannot be written.
+******************************************************************************/
+static const FORMAT_CAPS *GetFormatCaps(FILE_TYPE type)
+{
+   U32 i;
+
+   for (i = 0; i < sizeof(formatCaps) / sizeof(formatCaps[0]); i++)
+   {
+      if (formatCaps[i].type == type)
+      {
+         return &formatCaps[i];
+      }
+   }
+
+   return NULL;
+}
+
+/**************************************************************************//**
+* Gets the layout of a memory initialization format.
+*
+* @param[in] type The output file type.
+*
+* @return The format's layout, or NULL if the type is not a memory initialization format.
+******************************************************************************/
+static const MEM_FORMAT *GetMemFormat(FILE_TYPE type)
+{
+   U32 i;
+
+   for (i = 0; i < sizeof(memFormats) / sizeof(memFormats[0]); i++)
+   {
+      if (memFormats[i].type == type)
+      {
+         return &memFormats[i];
+      }
+   }
+
+   return NULL;
+}
+
+/**************************************************************************//**
+* Gets the number of hex digits needed to write a value.
+*
+* @param[in] val The value.
+*
+* @return The number of hex digits, at least 1.
+******************************************************************************/
+static U32 GetHexDigits(U32 val)
+{
+   U32 digits = 1;
+
+   while (val >>= 4)
+   {
+      digits++;
+   }
+
+   return digits;
+}
+
+/**************************************************************************//**
+* Writes a value as a number of ASCII hex digits, in MSB.
+*
+* @param[in] pOut Where to write the digits.
+* @param[in] val The value to write.
+* @param[in] numDigits The number of digits to write.
+*
+* @return A pointer just past the digits written.
+******************************************************************************/
+static U8 *PutHexDigits(U8 *pOut, U32 val, U32 numDigits)
+{
+   while (numDigits--)
+   {
+      *(pOut++) = hexDigits[(val >> (numDigits * 4)) & 0xF];
+   }
+
+   return pOut;
+}
+
+/**************************************************************************//**
+* Gets the length of the next block of a range which an output format can hold.
+*
+* @param[in] pCaps The limits of the output format.
+* @param[in] len The number of bytes left in the range.
+*
+* @return The length of the block.
+******************************************************************************/
+static U32 GetBlockLen(const FORMAT_CAPS *pCaps, U32 len)
+{
+   return (pCaps->maxBlockLen && len > pCaps->maxBlockLen) ? pCaps->maxBlockLen : len;
+}
+
+/**************************************************************************//**
+* Gets the length of the block of an output which starts at an address.
+*
+* Intel HEX blocks also end at each 64 KB boundary, as the records only hold
+* the low 16 bits of their addresses.
+*
+* @param[in] type The output file type.
+* @param[in] pCaps The format's limits.
+* @param[in] addr The address of the block.
+* @param[in] len The number of bytes left to write.
+*
+* @return The length of the block.
+******************************************************************************/
+static U32 GetOutBlockLen(FILE_TYPE type, const FORMAT_CAPS *pCaps, U32 addr, U32 len)
+{
+   len = GetBlockLen(pCaps, len);
+   if (type == FILE_TYPE_HEX && len > 0x10000 - (addr & 0xFFFF))
+   {
+      len = 0x10000 - (addr & 0xFFFF);
+   }
+
+   return len;
+}
+
+/**************************************************************************//**
+* Ensures the loaded ranges can be represented in an output format.
+*
+* This is done right after loading, so a conversion which cannot succeed fails
+* before any output is produced.
+*
+* @param[in] pCtx The conversion context.
+* @param[in] type The output file type.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+static RESULT CheckFormatLimits(const RFT_CONTEXT *pCtx, FILE_TYPE type)
+{
+   const FORMAT_CAPS *pCaps = GetFormatCaps(type);
+   RANGE *pRange;
+
+   if (pCaps == NULL)
+   {
+      ReportError("ERROR: %s files cannot be written.\n", RftGetFormatDesc(type));
+      return UNSUPPORTED;
+   }
+
+   for (pRange = pCtx->pAllRanges; pRange; pRange = pRange->pNext)
+   {
+      if (pCaps->addrBits < 32 && ((pRange->addr + pRange->len - 1) >> pCaps->addrBits))
+      {
+         ReportError("ERROR: Range 0x%04X - 0x%04X does not fit the %u-bit addresses of "
+            "%s files.\n", pRange->addr, pRange->addr + pRange->len - 1, pCaps->addrBits,
+            pCaps->pDesc);
+         return ADDR_OUT_OF_RANGE;
+      }
+
+      if (GetBlockLen(pCaps, pRange->len) < pRange->len)
+      {
+         printf("Range 0x%04X - 0x%04X is longer than a %s block, so it will be split.\n",
+            pRange->addr, pRange->addr + pRange->len - 1, pCaps->pDesc);
+      }
+   }
+
+   return OK;
+}
+
+/**************************************************************************//**
+* Sets the length of a planned output, which must be less than 4 GB, since the
+* offsets into an output are 32-bit.
+*
+* @param[in,out] pPlan The plan.
+* @param[in] len The length of the output, in bytes.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+static RESULT SetOutLen(OUTPUT_PLAN *pPlan, U64 len)
+{
+   if (len > 0xFFFFFFFF)
+   {
+      ReportError("ERROR: The output would be %u MB, which is 4 GB or more.\n", (U32) (len >> 20));
+      return LEN_OUT_OF_RANGE;
+   }
+
+   pPlan->outLen = (U32) len;
+   return OK;
+}
+
+/**************************************************************************//**
+* Plans a shared memory output, choosing the size of its address space.
+*
+* @param[in] pCtx The conversion context.
+* @param[in] pOpts The file options for this file type, or NULL for the defaults.
+* @param[in,out] pPlan The plan to complete.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+static RESULT PlanShm(const RFT_CONTEXT *pCtx, const FILE_OPTS_SHM *pOpts, OUTPUT_PLAN *pPlan)
+{
+   RANGE *pRange;
+   U32 endAddr, i;
+
+   /* The ranges are sorted, so the last one determines the highest address. */
+   for (pRange = pCtx->pAllRanges; pRange && pRange->pNext; pRange = pRange->pNext);
+   endAddr = pRange ? pRange->addr + pRange->len : 0;
+
+   /* Choose the smallest address space which holds all the ranges. */
+   pPlan->addrSpace = pOpts ? pOpts->addrSpace : 0;
+   if (pPlan->addrSpace == 0)
+   {
+      pPlan->addrSpace = endAddr > SHM_SPACE_64K ? SHM_SPACE_16M : SHM_SPACE_64K;
+   }
+
+   if (endAddr > pPlan->addrSpace)
+   {
+      ReportError("ERROR: Address out of range.\n");
+      return ADDR_OUT_OF_RANGE;
+   }
+
+   /* The header is followed by the bitmap, and then the flat image. */
+   pPlan->outLen = sizeof(SHM_HEADER) + (pPlan->addrSpace / 8) + pPlan->addrSpace;
+   for (pRange = pCtx->pAllRanges, i = 0; pRange; pRange = pRange->pNext, i++)
+   {
+      pPlan->pRangeOfs[i] = sizeof(SHM_HEADER) + (pPlan->addrSpace / 8) + pRange->addr;
+   }
+
+   return OK;
+}
+
+/**************************************************************************//**
+* Plans a memory initialization output, gathering the words it holds.
+*
+* Every line of these formats has the same length, so once the words are
+* gathered into one flat buffer, any chunk of lines can be written on its own.
+*
+* @param[in] pCtx The conversion context.
+* @param[in] type The type of the output file.
+* @param[in] pOpts The file options for this file type, or NULL for the defaults.
+* @param[in,out] pPlan The plan to complete.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+static RESULT PlanMemInit(const RFT_CONTEXT *pCtx, FILE_TYPE type, const FILE_OPTS_MEM *pOpts,
+   OUTPUT_PLAN *pPlan)
+{
+   const MEM_FORMAT *pFmt = GetMemFormat(type);
+   FILE_OPTS_MEM *pMem = &pPlan->mem;
+   U32 wordLen, numBytes = 0, last, ofs, len, i, j;
+   RANGE *pRange;
+   SEGMENT *pSeg;
+
+   if (pOpts != NULL)
+   {
+      *pMem = *pOpts;
+   }
+
+   if (pMem->wordBits == 0)
+   {
+      pMem->wordBits = 8;
+   }
+
+   if (pMem->numLanes == 0)
+   {
+      pMem->numLanes = 1;
+   }
+
+   if (pMem->wordBits != 8 && pMem->wordBits != 16 && pMem->wordBits != 32 && pMem->wordBits != 64)
+   {
+      ReportError("ERROR: Invalid word width: %u bits.\n", pMem->wordBits);
+      return INVALID_ARGUMENTS;
+   }
+
+   if (pMem->lane >= pMem->numLanes)
+   {
+      ReportError("ERROR: Invalid byte lane: %u of %u.\n", pMem->lane, pMem->numLanes);
+      return INVALID_ARGUMENTS;
+   }
+
+   wordLen = pMem->wordBits / 8;
+
+   /* Find how many bytes of the memory hold data. */
+   for (pRange = pCtx->pAllRanges; pRange; pRange = pRange->pNext)
+   {
+      if (pRange->addr < pMem->baseAddr)
+      {
+         ReportError("ERROR: Range 0x%04X - 0x%04X starts below the base address 0x%04X.\n",
+            pRange->addr, pRange->addr + pRange->len - 1, pMem->baseAddr);
+         return ADDR_OUT_OF_RANGE;
+      }
+
+      last = pRange->addr + pRange->len - 1 - pMem->baseAddr;
+      len = last / pMem->numLanes + (last % pMem->numLanes >= pMem->lane ? 1 : 0);
+      numBytes = len > numBytes ? len : numBytes;
+   }
+
+   if (pMem->depth == 0)
+   {
+      pMem->depth = numBytes ? (numBytes + wordLen - 1) / wordLen : 1;
+   }
+   else if ((numBytes + wordLen - 1) / wordLen > pMem->depth)
+   {
+      ReportError("ERROR: The data needs %u words, which is more than the depth of %u.\n",
+         (numBytes + wordLen - 1) / wordLen, pMem->depth);
+      return LEN_OUT_OF_RANGE;
+   }
+
+   /* Every line holds the same number of characters. */
+   pPlan->lineLen = wordLen * 2 + (U32) strlen(pFmt->pLineEnd);
+   if (pFmt->pAddrPrefix != NULL)
+   {
+      pPlan->lineLen += (U32) (strlen(pFmt->pAddrPrefix) + strlen(pFmt->pAddrSuffix)) +
+         GetHexDigits(pMem->depth - 1);
+   }
+
+   if (pMem->depth > (0xFFFFFFFF - 0x1000) / pPlan->lineLen)
+   {
+      ReportError("ERROR: A depth of %u words is too large.\n", pMem->depth);
+      return LEN_OUT_OF_RANGE;
+   }
+
+   pPlan->linesOfs = (U32) snprintf(NULL, 0, pFmt->pHeader, pMem->wordBits, pMem->depth);
+   pPlan->numRecords = pMem->depth;
+   pPlan->numChunks = (pMem->depth + MEM_CHUNK_WORDS - 1) / MEM_CHUNK_WORDS;
+   pPlan->outLen = pPlan->linesOfs + pMem->depth * pPlan->lineLen + (U32) strlen(pFmt->pTrailer);
+
+   /* Gather this lane's bytes into the words, leaving the pad value in any gaps. */
+   pPlan->pWords = (U8 *) malloc(pMem->depth * wordLen);
+   if (pPlan->pWords == NULL)
+   {
+      ReportError("ERROR: Out of memory.\n");
+      return NO_MEMORY;
+   }
+   memset(pPlan->pWords, pMem->pad, pMem->depth * wordLen);
+
+   for (pRange = pCtx->pAllRanges, i = 0; pRange; pRange = pRange->pNext, i++)
+   {
+      ofs = pRange->addr - pMem->baseAddr;
+      pPlan->pRangeOfs[i] = pPlan->linesOfs + (ofs / pMem->numLanes / wordLen) * pPlan->lineLen;
+
+      for (pSeg = pRange->pSegStart; pSeg; ofs += pSeg->len, pSeg = pSeg->pNext)
+      {
+         if (pMem->numLanes == 1)
+         {
+            memcpy(&pPlan->pWords[ofs], pSeg->pData, pSeg->len);
+            continue;
+         }
+
+         /* Only every numLanes-th byte belongs to this lane. */
+         j = (pMem->lane + pMem->numLanes - ofs % pMem->numLanes) % pMem->numLanes;
+         for (; j < pSeg->len; j += pMem->numLanes)
+         {
+            pPlan->pWords[(ofs + j) / pMem->numLanes] = pSeg->pData[j];
+         }
+      }
+   }
+
+   return OK;
+}
+
+/**************************************************************************//**
+* Counts the bytes at the start of a buffer which hold the fill value.
+*
+* Eight bytes are compared at a time.
+*
+* @param[in] pData The data to scan.
+* @param[in] len The length of the data, in bytes.
+* @param[in] fill The fill value.
+*
+* @return The number of leading fill bytes.
+******************************************************************************/
+static U32 SkipFill(const U8 *pData, U32 len, U8 fill)
+{
+   U64 pattern = 0x0101010101010101ULL * fill, w;
+   U32 i;
+
+   for (i = 0; i + 8 <= len; i += 8)
+   {
+      memcpy(&w, &pData[i], 8);
+      if (w != pattern)
+      {
+         break;
+      }
+   }
+
+   while (i < len && pData[i] == fill)
+   {
+      i++;
+   }
+
+   return i;
+}
+
+/**************************************************************************//**
+* Counts the bytes at the start of a buffer which do not hold the fill value.
+*
+* Eight bytes are checked at a time, for any byte which matches the fill value.
+*
+* @param[in] pData The data to scan.
+* @param[in] len The length of the data, in bytes.
+* @param[in] fill The fill value.
+*
+* @return The number of leading bytes which are not the fill value.
+******************************************************************************/
+static U32 SkipNonFill(const U8 *pData, U32 len, U8 fill)
+{
+   U64 pattern = 0x0101010101010101ULL * fill, w;
+   U32 i;
+
+   for (i = 0; i + 8 <= len; i += 8)
+   {
+      /* A byte of w ^ pattern is zero wherever the data holds the fill value. */
+      memcpy(&w, &pData[i], 8);
+      w ^= pattern;
+      if ((w - 0x0101010101010101ULL) & ~w & 0x8080808080808080ULL)
+      {
+         break;
+      }
+   }
+
+   while (i < len && pData[i] != fill)
+   {
+      i++;
+   }
+
+   return i;
+}
+
+/**************************************************************************//**
+* Adds a span to a growing list of spans.
+*
+* @param[in,out] ppSpans The list of spans, which may be moved.
+* @param[in,out] pNumSpans The number of spans in the list.
+* @param[in] pSpan The span to add. Empty spans are ignored.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+static RESULT AddSpan(OUT_SPAN **ppSpans, U32 *pNumSpans, const OUT_SPAN *pSpan)
+{
+   OUT_SPAN *pNew;
+
+   if (pSpan->len == 0)
+   {
+      return OK;
+   }
+
+   /* Grow the list whenever its size reaches a power of two. */
+   if ((*pNumSpans & (*pNumSpans - 1)) == 0)
+   {
+      pNew = (OUT_SPAN *) realloc(*ppSpans, (*pNumSpans ? *pNumSpans * 2 : 16) * sizeof(OUT_SPAN));
+      if (pNew == NULL)
+      {
+         ReportError("ERROR: Out of memory.\n");
+         return NO_MEMORY;
+      }
+      *ppSpans = pNew;
+   }
+
+   (*ppSpans)[(*pNumSpans)++] = *pSpan;
+   return OK;
+}
+
+/**************************************************************************//**
+* Divides the ranges into the spans which are written to an output.
+*
+* If enabled, runs of the fill value which are at least elideMinRun bytes long
+* are left out, splitting their range around them. Runs may cross segments.
+*
+* @param[in] pCtx The conversion context.
+* @param[out] ppSpans The spans, in address order. The caller must free them.
+* @param[out] pNumSpans The number of spans.
+* @param[in,out] pPlan Receives the number of bytes and runs left out.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+static RESULT FindSpans(const RFT_CONTEXT *pCtx, OUT_SPAN **ppSpans, U32 *pNumSpans,
+   OUTPUT_PLAN *pPlan)
+{
+   U32 minRun = pCtx->elideMinRun, segAddr, ofs, runStart = 0, end, i;
+   U8 fill = pCtx->elideFill;
+   int inRun;
+   OUT_SPAN span;
+   RANGE *pRange;
+   SEGMENT *pSeg;
+   RESULT r;
+
+   *ppSpans = NULL;
+   *pNumSpans = 0;
+
+   for (pRange = pCtx->pAllRanges, i = 0; pRange; pRange = pRange->pNext, i++)
+   {
+      span.addr = pRange->addr;
+      span.pSeg = pRange->pSegStart;
+      span.segOfs = 0;
+      span.range = i;
+      end = pRange->addr + pRange->len;
+      inRun = 0;
+
+      if (minRun != 0)
+      {
+         for (pSeg = pRange->pSegStart, segAddr = pRange->addr; pSeg; segAddr += pSeg->len, pSeg = pSeg->pNext)
+         {
+            for (ofs = 0; ofs < pSeg->len; )
+            {
+               if (!inRun)
+               {
+                  ofs += SkipNonFill(&pSeg->pData[ofs], pSeg->len - ofs, fill);
+                  if (ofs < pSeg->len)
+                  {
+                     inRun = 1;
+                     runStart = segAddr + ofs;
+                  }
+                  continue;
+               }
+
+               ofs += SkipFill(&pSeg->pData[ofs], pSeg->len - ofs, fill);
+               if (ofs == pSeg->len)
+               {
+                  continue;
+               }
+
+               /* The run has ended. Leave it out if it is long enough. */
+               inRun = 0;
+               if (segAddr + ofs - runStart >= minRun)
+               {
+                  span.len = runStart - span.addr;
+                  r = AddSpan(ppSpans, pNumSpans, &span);
+                  if (r != OK)
+                  {
+                     return r;
+                  }
+
+                  pPlan->elidedBytes += segAddr + ofs - runStart;
+                  pPlan->elidedRuns++;
+                  span.addr = segAddr + ofs;
+                  span.pSeg = pSeg;
+                  span.segOfs = ofs;
+               }
+            }
+         }
+      }
+
+      /* A run may also end the range. */
+      if (inRun && end - runStart >= minRun)
+      {
+         pPlan->elidedBytes += end - runStart;
+         pPlan->elidedRuns++;
+         end = runStart;
+      }
+
+      span.len = end - span.addr;
+      r = AddSpan(ppSpans, pNumSpans, &span);
+      if (r != OK)
+      {
+         return r;
+      }
+   }
+
+   return OK;
+}
+
+/**************************************************************************//**
+* Ends the current run of a single value while analyzing a range, keeping it if
+* it is the longest so far.
+*
+* @param[in,out] pStats The statistics of the range.
+* @param[in] runAddr The address of the current run.
+* @param[in] runLen The length of the current run.
+* @param[in] runValue The value of the current run.
+*
+* @return None.
+******************************************************************************/
+static void EndRun(RFT_RANGE_STATS *pStats, U32 runAddr, U32 runLen, U8 runValue)
+{
+   if (runLen > pStats->runLen)
+   {
+      pStats->runAddr = runAddr;
+      pStats->runLen = runLen;
+      pStats->runValue = runValue;
+   }
+}
+
+/**************************************************************************//**
+* Analyzes one range: its byte histogram, entropy and longest run. Runs as a
+* scheduled task.
+*
+* The histogram is counted into four tables, each byte of a word going to a
+* different table, so that consecutive equal bytes (which are common in ROM
+* images) do not stall on incrementing the same counter. The runs are found in
+* the same pass, a word at a time while a run continues.
+*
+* @param[in] pArg The ANALYZE_JOB.
+* @param[in] i The index of the range to analyze.
+*
+* @return None.
+******************************************************************************/
+static void AnalyzeRange(void *pArg, U32 i)
+{
+   ANALYZE_JOB *pJob = (ANALYZE_JOB *) pArg;
+   const RANGE *pRange = pJob->ppRanges[i];
+   RFT_RANGE_STATS *pStats = &pJob->pStats[i];
+   U32 counts[4][256], runAddr, runLen = 0, addr, j, k;
+   const SEGMENT *pSeg;
+   const U8 *pData;
+   double sum = 0;
+   U8 runValue = 0;
+   U64 w;
+
+   memset(counts, 0, sizeof(counts));
+   memset(pStats, 0, sizeof(*pStats));
+   pStats->addr = pRange->addr;
+   pStats->len = pRange->len;
+   runAddr = pRange->addr;
+
+   for (pSeg = pRange->pSegStart, addr = pRange->addr; pSeg; addr += pSeg->len, pSeg = pSeg->pNext)
+   {
+      pData = pSeg->pData;
+
+      for (j = 0; j + 8 <= pSeg->len; j += 8)
+      {
+         memcpy(&w, &pData[j], 8);
+         counts[0][pData[j + 0]]++;
+         counts[1][pData[j + 1]]++;
+         counts[2][pData[j + 2]]++;
+         counts[3][pData[j + 3]]++;
+         counts[0][pData[j + 4]]++;
+         counts[1][pData[j + 5]]++;
+         counts[2][pData[j + 6]]++;
+         counts[3][pData[j + 7]]++;
+
+         /* A word of the current run's value continues it. */
+         if (runLen && w == 0x0101010101010101ULL * runValue)
+         {
+            runLen += 8;
+            continue;
+         }
+
+         for (k = j; k < j + 8; k++)
+         {
+            if (runLen && pData[k] == runValue)
+            {
+               runLen++;
+            }
+            else
+            {
+               EndRun(pStats, runAddr, runLen, runValue);
+               runAddr = addr + k;
+               runLen = 1;
+               runValue = pData[k];
+            }
+         }
+      }
+
+      for (; j < pSeg->len; j++)
+      {
+         counts[0][pData[j]]++;
+         if (runLen && pData[j] == runValue)
+         {
+            runLen++;
+         }
+         else
+         {
+            EndRun(pStats, runAddr, runLen, runValue);
+            runAddr = addr + j;
+            runLen = 1;
+            runValue = pData[j];
+         }
+      }
+   }
+
+   EndRun(pStats, runAddr, runLen, runValue);
+
+   /* H = log2(len) - sum(count * log2(count)) / len */
+   for (j = 0; j < 256; j++)
+   {
+      pStats->counts[j] = counts[0][j] + counts[1][j] + counts[2][j] + counts[3][j];
+      if (pStats->counts[j])
+      {
+         sum += pStats->counts[j] * log((double) pStats->counts[j]);
+      }
+   }
+
+   pStats->entropy = (log((double) pRange->len) - sum / pRange->len) / log(2.0);
+}
+
+/**************************************************************************//**
+* Reads the bytes of one line of a hexdump output. Lines are aligned to
+* DUMP_LINE_BYTES, so a range's first and last lines may be partly empty.
+*
+* @param[in,out] ppSeg The segment holding the next byte, which is updated.
+* @param[in,out] pSegOfs The offset of the next byte within the segment, which is updated.
+* @param[in] addr The address of the next byte.
+* @param[in] left The number of bytes left in the range.
+* @param[out] pLine Receives the line's bytes, at their offsets in the line.
+* @param[out] pFirst Receives the offset in the line of its first byte.
+*
+* @return The number of bytes in the line.
+******************************************************************************/
+static U32 GetDumpLine(const SEGMENT **ppSeg, U32 *pSegOfs, U32 addr, U32 left, U8 *pLine,
+   U32 *pFirst)
+{
+   const SEGMENT *pSeg = *ppSeg;
+   U32 segOfs = *pSegOfs, first = addr % DUMP_LINE_BYTES, n, i, take;
+
+   n = DUMP_LINE_BYTES - first < left ? DUMP_LINE_BYTES - first : left;
+   for (i = 0; i < n; i += take)
+   {
+      if (segOfs == pSeg->len)
+      {
+         pSeg = pSeg->pNext;
+         segOfs = 0;
+      }
+
+      take = pSeg->len - segOfs < n - i ? pSeg->len - segOfs : n - i;
+      memcpy(&pLine[first + i], &pSeg->pData[segOfs], take);
+      segOfs += take;
+   }
+
+   *ppSeg = pSeg;
+   *pSegOfs = segOfs;
+   *pFirst = first;
+
+   return n;
+}
+
+/**************************************************************************//**
+* Plans a hexdump output.
+*
+* Each line has the same length, except that a run of identical lines can be
+* squeezed into its first line and a "*". So the lines are read once here, to
+* find which are squeezed, and each chunk records whether it starts in a run.
+*
+* @param[in] pCtx The conversion context.
+* @param[in] pOpts The file options for this file type, or NULL for the defaults.
+* @param[in,out] pPlan The plan to complete.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+static RESULT PlanDump(const RFT_CONTEXT *pCtx, const FILE_OPTS_DUMP *pOpts, OUTPUT_PLAN *pPlan)
+{
+   int squeeze = pOpts != NULL && pOpts->squeeze;
+   U8 line[DUMP_LINE_BYTES], prev[DUMP_LINE_BYTES];
+   U32 prevEnd = 0, left, addr, segOfs, lineNo, first, n, i;
+   int full, prevFull, repeat, prevRepeat;
+   U64 ofs = 0;
+   const SEGMENT *pSeg;
+   OUT_CHUNK *pChunk;
+   RANGE *pRange;
+
+   memset(line, 0, sizeof(line));
+
+   /* Each range has its own lines, so chunks never span ranges. */
+   for (pRange = pCtx->pAllRanges; pRange; pRange = pRange->pNext)
+   {
+      n = ((pRange->addr + pRange->len - 1) / DUMP_LINE_BYTES) - (pRange->addr / DUMP_LINE_BYTES) + 1;
+      pPlan->numChunks += (n + DUMP_CHUNK_LINES - 1) / DUMP_CHUNK_LINES;
+   }
+
+   pPlan->pChunks = (OUT_CHUNK *) malloc(pPlan->numChunks * sizeof(OUT_CHUNK));
+   if (pPlan->pChunks == NULL && pPlan->numChunks != 0)
+   {
+      ReportError("ERROR: Out of memory.\n");
+      return NO_MEMORY;
+   }
+
+   /* The offsets are only kept if the whole dump is less than 4 GB: see SetOutLen(). */
+   pChunk = pPlan->pChunks - 1;
+   for (pRange = pCtx->pAllRanges, i = 0; pRange; pRange = pRange->pNext, i++)
+   {
+      pPlan->pRangeOfs[i] = (U32) ofs;
+      pSeg = pRange->pSegStart;
+      segOfs = 0;
+      addr = pRange->addr;
+      prevFull = 0;
+      prevRepeat = 0;
+
+      for (left = pRange->len, lineNo = 0; left; left -= n, addr += n, lineNo++)
+      {
+         if (lineNo % DUMP_CHUNK_LINES == 0)
+         {
+            pChunk++;
+            pChunk->addr = addr;
+            pChunk->len = 0;
+            pChunk->pSeg = (SEGMENT *) pSeg;
+            pChunk->segOfs = segOfs;
+            pChunk->outOfs = (U32) ofs;
+            pChunk->blockLen = lineNo == 0 ? pRange->len : 0;
+            pChunk->gapLen = lineNo == 0 && i != 0 ? pRange->addr - prevEnd : 0;
+            pChunk->dumpFlags = (squeeze ? DUMP_SQUEEZE : 0) | (prevRepeat ? DUMP_SQUEEZED : 0);
+
+            /* A gap line separates each range from the previous one. */
+            if (pChunk->gapLen)
+            {
+               ofs += DUMP_GAP_LEN;
+            }
+         }
+
+         n = GetDumpLine(&pSeg, &segOfs, addr, left, line, &first);
+         full = n == DUMP_LINE_BYTES;
+         repeat = squeeze && full && prevFull && !memcmp(line, prev, DUMP_LINE_BYTES);
+         if (repeat && lineNo % DUMP_CHUNK_LINES == 0)
+         {
+            pChunk->dumpFlags |= DUMP_REPEAT;
+         }
+
+         /* The first repeated line is written as a "*", and the rest are left out. */
+         ofs += repeat ? (prevRepeat ? 0 : 2) : DUMP_LINE_LEN;
+         pChunk->len += n;
+
+         memcpy(prev, line, DUMP_LINE_BYTES);
+         prevFull = full;
+         prevRepeat = repeat;
+      }
+
+      prevEnd = pRange->addr + pRange->len;
+   }
+
+   /* The dump ends with the address just past the data, like hexdump. */
+   return SetOutLen(pPlan, ofs + 9);
+}
+
+/**************************************************************************//**
+* Finds where the data loaded within a window of addresses ends.
+*
+* @param[in] pCtx The conversion context.
+* @param[in] start The first address of the window.
+* @param[in] end The address just past the window.
+*
+* @return The address just past the last byte loaded in the window, or start if
+*         nothing is loaded there.
+******************************************************************************/
+static U64 GetDataEnd(const RFT_CONTEXT *pCtx, U64 start, U64 end)
+{
+   const RANGE *pRange;
+   U64 dataEnd = start, rangeEnd;
+
+   for (pRange = pCtx->pAllRanges; pRange; pRange = pRange->pNext)
+   {
+      rangeEnd = (U64) pRange->addr + pRange->len;
+      if (pRange->addr < end && rangeEnd > start)
+      {
+         dataEnd = rangeEnd < end ? rangeEnd : end;
+      }
+   }
+
+   return dataEnd;
+}
+
+/**************************************************************************//**
+* Gets the number of bytes two windows of addresses have in common.
+*
+* @param[in] startA The first address of the first window.
+* @param[in] endA The address just past the first window.
+* @param[in] startB The first address of the second window.
+* @param[in] endB The address just past the second window.
+*
+* @return The number of bytes in both windows.
+******************************************************************************/
+static U64 GetOverlapLen(U64 startA, U64 endA, U64 startB, U64 endB)
+{
+   U64 start = startA > startB ? startA : startB;
+   U64 end = endA < endB ? endA : endB;
+
+   return end > start ? end - start : 0;
+}
+
+/**************************************************************************//**
+* Plans the chunks of one ROM of an NES file, which copy the data loaded within
+* its window of addresses to where the ROM is in the file.
+*
+* When the plan has no chunks allocated yet, they are only counted.
+*
+* @param[in] pCtx The conversion context.
+* @param[in] start The address of the first byte of the ROM.
+* @param[in] end The address just past the ROM.
+* @param[in] outOfs The offset of the ROM in the file.
+* @param[in,out] pPlan The plan, whose chunks are added to.
+*
+* @return None.
+******************************************************************************/
+static void PlanNesRom(const RFT_CONTEXT *pCtx, U64 start, U64 end, U32 outOfs,
+   OUTPUT_PLAN *pPlan)
+{
+   const RANGE *pRange;
+   OUT_CHUNK *pChunk;
+   SEGMENT *pSeg;
+   U64 from, to;
+   U32 segOfs, take, i;
+
+   for (pRange = pCtx->pAllRanges, i = 0; pRange; pRange = pRange->pNext, i++)
+   {
+      from = pRange->addr > start ? pRange->addr : start;
+      to = (U64) pRange->addr + pRange->len < end ? (U64) pRange->addr + pRange->len : end;
+      if (from >= to)
+      {
+         continue;
+      }
+
+      /* Each range is output where its first byte is. */
+      if (pRange->addr >= start)
+      {
+         pPlan->pRangeOfs[i] = outOfs + (U32) (pRange->addr - start);
+      }
+
+      pSeg = pRange->pSegStart;
+      segOfs = (U32) (from - pRange->addr);
+      while (segOfs > pSeg->len)
+      {
+         segOfs -= pSeg->len;
+         pSeg = pSeg->pNext;
+      }
+
+      for (; from < to; from += take)
+      {
+         take = to - from < OUT_CHUNK_LEN ? (U32) (to - from) : OUT_CHUNK_LEN;
+
+         if (pPlan->pChunks != NULL)
+         {
+            pChunk = &pPlan->pChunks[pPlan->numChunks];
+            memset(pChunk, 0, sizeof(*pChunk));
+            pChunk->addr = (U32) from;
+            pChunk->len = take;
+            pChunk->pSeg = pSeg;
+            pChunk->segOfs = segOfs;
+            pChunk->outOfs = outOfs + (U32) (from - start);
+         }
+         pPlan->numChunks++;
+
+         /* Find where the next chunk starts. */
+         segOfs += take;
+         while (segOfs > pSeg->len)
+         {
+            segOfs -= pSeg->len;
+            pSeg = pSeg->pNext;
+         }
+      }
+   }
+}
+
+/**************************************************************************//**
+* Plans an iNES or NES 2.0 file: a 16-byte header, PRG ROM, then CHR ROM.
+*
+* Each ROM is a window of addresses of the image, which is padded out to whole
+* banks. The data is copied straight from the segments into the file.
+*
+* @param[in] pCtx The conversion context.
+* @param[in] pOpts The file options for this file type, or NULL for the defaults.
+* @param[in,out] pPlan The plan to complete.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+static RESULT PlanNes(const RFT_CONTEXT *pCtx, const FILE_OPTS_NES *pOpts, OUTPUT_PLAN *pPlan)
+{
+   FILE_OPTS_NES *pNes = &pPlan->nes;
+   const RANGE *pRange;
+   U64 prgEnd, chrEnd, prgLen, chrLen, limit;
+   U32 maxBanks, i;
+
+   if (pOpts != NULL)
+   {
+      *pNes = *pOpts;
+   }
+
+   if (pNes->mapper > 4095 || pNes->subMapper > 15)
+   {
+      ReportError("ERROR: Invalid mapper %u.%u.\n", pNes->mapper, pNes->subMapper);
+      return INVALID_ARGUMENTS;
+   }
+
+   if (!pNes->nes2 && (pNes->mapper > 255 || pNes->subMapper))
+   {
+      ReportError("ERROR: Mapper %u.%u needs an NES 2.0 header.\n", pNes->mapper, pNes->subMapper);
+      return INVALID_ARGUMENTS;
+   }
+
+   if (pNes->prgLen % NES_PRG_BANK_LEN || pNes->chrLen % NES_CHR_BANK_LEN)
+   {
+      ReportError("ERROR: PRG ROM must be whole 16 KB banks, and CHR ROM whole 8 KB banks.\n");
+      return INVALID_ARGUMENTS;
+   }
+
+   /* PRG ROM starts at the lowest address loaded, unless it is given. */
+   if (!pNes->prgAddrSpecified)
+   {
+      pNes->prgAddr = pCtx->pAllRanges ? pCtx->pAllRanges->addr : 0;
+   }
+
+   /* A ROM whose size is not given holds the data up to where the other starts. */
+   prgLen = pNes->prgLen;
+   if (prgLen == 0)
+   {
+      limit = pNes->hasChr && pNes->chrAddr > pNes->prgAddr ? pNes->chrAddr : 0x100000000ULL;
+      prgEnd = GetDataEnd(pCtx, pNes->prgAddr, limit);
+      prgLen = (prgEnd - pNes->prgAddr + NES_PRG_BANK_LEN - 1) & ~(U64) (NES_PRG_BANK_LEN - 1);
+      prgLen = prgLen ? prgLen : NES_PRG_BANK_LEN;
+   }
+
+   chrLen = pNes->chrLen;
+   if (pNes->hasChr && chrLen == 0)
+   {
+      limit = pNes->prgAddr > pNes->chrAddr ? pNes->prgAddr : 0x100000000ULL;
+      chrEnd = GetDataEnd(pCtx, pNes->chrAddr, limit);
+      chrLen = (chrEnd - pNes->chrAddr + NES_CHR_BANK_LEN - 1) & ~(U64) (NES_CHR_BANK_LEN - 1);
+      chrLen = chrLen ? chrLen : NES_CHR_BANK_LEN;
+   }
+   else if (!pNes->hasChr)
+   {
+      chrLen = 0;
+   }
+
+   /* NES 2.0 headers hold four more bits of each bank count. */
+   maxBanks = pNes->nes2 ? 0xEFF : 0xFF;
+   if (prgLen / NES_PRG_BANK_LEN > maxBanks || chrLen / NES_CHR_BANK_LEN > maxBanks)
+   {
+      ReportError("ERROR: %u KB of PRG ROM and %u KB of CHR ROM do not fit an %s header.\n",
+         (U32) (prgLen >> 10), (U32) (chrLen >> 10), pNes->nes2 ? "NES 2.0" : "iNES");
+      return LEN_OUT_OF_RANGE;
+   }
+   pNes->prgLen = (U32) prgLen;
+   pNes->chrLen = (U32) chrLen;
+
+   if (GetOverlapLen(pNes->prgAddr, pNes->prgAddr + prgLen, pNes->chrAddr,
+      pNes->chrAddr + chrLen) != 0)
+   {
+      ReportError("ERROR: PRG ROM (0x%X - 0x%X) overlaps CHR ROM (0x%X - 0x%X).\n",
+         pNes->prgAddr, (U32) (pNes->prgAddr + prgLen - 1), pNes->chrAddr,
+         (U32) (pNes->chrAddr + chrLen - 1));
+      return INVALID_ARGUMENTS;
+   }
+
+   /* Every byte loaded must be in one of the ROMs. */
+   for (pRange = pCtx->pAllRanges; pRange; pRange = pRange->pNext)
+   {
+      if (GetOverlapLen(pRange->addr, (U64) pRange->addr + pRange->len, pNes->prgAddr,
+         pNes->prgAddr + prgLen) + GetOverlapLen(pRange->addr, (U64) pRange->addr + pRange->len,
+         pNes->chrAddr, pNes->chrAddr + chrLen) != pRange->len)
+      {
+         ReportError("ERROR: Range 0x%04X - 0x%04X is not within PRG ROM (0x%X - 0x%X)%s.\n",
+            pRange->addr, pRange->addr + pRange->len - 1, pNes->prgAddr,
+            (U32) (pNes->prgAddr + prgLen - 1), pNes->hasChr ? " or CHR ROM" : "");
+         return ADDR_OUT_OF_RANGE;
+      }
+   }
+
+   /* Count the chunks of each ROM, then plan them. */
+   for (i = 0; i < 2; i++)
+   {
+      if (i)
+      {
+         pPlan->pChunks = (OUT_CHUNK *) malloc((pPlan->numChunks + 1) * sizeof(OUT_CHUNK));
+         if (pPlan->pChunks == NULL)
+         {
+            ReportError("ERROR: Out of memory.\n");
+            return NO_MEMORY;
+         }
+         pPlan->numChunks = 0;
+      }
+
+      PlanNesRom(pCtx, pNes->prgAddr, pNes->prgAddr + prgLen, NES_HEADER_LEN, pPlan);
+      PlanNesRom(pCtx, pNes->chrAddr, pNes->chrAddr + chrLen, NES_HEADER_LEN + pNes->prgLen, pPlan);
+   }
+
+   pPlan->outLen = NES_HEADER_LEN + pNes->prgLen + pNes->chrLen;
+
+   return OK;
+}
+
+/**************************************************************************//**
+* Gets the size of the chip of a C64 cartridge which holds an address.
+*
+* @param[in] pCrt The options of the cartridge.
+* @param[in] addr The address, whose bits 16 and up are the bank.
+*
+* @return The size of the chip, or 0 if the address is not in a chip.
+******************************************************************************/
+static U32 GetCrtChipLen(const FILE_OPTS_CRT *pCrt, U32 addr)
+{
+   addr &= 0xFFFF;
+
+   if (addr >= 0x8000 && addr < 0xC000)
+   {
+      return pCrt->chip16K ? 0x4000 : 0x2000;
+   }
+
+   return addr >= 0xE000 ? 0x2000 : 0;
+}
+
+/**************************************************************************//**
+* Finds whether a chunk of a C64 cartridge is the first of its chip, which is
+* preceded by the chip's CHIP packet header.
+*
+* @param[in] pPlan The plan of the output.
+* @param[in] i The index of the chunk.
+* @param[out] pChipAddr The address of the chip.
+* @param[out] pChipLen The size of the chip.
+* @param[out] pHeaderOfs The offset of the CHIP packet in the output.
+*
+* @return Non-zero if the chunk is the first of its chip.
+******************************************************************************/
+static int StartsCrtChip(const OUTPUT_PLAN *pPlan, U32 i, U32 *pChipAddr, U32 *pChipLen,
+   U32 *pHeaderOfs)
+{
+   const OUT_CHUNK *pChunk = &pPlan->pChunks[i];
+
+   *pChipLen = GetCrtChipLen(&pPlan->crt, pChunk->addr);
+   *pChipAddr = pChunk->addr & ~(*pChipLen - 1);
+   *pHeaderOfs = pChunk->outOfs - (pChunk->addr - *pChipAddr) - CRT_CHIP_HEADER_LEN;
+
+   /* The chunks are in address order, so one in the same chip comes just before. */
+   return i == 0 || pChunk[-1].addr < *pChipAddr;
+}
+
+/**************************************************************************//**
+* Plans a C64 cartridge (CRT) file: a 64-byte header, then a CHIP packet for
+* each 8 KB or 16 KB chip of each bank which holds any data.
+*
+* Each chip is padded out to its full size. The data is copied straight from
+* the segments into the file.
+*
+* @param[in] pCtx The conversion context.
+* @param[in] pOpts The file options for this file type, or NULL for the defaults.
+* @param[in,out] pPlan The plan to complete.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+static RESULT PlanCrt(const RFT_CONTEXT *pCtx, const FILE_OPTS_CRT *pOpts, OUTPUT_PLAN *pPlan)
+{
+   FILE_OPTS_CRT *pCrt = &pPlan->crt;
+   const RANGE *pRange;
+   OUT_CHUNK *pChunk;
+   SEGMENT *pSeg;
+   U64 addr, end, chipEnd;
+   U32 chipAddr = 0, chipLen = 0, ofs, segOfs, take, pass, i;
+   int hasRomh = 0, hasUltimax = 0;
+
+   if (pOpts != NULL)
+   {
+      *pCrt = *pOpts;
+   }
+
+   if (pCrt->hwType > 0xFFFF || pCrt->exrom > 1 || pCrt->game > 1 || pCrt->chipType > 2)
+   {
+      ReportError("ERROR: Invalid C64 cartridge hardware type, EXROM or GAME line, or "
+         "chip type.\n");
+      return INVALID_ARGUMENTS;
+   }
+
+   /* Count the chunks of each chip, then plan them. */
+   for (pass = 0; pass < 2; pass++)
+   {
+      if (pass)
+      {
+         pPlan->pChunks = (OUT_CHUNK *) malloc((pPlan->numChunks + 1) * sizeof(OUT_CHUNK));
+         if (pPlan->pChunks == NULL)
+         {
+            ReportError("ERROR: Out of memory.\n");
+            return NO_MEMORY;
+         }
+         pPlan->numChunks = 0;
+      }
+
+      ofs = CRT_HEADER_LEN;
+      for (pRange = pCtx->pAllRanges, i = 0; pRange; pRange = pRange->pNext, i++)
+      {
+         pSeg = pRange->pSegStart;
+         segOfs = 0;
+         end = (U64) pRange->addr + pRange->len;
+
+         for (addr = pRange->addr; addr < end; addr += take)
+         {
+            /* Each chip which holds data starts a CHIP packet, after the previous one. */
+            if (pPlan->numChunks == 0 || addr >= (U64) chipAddr + chipLen)
+            {
+               if (pPlan->numChunks)
+               {
+                  ofs += CRT_CHIP_HEADER_LEN + chipLen;
+               }
+
+               chipLen = GetCrtChipLen(pCrt, (U32) addr);
+               if (chipLen == 0)
+               {
+                  ReportError("ERROR: Range 0x%04X - 0x%04X is not within the $8000 - $BFFF and "
+                     "$E000 - $FFFF chips of a C64 cartridge bank.\n",
+                     pRange->addr, pRange->addr + pRange->len - 1);
+                  return ADDR_OUT_OF_RANGE;
+               }
+               chipAddr = (U32) addr & ~(chipLen - 1);
+
+               hasRomh |= (chipAddr & 0xFFFF) == 0xA000 || chipLen == 0x4000;
+               hasUltimax |= (chipAddr & 0xFFFF) == 0xE000;
+            }
+
+            chipEnd = (U64) chipAddr + chipLen;
+            take = chipEnd - addr < OUT_CHUNK_LEN ? (U32) (chipEnd - addr) : OUT_CHUNK_LEN;
+            take = end - addr < take ? (U32) (end - addr) : take;
+
+            if (addr == pRange->addr)
+            {
+               pPlan->pRangeOfs[i] = ofs + CRT_CHIP_HEADER_LEN + (U32) addr - chipAddr;
+            }
+
+            if (pPlan->pChunks != NULL)
+            {
+               pChunk = &pPlan->pChunks[pPlan->numChunks];
+               memset(pChunk, 0, sizeof(*pChunk));
+               pChunk->addr = (U32) addr;
+               pChunk->len = take;
+               pChunk->pSeg = pSeg;
+               pChunk->segOfs = segOfs;
+               pChunk->outOfs = ofs + CRT_CHIP_HEADER_LEN + (U32) addr - chipAddr;
+            }
+            pPlan->numChunks++;
+
+            /* Find where the next chunk starts. */
+            segOfs += take;
+            while (segOfs > pSeg->len)
+            {
+               segOfs -= pSeg->len;
+               pSeg = pSeg->pNext;
+            }
+         }
+      }
+   }
+
+   pPlan->outLen = ofs + (pPlan->numChunks ? CRT_CHIP_HEADER_LEN + chipLen : 0);
+
+   /* By default, the lines select Ultimax mode for chips at $E000, and otherwise a 16 KB
+   or 8 KB cartridge, by whether there is ROMH. */
+   if (!pCrt->linesSpecified)
+   {
+      pCrt->exrom = hasUltimax ? 1 : 0;
+      pCrt->game = hasUltimax || hasRomh ? 0 : 1;
+   }
+
+   return OK;
+}
+
+/**************************************************************************//**
+* Computes where everything goes in an output file, before it is written.
+*
+* The data of each range is divided into chunks, and each chunk is assigned the
+* offset at which its output starts. Chunks never share output bytes.
+*
+* @param[in] pCtx The conversion context.
+* @param[in] type The type of the output file.
+* @param[in] pOpts The file options for this file type.
+* @param[out] pPlan The computed plan. Release it with RftFreePlan().
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+static RESULT PlanOutput(const RFT_CONTEXT *pCtx, FILE_TYPE type, const void *pOpts,
+   OUTPUT_PLAN *pPlan)
+{
+   const FORMAT_CAPS *pCaps = GetFormatCaps(type);
+   OUT_SPAN *pSpans, *pSpan;
+   OUT_CHUNK *pChunk;
+   RANGE *pRange;
+   SEGMENT *pSeg;
+   U32 segOfs, len, take, blockLen, blockLeft, numSpans, i, chunkLen, numRecs;
+   U32 page = 0;
+   U64 ofs, end;
+   RESULT r;
+
+   memset(pPlan, 0, sizeof(*pPlan));
+
+   pPlan->pRangeOfs = (U32 *) malloc((pCtx->numRanges + 1) * sizeof(U32));
+   if (pPlan->pRangeOfs == NULL)
+   {
+      ReportError("ERROR: Out of memory.\n");
+      return NO_MEMORY;
+   }
+
+   if (type == FILE_TYPE_SHM)
+   {
+      return PlanShm(pCtx, (const FILE_OPTS_SHM *) pOpts, pPlan);
+   }
+
+   if (GetMemFormat(type) != NULL)
+   {
+      return PlanMemInit(pCtx, type, (const FILE_OPTS_MEM *) pOpts, pPlan);
+   }
+
+   if (type == FILE_TYPE_DUMP)
+   {
+      return PlanDump(pCtx, (const FILE_OPTS_DUMP *) pOpts, pPlan);
+   }
+
+   if (type == FILE_TYPE_NES)
+   {
+      return PlanNes(pCtx, (const FILE_OPTS_NES *) pOpts, pPlan);
+   }
+
+   if (type == FILE_TYPE_CRT)
+   {
+      return PlanCrt(pCtx, (const FILE_OPTS_CRT *) pOpts, pPlan);
+   }
+
+   /* Intel HEX records are all the same length from the start of each block, so
+   chunks hold a whole number of them. */
+   chunkLen = OUT_CHUNK_LEN;
+   if (type == FILE_TYPE_HEX)
+   {
+      pPlan->recLen = pOpts != NULL && ((const FILE_OPTS_HEX *) pOpts)->recLen ?
+         ((const FILE_OPTS_HEX *) pOpts)->recLen : HEX_REC_LEN;
+      if (pPlan->recLen > HEX_MAX_REC_LEN)
+      {
+         ReportError("ERROR: Intel HEX records hold at most %u bytes.\n", HEX_MAX_REC_LEN);
+         return INVALID_ARGUMENTS;
+      }
+      chunkLen -= OUT_CHUNK_LEN % pPlan->recLen;
+   }
+
+   r = FindSpans(pCtx, &pSpans, &numSpans, pPlan);
+   if (r != OK)
+   {
+      free(pSpans);
+      return r;
+   }
+
+   /* Count the chunks needed. Chunks never span blocks, and each span starts a block. */
+   for (pSpan = pSpans; pSpan < pSpans + numSpans; pSpan++)
+   {
+      for (len = 0; len < pSpan->len; len += blockLen)
+      {
+         blockLen = GetOutBlockLen(type, pCaps, pSpan->addr + len, pSpan->len - len);
+         pPlan->numChunks += (blockLen + chunkLen - 1) / chunkLen;
+      }
+   }
+
+   pPlan->pChunks = (OUT_CHUNK *) malloc(pPlan->numChunks * sizeof(OUT_CHUNK));
+   if (pPlan->pChunks == NULL && pPlan->numChunks != 0)
+   {
+      ReportError("ERROR: Out of memory.\n");
+      free(pSpans);
+      return NO_MEMORY;
+   }
+
+   /* A WDC file starts with a 'Z'. Intel HEX, TI-TXT and Tektronix outputs may hold
+   32-bit addresses, so the offsets are only kept if the whole output is less than
+   4 GB: see SetOutLen(). */
+   ofs = type == FILE_TYPE_WDC ? 1 : 0;
+
+   /* Tektronix extended hex addresses are all written with the same number of digits. */
+   for (pRange = pCtx->pAllRanges; pRange && pRange->pNext; pRange = pRange->pNext);
+   pPlan->addrDigits = (pRange && pRange->addr + pRange->len - 1 > 0xFFFF) ||
+      pCtx->startAddr > 0xFFFF ? 8 : 4;
+
+   pChunk = pPlan->pChunks;
+   i = 0;
+   for (pSpan = pSpans; pSpan < pSpans + numSpans; pSpan++)
+   {
+      /* Each range starts with its first span. Ranges which were entirely fill start
+      where the next one does. */
+      while (i <= pSpan->range)
+      {
+         pPlan->pRangeOfs[i++] = (U32) ofs;
+      }
+
+      pSeg = pSpan->pSeg;
+      segOfs = pSpan->segOfs;
+      blockLeft = 0;
+
+      for (len = 0; len < pSpan->len; len += pChunk->len, pChunk++)
+      {
+         /* Start a new block once the previous one is complete. An Intel HEX block in
+         a different 64 KB page to the one before starts by setting the page. */
+         pChunk->addr = pSpan->addr + len;
+         pChunk->blockLen = 0;
+         pChunk->extAddr = 0;
+         if (blockLeft == 0)
+         {
+            blockLeft = GetOutBlockLen(type, pCaps, pChunk->addr, pSpan->len - len);
+            pChunk->blockLen = blockLeft;
+
+            if (type == FILE_TYPE_HEX && (pChunk->addr >> 16) != page)
+            {
+               page = pChunk->addr >> 16;
+               pChunk->extAddr = 1;
+            }
+         }
+
+         pChunk->len = blockLeft < chunkLen ? blockLeft : chunkLen;
+         pChunk->pSeg = pSeg;
+         pChunk->segOfs = segOfs;
+         pChunk->outOfs = (U32) ofs;
+         blockLeft -= pChunk->len;
+
+         switch (type)
+         {
+            case FILE_TYPE_WDC:
+               /* Each block is preceded by its address and length. */
+               ofs += (pChunk->blockLen ? 6 : 0) + pChunk->len;
+               break;
+
+            case FILE_TYPE_TITXT:
+               /* Each block starts with an "@ADDR" line, and each byte is followed by a
+               space or, at the end of a line, a CR LF. */
+               if (pChunk->blockLen)
+               {
+                  ofs += 3 + (pChunk->addr > 0xFFFF ? GetHexDigits(pChunk->addr) : 4);
+               }
+               ofs += pChunk->len * 3 + (pChunk->len + TI_LINE_LEN - 1) / TI_LINE_LEN;
+               break;
+
+            case FILE_TYPE_TEK:
+               /* Each record has 9 bytes of framing and an address, plus two hex digits per byte. */
+               pPlan->numRecords += (pChunk->len + TEK_REC_LEN - 1) / TEK_REC_LEN;
+               ofs += ((pChunk->len + TEK_REC_LEN - 1) / TEK_REC_LEN) * (9 + pPlan->addrDigits) +
+                  pChunk->len * 2;
+               break;
+
+            case FILE_TYPE_HEX:
+               /* Each record has 13 bytes of framing, plus two hex digits per byte, and an
+               extended linear address record holds two bytes. Only the data records are
+               counted, as for the other formats. */
+               numRecs = (pChunk->len + pPlan->recLen - 1) / pPlan->recLen;
+               pPlan->numRecords += numRecs;
+               ofs += (numRecs + pChunk->extAddr) * HEX_RECORD_LEN(0) +
+                  (pChunk->len + pChunk->extAddr * 2) * 2;
+               break;
+
+            default:
+               /* Each PAP record has 13 bytes of framing, plus two hex digits per byte. */
+               pPlan->numRecords += (pChunk->len + PAP_REC_LEN - 1) / PAP_REC_LEN;
+               ofs += ((pChunk->len + PAP_REC_LEN - 1) / PAP_REC_LEN) * 13 + pChunk->len * 2;
+               break;
+         }
+
+         /* Find where the next chunk starts. */
+         for (take = pChunk->len; take; )
+         {
+            if (segOfs == pSeg->len)
+            {
+               pSeg = pSeg->pNext;
+               segOfs = 0;
+            }
+
+            if (pSeg->len - segOfs > take)
+            {
+               segOfs += take;
+               take = 0;
+            }
+            else
+            {
+               take -= pSeg->len - segOfs;
+               segOfs = pSeg->len;
+            }
+         }
+      }
+   }
+
+   while (i < pCtx->numRanges)
+   {
+      pPlan->pRangeOfs[i++] = (U32) ofs;
+   }
+
+   free(pSpans);
+
+   /* Each format ends with an end record. */
+   switch (type)
+   {
+      case FILE_TYPE_WDC:
+         end = 6;
+         break;
+
+      case FILE_TYPE_TITXT:
+         end = 3;
+         break;
+
+      case FILE_TYPE_TEK:
+         end = 9 + pPlan->addrDigits;
+         break;
+
+      case FILE_TYPE_HEX:
+         /* A starting address is written in one record before the end record. */
+         end = (pCtx->startAddr != 0 ? HEX_RECORD_LEN(4) : 0) + HEX_RECORD_LEN(0);
+         break;
+
+      default:
+         end = 13;
+         break;
+   }
+
+   return SetOutLen(pPlan, ofs + end);
+}
+
+/**************************************************************************//**
+* Reserves disk space for the whole output file before it is written.
+*
+* This way, running out of disk space is reported up front, rather than part
+* way through writing (or as a fault while writing through a mapping). Devices
+* and pipes, such as /dev/null, have no disk space to reserve, so are skipped.
+*
+* @param[in] fd The descriptor of the output file.
+* @param[in] len The final size of the output file, in bytes.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+static RESULT PreallocateFile(int fd, U32 len)
+{
+#ifdef _WIN32
+   HANDLE hFile = (HANDLE) _get_osfhandle(fd);
+   FILE_ALLOCATION_INFO allocInfo;
+
+   if (GetFileType(hFile) != FILE_TYPE_DISK)
+   {
+      return OK;
+   }
+
+   allocInfo.AllocationSize.QuadPart = len;
+   if (!SetFileInformationByHandle(hFile, FileAllocationInfo, &allocInfo, sizeof(allocInfo)))
+#else
+   struct stat st;
+   int err;
+
+   if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+   {
+      return OK;
+   }
+
+   /* Some file systems cannot preallocate, which is not an error. */
+   err = posix_fallocate(fd, 0, len);
+   if (err != 0 && err != EINVAL && err != EOPNOTSUPP && err != ENODEV && err != ESPIPE)
+#endif
+   {
+      ReportError("Unable to reserve %u bytes for the output file.\n", len);
+      return IO_ERROR;
+   }
+
+   return OK;
+}
+
+/**************************************************************************//**
+* Writes the WDC binary output for one chunk.
+*
+* @param[in] pOut The start of the output file's contents.
+* @param[in] pChunk The chunk to write.
+*
+* @return None.
+******************************************************************************/
+static void RenderWdcChunk(U8 *pOut, const OUT_CHUNK *pChunk)
+{
+   const SEGMENT *pSeg = pChunk->pSeg;
+   U32 segOfs = pChunk->segOfs, len = pChunk->len, take;
+
+   pOut += pChunk->outOfs;
+
+   /* The first chunk of a block writes the block's address and length. */
+   if (pChunk->blockLen)
+   {
+      pOut[0] = (U8) (pChunk->addr >> 0);
+      pOut[1] = (U8) (pChunk->addr >> 8);
+      pOut[2] = (U8) (pChunk->addr >> 16);
+      pOut[3] = (U8) (pChunk->blockLen >> 0);
+      pOut[4] = (U8) (pChunk->blockLen >> 8);
+      pOut[5] = (U8) (pChunk->blockLen >> 16);
+      pOut += 6;
+   }
+
+   /* Copy the data from each segment. */
+   while (len)
+   {
+      if (segOfs == pSeg->len)
+      {
+         pSeg = pSeg->pNext;
+         segOfs = 0;
+      }
+
+      take = pSeg->len - segOfs < len ? pSeg->len - segOfs : len;
+      memcpy(pOut, &pSeg->pData[segOfs], take);
+      pOut += take;
+      segOfs += take;
+      len -= take;
+   }
+}
+
+/**************************************************************************//**
+* Writes the PAP records for one chunk.
+*
+* @param[in] pOut The start of the output file's contents.
+* @param[in] pChunk The chunk to write.
+*
+* @return None.
+******************************************************************************/
+static void RenderPapChunk(U8 *pOut, const OUT_CHUNK *pChunk)
+{
+   const SEGMENT *pSeg = pChunk->pSeg;
+   U32 segOfs = pChunk->segOfs, len = pChunk->len, addr = pChunk->addr;
+   U32 papRecLen;
+   U16 chkSum;
+   U8 val;
+
+   pOut += pChunk->outOfs;
+
+   while (len)
+   {
+      /* Determine the length of the PAP record to write. */
+      papRecLen = len < PAP_REC_LEN ? len : PAP_REC_LEN;
+
+      /* Write the record start char, the record length, and the address. */
+      *(pOut++) = ';';
+      pOut = PutHex(pOut, (U8) papRecLen);
+      pOut = PutHex(pOut, (U8) (addr >> 8));
+      pOut = PutHex(pOut, (U8) addr);
+
+      /* Initialize the checkSum. All hex-formatted data is included. */
+      chkSum = papRecLen + (addr & 0xFF) + ((addr >> 8) & 0xFF);
+
+      /* Move to the next PAP record. */
+      len -= papRecLen;
+      addr += papRecLen;
+
+      /* Write the data for this PAP record. */
+      while (papRecLen--)
+      {
+         /* See if we've reached the end of the current segment. */
+         if (segOfs == pSeg->len)
+         {
+            pSeg = pSeg->pNext;
+            segOfs = 0;
+         }
+
+         val = pSeg->pData[segOfs++];
+         chkSum += val;
+         pOut = PutHex(pOut, val);
+      }
+
+      /* Write the checksum and the record footer. */
+      pOut = PutHex(pOut, (U8) (chkSum >> 8));
+      pOut = PutHex(pOut, (U8) chkSum);
+      *(pOut++) = '\r';
+      *(pOut++) = '\n';
+   }
+}
+
+/**************************************************************************//**
+* Writes the TI-TXT lines for one chunk.
+*
+* @param[in] pOut The start of the output file's contents.
+* @param[in] pChunk The chunk to write.
+*
+* @return None.
+******************************************************************************/
+static void RenderTiTxtChunk(U8 *pOut, const OUT_CHUNK *pChunk)
+{
+   const SEGMENT *pSeg = pChunk->pSeg;
+   U32 segOfs = pChunk->segOfs, i;
+
+   pOut += pChunk->outOfs;
+
+   /* The first chunk of a block writes the block's address. */
+   if (pChunk->blockLen)
+   {
+      *(pOut++) = '@';
+      pOut = PutHexDigits(pOut, pChunk->addr, pChunk->addr > 0xFFFF ? GetHexDigits(pChunk->addr) : 4);
+      *(pOut++) = '\r';
+      *(pOut++) = '\n';
+   }
+
+   /* Chunks start on a line boundary, so every 16th byte ends a line. */
+   for (i = 1; i <= pChunk->len; i++)
+   {
+      if (segOfs == pSeg->len)
+      {
+         pSeg = pSeg->pNext;
+         segOfs = 0;
+      }
+
+      pOut = PutHex(pOut, pSeg->pData[segOfs++]);
+      if (i % TI_LINE_LEN == 0 || i == pChunk->len)
+      {
+         *(pOut++) = '\r';
+         *(pOut++) = '\n';
+      }
+      else
+      {
+         *(pOut++) = ' ';
+      }
+   }
+}
+
+/**************************************************************************//**
+* Writes the checksum of a Tektronix extended hex record, which is the sum of
+* the values of all its hex digits except the checksum itself.
+*
+* @param[in] pRec The record, just past its '%'.
+* @param[in] len The number of characters in the record, excluding the '%'.
+*
+* @return None.
+******************************************************************************/
+static void PutTekChkSum(U8 *pRec, U32 len)
+{
+   U32 i;
+   U8 chkSum = 0;
+
+   for (i = 0; i < len; i++)
+   {
+      if (i != 3 && i != 4)
+      {
+         chkSum += hexValues[pRec[i]] & 0xF;
+      }
+   }
+
+   PutHex(&pRec[3], chkSum);
+}
+
+/**************************************************************************//**
+* Writes the Tektronix extended hex records for one chunk.
+*
+* @param[in] pOut The start of the output file's contents.
+* @param[in] pChunk The chunk to write.
+* @param[in] addrDigits The number of hex digits in each address.
+*
+* @return None.
+******************************************************************************/
+static void RenderTekChunk(U8 *pOut, const OUT_CHUNK *pChunk, U32 addrDigits)
+{
+   const SEGMENT *pSeg = pChunk->pSeg;
+   U32 segOfs = pChunk->segOfs, len = pChunk->len, addr = pChunk->addr;
+   U32 recLen;
+   U8 *pRec;
+
+   pOut += pChunk->outOfs;
+
+   while (len)
+   {
+      recLen = len < TEK_REC_LEN ? len : TEK_REC_LEN;
+
+      /* Write the record length and type, leaving room for the checksum. */
+      *(pOut++) = '%';
+      pRec = pOut;
+      pOut = PutHex(pOut, (U8) (6 + addrDigits + recLen * 2));
+      *(pOut++) = '6';
+      pOut += 2;
+
+      /* Write the address. */
+      *(pOut++) = hexDigits[addrDigits];
+      pOut = PutHexDigits(pOut, addr, addrDigits);
+
+      len -= recLen;
+      addr += recLen;
+
+      /* Write the data for this record. */
+      while (recLen--)
+      {
+         if (segOfs == pSeg->len)
+         {
+            pSeg = pSeg->pNext;
+            segOfs = 0;
+         }
+
+         pOut = PutHex(pOut, pSeg->pData[segOfs++]);
+      }
+
+      PutTekChkSum(pRec, (U32) (pOut - pRec));
+      *(pOut++) = '\r';
+      *(pOut++) = '\n';
+   }
+}
+
+/**************************************************************************//**
+* Writes bytes as upper case ASCII hex digits, and adds them up.
+*
+* Sixteen bytes at a time are formatted and summed with SSE2 where it is
+* available.
+*
+* @param[in] pOut Where to write the digits.
+* @param[in] pData The bytes to write.
+* @param[in] len The number of bytes to write.
+* @param[in,out] pSum The sum of the bytes is added to this.
+*
+* @return A pointer just past the digits written.
+******************************************************************************/
+static U8 *PutHexBytes(U8 *pOut, const U8 *pData, U32 len, U32 *pSum)
+{
+   U32 i = 0;
+#ifdef USE_SSE2
+   __m128i v, hi, lo, d0, d1, nine, adj, sums;
+
+   nine = _mm_set1_epi8(9);
+   adj = _mm_set1_epi8('A' - '0' - 10);
+   sums = _mm_setzero_si128();
+
+   for (; i + 16 <= len; i += 16)
+   {
+      v = _mm_loadu_si128((const __m128i *) &pData[i]);
+      sums = _mm_add_epi64(sums, _mm_sad_epu8(v, _mm_setzero_si128()));
+
+      /* Split each byte into its nibbles, in order, and turn each into a digit. */
+      hi = _mm_and_si128(_mm_srli_epi16(v, 4), _mm_set1_epi8(0x0F));
+      lo = _mm_and_si128(v, _mm_set1_epi8(0x0F));
+      d0 = _mm_unpacklo_epi8(hi, lo);
+      d1 = _mm_unpackhi_epi8(hi, lo);
+      d0 = _mm_add_epi8(_mm_add_epi8(d0, _mm_set1_epi8('0')), _mm_and_si128(_mm_cmpgt_epi8(d0, nine), adj));
+      d1 = _mm_add_epi8(_mm_add_epi8(d1, _mm_set1_epi8('0')), _mm_and_si128(_mm_cmpgt_epi8(d1, nine), adj));
+      _mm_storeu_si128((__m128i *) &pOut[0], d0);
+      _mm_storeu_si128((__m128i *) &pOut[16], d1);
+      pOut += 32;
+   }
+
+   *pSum += (U32) _mm_cvtsi128_si32(sums) + (U32) _mm_cvtsi128_si32(_mm_srli_si128(sums, 8));
+#endif
+
+   for (; i < len; i++)
+   {
+      *pSum += pData[i];
+      pOut = PutHex(pOut, pData[i]);
+   }
+
+   return pOut;
+}
+
+/**************************************************************************//**
+* Writes one Intel HEX record.
+*
+* @param[in] pOut Where to write the record.
+* @param[in] recType The type of the record.
+* @param[in] addr16 The low 16 bits of the address.
+* @param[in] pData The data of the record.
+* @param[in] len The number of bytes of data.
+*
+* @return A pointer just past the record.
+******************************************************************************/
+static U8 *PutHexRecord(U8 *pOut, HEX_RECORD_TYPE recType, U32 addr16, const U8 *pData, U32 len)
+{
+   U32 chkSum = len + (addr16 >> 8) + (addr16 & 0xFF) + recType;
+
+   *(pOut++) = ':';
+   pOut = PutHex(pOut, (U8) len);
+   pOut = PutHex(pOut, (U8) (addr16 >> 8));
+   pOut = PutHex(pOut, (U8) addr16);
+   pOut = PutHex(pOut, (U8) recType);
+   pOut = PutHexBytes(pOut, pData, len, &chkSum);
+   pOut = PutHex(pOut, (U8) -chkSum);
+   *(pOut++) = '\r';
+   *(pOut++) = '\n';
+
+   return pOut;
+}
+
+/**************************************************************************//**
+* Writes the Intel HEX records for one chunk.
+*
+* @param[in] pOut The start of the output file's contents.
+* @param[in] pChunk The chunk to write.
+* @param[in] recLen The number of data bytes in each full record.
+*
+* @return None.
+******************************************************************************/
+static void RenderHexChunk(U8 *pOut, const OUT_CHUNK *pChunk, U32 recLen)
+{
+   const SEGMENT *pSeg = pChunk->pSeg;
+   U32 segOfs = pChunk->segOfs, len = pChunk->len, addr = pChunk->addr;
+   U32 n, take, i;
+   U8 rec[HEX_MAX_REC_LEN];
+   const U8 *pData;
+
+   pOut += pChunk->outOfs;
+
+   if (pChunk->extAddr)
+   {
+      rec[0] = (U8) (addr >> 24);
+      rec[1] = (U8) (addr >> 16);
+      pOut = PutHexRecord(pOut, REC_EXT_LIN_ADDR, 0, rec, 2);
+   }
+
+   while (len)
+   {
+      n = len < recLen ? len : recLen;
+
+      if (segOfs == pSeg->len)
+      {
+         pSeg = pSeg->pNext;
+         segOfs = 0;
+      }
+
+      /* A record within one segment is written from it in place, and one which
+      crosses segments is gathered first. */
+      if (pSeg->len - segOfs >= n)
+      {
+         pData = &pSeg->pData[segOfs];
+         segOfs += n;
+      }
+      else
+      {
+         for (i = 0; i < n; i += take)
+         {
+            if (segOfs == pSeg->len)
+            {
+               pSeg = pSeg->pNext;
+               segOfs = 0;
+            }
+
+            take = pSeg->len - segOfs < n - i ? pSeg->len - segOfs : n - i;
+            memcpy(&rec[i], &pSeg->pData[segOfs], take);
+            segOfs += take;
+         }
+         pData = rec;
+      }
+
+      pOut = PutHexRecord(pOut, REC_DATA, addr & 0xFFFF, pData, n);
+      len -= n;
+      addr += n;
+   }
+}
+
+/**************************************************************************//**
+* Writes a value as lower case ASCII hex digits, for hexdump outputs.
+*
+* @param[in] pOut Where to write the digits.
+* @param[in] val The value to write.
+* @param[in] numDigits The number of digits to write.
+*
+* @return A pointer just past the digits written.
+******************************************************************************/
+static U8 *PutDumpDigits(U8 *pOut, U32 val, U32 numDigits)
+{
+   while (numDigits--)
+   {
+      *(pOut++) = dumpDigits[(val >> (numDigits * 4)) & 0xF];
+   }
+
+   return pOut;
+}
+
+/**************************************************************************//**
+* Writes one line of a hexdump output.
+*
+* The hex digits and the ASCII column of a line are each formatted sixteen
+* bytes at a time with SSE2 where it is available.
+*
+* @param[in] pOut Where to write the line.
+* @param[in] addr The address of the line, which is a multiple of DUMP_LINE_BYTES.
+* @param[in] pLine The line's bytes.
+* @param[in] first The offset in the line of its first byte.
+* @param[in] n The number of bytes in the line.
+*
+* @return A pointer just past the line.
+******************************************************************************/
+static U8 *PutDumpLine(U8 *pOut, U32 addr, const U8 *pLine, U32 first, U32 n)
+{
+   U8 digits[DUMP_LINE_BYTES * 2], text[DUMP_LINE_BYTES], *pHex;
+   U32 i;
+#ifdef USE_SSE2
+   __m128i v, hi, lo, d0, d1, nine, adj, printable;
+
+   v = _mm_loadu_si128((const __m128i *) pLine);
+
+   /* Split each byte into its nibbles, in order, and turn each into a digit. */
+   hi = _mm_and_si128(_mm_srli_epi16(v, 4), _mm_set1_epi8(0x0F));
+   lo = _mm_and_si128(v, _mm_set1_epi8(0x0F));
+   d0 = _mm_unpacklo_epi8(hi, lo);
+   d1 = _mm_unpackhi_epi8(hi, lo);
+   nine = _mm_set1_epi8(9);
+   adj = _mm_set1_epi8('a' - '0' - 10);
+   d0 = _mm_add_epi8(_mm_add_epi8(d0, _mm_set1_epi8('0')), _mm_and_si128(_mm_cmpgt_epi8(d0, nine), adj));
+   d1 = _mm_add_epi8(_mm_add_epi8(d1, _mm_set1_epi8('0')), _mm_and_si128(_mm_cmpgt_epi8(d1, nine), adj));
+   _mm_storeu_si128((__m128i *) &digits[0], d0);
+   _mm_storeu_si128((__m128i *) &digits[16], d1);
+
+   /* Bytes from 0x20 to 0x7E are printed as they are, and the rest as '.'. As the
+   comparisons are signed, bytes from 0x80 up are not above 0x1F. */
+   printable = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(0x1F)), _mm_cmplt_epi8(v, _mm_set1_epi8(0x7F)));
+   v = _mm_or_si128(_mm_and_si128(printable, v), _mm_andnot_si128(printable, _mm_set1_epi8('.')));
+   _mm_storeu_si128((__m128i *) text, v);
+#else
+   for (i = 0; i < DUMP_LINE_BYTES; i++)
+   {
+      digits[i * 2] = dumpDigits[pLine[i] >> 4];
+      digits[i * 2 + 1] = dumpDigits[pLine[i] & 0xF];
+      text[i] = pLine[i] >= 0x20 && pLine[i] < 0x7F ? pLine[i] : '.';
+   }
+#endif
+
+   memcpy(pOut, dumpLine, DUMP_LINE_LEN);
+   PutDumpDigits(pOut, addr, 8);
+
+   /* Each byte is two digits and a space, with an extra space after the eighth. */
+   pHex = pOut + 10 + first * 3 + (first >= 8);
+   for (i = first; i < first + n; i++)
+   {
+      pHex[0] = digits[i * 2];
+      pHex[1] = digits[i * 2 + 1];
+      pHex += i == 7 ? 4 : 3;
+   }
+
+   memcpy(&pOut[61 + first], &text[first], n);
+
+   return pOut + DUMP_LINE_LEN;
+}
+
+/**************************************************************************//**
+* Writes the lines of a hexdump output for one chunk.
+*
+* @param[in] pOut The start of the output file's contents.
+* @param[in] pChunk The chunk to write.
+*
+* @return None.
+******************************************************************************/
+static void RenderDumpChunk(U8 *pOut, const OUT_CHUNK *pChunk)
+{
+   const SEGMENT *pSeg = pChunk->pSeg;
+   U32 segOfs = pChunk->segOfs, addr = pChunk->addr, left, first, n;
+   U8 line[DUMP_LINE_BYTES], prev[DUMP_LINE_BYTES];
+   int full, prevFull = 1, repeat, prevRepeat;
+
+   pOut += pChunk->outOfs;
+   memset(line, 0, sizeof(line));
+
+   if (pChunk->gapLen)
+   {
+      memcpy(pOut, "-- gap of ", 10);
+      PutDumpDigits(&pOut[10], pChunk->gapLen, 8);
+      memcpy(&pOut[18], " bytes --\n", 10);
+      pOut += DUMP_GAP_LEN;
+   }
+
+   /* The chunk's first line was compared with the line before it while planning. */
+   repeat = (pChunk->dumpFlags & DUMP_REPEAT) != 0;
+   prevRepeat = (pChunk->dumpFlags & DUMP_SQUEEZED) != 0;
+
+   for (left = pChunk->len; left; left -= n, addr += n)
+   {
+      n = GetDumpLine(&pSeg, &segOfs, addr, left, line, &first);
+      full = n == DUMP_LINE_BYTES;
+      if (left != pChunk->len)
+      {
+         repeat = (pChunk->dumpFlags & DUMP_SQUEEZE) && full && prevFull &&
+            !memcmp(line, prev, DUMP_LINE_BYTES);
+      }
+
+      if (!repeat)
+      {
+         pOut = PutDumpLine(pOut, addr - first, line, first, n);
+      }
+      else if (!prevRepeat)
+      {
+         *(pOut++) = '*';
+         *(pOut++) = '\n';
+      }
+
+      memcpy(prev, line, DUMP_LINE_BYTES);
+      prevFull = full;
+      prevRepeat = repeat;
+   }
+}
+
+/**************************************************************************//**
+* Writes the lines of a memory initialization output for one chunk of words.
+*
+* @param[in] type The type of the output file.
+* @param[in] pOut The start of the output file's contents.
+* @param[in] pPlan The plan of the output file.
+* @param[in] chunk The index of the chunk to write.
+*
+* @return None.
+******************************************************************************/
+static void RenderMemChunk(FILE_TYPE type, U8 *pOut, const OUTPUT_PLAN *pPlan, U32 chunk)
+{
+   const MEM_FORMAT *pFmt = GetMemFormat(type);
+   const FILE_OPTS_MEM *pMem = &pPlan->mem;
+   U32 wordLen = pMem->wordBits / 8, addrDigits = GetHexDigits(pMem->depth - 1);
+   U32 prefixLen = 0, suffixLen = 0, endLen = (U32) strlen(pFmt->pLineEnd);
+   U32 word = chunk * MEM_CHUNK_WORDS, end, b;
+   const U8 *pWord;
+
+   end = pMem->depth - word < MEM_CHUNK_WORDS ? pMem->depth : word + MEM_CHUNK_WORDS;
+   if (pFmt->pAddrPrefix != NULL)
+   {
+      prefixLen = (U32) strlen(pFmt->pAddrPrefix);
+      suffixLen = (U32) strlen(pFmt->pAddrSuffix);
+   }
+
+   pOut += pPlan->linesOfs + word * pPlan->lineLen;
+   for (; word < end; word++)
+   {
+      /* Write the word's address, for formats which have them. */
+      if (pFmt->pAddrPrefix != NULL)
+      {
+         memcpy(pOut, pFmt->pAddrPrefix, prefixLen);
+         pOut += prefixLen;
+         pOut = PutHexDigits(pOut, word, addrDigits);
+         memcpy(pOut, pFmt->pAddrSuffix, suffixLen);
+         pOut += suffixLen;
+      }
+
+      /* Write the word, most significant byte first. */
+      pWord = &pPlan->pWords[word * wordLen];
+      if (pMem->bigEndian)
+      {
+         for (b = 0; b < wordLen; b++)
+         {
+            pOut = PutHex(pOut, pWord[b]);
+         }
+      }
+      else
+      {
+         for (b = wordLen; b--; )
+         {
+            pOut = PutHex(pOut, pWord[b]);
+         }
+      }
+
+      memcpy(pOut, word == pMem->depth - 1 ? pFmt->pLastLineEnd : pFmt->pLineEnd, endLen);
+      pOut += endLen;
+   }
+}
+
+/**************************************************************************//**
+* Writes the header of an iNES or NES 2.0 file.
+*
+* @param[out] pOut Where to write the header.
+* @param[in] pNes The resolved options of the file.
+*
+* @return None.
+******************************************************************************/
+static void PutNesHeader(U8 *pOut, const FILE_OPTS_NES *pNes)
+{
+   U32 prgBanks = pNes->prgLen / NES_PRG_BANK_LEN, chrBanks = pNes->chrLen / NES_CHR_BANK_LEN;
+
+   memset(pOut, 0, NES_HEADER_LEN);
+   memcpy(pOut, "NES\x1A", 4);
+   pOut[4] = (U8) prgBanks;
+   pOut[5] = (U8) chrBanks;
+   pOut[6] = (U8) (((pNes->mapper & 0x0F) << 4) | (pNes->fourScreen ? 0x08 : 0) |
+      (pNes->battery ? 0x02 : 0) | (pNes->vertical ? 0x01 : 0));
+   pOut[7] = (U8) (pNes->mapper & 0xF0);
+
+   if (pNes->nes2)
+   {
+      pOut[7] |= 0x08;
+      pOut[8] = (U8) ((pNes->subMapper << 4) | (pNes->mapper >> 8));
+      pOut[9] = (U8) (((chrBanks >> 8) << 4) | (prgBanks >> 8));
+
+      /* A battery backs 8 KB of PRG RAM, and a cartridge without CHR ROM has 8 KB of CHR RAM. */
+      pOut[10] = pNes->battery ? 0x70 : 0;
+      pOut[11] = pNes->chrLen ? 0 : 0x07;
+   }
+}
+
+/**************************************************************************//**
+* Writes a value as big-endian bytes, as C64 cartridge files hold them.
+*
+* @param[out] pOut Where to write the value.
+* @param[in] val The value.
+* @param[in] numBytes The number of bytes to write.
+*
+* @return None.
+******************************************************************************/
+static void PutBigEndian(U8 *pOut, U32 val, U32 numBytes)
+{
+   while (numBytes--)
+   {
+      *(pOut++) = (U8) (val >> (numBytes * 8));
+   }
+}
+
+/**************************************************************************//**
+* Writes the header of a C64 cartridge file.
+*
+* @param[out] pOut Where to write the header.
+* @param[in] pCrt The resolved options of the file.
+*
+* @return None.
+******************************************************************************/
+static void PutCrtHeader(U8 *pOut, const FILE_OPTS_CRT *pCrt)
+{
+   size_t nameLen = pCrt->pName ? strlen(pCrt->pName) : 0;
+
+   memset(pOut, 0, CRT_HEADER_LEN);
+   memcpy(pOut, "C64 CARTRIDGE   ", 16);
+   PutBigEndian(&pOut[0x10], CRT_HEADER_LEN, 4);
+   PutBigEndian(&pOut[0x14], 0x0100, 2);
+   PutBigEndian(&pOut[0x16], pCrt->hwType, 2);
+   pOut[0x18] = (U8) pCrt->exrom;
+   pOut[0x19] = (U8) pCrt->game;
+   memcpy(&pOut[0x20], pCrt->pName ? pCrt->pName : "", nameLen < 32 ? nameLen : 32);
+}
+
+/**************************************************************************//**
+* Writes the header of a CHIP packet of a C64 cartridge file.
+*
+* @param[out] pOut Where to write the header.
+* @param[in] pCrt The resolved options of the file.
+* @param[in] chipAddr The address of the chip, whose bits 16 and up are the bank.
+* @param[in] chipLen The size of the chip.
+*
+* @return None.
+******************************************************************************/
+static void PutCrtChipHeader(U8 *pOut, const FILE_OPTS_CRT *pCrt, U32 chipAddr, U32 chipLen)
+{
+   memcpy(pOut, "CHIP", 4);
+   PutBigEndian(&pOut[0x04], CRT_CHIP_HEADER_LEN + chipLen, 4);
+   PutBigEndian(&pOut[0x08], pCrt->chipType, 2);
+   PutBigEndian(&pOut[0x0A], chipAddr >> 16, 2);
+   PutBigEndian(&pOut[0x0C], chipAddr & 0xFFFF, 2);
+   PutBigEndian(&pOut[0x0E], chipLen, 2);
+}
+
+/**************************************************************************//**
+* Writes the file header and end record, which surround the chunks.
+*
+* @param[in] pCtx The conversion context.
+* @param[in] type The type of the output file.
+* @param[in] pOut The start of the output file's contents.
+* @param[in] pPlan The plan of the output file.
+*
+* @return None.
+******************************************************************************/
+static void RenderHeaderAndEnd(const RFT_CONTEXT *pCtx, FILE_TYPE type, U8 *pOut,
+   const OUTPUT_PLAN *pPlan)
+{
+   const MEM_FORMAT *pFmt = GetMemFormat(type);
+   const RANGE *pRange;
+   char header[256];
+   U32 ofs, end, chipAddr, chipLen, headerOfs, i;
+   U8 *pEnd, pad, startBytes[4];
+   U16 chkSum;
+
+   if (pFmt != NULL)
+   {
+      /* The header is formatted aside, as snprintf() also writes a terminator. */
+      snprintf(header, sizeof(header), pFmt->pHeader, pPlan->mem.wordBits, pPlan->mem.depth);
+      memcpy(pOut, header, pPlan->linesOfs);
+      memcpy(&pOut[pPlan->outLen - strlen(pFmt->pTrailer)], pFmt->pTrailer, strlen(pFmt->pTrailer));
+   }
+   else if (type == FILE_TYPE_TITXT)
+   {
+      memcpy(&pOut[pPlan->outLen - 3], "q\r\n", 3);
+   }
+   else if (type == FILE_TYPE_HEX)
+   {
+      /* Any starting address is written once, just before the end record. */
+      pEnd = &pOut[pPlan->outLen - HEX_RECORD_LEN(0)];
+      if (pCtx->startAddr != 0)
+      {
+         PutBigEndian(startBytes, pCtx->startAddr, 4);
+         pEnd = PutHexRecord(pEnd - HEX_RECORD_LEN(4), REC_START_LIN_ADDR, 0, startBytes, 4);
+      }
+      PutHexRecord(pEnd, REC_EOF, 0, NULL, 0);
+   }
+   else if (type == FILE_TYPE_TEK)
+   {
+      /* The termination record holds the starting address. */
+      pEnd = &pOut[pPlan->outLen - 9 - pPlan->addrDigits];
+      *(pEnd++) = '%';
+      PutHex(pEnd, (U8) (6 + pPlan->addrDigits));
+      pEnd[2] = '8';
+      pEnd[5] = hexDigits[pPlan->addrDigits];
+      PutHexDigits(&pEnd[6], pCtx->startAddr, pPlan->addrDigits);
+      PutTekChkSum(pEnd, 6 + pPlan->addrDigits);
+      pEnd[6 + pPlan->addrDigits] = '\r';
+      pEnd[7 + pPlan->addrDigits] = '\n';
+   }
+   else if (type == FILE_TYPE_DUMP)
+   {
+      /* The last line is the address just past the data. */
+      for (pRange = pCtx->pAllRanges; pRange && pRange->pNext; pRange = pRange->pNext);
+      PutDumpDigits(&pOut[pPlan->outLen - 9], pRange ? pRange->addr + pRange->len : 0, 8);
+      pOut[pPlan->outLen - 1] = '\n';
+   }
+   else if (type == FILE_TYPE_NES || type == FILE_TYPE_CRT)
+   {
+      /* The chunks copy the data, so only the headers and the padding around them are left. */
+      if (type == FILE_TYPE_NES)
+      {
+         PutNesHeader(pOut, &pPlan->nes);
+         ofs = NES_HEADER_LEN;
+         pad = pPlan->nes.pad;
+      }
+      else
+      {
+         PutCrtHeader(pOut, &pPlan->crt);
+         ofs = CRT_HEADER_LEN;
+         pad = pPlan->crt.pad;
+      }
+
+      for (i = 0; i <= pPlan->numChunks; i++)
+      {
+         end = i < pPlan->numChunks ? pPlan->pChunks[i].outOfs : pPlan->outLen;
+         if (type == FILE_TYPE_CRT && i < pPlan->numChunks &&
+            StartsCrtChip(pPlan, i, &chipAddr, &chipLen, &headerOfs))
+         {
+            memset(&pOut[ofs], pad, headerOfs - ofs);
+            PutCrtChipHeader(&pOut[headerOfs], &pPlan->crt, chipAddr, chipLen);
+            ofs = headerOfs + CRT_CHIP_HEADER_LEN;
+         }
+
+         memset(&pOut[ofs], pad, end - ofs);
+         ofs = i < pPlan->numChunks ? end + pPlan->pChunks[i].len : end;
+      }
+   }
+   else if (type == FILE_TYPE_WDC)
+   {
+      /* Write the header, and the end record -- an address and size of 0. */
+      pOut[0] = 'Z';
+      memset(&pOut[pPlan->outLen - 6], 0, 6);
+   }
+   else
+   {
+      /* The end record holds the number of records written. */
+      pEnd = &pOut[pPlan->outLen - 13];
+      chkSum = ((pPlan->numRecords >> 8) & 0xFF) + (pPlan->numRecords & 0xFF);
+      *(pEnd++) = ';';
+      pEnd = PutHex(pEnd, 0);
+      pEnd = PutHex(pEnd, (U8) (pPlan->numRecords >> 8));
+      pEnd = PutHex(pEnd, (U8) pPlan->numRecords);
+      pEnd = PutHex(pEnd, (U8) (chkSum >> 8));
+      pEnd = PutHex(pEnd, (U8) chkSum);
+      *(pEnd++) = '\r';
+      *(pEnd++) = '\n';
+   }
+}
+
+/**************************************************************************//**
+* Writes one chunk of an output file. Runs as a scheduled task.
+*
+* @param[in] pArg The RENDER_JOB describing the output.
+* @param[in] i The index of the chunk to write.
+*
+* @return None.
+******************************************************************************/
+static void RenderChunk(void *pArg, U32 i)
+{
+   RENDER_JOB *pJob = (RENDER_JOB *) pArg;
+
+   if (pJob->pPlan->pWords != NULL)
+   {
+      RenderMemChunk(pJob->type, pJob->pOut, pJob->pPlan, i);
+   }
+   else if (pJob->type == FILE_TYPE_WDC || IsGatheredType(pJob->type))
+   {
+      /* NES and C64 cartridge chunks never start a block, so they are only copies of the data. */
+      RenderWdcChunk(pJob->pOut, &pJob->pPlan->pChunks[i]);
+   }
+   else if (pJob->type == FILE_TYPE_TITXT)
+   {
+      RenderTiTxtChunk(pJob->pOut, &pJob->pPlan->pChunks[i]);
+   }
+   else if (pJob->type == FILE_TYPE_TEK)
+   {
+      RenderTekChunk(pJob->pOut, &pJob->pPlan->pChunks[i], pJob->pPlan->addrDigits);
+   }
+   else if (pJob->type == FILE_TYPE_HEX)
+   {
+      RenderHexChunk(pJob->pOut, &pJob->pPlan->pChunks[i], pJob->pPlan->recLen);
+   }
+   else if (pJob->type == FILE_TYPE_DUMP)
+   {
+      RenderDumpChunk(pJob->pOut, &pJob->pPlan->pChunks[i]);
+   }
+   else
+   {
+      RenderPapChunk(pJob->pOut, &pJob->pPlan->pChunks[i]);
+   }
+}
+
+/**************************************************************************//**
+* Writes a shared memory image: the header, the range bitmap, and the flat image.
+*
+* The generation in the header is left for the caller to manage.
+*
+* @param[in] pCtx The conversion context.
+* @param[in] pOut Where to write the image.
+* @param[in] pPlan The plan of the output.
+*
+* @return None.
+******************************************************************************/
+static void RenderShm(const RFT_CONTEXT *pCtx, U8 *pOut, const OUTPUT_PLAN *pPlan)
+{
+   SHM_HEADER *pHdr = (SHM_HEADER *) pOut;
+   U32 addrSpace = pPlan->addrSpace, addr;
+   U8 *pBitmap, *pImage;
+   RANGE *pRange;
+   SEGMENT *pSeg;
+
+   pHdr->magic = SHM_MAGIC;
+   pHdr->version = SHM_VERSION;
+   pHdr->addrSpace = addrSpace;
+   pHdr->bitmapOfs = sizeof(SHM_HEADER);
+   pHdr->imageOfs = sizeof(SHM_HEADER) + (addrSpace / 8);
+   pHdr->startAddr = pCtx->startAddr;
+   pHdr->dataBytes = pCtx->dataBytes;
+   pHdr->numRanges = pCtx->numRanges;
+
+   pBitmap = pOut + pHdr->bitmapOfs;
+   pImage = pOut + pHdr->imageOfs;
+   memset(pBitmap, 0, addrSpace / 8);
+   memset(pImage, 0, addrSpace);
+
+   /* Copy each range into the flat image, and mark its addresses as loaded. */
+   for (pRange = pCtx->pAllRanges; pRange; pRange = pRange->pNext)
+   {
+      addr = pRange->addr;
+      for (pSeg = pRange->pSegStart; pSeg; pSeg = pSeg->pNext)
+      {
+         memcpy(&pImage[addr], pSeg->pData, pSeg->len);
+         addr += pSeg->len;
+      }
+
+      for (addr = pRange->addr; addr < pRange->addr + pRange->len; )
+      {
+         if ((addr & 7) == 0 && addr + 8 <= pRange->addr + pRange->len)
+         {
+            pBitmap[addr >> 3] = 0xFF;
+            addr += 8;
+         }
+         else
+         {
+            pBitmap[addr >> 3] |= 1 << (addr & 7);
+            addr++;
+         }
+      }
+   }
+}
+
+/**************************************************************************//**
+* Publishes the loaded input data into a shared memory object.
+*
+* A running emulator can map the same object and pick up each new image as soon
+* as the generation changes, without parsing any files. On Windows the object
+* only exists while some process holds it open, so the emulator must create it
+* (or keep it mapped) for the image to outlive this program.
+*
+* @param[in] pCtx The conversion context.
+* @param[in] pName The name of the shared memory object.
+* @param[in] pPlan The plan of the output.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+static RESULT PublishShm(const RFT_CONTEXT *pCtx, const char *pName, const OUTPUT_PLAN *pPlan)
+{
+   U32 mapSize = pPlan->outLen, gen;
+   SHM_HEADER *pHdr;
+
+#ifdef _WIN32
+   HANDLE hMap = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, mapSize, pName);
+   if (hMap == NULL)
+   {
+      ReportError("Unable to create the shared memory object \"%s\".\n", pName);
+      return CANNOT_OPEN_FILE;
+   }
+
+   pHdr = (SHM_HEADER *) MapViewOfFile(hMap, FILE_MAP_ALL_ACCESS, 0, 0, mapSize);
+   if (pHdr == NULL)
+   {
+      ReportError("Unable to map the shared memory object \"%s\".\n", pName);
+      CloseHandle(hMap);
+      return IO_ERROR;
+   }
+#else
+   char shmName[256];
+   struct stat st;
+   int fd;
+
+   /* POSIX shared memory object names must start with a '/'. */
+   snprintf(shmName, sizeof(shmName), "%s%s", pName[0] == '/' ? "" : "/", pName);
+
+   fd = shm_open(shmName, O_RDWR | O_CREAT, 0666);
+   if (fd < 0)
+   {
+      ReportError("Unable to create the shared memory object \"%s\".\n", shmName);
+      return CANNOT_OPEN_FILE;
+   }
+
+   /* Resize the object only when needed, so existing readers stay mapped. */
+   if (fstat(fd, &st) != 0 || ((U32) st.st_size != mapSize && ftruncate(fd, mapSize) != 0))
+   {
+      ReportError("Unable to size the shared memory object \"%s\".\n", shmName);
+      close(fd);
+      return IO_ERROR;
+   }
+
+   pHdr = (SHM_HEADER *) mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+   close(fd);
+   if (pHdr == MAP_FAILED)
+   {
+      ReportError("Unable to map the shared memory object \"%s\".\n", shmName);
+      return IO_ERROR;
+   }
+#endif
+
+   /* Continue the generation count of a previous image of the same layout. */
+   gen = 1;
+   if (pHdr->magic == SHM_MAGIC && pHdr->version == SHM_VERSION && pHdr->addrSpace == pPlan->addrSpace)
+   {
+      gen = pHdr->generation | 1;
+   }
+
+   /* Mark the image as being updated. */
+   pHdr->generation = gen;
+   MEMORY_BARRIER();
+
+   RenderShm(pCtx, (U8 *) pHdr, pPlan);
+
+   /* Publish the new image. */
+   MEMORY_BARRIER();
+   pHdr->generation = gen + 1;
+
+   printf("Image published to shared memory, generation %u.\n", gen + 1);
+
+#ifdef _WIN32
+   UnmapViewOfFile(pHdr);
+   CloseHandle(hMap);
+#else
+   munmap(pHdr, mapSize);
+#endif
+
+   return OK;
+}
+
+/**************************************************************************//**
+* Writes a whole buffer to a file descriptor.
+*
+* @param[in] fd The file descriptor to write to.
+* @param[in] pBuf The data to write.
+* @param[in] len The number of bytes to write.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+static RESULT WriteFdData(int fd, const U8 *pBuf, U32 len)
+{
+   int n;
+
+   while (len)
+   {
+      n = FD_WRITE(fd, pBuf, len > 0x40000000 ? 0x40000000 : len);
+      if (n <= 0)
+      {
+         ReportError("Error writing output file.\n");
+         return IO_ERROR;
+      }
+
+      pBuf += n;
+      len -= n;
+   }
+
+   return OK;
+}
+
+/**************************************************************************//**
+* Writes the pieces a gathered write has collected.
+*
+* @param[in,out] pGather The gathered write.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+static RESULT FlushGather(GATHER *pGather)
+{
+   GATHER_PIECE *pPiece = pGather->pieces;
+   U32 left = pGather->numPieces;
+   RESULT r = OK;
+
+   pGather->numPieces = 0;
+
+#ifdef _WIN32
+   /* Windows has no gathered write for file descriptors, so the pieces are written in turn. */
+   for (; left && r == OK; left--, pPiece++)
+   {
+      r = WriteFdData(pGather->fd, (const U8 *) pPiece->iov_base, (U32) pPiece->iov_len);
+   }
+#else
+   ssize_t n;
+
+   while (left)
+   {
+      n = writev(pGather->fd, pPiece, (int) left);
+      if (n <= 0)
+      {
+         ReportError("Error writing output file.\n");
+         r = IO_ERROR;
+         break;
+      }
+
+      /* Skip the pieces written, and resume part way through a piece written in part. */
+      while (left && (size_t) n >= pPiece->iov_len)
+      {
+         n -= pPiece->iov_len;
+         pPiece++;
+         left--;
+      }
+
+      if (left)
+      {
+         pPiece->iov_base = (U8 *) pPiece->iov_base + n;
+         pPiece->iov_len -= n;
+      }
+   }
+#endif
+
+   return r;
+}
+
+/**************************************************************************//**
+* Adds a piece to a gathered write, and writes the pieces once there are enough.
+*
+* @param[in,out] pGather The gathered write.
+* @param[in] pData The data of the piece, which must stay valid until it is written.
+* @param[in] len The length of the piece, in bytes.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+static RESULT GatherPiece(GATHER *pGather, const U8 *pData, U32 len)
+{
+   GATHER_PIECE *pPiece;
+
+   if (len == 0)
+   {
+      return OK;
+   }
+
+   pPiece = &pGather->pieces[pGather->numPieces++];
+   pPiece->iov_base = (void *) pData;
+   pPiece->iov_len = len;
+   pGather->ofs += len;
+
+   return pGather->numPieces == GATHER_MAX_PIECES ? FlushGather(pGather) : OK;
+}
+
+/**************************************************************************//**
+* Adds padding to a gathered write, up to an offset in the output.
+*
+* @param[in,out] pGather The gathered write.
+* @param[in] ofs The offset the padding ends at.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+static RESULT GatherPad(GATHER *pGather, U32 ofs)
+{
+   U32 len;
+   RESULT r = OK;
+
+   while (pGather->ofs < ofs && r == OK)
+   {
+      len = ofs - pGather->ofs < GATHER_PAD_LEN ? ofs - pGather->ofs : GATHER_PAD_LEN;
+      r = GatherPiece(pGather, pGather->pad, len);
+   }
+
+   return r;
+}
+
+/**************************************************************************//**
+* Adds the data of a chunk to a gathered write, straight from its segments.
+*
+* @param[in,out] pGather The gathered write.
+* @param[in] pChunk The chunk, which is only a copy of the data.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+static RESULT GatherChunk(GATHER *pGather, const OUT_CHUNK *pChunk)
+{
+   const SEGMENT *pSeg = pChunk->pSeg;
+   U32 segOfs = pChunk->segOfs, len = pChunk->len, take;
+   RESULT r = OK;
+
+   while (len && r == OK)
+   {
+      if (segOfs == pSeg->len)
+      {
+         pSeg = pSeg->pNext;
+         segOfs = 0;
+      }
+
+      take = pSeg->len - segOfs < len ? pSeg->len - segOfs : len;
+      r = GatherPiece(pGather, &pSeg->pData[segOfs], take);
+      segOfs += take;
+      len -= take;
+   }
+
+   return r;
+}
+
+/**************************************************************************//**
+* Writes an output whose chunks are copies of the data, with a gathered write.
+*
+* The header and padding come from small buffers, and the data straight from the
+* segments, so nothing is copied or formatted, and the output is written with a
+* few system calls however many pieces it has.
+*
+* @param[in] type The type of the output.
+* @param[in] fd The file descriptor to write to.
+* @param[in] pPlan The plan of the output.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+static RESULT WriteGathered(FILE_TYPE type, int fd, const OUTPUT_PLAN *pPlan)
+{
+   U32 chipAddr, chipLen, headerOfs, i;
+   U8 *pHeaders, *pHeader;
+   GATHER *pGather;
+   RESULT r;
+
+   /* The headers of a C64 cartridge's CHIP packets follow its own, and all must stay put
+   until they are written. */
+   pGather = (GATHER *) malloc(sizeof(GATHER));
+   pHeaders = (U8 *) malloc(CRT_HEADER_LEN + pPlan->numChunks * CRT_CHIP_HEADER_LEN);
+   if (pGather == NULL || pHeaders == NULL)
+   {
+      ReportError("ERROR: Out of memory.\n");
+      free(pGather);
+      free(pHeaders);
+      return NO_MEMORY;
+   }
+
+   pGather->fd = fd;
+   pGather->ofs = 0;
+   pGather->numPieces = 0;
+
+   if (type == FILE_TYPE_NES)
+   {
+      memset(pGather->pad, pPlan->nes.pad, GATHER_PAD_LEN);
+      PutNesHeader(pHeaders, &pPlan->nes);
+      r = GatherPiece(pGather, pHeaders, NES_HEADER_LEN);
+   }
+   else
+   {
+      memset(pGather->pad, pPlan->crt.pad, GATHER_PAD_LEN);
+      PutCrtHeader(pHeaders, &pPlan->crt);
+      r = GatherPiece(pGather, pHeaders, CRT_HEADER_LEN);
+   }
+
+   pHeader = pHeaders + CRT_HEADER_LEN;
+   for (i = 0; i < pPlan->numChunks && r == OK; i++)
+   {
+      if (type == FILE_TYPE_CRT && StartsCrtChip(pPlan, i, &chipAddr, &chipLen, &headerOfs))
+      {
+         r = GatherPad(pGather, headerOfs);
+         PutCrtChipHeader(pHeader, &pPlan->crt, chipAddr, chipLen);
+         if (r == OK)
+         {
+            r = GatherPiece(pGather, pHeader, CRT_CHIP_HEADER_LEN);
+         }
+         pHeader += CRT_CHIP_HEADER_LEN;
+      }
+
+      if (r == OK)
+      {
+         r = GatherPad(pGather, pPlan->pChunks[i].outOfs);
+      }
+      if (r == OK)
+      {
+         r = GatherChunk(pGather, &pPlan->pChunks[i]);
+      }
+   }
+
+   if (r == OK)
+   {
+      r = GatherPad(pGather, pPlan->outLen);
+   }
+
+   if (r == OK)
+   {
+      r = FlushGather(pGather);
+   }
+
+   free(pGather);
+   free(pHeaders);
+
+   return r;
+}
+
+/**************************************************************************//**
+* Writes the output file contents into memory, using multiple threads.
+*
+* @param[in] pCtx The conversion context.
+* @param[in] type The type of the output file.
+* @param[in] pOut Where to write the output file contents.
+* @param[in] pPlan The plan of the output file.
+*
+* @return None.
+******************************************************************************/
+static void RenderOutput(const RFT_CONTEXT *pCtx, FILE_TYPE type, U8 *pOut,
+   const OUTPUT_PLAN *pPlan)
+{
+   TASK_GROUP group;
+   RENDER_JOB job;
+   U32 i, n;
+
+   /* A shared memory image is a single copy of the data. */
+   if (type == FILE_TYPE_SHM)
+   {
+      ((SHM_HEADER *) pOut)->generation = 2;
+      RenderShm(pCtx, pOut, pPlan);
+      return;
+   }
+
+   /* There is no point in more threads than chunks. */
+   n = GetNumThreads(pCtx->numThreads);
+   if (n > pPlan->numChunks)
+   {
+      n = pPlan->numChunks ? pPlan->numChunks : 1;
+   }
+
+   RenderHeaderAndEnd(pCtx, type, pOut, pPlan);
+
+   job.type = type;
+   job.pOut = pOut;
+   job.pPlan = pPlan;
+
+   /* Each worker starts with a contiguous run of chunks, and the workers which
+   finish first steal from the others. A chunk which cannot be queued is written
+   here instead. */
+   SchedBegin(&group, TASK_PRIO_WRITE, n);
+   for (i = 0; i < pPlan->numChunks; i++)
+   {
+      if (SchedSubmit(&group, (U32) ((U64) i * group.numWorkers / pPlan->numChunks),
+         RenderChunk, &job, i) != OK)
+      {
+         RenderChunk(&job, i);
+      }
+   }
+
+   SchedWait(&group);
+}
+
+/**************************************************************************//**
+* Writes the output file through a memory mapping of the file.
+*
+* The file is sized up front, and the chunks are written directly into the
+* mapping, so no stdio buffers are involved.
+*
+* @param[in] pCtx The conversion context.
+* @param[in] type The type of the output file.
+* @param[in] pName The name of the output file.
+* @param[in] pPlan The plan of the output file.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+static RESULT WriteMappedFile(const RFT_CONTEXT *pCtx, FILE_TYPE type, const char *pName,
+   const OUTPUT_PLAN *pPlan)
+{
+   U8 *pOut;
+
+#ifdef _WIN32
+   HANDLE hFile, hMap;
+
+   hFile = CreateFileA(pName, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+      FILE_ATTRIBUTE_NORMAL, NULL);
+   if (hFile == INVALID_HANDLE_VALUE)
+   {
+      ReportError("Unable to open the output file \"%s\".\n", pName);
+      return CANNOT_OPEN_FILE;
+   }
+
+   /* Creating the mapping extends the file to its final size. */
+   hMap = CreateFileMappingA(hFile, NULL, PAGE_READWRITE, 0, pPlan->outLen, NULL);
+   pOut = hMap ? (U8 *) MapViewOfFile(hMap, FILE_MAP_WRITE, 0, 0, pPlan->outLen) : NULL;
+   if (pOut == NULL)
+   {
+      ReportError("Unable to map the output file \"%s\".\n", pName);
+      if (hMap) CloseHandle(hMap);
+      CloseHandle(hFile);
+      return IO_ERROR;
+   }
+
+   RenderOutput(pCtx, type, pOut, pPlan);
+
+   UnmapViewOfFile(pOut);
+   CloseHandle(hMap);
+   CloseHandle(hFile);
+#else
+   int fd;
+
+   fd = open(pName, O_RDWR | O_CREAT | O_TRUNC, 0666);
+   if (fd < 0)
+   {
+      ReportError("Unable to open the output file \"%s\".\n", pName);
+      return CANNOT_OPEN_FILE;
+   }
+
+   if (PreallocateFile(fd, pPlan->outLen) != OK)
+   {
+      close(fd);
+      return IO_ERROR;
+   }
+
+   if (ftruncate(fd, pPlan->outLen) != 0)
+   {
+      ReportError("Error writing output file.\n");
+      close(fd);
+      return IO_ERROR;
+   }
+
+   pOut = (U8 *) mmap(NULL, pPlan->outLen, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+   if (pOut == MAP_FAILED)
+   {
+      ReportError("Unable to map the output file \"%s\".\n", pName);
+      close(fd);
+      return IO_ERROR;
+   }
+
+   RenderOutput(pCtx, type, pOut, pPlan);
+
+   munmap(pOut, pPlan->outLen);
+   if (close(fd) != 0)
+   {
+      ReportError("Error writing output file.\n");
+      return IO_ERROR;
+   }
+#endif
+
+   return OK;
+}
+
+/**************************************************************************//**
+* Creates an empty temporary file beside an output file. The output is written
+* to it, and it is renamed over the output file once it is complete.
+*
+* @param[in] pName The name of the output file.
+*
+* @return The name of the temporary file, which the caller frees, or NULL if
+* one could not be created.
+******************************************************************************/
+static char *CreateTempOutput(const char *pName)
+{
+   static volatile long tempCount = 0;
+   size_t len = strlen(pName) + 32;
+   char *pTempName;
+   int fd, i;
+
+   pTempName = (char *) malloc(len);
+   if (pTempName == NULL)
+   {
+      return NULL;
+   }
+
+   /* Another writer may have taken a name first, so keep trying new ones. */
+   for (i = 0; i < 100; i++)
+   {
+#ifdef _WIN32
+      snprintf(pTempName, len, "%s.%ld.%ld.tmp", pName, (long) _getpid(),
+         (long) ATOMIC_ADD(&tempCount, 1));
+      fd = _open(pTempName, _O_WRONLY | _O_CREAT | _O_EXCL, _S_IREAD | _S_IWRITE);
+      if (fd >= 0)
+      {
+         _close(fd);
+         return pTempName;
+      }
+#else
+      snprintf(pTempName, len, "%s.%ld.%ld.tmp", pName, (long) getpid(),
+         (long) ATOMIC_ADD(&tempCount, 1));
+      fd = open(pTempName, O_WRONLY | O_CREAT | O_EXCL, 0666);
+      if (fd >= 0)
+      {
+         close(fd);
+         return pTempName;
+      }
+#endif
+
+      if (errno != EEXIST)
+      {
+         break;
+      }
+   }
+
+   free(pTempName);
+   return NULL;
+}
+
+/**************************************************************************//**
+* Replaces an output file with the temporary file it was written to.
+*
+* @param[in] pTempName The name of the temporary file.
+* @param[in] pName The name of the output file.
+* @param[in] pOldStat The status of the output file being replaced, or NULL if
+* there was none.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+static RESULT ReplaceOutput(const char *pTempName, const char *pName,
+   const struct stat *pOldStat)
+{
+#ifdef _WIN32
+   if (!MoveFileExA(pTempName, pName, MOVEFILE_REPLACE_EXISTING))
+#else
+   /* The output keeps the permissions of the file it replaces. */
+   if ((pOldStat != NULL && chmod(pTempName, pOldStat->st_mode & 07777) != 0) ||
+      rename(pTempName, pName) != 0)
+#endif
+   {
+      ReportError("Unable to replace the output file \"%s\".\n", pName);
+      return IO_ERROR;
+   }
+
+   return OK;
+}
+
+/**************************************************************************//**
+* Transforms eight bytes, which are a whole number of words, with a single
+* transform. This handles the bytes which do not fill a vector.
+*
+* @param[in] xform The RFT_XFORM_ transform: swap, invert or bit reversal.
+* @param[in] w The bytes.
+*
+* @return The transformed bytes.
+******************************************************************************/
+static U64 XformWord(U32 xform, U64 w)
+{
+   switch (xform)
+   {
+      case RFT_XFORM_SWAP16:
+         return ((w >> 8) & 0x00FF00FF00FF00FFULL) | ((w & 0x00FF00FF00FF00FFULL) << 8);
+
+      case RFT_XFORM_SWAP32:
+         w = ((w >> 8) & 0x00FF00FF00FF00FFULL) | ((w & 0x00FF00FF00FF00FFULL) << 8);
+         return ((w >> 16) & 0x0000FFFF0000FFFFULL) | ((w & 0x0000FFFF0000FFFFULL) << 16);
+
+      case RFT_XFORM_INVERT:
+         return ~w;
+
+      case RFT_XFORM_BITREV:
+         w = ((w >> 4) & 0x0F0F0F0F0F0F0F0FULL) | ((w & 0x0F0F0F0F0F0F0F0FULL) << 4);
+         w = ((w >> 2) & 0x3333333333333333ULL) | ((w & 0x3333333333333333ULL) << 2);
+         return ((w >> 1) & 0x5555555555555555ULL) | ((w & 0x5555555555555555ULL) << 1);
+
+      default:
+         return w;
+   }
+}
+
+#ifdef USE_SSE2
+/**************************************************************************//**
+* Transforms sixteen bytes with a single transform, like XformWord().
+*
+* @param[in] xform The RFT_XFORM_ transform: swap, invert or bit reversal.
+* @param[in] v The bytes.
+*
+* @return The transformed bytes.
+******************************************************************************/
+static __m128i XformVector(U32 xform, __m128i v)
+{
+   __m128i m;
+
+   switch (xform)
+   {
+      case RFT_XFORM_SWAP16:
+         return _mm_or_si128(_mm_srli_epi16(v, 8), _mm_slli_epi16(v, 8));
+
+      case RFT_XFORM_SWAP32:
+         v = _mm_or_si128(_mm_srli_epi16(v, 8), _mm_slli_epi16(v, 8));
+         return _mm_or_si128(_mm_srli_epi32(v, 16), _mm_slli_epi32(v, 16));
+
+      case RFT_XFORM_INVERT:
+         return _mm_xor_si128(v, _mm_set1_epi32(-1));
+
+      case RFT_XFORM_BITREV:
+         m = _mm_set1_epi8(0x0F);
+         v = _mm_or_si128(_mm_and_si128(_mm_srli_epi16(v, 4), m), _mm_slli_epi16(_mm_and_si128(v, m), 4));
+         m = _mm_set1_epi8(0x33);
+         v = _mm_or_si128(_mm_and_si128(_mm_srli_epi16(v, 2), m), _mm_slli_epi16(_mm_and_si128(v, m), 2));
+         m = _mm_set1_epi8(0x55);
+         return _mm_or_si128(_mm_and_si128(_mm_srli_epi16(v, 1), m), _mm_slli_epi16(_mm_and_si128(v, m), 1));
+
+      default:
+         return v;
+   }
+}
+#endif
+
+/**************************************************************************//**
+* Applies a swap, inversion or bit reversal to data in place, sixteen bytes at
+* a time with SSE2 where it is available, and otherwise eight at a time.
+*
+* @param[in] xform The RFT_XFORM_ transform.
+* @param[in,out] pData The data, which is a whole number of the transform's words.
+* @param[in] len The length of the data, in bytes.
+*
+* @return None.
+******************************************************************************/
+static void XformBytes(U32 xform, U8 *pData, U32 len)
+{
+   U32 i = 0;
+   U64 w;
+
+#ifdef USE_SSE2
+   for (; i + 16 <= len; i += 16)
+   {
+      _mm_storeu_si128((__m128i *) &pData[i],
+         XformVector(xform, _mm_loadu_si128((const __m128i *) &pData[i])));
+   }
+#endif
+
+   for (; i + 8 <= len; i += 8)
+   {
+      memcpy(&w, &pData[i], 8);
+      w = XformWord(xform, w);
+      memcpy(&pData[i], &w, 8);
+   }
+
+   /* The rest is padded out to a whole U64, which holds whole words. */
+   if (i < len)
+   {
+      w = 0;
+      memcpy(&w, &pData[i], len - i);
+      w = XformWord(xform, w);
+      memcpy(&pData[i], &w, len - i);
+   }
+}
+
+/**************************************************************************//**
+* Interleaves the two halves of data, so the first half fills the even bytes
+* and the second half fills the odd bytes. This joins the images of a pair of
+* 8-bit ROMs which hold the two halves of a 16-bit bus.
+*
+* @param[out] pDest Receives the interleaved data.
+* @param[in] pSrc The data, which is an even number of bytes.
+* @param[in] len The length of the data, in bytes.
+*
+* @return None.
+******************************************************************************/
+static void InterleaveBytes(U8 *pDest, const U8 *pSrc, U32 len)
+{
+   const U8 *pOdd = pSrc + len / 2;
+   U32 i = 0;
+#ifdef USE_SSE2
+   __m128i even, odd;
+
+   for (; i + 16 <= len / 2; i += 16)
+   {
+      even = _mm_loadu_si128((const __m128i *) &pSrc[i]);
+      odd = _mm_loadu_si128((const __m128i *) &pOdd[i]);
+      _mm_storeu_si128((__m128i *) &pDest[i * 2], _mm_unpacklo_epi8(even, odd));
+      _mm_storeu_si128((__m128i *) &pDest[i * 2 + 16], _mm_unpackhi_epi8(even, odd));
+   }
+#endif
+
+   for (; i < len / 2; i++)
+   {
+      pDest[i * 2] = pSrc[i];
+      pDest[i * 2 + 1] = pOdd[i];
+   }
+}
+
+/**************************************************************************//**
+* Splits data into its even bytes followed by its odd bytes, which is the
+* reverse of InterleaveBytes(). Each half can then be programmed into one of a
+* pair of 8-bit ROMs.
+*
+* @param[out] pDest Receives the even bytes, and then the odd bytes.
+* @param[in] pSrc The data, which is an even number of bytes.
+* @param[in] len The length of the data, in bytes.
+*
+* @return None.
+******************************************************************************/
+static void DeinterleaveBytes(U8 *pDest, const U8 *pSrc, U32 len)
+{
+   U8 *pOdd = pDest + len / 2;
+   U32 i = 0;
+#ifdef USE_SSE2
+   __m128i lo, hi, mask = _mm_set1_epi16(0x00FF);
+
+   for (; i + 16 <= len / 2; i += 16)
+   {
+      lo = _mm_loadu_si128((const __m128i *) &pSrc[i * 2]);
+      hi = _mm_loadu_si128((const __m128i *) &pSrc[i * 2 + 16]);
+      _mm_storeu_si128((__m128i *) &pDest[i],
+         _mm_packus_epi16(_mm_and_si128(lo, mask), _mm_and_si128(hi, mask)));
+      _mm_storeu_si128((__m128i *) &pOdd[i],
+         _mm_packus_epi16(_mm_srli_epi16(lo, 8), _mm_srli_epi16(hi, 8)));
+   }
+#endif
+
+   for (; i < len / 2; i++)
+   {
+      pDest[i] = pSrc[i * 2];
+      pOdd[i] = pSrc[i * 2 + 1];
+   }
+}
+
+/**************************************************************************//**
+* Gets a range's data as a single buffer which belongs to the range alone, so
+* that it can be changed in place.
+*
+* @param[in,out] pRange The range.
+* @param[out] ppData The range's data.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+static RESULT GetPrivateRangeData(RANGE *pRange, U8 **ppData)
+{
+   SEGMENT *pSeg;
+   const U8 *pData;
+   RESULT r;
+
+   r = RftGetRangeData(pRange, &pData);
+   if (r != OK)
+   {
+      return r;
+   }
+
+   /* A single segment may hold a payload shared with other segments. */
+   pSeg = pRange->pSegStart;
+   if (pSeg->pData != (U8 *) (pSeg + 1))
+   {
+      pSeg = AllocSegment(pRange->len);
+      if (pSeg == NULL)
+      {
+         ReportError("ERROR: Out of memory.\n");
+         return NO_MEMORY;
+      }
+
+      pSeg->addr = pRange->addr;
+      memcpy(pSeg->pData, pData, pRange->len);
+      free(pRange->pSegStart);
+      pRange->pSegStart = pSeg;
+      pRange->pSegEnd = pSeg;
+   }
+
+   *ppData = pSeg->pData;
+   return OK;
+}
+
+/**************************************************************************//**
+* Applies transforms to each range of a context, in place.
+*
+* The transforms are applied in this order: de-interleaving, 16-bit and 32-bit
+* byte swaps, bit reversal, inversion, and interleaving. Words are aligned to
+* their addresses, so each range must start and end on a word boundary.
+*
+* @param[in,out] pCtx The conversion context.
+* @param[in] xform The RFT_XFORM_ transforms to apply.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+static RESULT TransformRanges(RFT_CONTEXT *pCtx, U32 xform)
+{
+   static const U32 inPlace[] = { RFT_XFORM_SWAP16, RFT_XFORM_SWAP32, RFT_XFORM_BITREV, RFT_XFORM_INVERT };
+   U32 wordLen, i;
+   RANGE *pRange;
+   U8 *pData, *pTemp = NULL;
+   RESULT r;
+
+   wordLen = (xform & RFT_XFORM_SWAP32) ? 4 :
+      (xform & (RFT_XFORM_SWAP16 | RFT_XFORM_INTERLEAVE | RFT_XFORM_DEINTERLEAVE)) ? 2 : 1;
+
+   for (pRange = pCtx->pAllRanges; pRange; pRange = pRange->pNext)
+   {
+      if ((pRange->addr | pRange->len) & (wordLen - 1))
+      {
+         ReportError("ERROR: The range at 0x%X (%u bytes) is not a whole number of "
+            "%u-byte words.\n", pRange->addr, pRange->len, wordLen);
+         return INVALID_DATA;
+      }
+   }
+
+   for (pRange = pCtx->pAllRanges; pRange; pRange = pRange->pNext)
+   {
+      r = GetPrivateRangeData(pRange, &pData);
+      if (r != OK)
+      {
+         break;
+      }
+
+      /* Interleaving moves bytes across the whole range, so it goes through a copy. */
+      if (xform & (RFT_XFORM_INTERLEAVE | RFT_XFORM_DEINTERLEAVE))
+      {
+         free(pTemp);
+         pTemp = (U8 *) malloc(pRange->len);
+         if (pTemp == NULL)
+         {
+            ReportError("ERROR: Out of memory.\n");
+            r = NO_MEMORY;
+            break;
+         }
+      }
+
+      if (xform & RFT_XFORM_DEINTERLEAVE)
+      {
+         DeinterleaveBytes(pTemp, pData, pRange->len);
+         memcpy(pData, pTemp, pRange->len);
+      }
+
+      for (i = 0; i < sizeof(inPlace) / sizeof(inPlace[0]); i++)
+      {
+         if (xform & inPlace[i])
+         {
+            XformBytes(inPlace[i], pData, pRange->len);
+         }
+      }
+
+      if (xform & RFT_XFORM_INTERLEAVE)
+      {
+         InterleaveBytes(pTemp, pData, pRange->len);
+         memcpy(pData, pTemp, pRange->len);
+      }
+   }
+
+   free(pTemp);
+   return pRange == NULL ? OK : r;
+}
+
+/**************************************************************************//**
+* Adds bytes to a running CRC-32 (the one used by zlib and Ethernet), eight
+* bytes at a time.
+*
+* @param[in] crc The running CRC-32, which starts at 0xFFFFFFFF and is inverted
+*    once all the bytes are added.
+* @param[in] pData The bytes.
+* @param[in] len The number of bytes.
+*
+* @return The running CRC-32.
+******************************************************************************/
+static U32 UpdateCrc32(U32 crc, const U8 *pData, U32 len)
+{
+   U32 lo, hi;
+
+   for (; len >= 8; len -= 8, pData += 8)
+   {
+      lo = crc ^ ((U32) pData[0] | ((U32) pData[1] << 8) | ((U32) pData[2] << 16) |
+         ((U32) pData[3] << 24));
+      hi = (U32) pData[4] | ((U32) pData[5] << 8) | ((U32) pData[6] << 16) | ((U32) pData[7] << 24);
+      crc = crcTables[7][lo & 0xFF] ^ crcTables[6][(lo >> 8) & 0xFF] ^
+         crcTables[5][(lo >> 16) & 0xFF] ^ crcTables[4][lo >> 24] ^
+         crcTables[3][hi & 0xFF] ^ crcTables[2][(hi >> 8) & 0xFF] ^
+         crcTables[1][(hi >> 16) & 0xFF] ^ crcTables[0][hi >> 24];
+   }
+
+   while (len--)
+   {
+      crc = (crc >> 8) ^ crcTables[0][(crc ^ *pData++) & 0xFF];
+   }
+
+   return crc;
+}
+
+/**************************************************************************//**
+* Parses a number of a script, in decimal, or in hex after 0x or $.
+*
+* @param[in] pTok The number, which ends at a space, ';' or the end of the line.
+* @param[out] pVal The number.
+*
+* @return Non-zero if the number is valid.
+******************************************************************************/
+static int ParseScriptNum(const char *pTok, U32 *pVal)
+{
+   U64 val = 0;
+   U32 radix = 10, digit, n = 0;
+
+   if (pTok[0] == '$')
+   {
+      radix = 16;
+      pTok++;
+   }
+   else if (pTok[0] == '0' && (pTok[1] == 'x' || pTok[1] == 'X'))
+   {
+      radix = 16;
+      pTok += 2;
+   }
+
+   for (; *pTok && !strchr(" \t\r\n;#", *pTok); pTok++, n++)
+   {
+      digit = hexValues[(U8) *pTok];
+      if (digit == 0 || (digit -= 0x10) >= radix)
+      {
+         return 0;
+      }
+
+      val = val * radix + digit;
+      if (val > 0xFFFFFFFF)
+      {
+         return 0;
+      }
+   }
+
+   *pVal = (U32) val;
+   return n != 0;
+}
+
+/**************************************************************************//**
+* Parses a script into its stages.
+*
+* Statements are separated by ';' or new lines, and '#' starts a comment which
+* runs to the end of the line. Ranges of addresses include their end.
+*
+*    crop START END           Keep only the data from START to END.
+*    fill VALUE [START END]   Fill the addresses from START to END which hold no
+*                             data with VALUE. Without a range, the window of the
+*                             last crop is filled, or from the lowest to the
+*                             highest address loaded if there was none.
+*    poke ADDR BYTE...        Write up to SCRIPT_POKE_LEN bytes at ADDR.
+*    crc32 START END -> ADDR  Store the CRC-32 of START to END at ADDR, least
+*                             significant byte first.
+*
+* @param[in] pCtx The conversion context.
+* @param[in] pScript The script.
+* @param[out] ppStages The stages. The caller must free them.
+* @param[out] pNumStages The number of stages.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+static RESULT ParseScript(const RFT_CONTEXT *pCtx, const char *pScript, STAGE **ppStages,
+   U32 *pNumStages)
+{
+   static const char *pNames[] = { "crop", "fill", "poke", "crc32" };
+   const char *pTok[SCRIPT_POKE_LEN + 2];
+   U32 numToks, maxStages = 0, numStages = 0, line = 1, vals[SCRIPT_POKE_LEN + 2], i;
+   U32 windowStart = 0;
+   U64 windowEnd = 0;
+   STAGE *pStages = NULL, *pNew, *pStage;
+   const RANGE *pRange;
+   const char *p = pScript;
+   int valid;
+
+   /* Until a crop, fill fills between the lowest and highest addresses loaded. */
+   if (pCtx->pAllRanges)
+   {
+      windowStart = pCtx->pAllRanges->addr;
+   }
+   for (pRange = pCtx->pAllRanges; pRange; pRange = pRange->pNext)
+   {
+      windowEnd = (U64) pRange->addr + pRange->len;
+   }
+
+   while (*p)
+   {
+      /* Split the statement into words. */
+      numToks = 0;
+      while (*p && *p != ';' && *p != '\n')
+      {
+         if (*p == '#')
+         {
+            while (*p && *p != '\n')
+            {
+               p++;
+            }
+            break;
+         }
+
+         if (strchr(" \t\r", *p))
+         {
+            p++;
+            continue;
+         }
+
+         if (numToks == SCRIPT_POKE_LEN + 2)
+         {
+            ReportError("ERROR: Script line %u: Too many words.\n", line);
+            free(pStages);
+            return INVALID_ARGUMENTS;
+         }
+
+         pTok[numToks++] = p;
+         while (*p && !strchr(" \t\r\n;#", *p))
+         {
+            p++;
+         }
+      }
+
+      if (numToks != 0)
+      {
+         for (i = 0; i < sizeof(pNames) / sizeof(pNames[0]); i++)
+         {
+            if (!strncmp(pTok[0], pNames[i], strlen(pNames[i])) &&
+               strchr(" \t\r\n;#", pTok[0][strlen(pNames[i])]))
+            {
+               break;
+            }
+         }
+
+         if (i == sizeof(pNames) / sizeof(pNames[0]))
+         {
+            ReportError("ERROR: Script line %u: Unknown command.\n", line);
+            free(pStages);
+            return INVALID_ARGUMENTS;
+         }
+
+         if (numStages == maxStages)
+         {
+            maxStages = maxStages ? maxStages * 2 : 16;
+            pNew = (STAGE *) realloc(pStages, maxStages * sizeof(STAGE));
+            if (pNew == NULL)
+            {
+               ReportError("ERROR: Out of memory.\n");
+               free(pStages);
+               return NO_MEMORY;
+            }
+            pStages = pNew;
+         }
+
+         pStage = &pStages[numStages++];
+         memset(pStage, 0, sizeof(*pStage));
+         pStage->type = (STAGE_TYPE) i;
+         pStage->line = line;
+
+         /* The arrow of crc32 is required, but only there to be read. */
+         if (pStage->type == STAGE_CRC32)
+         {
+            if (numToks != 5 || strncmp(pTok[3], "->", 2) || !strchr(" \t\r\n;#", pTok[3][2]))
+            {
+               ReportError("ERROR: Script line %u: Expected crc32 START END -> ADDR.\n", line);
+               free(pStages);
+               return INVALID_ARGUMENTS;
+            }
+            pTok[3] = pTok[4];
+            numToks = 4;
+         }
+
+         for (i = 1; i < numToks; i++)
+         {
+            if (!ParseScriptNum(pTok[i], &vals[i]))
+            {
+               ReportError("ERROR: Script line %u: Invalid number.\n", line);
+               free(pStages);
+               return INVALID_ARGUMENTS;
+            }
+         }
+
+         if ((pStage->type == STAGE_CROP && numToks != 3) ||
+            (pStage->type == STAGE_FILL && numToks != 2 && numToks != 4) ||
+            (pStage->type == STAGE_POKE && numToks < 3))
+         {
+            ReportError("ERROR: Script line %u: Wrong number of arguments to %s.\n", line,
+               pNames[pStage->type]);
+            free(pStages);
+            return INVALID_ARGUMENTS;
+         }
+
+         valid = 1;
+         switch (pStage->type)
+         {
+            case STAGE_CROP:
+            case STAGE_CRC32:
+               pStage->start = vals[1];
+               pStage->end = (U64) vals[2] + 1;
+               valid = vals[2] >= vals[1];
+               if (pStage->type == STAGE_CROP)
+               {
+                  windowStart = pStage->start;
+                  windowEnd = pStage->end;
+               }
+               else
+               {
+                  pStage->target = vals[3];
+                  valid &= vals[3] <= 0xFFFFFFFC;
+
+                  /* The CRC can't be stored within the range it is computed over. */
+                  if (valid && (U64) pStage->target + 4 > pStage->start &&
+                     pStage->target < pStage->end)
+                  {
+                     ReportError("ERROR: Script line %u: The crc32 is stored within the "
+                        "range it reads.\n", line);
+                     free(pStages);
+                     return INVALID_ARGUMENTS;
+                  }
+               }
+               break;
+
+            case STAGE_FILL:
+               pStage->fill = (U8) vals[1];
+               pStage->start = numToks == 4 ? vals[2] : windowStart;
+               pStage->end = numToks == 4 ? (U64) vals[3] + 1 : windowEnd;
+               valid = vals[1] <= 0xFF && (numToks == 2 || vals[3] >= vals[2]);
+               break;
+
+            case STAGE_POKE:
+               pStage->start = vals[1];
+               pStage->end = (U64) vals[1] + numToks - 2;
+               valid = pStage->end <= 0x100000000ULL;
+               for (i = 2; i < numToks; i++)
+               {
+                  pStage->data[i - 2] = (U8) vals[i];
+                  valid &= vals[i] <= 0xFF;
+               }
+               break;
+         }
+
+         if (!valid)
+         {
+            ReportError("ERROR: Script line %u: Invalid address, range or byte value.\n", line);
+            free(pStages);
+            return INVALID_ARGUMENTS;
+         }
+      }
+
+      if (*p)
+      {
+         line += *p++ == '\n';
+      }
+   }
+
+   *ppStages = pStages;
+   *pNumStages = numStages;
+
+   return OK;
+}
+
+/**************************************************************************//**
+* Moves a cursor forward to an address of its image.
+*
+* @param[in,out] pCursor The cursor, which must not be past the address.
+* @param[in] addr The address.
+*
+* @return Non-zero if the image holds data at the address.
+******************************************************************************/
+static int SeekSource(SRC_CURSOR *pCursor, U32 addr)
+{
+   while (pCursor->pRange && (U64) pCursor->pRange->addr + pCursor->pRange->len <= addr)
+   {
+      pCursor->pRange = pCursor->pRange->pNext;
+      pCursor->pSeg = NULL;
+   }
+
+   if (pCursor->pRange == NULL || pCursor->pRange->addr > addr)
+   {
+      return 0;
+   }
+
+   if (pCursor->pSeg == NULL)
+   {
+      pCursor->pSeg = pCursor->pRange->pSegStart;
+      pCursor->segAddr = pCursor->pRange->addr;
+   }
+
+   while (pCursor->segAddr + pCursor->pSeg->len <= addr)
+   {
+      pCursor->segAddr += pCursor->pSeg->len;
+      pCursor->pSeg = pCursor->pSeg->pNext;
+   }
+
+   return 1;
+}
+
+/**************************************************************************//**
+* Works out what a span of addresses holds after some stages of a script, and
+* what each crc32 among them reads there.
+*
+* Every boundary of a stage is a boundary of a span, so each stage treats the
+* whole span alike.
+*
+* @param[in,out] pStages The stages. The reading and seen fields of each crc32
+*    are set.
+* @param[in] numStages The number of stages.
+* @param[in] addr The first address of the span.
+* @param[in] inSource Whether the image holds data at the span.
+*
+* @return What the span holds after the stages.
+******************************************************************************/
+static SPAN_STATE EvalSpan(STAGE *pStages, U32 numStages, U32 addr, int inSource)
+{
+   SPAN_STATE state;
+   STAGE *pStage;
+   U32 i;
+
+   state.kind = inSource ? SPAN_SOURCE : SPAN_ABSENT;
+   state.fill = 0;
+   state.pLiteral = NULL;
+
+   for (i = 0; i < numStages; i++)
+   {
+      pStage = &pStages[i];
+      pStage->reading = addr >= pStage->start && addr < pStage->end;
+
+      switch (pStage->type)
+      {
+         case STAGE_CROP:
+            if (!pStage->reading)
+            {
+               state.kind = SPAN_ABSENT;
+            }
+            break;
+
+         case STAGE_FILL:
+            if (pStage->reading && state.kind == SPAN_ABSENT)
+            {
+               state.kind = SPAN_FILL;
+               state.fill = pStage->fill;
+            }
+            break;
+
+         case STAGE_POKE:
+            if (pStage->reading)
+            {
+               state.kind = SPAN_LITERAL;
+               state.pLiteral = &pStage->data[addr - pStage->start];
+            }
+            break;
+
+         case STAGE_CRC32:
+            pStage->seen = state;
+            if (addr - pStage->target < 4)
+            {
+               state.kind = SPAN_LITERAL;
+               state.pLiteral = &pStage->data[addr - pStage->target];
+            }
+            break;
+      }
+   }
+
+   return state;
+}
+
+/**************************************************************************//**
+* Finds how many stages of a script, from the first, can run as one pass.
+*
+* A crc32 is stored once its pass is over, so the pass ends at a crc32 which a
+* later stage would crop, poke over, or read.
+*
+* @param[in] pStages The stages.
+* @param[in] numStages The number of stages.
+*
+* @return The number of stages in the pass.
+******************************************************************************/
+static U32 GetPassLen(const STAGE *pStages, U32 numStages)
+{
+   const STAGE *pCrc, *pLater;
+   U32 i, j;
+
+   for (i = 0; i < numStages; i++)
+   {
+      pCrc = &pStages[i];
+      if (pCrc->type != STAGE_CRC32)
+      {
+         continue;
+      }
+
+      for (j = i + 1; j < numStages; j++)
+      {
+         pLater = &pStages[j];
+         if ((pLater->type == STAGE_CROP &&
+            (pCrc->target < pLater->start || (U64) pCrc->target + 4 > pLater->end)) ||
+            ((pLater->type == STAGE_POKE || pLater->type == STAGE_CRC32) &&
+            pLater->start < (U64) pCrc->target + 4 && pLater->end > pCrc->target))
+         {
+            return i + 1;
+         }
+      }
+   }
+
+   return numStages;
+}
+
+/**************************************************************************//**
+* Adds a span's data to the crc32s of a pass which read it, and copies it into
+* the new image, a block at a time while it is in the cache.
+*
+* @param[in,out] pStages The stages of the pass, as set by EvalSpan().
+* @param[in] numStages The number of stages.
+* @param[in] pFinal What the span holds at the end of the pass.
+* @param[in,out] pCursor The cursor of the old image.
+* @param[in] inSource Whether the old image holds data at the span.
+* @param[in] addr The first address of the span.
+* @param[in] len The length of the span, in bytes.
+* @param[out] pOut Receives the span's data, unless it holds none at the end.
+*
+* @return None.
+******************************************************************************/
+static void RunSpan(STAGE *pStages, U32 numStages, const SPAN_STATE *pFinal,
+   SRC_CURSOR *pCursor, int inSource, U32 addr, U32 len, U8 *pOut)
+{
+   U8 fills[SCRIPT_BLOCK_LEN];
+   const U8 *pSrc = NULL, *pData;
+   const SPAN_STATE *pSeen;
+   U32 n, ofs, i;
+
+   /* Nothing reads or keeps most gaps. */
+   for (i = 0; i < numStages && !(pStages[i].type == STAGE_CRC32 && pStages[i].reading); i++);
+   if (i == numStages && pFinal->kind == SPAN_ABSENT)
+   {
+      return;
+   }
+
+   for (ofs = 0; ofs < len; ofs += n)
+   {
+      n = len - ofs < SCRIPT_BLOCK_LEN ? len - ofs : SCRIPT_BLOCK_LEN;
+
+      /* Source data may be split over segments, so it is taken a segment at a time. */
+      if (inSource)
+      {
+         SeekSource(pCursor, addr + ofs);
+         i = addr + ofs - pCursor->segAddr;
+         if (n > pCursor->pSeg->len - i)
+         {
+            n = pCursor->pSeg->len - i;
+         }
+         pSrc = &pCursor->pSeg->pData[i];
+      }
+
+      for (i = 0; i < numStages; i++)
+      {
+         if (pStages[i].type != STAGE_CRC32 || !pStages[i].reading)
+         {
+            continue;
+         }
+
+         pSeen = &pStages[i].seen;
+         if (pSeen->kind == SPAN_SOURCE)
+         {
+            pData = pSrc;
+         }
+         else if (pSeen->kind == SPAN_FILL)
+         {
+            memset(fills, pSeen->fill, n);
+            pData = fills;
+         }
+         else
+         {
+            pData = pSeen->pLiteral + ofs;
+         }
+         pStages[i].crc = UpdateCrc32(pStages[i].crc, pData, n);
+      }
+
+      switch (pFinal->kind)
+      {
+         case SPAN_SOURCE:
+            memcpy(&pOut[ofs], pSrc, n);
+            break;
+
+         case SPAN_FILL:
+            memset(&pOut[ofs], pFinal->fill, n);
+            break;
+
+         case SPAN_LITERAL:
+            memcpy(&pOut[ofs], pFinal->pLiteral + ofs, n);
+            break;
+
+         default:
+            break;
+      }
+   }
+}
+
+/**************************************************************************//**
+* Compares two addresses, for qsort().
+*
+* @param[in] pA The first U64.
+* @param[in] pB The second U64.
+*
+* @return Less than, equal to, or greater than zero, as for qsort().
+******************************************************************************/
+static int CompareAddrs(const void *pA, const void *pB)
+{
+   U64 a = *(const U64 *) pA, b = *(const U64 *) pB;
+
+   return a < b ? -1 : (a > b);
+}
+
+/**************************************************************************//**
+* Runs stages of a script over a context's image as one pass, which builds the
+* new image.
+*
+* The address space is cut into spans at every boundary of a range or a stage,
+* so that each stage treats a whole span alike, and what each span holds is
+* worked out once for all the stages together. A first walk over the spans
+* lays out the new ranges, and a second copies each byte once, adding it to
+* any crc32s on the way.
+*
+* @param[in,out] pCtx The conversion context.
+* @param[in,out] pStages The stages of the pass.
+* @param[in] numStages The number of stages.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+static RESULT RunScriptPass(RFT_CONTEXT *pCtx, STAGE *pStages, U32 numStages)
+{
+   SCRIPT_RUN *pRuns = NULL, *pNewRuns;
+   RANGE *pNewRanges = NULL, **ppTail = &pNewRanges, *pRange, *pNextRange;
+   SEGMENT *pSeg, *pNextSeg;
+   U64 *pBounds, len;
+   U32 numBounds = 0, numRuns = 0, maxRuns = 0, run, addr, i, j;
+   SRC_CURSOR cursor;
+   SPAN_STATE final;
+   U8 *pOut = NULL;
+   int inSource;
+   RESULT r = OK;
+
+   pBounds = (U64 *) malloc((pCtx->numRanges * 2 + numStages * 4 + 1) * sizeof(U64));
+   if (pBounds == NULL)
+   {
+      ReportError("ERROR: Out of memory.\n");
+      return NO_MEMORY;
+   }
+
+   for (pRange = pCtx->pAllRanges; pRange; pRange = pRange->pNext)
+   {
+      pBounds[numBounds++] = pRange->addr;
+      pBounds[numBounds++] = (U64) pRange->addr + pRange->len;
+   }
+
+   for (i = 0; i < numStages; i++)
+   {
+      if (pStages[i].end > pStages[i].start)
+      {
+         pBounds[numBounds++] = pStages[i].start;
+         pBounds[numBounds++] = pStages[i].end;
+      }
+      if (pStages[i].type == STAGE_CRC32)
+      {
+         pBounds[numBounds++] = pStages[i].target;
+         pBounds[numBounds++] = (U64) pStages[i].target + 4;
+         pStages[i].crc = 0xFFFFFFFF;
+      }
+   }
+
+   qsort(pBounds, numBounds, sizeof(U64), CompareAddrs);
+   for (i = j = 0; i < numBounds; i++)
+   {
+      if (j == 0 || pBounds[i] != pBounds[j - 1])
+      {
+         pBounds[j++] = pBounds[i];
+      }
+   }
+   numBounds = j;
+
+   /* Lay out the new ranges, and check that each crc32 reads only data. */
+   memset(&cursor, 0, sizeof(cursor));
+   cursor.pRange = pCtx->pAllRanges;
+   for (i = 0; i + 1 < numBounds && r == OK; i++)
+   {
+      addr = (U32) pBounds[i];
+      final = EvalSpan(pStages, numStages, addr, SeekSource(&cursor, addr));
+
+      for (j = 0; j < numStages; j++)
+      {
+         if (pStages[j].type == STAGE_CRC32 && pStages[j].reading &&
+            pStages[j].seen.kind == SPAN_ABSENT)
+         {
+            ReportError("ERROR: Script line %u: The crc32 reads 0x%X, which holds no data.\n",
+               pStages[j].line, addr);
+            r = INVALID_DATA;
+         }
+      }
+
+      if (final.kind == SPAN_ABSENT || r != OK)
+      {
+         continue;
+      }
+
+      if (numRuns && pRuns[numRuns - 1].addr + pRuns[numRuns - 1].len == addr)
+      {
+         pRuns[numRuns - 1].len += pBounds[i + 1] - addr;
+         continue;
+      }
+
+      if (numRuns == maxRuns)
+      {
+         maxRuns = maxRuns ? maxRuns * 2 : 64;
+         pNewRuns = (SCRIPT_RUN *) realloc(pRuns, maxRuns * sizeof(SCRIPT_RUN));
+         if (pNewRuns == NULL)
+         {
+            ReportError("ERROR: Out of memory.\n");
+            r = NO_MEMORY;
+            continue;
+         }
+         pRuns = pNewRuns;
+      }
+
+      pRuns[numRuns].addr = addr;
+      pRuns[numRuns++].len = pBounds[i + 1] - addr;
+   }
+
+   /* Make a range of one segment for each run. */
+   for (run = 0; run < numRuns && r == OK; run++)
+   {
+      if (pRuns[run].len > 0xFFFFFFFF)
+      {
+         ReportError("ERROR: The script makes a range of 4 GB.\n");
+         r = LEN_OUT_OF_RANGE;
+         break;
+      }
+
+      pRange = (RANGE *) malloc(sizeof(RANGE));
+      pSeg = AllocSegment((U32) pRuns[run].len);
+      if (pRange == NULL || pSeg == NULL)
+      {
+         ReportError("ERROR: Out of memory.\n");
+         free(pRange);
+         free(pSeg);
+         r = NO_MEMORY;
+         break;
+      }
+
+      pSeg->addr = pRuns[run].addr;
+      pRange->addr = pRuns[run].addr;
+      pRange->len = (U32) pRuns[run].len;
+      pRange->pSegStart = pSeg;
+      pRange->pSegEnd = pSeg;
+      pRange->pNext = NULL;
+      *ppTail = pRange;
+      ppTail = &pRange->pNext;
+   }
+
+   /* Fill in the new ranges, in address order. */
+   if (r == OK)
+   {
+      memset(&cursor, 0, sizeof(cursor));
+      cursor.pRange = pCtx->pAllRanges;
+      pRange = NULL;
+      for (i = 0; i + 1 < numBounds; i++)
+      {
+         addr = (U32) pBounds[i];
+         len = pBounds[i + 1] - addr;
+         inSource = SeekSource(&cursor, addr);
+         final = EvalSpan(pStages, numStages, addr, inSource);
+
+         /* Runs are laid out as the spans which hold data, so one past its end starts the next. */
+         if (final.kind != SPAN_ABSENT &&
+            (pRange == NULL || addr >= (U64) pRange->addr + pRange->len))
+         {
+            pRange = pRange ? pRange->pNext : pNewRanges;
+            pOut = pRange->pSegStart->pData;
+         }
+
+         RunSpan(pStages, numStages, &final, &cursor, inSource, addr, (U32) len, pOut);
+
+         for (j = 0; j < numStages; j++)
+         {
+            if (pStages[j].type == STAGE_CRC32 && pStages[j].target == addr)
+            {
+               pStages[j].pOut = pOut;
+            }
+         }
+
+         if (final.kind != SPAN_ABSENT)
+         {
+            pOut += len;
+         }
+      }
+
+      /* Each crc32 is stored once all its data has been read. */
+      for (j = 0; j < numStages; j++)
+      {
+         if (pStages[j].type == STAGE_CRC32)
+         {
+            pStages[j].crc = ~pStages[j].crc;
+            for (i = 0; i < 4; i++)
+            {
+               pStages[j].pOut[i] = (U8) (pStages[j].crc >> (i * 8));
+            }
+         }
+      }
+   }
+
+   /* Swap the new image in, and release the old one, or the new one on failure. */
+   if (r == OK)
+   {
+      pRange = pCtx->pAllRanges;
+      pCtx->pAllRanges = pNewRanges;
+      pNewRanges = pRange;
+      pCtx->numRanges = numRuns;
+      pCtx->dataBytes = 0;
+      for (pRange = pCtx->pAllRanges; pRange; pRange = pRange->pNext)
+      {
+         pCtx->dataBytes += pRange->len;
+      }
+   }
+
+   for (pRange = pNewRanges; pRange; pRange = pNextRange)
+   {
+      for (pSeg = pRange->pSegStart; pSeg; pSeg = pNextSeg)
+      {
+         pNextSeg = pSeg->pNext;
+         free(pSeg);
+      }
+      pNextRange = pRange->pNext;
+      free(pRange);
+   }
+
+   free(pRuns);
+   free(pBounds);
+
+   return r;
+}
+
+/**************************************************************************//**
+* Runs a script over a context's image.
+*
+* The stages are run in as few passes as they can be: see RunScriptPass().
+*
+* @param[in,out] pCtx The conversion context.
+* @param[in] pStages The stages.
+* @param[in] numStages The number of stages.
+* @param[out] pNumPasses The number of passes the stages took.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+static RESULT RunScript(RFT_CONTEXT *pCtx, STAGE *pStages, U32 numStages, U32 *pNumPasses)
+{
+   U32 done, n;
+   RESULT r = OK;
+
+   *pNumPasses = 0;
+   for (done = 0; done < numStages && r == OK; done += n)
+   {
+      n = GetPassLen(&pStages[done], numStages - done);
+      r = RunScriptPass(pCtx, &pStages[done], n);
+      (*pNumPasses)++;
+   }
+
+   return r;
+}
+
+/**************************************************************************//**
+* Loads an input held in memory into a context, as it is.
+*
+* @param[in,out] pCtx The conversion context.
+* @param[in] type The type of the input.
+* @param[in] pOpts The file options for this file type.
+* @param[in] pBuf The input's contents.
+* @param[in] len The length of the input, in bytes.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+static RESULT LoadMem(RFT_CONTEXT *pCtx, FILE_TYPE type, const void *pOpts,
+   const U8 *pBuf, U32 len)
+{
+   RFT_VISITOR visitor;
+
+   /* Text inputs are either sorted by address before they are merged, or decoded in
+   another thread while the records are merged. */
+   if (pCtx->sortRunLen != 0 && IsTextType(type))
+   {
+      return LoadSorted(pCtx, type, pBuf, len);
+   }
+
+   if (UsePipeline(pCtx, type))
+   {
+      return LoadPipelined(pCtx, type, NULL, pBuf, len);
+   }
+
+   visitor.pfnData = AddRecord;
+   visitor.pfnStart = SetStartAddr;
+   visitor.pUser = pCtx;
+
+   return RftVisitMem(type, pOpts, pBuf, len, &visitor);
+}
+
+/**************************************************************************//**
+* Loads the contents of an input file, held in a segment, into a context.
+*
+* Raw binary data is used in place, and all other types are decoded.
+*
+* @param[in,out] pCtx The conversion context.
+* @param[in] type The type of the input.
+* @param[in] pOpts The file options for this file type.
+* @param[in] pSeg The file's contents. This is consumed.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+static RESULT LoadSegData(RFT_CONTEXT *pCtx, FILE_TYPE type, const void *pOpts, SEGMENT *pSeg)
+{
+   const FILE_OPTS_BIN *pBinOpts = (const FILE_OPTS_BIN *) pOpts;
+   RESULT r;
+
+   /* With deduplication, binary data is also copied into the shared payloads. */
+   if (type == FILE_TYPE_BIN && pBinOpts != NULL && pBinOpts->addrSpecified && pSeg->len &&
+      !pCtx->useDedup)
+   {
+      pSeg->addr = pBinOpts->startAddr;
+      r = AppendSegment(&pCtx->run, pSeg);
+      if (r != OK)
+      {
+         free(pSeg);
+      }
+
+      return r;
+   }
+
+   r = LoadMem(pCtx, type, pOpts, pSeg->pData, pSeg->len);
+   free(pSeg);
+
+   return r;
+}
+
+/**************************************************************************//**
+* Loads an input read from a file descriptor into a context, as it is.
+*
+* @param[in,out] pCtx The conversion context.
+* @param[in] type The type of the input.
+* @param[in] pOpts The file options for this file type.
+* @param[in] fd The file descriptor to read until its end.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+static RESULT LoadFd(RFT_CONTEXT *pCtx, FILE_TYPE type, const void *pOpts, int fd)
+{
+   SEGMENT *pSeg;
+   RESULT r;
+
+   r = ReadFdData(fd, &pSeg);
+   if (r != OK)
+   {
+      return r;
+   }
+
+   return LoadSegData(pCtx, type, pOpts, pSeg);
+}
+
+/**************************************************************************//**
+* Loads an input file into a context, as it is.
+*
+* @param[in,out] pCtx The conversion context.
+* @param[in] type The type of the input.
+* @param[in] pOpts The file options for this file type.
+* @param[in] pName The name of the input file.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+static RESULT LoadFile(RFT_CONTEXT *pCtx, FILE_TYPE type, const void *pOpts, const char *pName)
+{
+   SEGMENT *pSeg;
+   FILE *inFile;
+   IN_MAP map;
+   U32 len;
+   RESULT r;
+
+   /* An externally sorted input is mapped rather than read, so that it need not fit in memory. */
+   if (pCtx->sortRunLen != 0 && IsTextType(type))
+   {
+      r = MapInputFile(pName, &map);
+      if (r != OK)
+      {
+         return r;
+      }
+
+      r = LoadSorted(pCtx, type, map.pData, map.len);
+      UnmapInputFile(&map);
+
+      return r;
+   }
+
+   /* Text inputs are read, decoded and merged at the same time. */
+   if (UsePipeline(pCtx, type))
+   {
+      r = OpenInputFile(pName, &inFile, &len);
+      if (r != OK)
+      {
+         return r;
+      }
+
+      r = LoadPipelined(pCtx, type, inFile, NULL, len);
+      fclose(inFile);
+
+      return r;
+   }
+
+   r = ReadFileData(pName, &pSeg);
+   if (r != OK)
+   {
+      return r;
+   }
+
+   return LoadSegData(pCtx, type, pOpts, pSeg);
+}
+
+/**************************************************************************//**
+* Merges the run of the input loaded into a context into its ranges, or
+* discards the run if the input failed to load, so a failed load adds nothing
+* to the image.
+*
+* @param[in,out] pCtx The conversion context.
+* @param[in] pName The name of the input, to name in messages, or NULL if it has none.
+* @param[in] r The result of loading the input.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+static RESULT FinishLoad(RFT_CONTEXT *pCtx, const char *pName, RESULT r)
+{
+   SEG_RUN *pRun = &pCtx->run;
+   RFT_INPUT input;
+
+   memset(&input, 0, sizeof(input));
+   input.pName = pName;
+
+   if (r == OK)
+   {
+      r = SortSegRun(pRun);
+   }
+
+   if (r == OK)
+   {
+      r = MergeSegRuns(pCtx, &pRun, 1, pName ? &input : NULL);
+   }
+
+   FreeSegRun(pRun, r != OK);
+   return r;
+}
+
+/**************************************************************************//**
+* Starts loading an input. When the input is transformed, it is loaded into a
+* context of its own, so it can be transformed before it joins the image.
+*
+* @param[in] pCtx The conversion context.
+* @param[out] ppTarget The context to load the input into.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+static RESULT BeginLoad(RFT_CONTEXT *pCtx, RFT_CONTEXT **ppTarget)
+{
+   RESULT r;
+
+   if (pCtx->xform == 0)
+   {
+      *ppTarget = pCtx;
+      return OK;
+   }
+
+   r = RftOpen(ppTarget);
+   if (r != OK)
+   {
+      return r;
+   }
+
+   (*ppTarget)->numThreads = pCtx->numThreads;
+   (*ppTarget)->sortRunLen = pCtx->sortRunLen;
+
+   return OK;
+}
+
+/**************************************************************************//**
+* Finishes loading an input started with BeginLoad(), transforming it and
+* adding it to the image.
+*
+* @param[in,out] pCtx The conversion context.
+* @param[in] pTarget The context the input was loaded into.
+* @param[in] pName The name of the input, to name in messages, or NULL if it has none.
+* @param[in] r The result of loading the input.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+static RESULT EndLoad(RFT_CONTEXT *pCtx, RFT_CONTEXT *pTarget, const char *pName, RESULT r)
+{
+   RANGE *pRange;
+   SEGMENT *pSeg;
+
+   r = FinishLoad(pTarget, pName, r);
+   if (pTarget == pCtx)
+   {
+      return r;
+   }
+
+   if (r == OK)
+   {
+      r = TransformRanges(pTarget, pCtx->xform);
+   }
+
+   /* Each transformed range is now a single segment, which moves to the image as it is. */
+   for (pRange = pTarget->pAllRanges; pRange && r == OK; pRange = pRange->pNext)
+   {
+      if (pCtx->useDedup)
+      {
+         r = AddRecord(pCtx, pRange->addr, pRange->pSegStart->pData, pRange->len);
+         continue;
+      }
+
+      pSeg = pRange->pSegStart;
+      pRange->pSegStart = NULL;
+      pRange->pSegEnd = NULL;
+
+      r = AppendSegment(&pCtx->run, pSeg);
+      if (r != OK)
+      {
+         free(pSeg);
+      }
+   }
+
+   r = FinishLoad(pCtx, pName, r);
+   if (r == OK && pTarget->startAddr != 0)
+   {
+      pCtx->startAddr = pTarget->startAddr;
+   }
+
+   RftClose(pTarget);
+   return r;
+}
+
+/**************************************************************************//**
+* Adds a decoded block of data to the run of one of several inputs loaded at
+* once. This is the visitor used when loading several inputs at once.
+*
+* @param[in,out] pUser The INPUT_LOADER of the input.
+* @param[in] addr The address of the data.
+* @param[in] pData The data.
+* @param[in] len The length of the data, in bytes.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+static RESULT LoaderRecord(void *pUser, U32 addr, const U8 *pData, U32 len)
+{
+   INPUT_LOADER *pLoader = (INPUT_LOADER *) pUser;
+
+   return AppendRecord(&pLoader->run, addr, pData, len);
+}
+
+/**************************************************************************//**
+* Records the program's execution starting address of one of several inputs
+* loaded at once.
+*
+* @param[in,out] pUser The INPUT_LOADER of the input.
+* @param[in] addr The starting address.
+*
+* @return OK.
+******************************************************************************/
+static RESULT LoaderStart(void *pUser, U32 addr)
+{
+   INPUT_LOADER *pLoader = (INPUT_LOADER *) pUser;
+
+   pLoader->startAddr = addr;
+   pLoader->hasStart = 1;
+
+   return OK;
+}
+
+/**************************************************************************//**
+* Loads an input into a context of its own, and then moves its segments into
+* its run. This is for inputs which must be whole before they join the image:
+* transformed inputs, and externally sorted ones.
+*
+* @param[in,out] pLoader The loading of the input.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+static RESULT LoadInputPrivate(INPUT_LOADER *pLoader)
+{
+   const RFT_INPUT *pInput = &pLoader->pJob->pInputs[pLoader->run.input];
+   RFT_CONTEXT *pCtx = pLoader->pJob->pCtx, *pTemp;
+   SEGMENT *pSeg, *pNextSeg;
+   RANGE *pRange;
+   RESULT r;
+
+   r = RftOpen(&pTemp);
+   if (r != OK)
+   {
+      return r;
+   }
+
+   /* The other inputs are already loading on the other threads. */
+   pTemp->numThreads = 1;
+   pTemp->sortRunLen = pCtx->sortRunLen;
+
+   r = FinishLoad(pTemp, pInput->pName,
+      LoadFile(pTemp, pInput->type, pInput->pOpts, pInput->pName));
+   if (r == OK && pInput->xform)
+   {
+      r = TransformRanges(pTemp, pInput->xform);
+   }
+
+   for (pRange = pTemp->pAllRanges; pRange; pRange = pRange->pNext)
+   {
+      pSeg = pRange->pSegStart;
+      pRange->pSegStart = NULL;
+      pRange->pSegEnd = NULL;
+
+      for (; pSeg; pSeg = pNextSeg)
+      {
+         pNextSeg = pSeg->pNext;
+
+         /* With deduplication, the data is copied into the shared payloads. */
+         if (r == OK && pCtx->useDedup)
+         {
+            r = LoaderRecord(pLoader, pSeg->addr, pSeg->pData, pSeg->len);
+         }
+         else if (r == OK)
+         {
+            r = AppendSegment(&pLoader->run, pSeg);
+            if (r == OK)
+            {
+               continue;
+            }
+         }
+         free(pSeg);
+      }
+   }
+
+   if (pTemp->startAddr != 0)
+   {
+      LoaderStart(pLoader, pTemp->startAddr);
+   }
+
+   RftClose(pTemp);
+   return r;
+}
+
+/**************************************************************************//**
+* Loads one input of a LOAD_JOB into its run.
+*
+* @param[in,out] pLoader The loading of the input.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+static RESULT LoadInputRun(INPUT_LOADER *pLoader)
+{
+   LOAD_JOB *pJob = pLoader->pJob;
+   const RFT_INPUT *pInput = &pJob->pInputs[pLoader->run.input];
+   const FILE_OPTS_BIN *pBinOpts = (const FILE_OPTS_BIN *) pInput->pOpts;
+   RFT_VISITOR visitor;
+   SEGMENT *pSeg;
+   RESULT r;
+
+   if (pInput->xform != 0 || (pJob->pCtx->sortRunLen != 0 && IsTextType(pInput->type)))
+   {
+      return LoadInputPrivate(pLoader);
+   }
+
+   r = ReadFileData(pInput->pName, &pSeg);
+   if (r != OK)
+   {
+      return r;
+   }
+
+   /* Raw binary data is used in place, as LoadSegData() does. */
+   if (pInput->type == FILE_TYPE_BIN && pBinOpts != NULL && pBinOpts->addrSpecified &&
+      pSeg->len && !pJob->pCtx->useDedup)
+   {
+      pSeg->addr = pBinOpts->startAddr;
+      r = AppendSegment(&pLoader->run, pSeg);
+      if (r != OK)
+      {
+         free(pSeg);
+      }
+      return r;
+   }
+
+   visitor.pfnData = LoaderRecord;
+   visitor.pfnStart = LoaderStart;
+   visitor.pUser = pLoader;
+
+   r = RftVisitMem(pInput->type, pInput->pOpts, pSeg->pData, pSeg->len, &visitor);
+   free(pSeg);
+
+   return r;
+}
+
+/**************************************************************************//**
+* Loads one input of a LOAD_JOB into its run, and sorts the run. This is a
+* scheduler task, so the inputs are decoded and sorted in parallel.
+*
+* @param[in,out] pArg The LOAD_JOB.
+* @param[in] i The index of the input.
+*
+* @return None.
+******************************************************************************/
+static void LoadJobInput(void *pArg, U32 i)
+{
+   INPUT_LOADER *pLoader = &((LOAD_JOB *) pArg)->pLoaders[i];
+   RESULT r;
+
+   r = LoadInputRun(pLoader);
+   if (r == OK)
+   {
+      r = SortSegRun(&pLoader->run);
+   }
+
+   pLoader->r = r;
+}
+
+/**************************************************************************//**
+* Makes the calling thread report errors to a context, for the length of an
+* operation on it. A new operation clears the context's last error.
+*
+* @param[in] pCtx The conversion context. Only its last error is changed.
+*
+* @return The context errors were reported to before, for LeaveContext().
+******************************************************************************/
+static RFT_CONTEXT *EnterContext(const RFT_CONTEXT *pCtx)
+{
+   RFT_CONTEXT *pPrev = pReportCtx;
+
+   /* A public function called by another is part of the same operation. */
+   if (pCtx != pPrev)
+   {
+      pReportCtx = (RFT_CONTEXT *) pCtx;
+      pReportCtx->hasError = 0;
+      pReportCtx->lastError[0] = '\0';
+   }
+
+   return pPrev;
+}
+
+/**************************************************************************//**
+* Ends an operation started with EnterContext().
+*
+* @param[in] pPrev The context errors were reported to before.
+* @param[in] r The result of the operation.
+*
+* @return The result of the operation.
+******************************************************************************/
+static RESULT LeaveContext(RFT_CONTEXT *pPrev, RESULT r)
+{
+   pReportCtx = pPrev;
+   return r;
+}
+
+/******************************************************************************
+ Public Function Definitions
+******************************************************************************/
+
+/**************************************************************************//**
+* Creates an empty conversion context.
+*
+* @param[out] ppCtx The new context. Release it with RftClose().
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+RESULT RftOpen(RFT_CONTEXT **ppCtx)
+{
+   *ppCtx = (RFT_CONTEXT *) calloc(1, sizeof(RFT_CONTEXT));
+   if (*ppCtx == NULL)
+   {
+      ReportError("ERROR: Out of memory.\n");
+      return NO_MEMORY;
+   }
+
+   return OK;
+}
+
+/**************************************************************************//**
+* Releases a conversion context, and all the data loaded into it.
+*
+* @param[in] pCtx The context to release, or NULL.
+*
+* @return None.
+******************************************************************************/
+void RftClose(RFT_CONTEXT *pCtx)
+{
+   RANGE *pRange, *pNextRange;
+   SEGMENT *pSeg, *pNextSeg;
+   BLOB *pBlob, *pNextBlob;
+   U32 i;
+
+   if (pCtx == NULL)
+   {
+      return;
+   }
+
+   for (pRange = pCtx->pAllRanges; pRange; pRange = pNextRange)
+   {
+      for (pSeg = pRange->pSegStart; pSeg; pSeg = pNextSeg)
+      {
+         pNextSeg = pSeg->pNext;
+         free(pSeg);
+      }
+
+      pNextRange = pRange->pNext;
+      free(pRange);
+   }
+
+   /* Segments only refer to the shared payloads, which are released last. */
+   for (i = 0; i < pCtx->numBuckets; i++)
+   {
+      for (pBlob = pCtx->ppBlobs[i]; pBlob; pBlob = pNextBlob)
+      {
+         pNextBlob = pBlob->pNext;
+         free(pBlob);
+      }
+   }
+   free(pCtx->ppBlobs);
+
+   free(pCtx);
+}
+
+/**************************************************************************//**
+* Sets the number of threads used to write outputs.
+*
+* @param[in,out] pCtx The conversion context.
+* @param[in] numThreads The number of threads, or 0 to use one per CPU.
+*
+* @return None.
+******************************************************************************/
+void RftSetThreads(RFT_CONTEXT *pCtx, U32 numThreads)
+{
+   pCtx->numThreads = numThreads;
+}
+
+/**************************************************************************//**
+* Sets whether RftWriteFile() writes through a memory mapping of the file.
+*
+* The file is sized up front, and the output is written directly into the
+* mapping, so no stdio buffers are involved.
+*
+* @param[in,out] pCtx The conversion context.
+* @param[in] useMapping Non-zero to write through a memory mapping.
+*
+* @return None.
+******************************************************************************/
+void RftSetMapping(RFT_CONTEXT *pCtx, int useMapping)
+{
+   pCtx->useMapping = useMapping;
+}
+
+/**************************************************************************//**
+* Sets which runs of a fill value are left out of outputs.
+*
+* Ranges are split around each run of the fill value which is at least minRun
+* bytes long, so that erased flash or padding is not written out. This applies
+* to the record based outputs (PAP, WDC, TI-TXT and Tektronix extended hex).
+*
+* @param[in,out] pCtx The conversion context.
+* @param[in] fill The fill value.
+* @param[in] minRun The shortest run to leave out, or 0 to write everything.
+*
+* @return None.
+******************************************************************************/
+void RftSetElision(RFT_CONTEXT *pCtx, U8 fill, U32 minRun)
+{
+   pCtx->elideFill = fill;
+   pCtx->elideMinRun = minRun;
+}
+
+/**************************************************************************//**
+* Sets whether identical segment payloads share memory.
+*
+* Each block loaded afterwards is hashed, and a block whose bytes match one
+* already loaded refers to the same copy. This saves memory when several
+* inputs hold the same library blocks, such as banks or overlays of variants.
+*
+* @param[in,out] pCtx The conversion context.
+* @param[in] useDedup Non-zero to share identical payloads.
+*
+* @return None.
+******************************************************************************/
+void RftSetDedup(RFT_CONTEXT *pCtx, int useDedup)
+{
+   pCtx->useDedup = useDedup;
+   pCtx->run.pInternCtx = useDedup ? pCtx : NULL;
+}
+
+/**************************************************************************//**
+* Sets whether text inputs are loaded with an external sort.
+*
+* Each input's records are sorted into runs of runLen bytes on disk, and then
+* merged by address into the image. This keeps the loading time and memory of
+* heavily out of order inputs bounded, at the cost of writing them to disk.
+*
+* @param[in,out] pCtx The conversion context.
+* @param[in] runLen The size of each sorted run, in bytes, or 0 to load records in place.
+*
+* @return None.
+******************************************************************************/
+void RftSetExternalSort(RFT_CONTEXT *pCtx, U32 runLen)
+{
+   pCtx->sortRunLen = runLen == 0 || runLen >= SORT_REC_LEN ? runLen : SORT_REC_LEN;
+}
+
+/**************************************************************************//**
+* Sets the transforms applied to each input loaded from now on.
+*
+* Each input is transformed on its own before it joins the image, so that, for
+* example, the images of the two ROMs of a 16-bit bus can be loaded back to back
+* and interleaved, while other inputs are loaded as they are.
+*
+* @param[in,out] pCtx The conversion context.
+* @param[in] xform The RFT_XFORM_ transforms, or 0 to load inputs as they are.
+*
+* @return None.
+******************************************************************************/
+void RftSetTransform(RFT_CONTEXT *pCtx, U32 xform)
+{
+   pCtx->xform = xform;
+}
+
+/**************************************************************************//**
+* Applies transforms to the whole image, in place.
+*
+* The transforms are applied in this order: de-interleaving, 16-bit and 32-bit
+* byte swaps, bit reversal, inversion, and interleaving. The kernels run at
+* memory bandwidth, using SSE2 where it is available.
+*
+* @param[in,out] pCtx The conversion context.
+* @param[in] xform The RFT_XFORM_ transforms.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+RESULT RftTransform(RFT_CONTEXT *pCtx, U32 xform)
+{
+   RFT_CONTEXT *pPrev = EnterContext(pCtx);
+
+   return LeaveContext(pPrev, TransformRanges(pCtx, xform));
+}
+
+/**************************************************************************//**
+* Runs a script of crop, fill, poke and crc32 stages over the image.
+*
+* Consecutive stages are fused into one pass over the data wherever a later
+* stage does not depend on a crc32 stored by an earlier one.
+*
+* @param[in,out] pCtx The conversion context.
+* @param[in] pScript The script. See ParseScript() for the commands.
+* @param[out] pNumPasses The number of passes over the data, or NULL.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+RESULT RftRunScript(RFT_CONTEXT *pCtx, const char *pScript, U32 *pNumPasses)
+{
+   RFT_CONTEXT *pPrev = EnterContext(pCtx);
+   STAGE *pStages = NULL;
+   U32 numStages, numPasses;
+   RESULT r;
+
+   r = ParseScript(pCtx, pScript, &pStages, &numStages);
+   if (r != OK)
+   {
+      return LeaveContext(pPrev, r);
+   }
+
+   r = RunScript(pCtx, pStages, numStages, &numPasses);
+   if (pNumPasses != NULL)
+   {
+      *pNumPasses = numPasses;
+   }
+
+   free(pStages);
+   return LeaveContext(pPrev, r);
+}
+
+/**************************************************************************//**
+* Computes the byte statistics of each range: a histogram, the entropy, and the
+* longest run of a single value. The ranges are analyzed in parallel.
+*
+* @param[in] pCtx The conversion context.
+* @param[out] pStats Receives the statistics, an entry per range in address order.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+RESULT RftAnalyze(const RFT_CONTEXT *pCtx, RFT_RANGE_STATS *pStats)
+{
+   RFT_CONTEXT *pPrev = EnterContext(pCtx);
+   ANALYZE_JOB job;
+   const RANGE *pRange;
+   TASK_GROUP group;
+   U32 i, n;
+
+   if (pCtx->numRanges == 0)
+   {
+      return LeaveContext(pPrev, OK);
+   }
+
+   job.ppRanges = (const RANGE **) malloc(pCtx->numRanges * sizeof(RANGE *));
+   if (job.ppRanges == NULL)
+   {
+      ReportError("ERROR: Out of memory.\n");
+      return LeaveContext(pPrev, NO_MEMORY);
+   }
+
+   for (pRange = pCtx->pAllRanges, i = 0; pRange; pRange = pRange->pNext, i++)
+   {
+      job.ppRanges[i] = pRange;
+   }
+   job.pStats = pStats;
+
+   n = GetNumThreads(pCtx->numThreads);
+   if (n > pCtx->numRanges)
+   {
+      n = pCtx->numRanges;
+   }
+
+   /* The ranges are dealt out in order, and idle workers steal the rest. */
+   SchedBegin(&group, TASK_PRIO_ANALYZE, n);
+   for (i = 0; i < pCtx->numRanges; i++)
+   {
+      if (SchedSubmit(&group, (U32) ((U64) i * group.numWorkers / pCtx->numRanges),
+         AnalyzeRange, &job, i) != OK)
+      {
+         AnalyzeRange(&job, i);
+      }
+   }
+
+   SchedWait(&group);
+
+   free((void *) job.ppRanges);
+   return LeaveContext(pPrev, OK);
+}
+
+/**************************************************************************//**
+* Gets the statistics of the shared segment payloads.
+*
+* @param[in] pCtx The conversion context.
+* @param[out] pStats The statistics.
+*
+* @return None.
+******************************************************************************/
+void RftGetDedupStats(const RFT_CONTEXT *pCtx, RFT_DEDUP_STATS *pStats)
+{
+   *pStats = pCtx->dedup;
+}
+
+/**************************************************************************//**
+* Checks whether an input starting with a 'Z' has plausible WDC block headers,
+* so that other binaries starting with a 'Z' (such as 65C02 code starting with
+* PHY) are not mistaken for WDC files.
+*
+* Each block header visible in the buffer is checked: the block must fit in
+* the 24-bit address space and, with room for an end record, within the input.
+* A zero length header must be the end record, at the very end of the input.
+*
+* @param[in] pBuf The start of the input.
+* @param[in] len The number of bytes available.
+* @param[in] fileLen The size of the whole input, in bytes.
+*
+* @return Non-zero if the input looks like a WDC binary.
+******************************************************************************/
+static int IsWdcHeader(const U8 *pBuf, U32 len, U32 fileLen)
+{
+   U32 ofs, addr, blockLen;
+
+   if (len < 7 || pBuf[0] != 'Z')
+   {
+      return 0;
+   }
+
+   for (ofs = 1; ofs + 6 <= len; ofs += 6 + blockLen)
+   {
+      addr = GetLittleEndian(&pBuf[ofs], 3);
+      blockLen = GetLittleEndian(&pBuf[ofs + 3], 3);
+
+      if (blockLen == 0)
+      {
+         return addr == 0 && ofs + 6 == fileLen;
+      }
+
+      if (addr + blockLen > 0x1000000 || blockLen + 12 > fileLen - ofs)
+      {
+         return 0;
+      }
+   }
+
+   return 1;
+}
+
+/**************************************************************************//**
+* Determines the type of an input by inspecting its first few KB.
+*
+* Anything which is not recognized is treated as raw binary.
+*
+* @param[in] pBuf The start of the input.
+* @param[in] len The number of bytes available, which need not be the whole input.
+* @param[in] fileLen The size of the whole input, in bytes.
+* @param[out] pType The type of the input.
+* @param[out] ppDesc If the input cannot be loaded, a description of its format.
+*
+* @return OK, or UNSUPPORTED if the input looks like a format which cannot be loaded.
+******************************************************************************/
+RESULT RftSniff(const U8 *pBuf, U32 len, U32 fileLen, FILE_TYPE *pType, const char **ppDesc)
+{
+   const char *pDesc = NULL;
+   U32 i;
+
+   /* Check for the binary formats identified by a fixed signature. */
+   for (i = 0; i < sizeof(magicSigs) / sizeof(magicSigs[0]); i++)
+   {
+      if (len >= magicSigs[i].len && !memcmp(pBuf, magicSigs[i].pSig, magicSigs[i].len))
+      {
+         pDesc = magicSigs[i].pDesc;
+         break;
+      }
+   }
+
+   /* A WDC binary starts with a 'Z', followed by blocks which each have an address
+   and length. */
+   if (pDesc == NULL && IsWdcHeader(pBuf, len, fileLen))
+   {
+      pDesc = "WDC binary";
+   }
+
+   if (pDesc == NULL)
+   {
+      /* The text formats may be preceded by white space. */
+      for (i = 0; i < len && (pBuf[i] == ' ' || pBuf[i] == '\t' ||
+         pBuf[i] == '\r' || pBuf[i] == '\n'); i++);
+
+      /* Intel HEX: ':' then the byte count, address, record type, and checksum. */
+      if (i < len && pBuf[i] == ':' && CountHexDigits(&pBuf[i + 1], len - i - 1) >= 10)
+      {
+         *pType = FILE_TYPE_HEX;
+         return OK;
+      }
+
+      /* TI-TXT: '@' then the address. */
+      if (i < len && pBuf[i] == '@' && CountHexDigits(&pBuf[i + 1], len - i - 1) >= 1)
+      {
+         *pType = FILE_TYPE_TITXT;
+         return OK;
+      }
+
+      /* Tektronix extended hex: '%' then the record length, type, and checksum. */
+      if (i < len && pBuf[i] == '%' && CountHexDigits(&pBuf[i + 1], len - i - 1) >= 6)
+      {
+         *pType = FILE_TYPE_TEK;
+         return OK;
+      }
+
+      /* Motorola S-record: 'S', the record type, then the byte count and address. */
+      if (i + 1 < len && pBuf[i] == 'S' && pBuf[i + 1] >= '0' && pBuf[i + 1] <= '9' &&
+         CountHexDigits(&pBuf[i + 2], len - i - 2) >= 6)
+      {
+         pDesc = "Motorola S-record";
+      }
+
+      /* MOS paper tape: ';' then the byte count and address. */
+      else if (i < len && pBuf[i] == ';' && CountHexDigits(&pBuf[i + 1], len - i - 1) >= 6)
+      {
+         pDesc = "MOS paper tape";
+      }
+   }
+
+   if (pDesc != NULL)
+   {
+      *ppDesc = pDesc;
+      return UNSUPPORTED;
+   }
+
+   *pType = FILE_TYPE_BIN;
+   return OK;
+}
+
+/**************************************************************************//**
+* Decodes an input held in memory, passing each record to a visitor.
+*
+* No memory is allocated, and raw binary data is passed without being copied,
+* so this may be used to consume an input without building an image. Only
+* the segments of OMF load files are built in memory, one at a time, to be
+* relocated.
+*
+* @param[in] type The type of the input.
+* @param[in] pOpts The file options for this file type.
+* @param[in] pBuf The input's contents.
+* @param[in] len The length of the input, in bytes.
+* @param[in] pVisitor Receives the decoded records.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+RESULT RftVisitMem(FILE_TYPE type, const void *pOpts, const U8 *pBuf, U32 len,
+   const RFT_VISITOR *pVisitor)
+{
+   IN_BUF in;
+
+   in.pCur = pBuf;
+   in.pEnd = pBuf + len;
+   in.pPipe = NULL;
+
+   return VisitInput(type, pOpts, &in, pVisitor);
+}
+
+/**************************************************************************//**
+* Decodes an input file, passing each record to a visitor.
+*
+* @param[in] type The type of the input.
+* @param[in] pOpts The file options for this file type.
+* @param[in] pName The name of the input file.
+* @param[in] pVisitor Receives the decoded records.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+RESULT RftVisitFile(FILE_TYPE type, const void *pOpts, const char *pName,
+   const RFT_VISITOR *pVisitor)
+{
+   SEGMENT *pSeg;
+   RESULT r;
+
+   r = ReadFileData(pName, &pSeg);
+   if (r != OK)
+   {
+      return r;
+   }
+
+   r = RftVisitMem(type, pOpts, pSeg->pData, pSeg->len, pVisitor);
+   free(pSeg);
+
+   return r;
+}
+
+/**************************************************************************//**
+* Loads an input held in memory into a context.
+*
+* @param[in,out] pCtx The conversion context.
+* @param[in] type The type of the input.
+* @param[in] pOpts The file options for this file type.
+* @param[in] pBuf The input's contents.
+* @param[in] len The length of the input, in bytes.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+RESULT RftLoadMem(RFT_CONTEXT *pCtx, FILE_TYPE type, const void *pOpts,
+   const U8 *pBuf, U32 len)
+{
+   RFT_CONTEXT *pPrev = EnterContext(pCtx);
+   RFT_CONTEXT *pTarget;
+   RESULT r;
+
+   r = BeginLoad(pCtx, &pTarget);
+   if (r != OK)
+   {
+      return LeaveContext(pPrev, r);
+   }
+
+   r = EndLoad(pCtx, pTarget, NULL, LoadMem(pTarget, type, pOpts, pBuf, len));
+   return LeaveContext(pPrev, r);
+}
+
+/**************************************************************************//**
+* Loads an input read from a file descriptor into a context.
+*
+* @param[in,out] pCtx The conversion context.
+* @param[in] type The type of the input.
+* @param[in] pOpts The file options for this file type.
+* @param[in] fd The file descriptor to read until its end.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+RESULT RftLoadFd(RFT_CONTEXT *pCtx, FILE_TYPE type, const void *pOpts, int fd)
+{
+   RFT_CONTEXT *pPrev = EnterContext(pCtx);
+   RFT_CONTEXT *pTarget;
+   RESULT r;
+
+   r = BeginLoad(pCtx, &pTarget);
+   if (r != OK)
+   {
+      return LeaveContext(pPrev, r);
+   }
+
+   r = EndLoad(pCtx, pTarget, NULL, LoadFd(pTarget, type, pOpts, fd));
+   return LeaveContext(pPrev, r);
+}
+
+/**************************************************************************//**
+* Loads an input file into a context.
+*
+* @param[in,out] pCtx The conversion context.
+* @param[in] type The type of the input.
+* @param[in] pOpts The file options for this file type.
+* @param[in] pName The name of the input file.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+RESULT RftLoadFile(RFT_CONTEXT *pCtx, FILE_TYPE type, const void *pOpts, const char *pName)
+{
+   RFT_CONTEXT *pPrev = EnterContext(pCtx);
+   RFT_CONTEXT *pTarget;
+   RESULT r;
+
+   r = BeginLoad(pCtx, &pTarget);
+   if (r != OK)
+   {
+      return LeaveContext(pPrev, r);
+   }
+
+   r = EndLoad(pCtx, pTarget, pName, LoadFile(pTarget, type, pOpts, pName));
+   return LeaveContext(pPrev, r);
+}
+
+/**************************************************************************//**
+* Loads several input files into a context at once.
+*
+* Each input is loaded by a scheduler task, which decodes it into a run of
+* segments of its own, and sorts the run by address. Once all the inputs are
+* loaded, the runs are merged into the image with a k-way merge, by address and
+* then by input order, which finds any overlaps and joins adjacent segments.
+* So the image, and any overlap reported, is the same whatever the number of
+* threads. A single input is loaded as RftLoadFile() does, so that a text input
+* is still pipelined.
+*
+* @param[in,out] pCtx The conversion context.
+* @param[in] pInputs The inputs, in order.
+* @param[in] numInputs The number of inputs.
+*
+* @return An RESULT indicating success or failure. On failure, no data is added to the image.
+******************************************************************************/
+RESULT RftLoadFiles(RFT_CONTEXT *pCtx, const RFT_INPUT *pInputs, U32 numInputs)
+{
+   RFT_CONTEXT *pPrev = EnterContext(pCtx);
+   SEG_RUN **ppRuns = NULL;
+   U32 xform = pCtx->xform, i, n;
+   LOAD_JOB job;
+   TASK_GROUP group;
+   RESULT r = OK;
+
+   if (numInputs == 1)
+   {
+      pCtx->xform = pInputs[0].xform;
+      r = RftLoadFile(pCtx, pInputs[0].type, pInputs[0].pOpts, pInputs[0].pName);
+      pCtx->xform = xform;
+      return LeaveContext(pPrev, r);
+   }
+
+   job.pCtx = pCtx;
+   job.pInputs = pInputs;
+   job.internLock = 0;
+   job.pLoaders = (INPUT_LOADER *) calloc(numInputs ? numInputs : 1, sizeof(INPUT_LOADER));
+   ppRuns = (SEG_RUN **) malloc((numInputs ? numInputs : 1) * sizeof(SEG_RUN *));
+   if (job.pLoaders == NULL || ppRuns == NULL)
+   {
+      ReportError("ERROR: Out of memory.\n");
+      free(job.pLoaders);
+      free(ppRuns);
+      return LeaveContext(pPrev, NO_MEMORY);
+   }
+
+   n = GetNumThreads(pCtx->numThreads);
+   if (n > numInputs)
+   {
+      n = numInputs ? numInputs : 1;
+   }
+
+   /* The inputs are dealt out in order, and idle workers steal the rest. */
+   for (i = 0; i < numInputs; i++)
+   {
+      job.pLoaders[i].pJob = &job;
+      job.pLoaders[i].run.input = i;
+      ppRuns[i] = &job.pLoaders[i].run;
+
+      /* The shared payloads are one table for the whole context. */
+      if (pCtx->useDedup)
+      {
+         job.pLoaders[i].run.pInternCtx = pCtx;
+         job.pLoaders[i].run.pInternLock = &job.internLock;
+      }
+   }
+
+   SchedBegin(&group, TASK_PRIO_LOAD, n);
+   for (i = 0; i < numInputs; i++)
+   {
+      if (SchedSubmit(&group, (U32) ((U64) i * group.numWorkers / numInputs),
+         LoadJobInput, &job, i) != OK)
+      {
+         LoadJobInput(&job, i);
+      }
+   }
+
+   SchedWait(&group);
+
+   /* The first input which failed decides the result, whichever finished first. */
+   for (i = 0; i < numInputs && r == OK; i++)
+   {
+      r = job.pLoaders[i].r;
+   }
+
+   if (r == OK)
+   {
+      r = MergeSegRuns(pCtx, ppRuns, numInputs, pInputs);
+   }
+
+   /* The last input with a starting address sets it, as when loading them one at a time. */
+   for (i = 0; i < numInputs && r == OK; i++)
+   {
+      if (job.pLoaders[i].hasStart)
+      {
+         pCtx->startAddr = job.pLoaders[i].startAddr;
+      }
+   }
+
+   for (i = 0; i < numInputs; i++)
+   {
+      FreeSegRun(&job.pLoaders[i].run, r != OK);
+   }
+   free(ppRuns);
+   free(job.pLoaders);
+
+   return LeaveContext(pPrev, r);
+}
+
+/**************************************************************************//**
+* Gets the first range loaded into a context.
+*
+* @param[in] pCtx The conversion context.
+*
+* @return The first range, in address order, or NULL. Follow pNext for the others.
+******************************************************************************/
+const RANGE *RftGetRanges(const RFT_CONTEXT *pCtx)
+{
+   return pCtx->pAllRanges;
+}
+
+/**************************************************************************//**
+* Gets a range's data as one contiguous block.
+*
+* A range which was built from several segments is first merged into a single
+* segment, so the data is copied at most once per range. Merging invalidates
+* any output plans made before it.
+*
+* @param[in] pRange A range of a context.
+* @param[out] ppData The range's data, which stays valid until the range is
+*    changed by a later load, or the context is closed.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+RESULT RftGetRangeData(const RANGE *pRange, const U8 **ppData)
+{
+   RANGE *pMut = (RANGE *) pRange;
+   SEGMENT *pSeg, *pNext, *pMerged;
+   U32 ofs = 0;
+
+   if (pMut->pSegStart != pMut->pSegEnd)
+   {
+      pMerged = AllocSegment(pMut->len);
+      if (pMerged == NULL)
+      {
+         ReportError("ERROR: Out of memory.\n");
+         return NO_MEMORY;
+      }
+
+      pMerged->addr = pMut->addr;
+
+      for (pSeg = pMut->pSegStart; pSeg; pSeg = pNext)
+      {
+         memcpy(&pMerged->pData[ofs], pSeg->pData, pSeg->len);
+         ofs += pSeg->len;
+         pNext = pSeg->pNext;
+         free(pSeg);
+      }
+
+      pMut->pSegStart = pMerged;
+      pMut->pSegEnd = pMerged;
+   }
+
+   *ppData = pMut->pSegStart->pData;
+   return OK;
+}
+
+/**************************************************************************//**
+* Gets the number of ranges loaded into a context.
+*
+* @param[in] pCtx The conversion context.
+*
+* @return The number of ranges.
+******************************************************************************/
+U32 RftGetNumRanges(const RFT_CONTEXT *pCtx)
+{
+   return pCtx->numRanges;
+}
+
+/**************************************************************************//**
+* Gets the number of data bytes loaded into a context.
+*
+* @param[in] pCtx The conversion context.
+*
+* @return The number of data bytes.
+******************************************************************************/
+U32 RftGetDataBytes(const RFT_CONTEXT *pCtx)
+{
+   return pCtx->dataBytes;
+}
+
+/**************************************************************************//**
+* Gets the program's execution starting address.
+*
+* @param[in] pCtx The conversion context.
+*
+* @return The starting address, or 0 if none was loaded.
+******************************************************************************/
+U32 RftGetStartAddr(const RFT_CONTEXT *pCtx)
+{
+   return pCtx->startAddr;
+}
+
+/**************************************************************************//**
+* Gets the first error reported by the last operation on a context, such as a
+* load or a write, which is also printed as it happens.
+*
+* @param[in] pCtx The conversion context.
+*
+* @return The error message, without the "ERROR: " prefix or a new line, or an
+*    empty string if the last operation reported no error.
+******************************************************************************/
+const char *RftGetLastError(const RFT_CONTEXT *pCtx)
+{
+   return pCtx->lastError;
+}
+
+/**************************************************************************//**
+* Gets a description of a file format.
+*
+* @param[in] type The file type.
+*
+* @return The description.
+******************************************************************************/
+const char *RftGetFormatDesc(FILE_TYPE type)
+{
+   const FORMAT_CAPS *pCaps;
+
+   switch (type)
+   {
+      case FILE_TYPE_HEX:
+         return "Intel HEX";
+
+      case FILE_TYPE_BIN:
+         return "raw binary";
+
+      case FILE_TYPE_OMF:
+         return "Apple IIgs OMF";
+
+      default:
+         pCaps = GetFormatCaps(type);
+         return pCaps ? pCaps->pDesc : "unknown";
+   }
+}
+
+/**************************************************************************//**
+* Checks the loaded data against the limits of an output format, and plans
+* the output.
+*
+* @param[in] pCtx The conversion context.
+* @param[in] type The type of the output.
+* @param[in] pOpts The file options for this file type.
+* @param[out] pPlan The computed plan. Release it with RftFreePlan(), even on failure.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+RESULT RftPlanOutput(RFT_CONTEXT *pCtx, FILE_TYPE type, const void *pOpts, OUTPUT_PLAN *pPlan)
+{
+   RFT_CONTEXT *pPrev = EnterContext(pCtx);
+   RFT_CONTEXT full;
+   OUTPUT_PLAN fullPlan;
+   RESULT r;
+
+   memset(pPlan, 0, sizeof(*pPlan));
+
+   /* Make sure the output format can hold the data before doing anything else. */
+   r = CheckFormatLimits(pCtx, type);
+   if (r != OK)
+   {
+      return LeaveContext(pPrev, r);
+   }
+
+   r = PlanOutput(pCtx, type, pOpts, pPlan);
+   if (r != OK || pPlan->elidedRuns == 0)
+   {
+      return LeaveContext(pPrev, r);
+   }
+
+   /* Plan the output again without elision, to find how much it saved. */
+   full = *pCtx;
+   full.elideMinRun = 0;
+   r = PlanOutput(&full, type, pOpts, &fullPlan);
+   if (r == OK)
+   {
+      pPlan->savedLen = fullPlan.outLen - pPlan->outLen;
+   }
+   RftFreePlan(&fullPlan);
+
+   return LeaveContext(pPrev, r);
+}
+
+/**************************************************************************//**
+* Releases the memory held by an output plan.
+*
+* @param[in] pPlan The plan to release.
+*
+* @return None.
+******************************************************************************/
+void RftFreePlan(OUTPUT_PLAN *pPlan)
+{
+   free(pPlan->pRangeOfs);
+   free(pPlan->pChunks);
+   free(pPlan->pWords);
+   memset(pPlan, 0, sizeof(*pPlan));
+}
+
+/**************************************************************************//**
+* Writes an output into a caller-provided buffer.
+*
+* @param[in] pCtx The conversion context.
+* @param[in] type The type of the output.
+* @param[in] pOpts The file options for this file type.
+* @param[in] pPlan The plan of the output, or NULL to plan it first.
+* @param[out] pBuf Where to write the output.
+* @param[in] bufLen The size of the buffer, in bytes.
+* @param[out] pOutLen The size of the output, in bytes.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+RESULT RftWriteMem(RFT_CONTEXT *pCtx, FILE_TYPE type, const void *pOpts,
+   const OUTPUT_PLAN *pPlan, U8 *pBuf, U32 bufLen, U32 *pOutLen)
+{
+   RFT_CONTEXT *pPrev = EnterContext(pCtx);
+   OUTPUT_PLAN plan;
+   RESULT r;
+
+   if (pPlan == NULL)
+   {
+      r = RftPlanOutput(pCtx, type, pOpts, &plan);
+      if (r == OK)
+      {
+         r = RftWriteMem(pCtx, type, pOpts, &plan, pBuf, bufLen, pOutLen);
+      }
+
+      RftFreePlan(&plan);
+      return LeaveContext(pPrev, r);
+   }
+
+   *pOutLen = pPlan->outLen;
+   if (bufLen < pPlan->outLen)
+   {
+      return LeaveContext(pPrev, BUFFER_TOO_SMALL);
+   }
+
+   RenderOutput(pCtx, type, pBuf, pPlan);
+
+   return LeaveContext(pPrev, OK);
+}
+
+/**************************************************************************//**
+* Writes an output to a file descriptor.
+*
+* @param[in] pCtx The conversion context.
+* @param[in] type The type of the output.
+* @param[in] pOpts The file options for this file type.
+* @param[in] pPlan The plan of the output, or NULL to plan it first.
+* @param[in] fd The file descriptor to write to.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+RESULT RftWriteFd(RFT_CONTEXT *pCtx, FILE_TYPE type, const void *pOpts,
+   const OUTPUT_PLAN *pPlan, int fd)
+{
+   RFT_CONTEXT *pPrev = EnterContext(pCtx);
+   OUTPUT_PLAN plan;
+   RESULT r;
+   U8 *pOut;
+
+   if (pPlan == NULL)
+   {
+      r = RftPlanOutput(pCtx, type, pOpts, &plan);
+      if (r == OK)
+      {
+         r = RftWriteFd(pCtx, type, pOpts, &plan, fd);
+      }
+
+      RftFreePlan(&plan);
+      return LeaveContext(pPrev, r);
+   }
+
+   /* NES and C64 cartridge files are mostly the data itself, so they are written straight
+   from the segments. */
+   if (IsGatheredType(type))
+   {
+      return LeaveContext(pPrev, WriteGathered(type, fd, pPlan));
+   }
+
+   /* Build the whole output in memory, and write it in one go. */
+   pOut = (U8 *) malloc(pPlan->outLen);
+   if (pOut == NULL)
+   {
+      ReportError("ERROR: Out of memory.\n");
+      return LeaveContext(pPrev, NO_MEMORY);
+   }
+
+   RenderOutput(pCtx, type, pOut, pPlan);
+   r = WriteFdData(fd, pOut, pPlan->outLen);
+   free(pOut);
+
+   return LeaveContext(pPrev, r);
+}
+
+/**************************************************************************//**
+* Writes an output file, or publishes a shared memory object.
+*
+* The file is written to a temporary file beside it, which only replaces it
+* once it is complete, so a failed write leaves any earlier file alone.
+* Devices, pipes and links are written in place instead.
+*
+* @param[in] pCtx The conversion context.
+* @param[in] type The type of the output.
+* @param[in] pOpts The file options for this file type.
+* @param[in] pPlan The plan of the output, or NULL to plan it first.
+* @param[in] pName The name of the output file, or of the shared memory object.
+*
+* @return An RESULT indicating success or failure.
+******************************************************************************/
+RESULT RftWriteFile(RFT_CONTEXT *pCtx, FILE_TYPE type, const void *pOpts,
+   const OUTPUT_PLAN *pPlan, const char *pName)
+{
+   RFT_CONTEXT *pPrev = EnterContext(pCtx);
+   const char *pWriteName = pName;
+   char *pTempName = NULL;
+   OUTPUT_PLAN plan;
+   struct stat st;
+   FILE *outFile;
+   int exists;
+   U8 *pOut;
+   RESULT r;
+
+   if (pPlan == NULL)
+   {
+      r = RftPlanOutput(pCtx, type, pOpts, &plan);
+      if (r == OK)
+      {
+         r = RftWriteFile(pCtx, type, pOpts, &plan, pName);
+      }
+
+      RftFreePlan(&plan);
+      return LeaveContext(pPrev, r);
+   }
+
+   /* Shared memory outputs are not files. */
+   if (type == FILE_TYPE_SHM)
+   {
+      return LeaveContext(pPrev, PublishShm(pCtx, pName, pPlan));
+   }
+
+#ifdef _WIN32
+   exists = (stat(pName, &st) == 0);
+#else
+   exists = (lstat(pName, &st) == 0);
+#endif
+
+   /* When no temporary file can be made beside the output, such as in a directory
+   which cannot be written to, the output is written in place too. */
+   if (!exists || S_ISREG(st.st_mode))
+   {
+      pTempName = CreateTempOutput(pName);
+      if (pTempName != NULL)
+      {
+         pWriteName = pTempName;
+      }
+   }
+
+   /* Only a temporary file is mapped, as devices and pipes cannot be. */
+   if (pCtx->useMapping && pTempName != NULL)
+   {
+      r = WriteMappedFile(pCtx, type, pWriteName, pPlan);
+   }
+   else if (IsGatheredType(type))
+   {
+      /* NES and C64 cartridge files are mostly the data itself, so they are written straight
+      from the segments. */
+      outFile = fopen(pWriteName, "wb");
+      if (!outFile)
+      {
+         ReportError("Unable to open the output file \"%s\".\n", pName);
+         r = CANNOT_OPEN_FILE;
+      }
+      else
+      {
+         r = PreallocateFile(fileno(outFile), pPlan->outLen);
+         if (r == OK)
+         {
+            r = WriteGathered(type, fileno(outFile), pPlan);
+         }
+
+         if (fclose(outFile) != 0 && r == OK)
+         {
+            ReportError("Error writing output file.\n");
+            r = IO_ERROR;
+         }
+      }
+   }
+   else
+   {
+      /* Build the whole file in memory, and write it in one go. */
+      pOut = (U8 *) malloc(pPlan->outLen);
+      if (pOut == NULL)
+      {
+         ReportError("ERROR: Out of memory.\n");
+         r = NO_MEMORY;
+      }
+      else
+      {
+         RenderOutput(pCtx, type, pOut, pPlan);
+
+         outFile = fopen(pWriteName, "w+b");
+         if (!outFile)
+         {
+            ReportError("Unable to open the output file \"%s\".\n", pName);
+            r = CANNOT_OPEN_FILE;
+         }
+         else
+         {
+            r = PreallocateFile(fileno(outFile), pPlan->outLen);
+            if (r == OK && !fwrite(pOut, pPlan->outLen, 1, outFile))
+            {
+               ReportError("Error writing output file.\n");
+               r = IO_ERROR;
+            }
+
+            if (fclose(outFile) != 0 && r == OK)
+            {
+               ReportError("Error writing output file.\n");
+               r = IO_ERROR;
+            }
+         }
+
+         free(pOut);
+      }
+   }
+
+   /* Only the temporary file is ever removed, never a file which was already there. */
+   if (pTempName != NULL)
+   {
+      if (r == OK)
+      {
+         r = ReplaceOutput(pTempName, pName, exists ? &st : NULL);
+      }
+
+      if (r != OK)
+      {
+         remove(pTempName);
+      }
+
+      free(pTempName);
+   }
+
+   return LeaveContext(pPrev, r);
+}
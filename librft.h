@@ -0,0 +1,563 @@
+/*********************************************************************//** @file
+The RetroFileTool library (librft), for loading and writing retro file formats.
+
+Typical use:
+
+   RFT_CONTEXT *pCtx;
+   RftOpen(&pCtx);
+   RftLoadFile(pCtx, FILE_TYPE_HEX, NULL, "in.hex");
+   RftWriteFile(pCtx, FILE_TYPE_WDC, NULL, NULL, "out.wdc.bin");
+   RftClose(pCtx);
+
+Every function which can fail returns a RESULT, and describes the failure on
+stdout. Inputs may be given as a path, a file descriptor, or a memory buffer,
+and outputs may be written to a path, a file descriptor, or a caller-provided
+buffer. To consume an input without building an image at all, use
+RftVisitMem() or RftVisitFile(), which pass each decoded record to a callback.
+******************************************************************************/
+
+#ifndef LIBRFT_H
+#define LIBRFT_H
+
+/******************************************************************************
+ Defines
+******************************************************************************/
+
+/** The maximum number of bytes in each PAP record. */
+#define PAP_REC_LEN                                               24
+
+/** The address space of a shared memory image for 16-bit address buses. */
+#define SHM_SPACE_64K                                             0x10000
+
+/** The address space of a shared memory image for 24-bit address buses. */
+#define SHM_SPACE_16M                                             0x1000000
+
+/** Swaps the bytes of each 16-bit word. */
+#define RFT_XFORM_SWAP16                                          0x01
+
+/** Reverses the bytes of each 32-bit word. */
+#define RFT_XFORM_SWAP32                                          0x02
+
+/** Inverts every bit. */
+#define RFT_XFORM_INVERT                                          0x04
+
+/** Reverses the order of the bits of each byte. */
+#define RFT_XFORM_BITREV                                          0x08
+
+/** Interleaves the two halves of each range, the first half in the even bytes. */
+#define RFT_XFORM_INTERLEAVE                                      0x10
+
+/** Splits each range into its even bytes followed by its odd bytes. */
+#define RFT_XFORM_DEINTERLEAVE                                    0x20
+
+/******************************************************************************
+ Typedefs and Enums
+******************************************************************************/
+
+/** An unsigned 32-bit integer. Change this to match your platform. */
+typedef unsigned int    U32;
+
+/** An unsigned 16-bit integer. Change this to match your platform. */
+typedef unsigned short  U16;
+
+/** An unsigned 8-bit integer. Change this to match your platform. */
+typedef unsigned char   U8;
+
+/** The different file types supported. */
+typedef enum
+{
+   FILE_TYPE_HEX,
+   FILE_TYPE_BIN,
+   FILE_TYPE_WDC,
+   FILE_TYPE_PAP,
+   FILE_TYPE_SHM,
+   FILE_TYPE_MEMH,
+   FILE_TYPE_MIF,
+   FILE_TYPE_COE,
+   FILE_TYPE_TITXT,
+   FILE_TYPE_TEK,
+   FILE_TYPE_DUMP,
+   FILE_TYPE_NES,
+   FILE_TYPE_CRT,
+   FILE_TYPE_OMF,
+
+} FILE_TYPE;
+
+/** The different error codes for the return values. */
+typedef enum
+{
+   OK                      = 0,
+   USAGE_SHOWN,
+   UNSUPPORTED,
+   INVALID_ARGUMENTS,
+   CANNOT_OPEN_FILE,
+   END_OF_FILE,
+   IO_ERROR,
+   INVALID_DATA,
+   MIXED_ADDRESSING_MODES,
+   INVALID_RECORD_TYPE,
+   END_RECORD_ERROR,
+   CHECKSUM_ERROR,
+   NO_MEMORY,
+   OVERLAPPING_SEGMENT,
+   ADDR_OUT_OF_RANGE,
+   LEN_OUT_OF_RANGE,
+   BUFFER_TOO_SMALL,
+
+} RESULT;
+
+/** File options for the raw binary file type. */
+typedef struct _FILE_OPTS_BIN_ FILE_OPTS_BIN;
+struct _FILE_OPTS_BIN_
+{
+   /** The starting address of the binary file. */
+   U32                     startAddr;
+
+   /** Whether or not the address was specified. */
+   int                     addrSpecified;
+};
+
+/** File options for the Apple IIgs OMF load file input type. */
+typedef struct _FILE_OPTS_OMF_ FILE_OPTS_OMF;
+struct _FILE_OPTS_OMF_
+{
+   /** Where the relocatable segments are loaded, from the first one on. */
+   U32                     loadAddr;
+
+   /** Whether or not the load address was specified, or else bank 2 is used. */
+   int                     addrSpecified;
+};
+
+/** File options for the Intel HEX output type. */
+typedef struct _FILE_OPTS_HEX_ FILE_OPTS_HEX;
+struct _FILE_OPTS_HEX_
+{
+   /** The number of data bytes in each record, up to 255, or 0 for 16. */
+   U32                     recLen;
+};
+
+/** File options for the shared memory output type. */
+typedef struct _FILE_OPTS_SHM_ FILE_OPTS_SHM;
+struct _FILE_OPTS_SHM_
+{
+   /** The size of the flat address space, or 0 to choose it from the data. */
+   U32                     addrSpace;
+};
+
+/** File options for the memory initialization output types ($readmemh, MIF and COE). */
+typedef struct _FILE_OPTS_MEM_ FILE_OPTS_MEM;
+struct _FILE_OPTS_MEM_
+{
+   /** The width of each word, in bits: 8, 16, 32 or 64. 0 means 8. */
+   U32                     wordBits;
+
+   /** The number of words, or 0 to fit the data. */
+   U32                     depth;
+
+   /** The address which maps to the first byte of the first word. */
+   U32                     baseAddr;
+
+   /** The value of the bytes which hold no data. */
+   U8                      pad;
+
+   /** The byte lane to write, for memories which hold every numLanes-th byte. */
+   U32                     lane;
+
+   /** The number of byte lanes, or 0 for a memory which holds every byte. */
+   U32                     numLanes;
+
+   /** Whether the first byte of each word is its most significant byte. */
+   int                     bigEndian;
+};
+
+/** File options for the hexdump output type. */
+typedef struct _FILE_OPTS_DUMP_ FILE_OPTS_DUMP;
+struct _FILE_OPTS_DUMP_
+{
+   /** Whether a run of identical lines is written as its first line and a "*". */
+   int                     squeeze;
+};
+
+/** File options for the iNES and NES 2.0 output type. */
+typedef struct _FILE_OPTS_NES_ FILE_OPTS_NES;
+struct _FILE_OPTS_NES_
+{
+   /** The address of the first byte of PRG ROM. */
+   U32                     prgAddr;
+
+   /** Whether prgAddr was specified, rather than the lowest address loaded. */
+   int                     prgAddrSpecified;
+
+   /** The size of PRG ROM, in bytes: a multiple of 16 KB, or 0 to fit the data. */
+   U32                     prgLen;
+
+   /** The address of the first byte of CHR ROM. */
+   U32                     chrAddr;
+
+   /** Whether there is CHR ROM at chrAddr, rather than CHR RAM on the cartridge. */
+   int                     hasChr;
+
+   /** The size of CHR ROM, in bytes: a multiple of 8 KB, or 0 to fit the data. */
+   U32                     chrLen;
+
+   /** The mapper number: up to 255, or up to 4095 with an NES 2.0 header. */
+   U32                     mapper;
+
+   /** The submapper number, up to 15, for NES 2.0 headers. */
+   U32                     subMapper;
+
+   /** Whether the nametables are mirrored vertically, rather than horizontally. */
+   int                     vertical;
+
+   /** Whether the cartridge provides four-screen nametable memory. */
+   int                     fourScreen;
+
+   /** Whether the cartridge has battery-backed PRG RAM. */
+   int                     battery;
+
+   /** Whether to write an NES 2.0 header, rather than an iNES one. */
+   int                     nes2;
+
+   /** The value of the bytes of each ROM which hold no data. */
+   U8                      pad;
+};
+
+/**
+* File options for the C64 cartridge (CRT) output type.
+*
+* Bits 16 and up of each address are the bank, and the rest the address the
+* bank's chip is seen at: $8000 - $9FFF (ROML), $A000 - $BFFF (ROMH) or
+* $E000 - $FFFF (ROMH in Ultimax mode).
+*/
+typedef struct _FILE_OPTS_CRT_ FILE_OPTS_CRT;
+struct _FILE_OPTS_CRT_
+{
+   /** The hardware type, such as 0 for a generic cartridge or 32 for EasyFlash. */
+   U32                     hwType;
+
+   /** The name of the cartridge, of up to 32 characters, or NULL. */
+   const char              *pName;
+
+   /** Whether exrom and game were specified, rather than chosen from the chips loaded. */
+   int                     linesSpecified;
+
+   /** The level of the EXROM line: 0 is low, which is active. */
+   U32                     exrom;
+
+   /** The level of the GAME line: 0 is low, which is active. */
+   U32                     game;
+
+   /** Whether $8000 - $BFFF of each bank is one 16 KB chip, rather than two 8 KB chips. */
+   int                     chip16K;
+
+   /** The type of every chip: 0 for ROM, 1 for RAM, or 2 for flash. */
+   U32                     chipType;
+
+   /** The value of the bytes of each chip which hold no data. */
+   U8                      pad;
+};
+
+/** Describes a single contiguous region of memory. */
+typedef struct _SEGMENT_ SEGMENT;
+struct _SEGMENT_
+{
+   /** The starting address of the segment. */
+   U32                     addr;
+
+   /** The length of the segment, in bytes. */
+   U32                     len;
+
+   /** The next segment is adjacent to this one. */
+   SEGMENT*                pNext;
+
+   /** The actual segment data, which may be shared with identical segments. */
+   U8                      *pData;
+};
+
+/** A collection of SEGMENTS which make up a contiguous range in memory. */
+typedef struct _RANGE_ RANGE;
+struct _RANGE_
+{
+   /** The starting address of the range. */
+   U32                     addr;
+
+   /** The length of the range, in bytes. */
+   U32                     len;
+
+   /** The first segment in this range. */
+   SEGMENT                 *pSegStart;
+
+   /** The last segment in this range. */
+   SEGMENT                 *pSegEnd;
+
+   /** The next range, which is not necessarily adjacent. */
+   RANGE                   *pNext;
+};
+
+/**
+* Describes where everything goes in an output file.
+*
+* The plan is computed before the output file is opened, so any data which
+* cannot be represented in the output format is reported before anything is
+* written, and so the output can be preallocated and written in parallel.
+*/
+typedef struct _OUTPUT_PLAN_ OUTPUT_PLAN;
+struct _OUTPUT_PLAN_
+{
+   /** The offset in the output where each range's output starts, in range order. */
+   U32                     *pRangeOfs;
+
+   /** The chunks, in address order. These are private to the library. */
+   struct _OUT_CHUNK_      *pChunks;
+
+   /** The number of chunks. */
+   U32                     numChunks;
+
+   /** The number of data records in the output file, for formats which have them. Address,
+   start and end records are not counted. */
+   U32                     numRecords;
+
+   /** The total size of the output file, in bytes. */
+   U32                     outLen;
+
+   /** The size of the flat address space, for shared memory outputs. */
+   U32                     addrSpace;
+
+   /** The resolved options, for memory initialization outputs. */
+   FILE_OPTS_MEM           mem;
+
+   /** The resolved options, with the size of each ROM, for NES outputs. */
+   FILE_OPTS_NES           nes;
+
+   /** The resolved options, with the EXROM and GAME lines, for C64 cartridge outputs. */
+   FILE_OPTS_CRT           crt;
+
+   /** The words of a memory initialization output, in order. Private to the library. */
+   U8                      *pWords;
+
+   /** The length of each line, for memory initialization outputs. */
+   U32                     lineLen;
+
+   /** The offset of the first line, for memory initialization outputs. */
+   U32                     linesOfs;
+
+   /** The number of hex digits in each address, for Tektronix extended hex outputs. */
+   U32                     addrDigits;
+
+   /** The number of data bytes in each full record, for Intel HEX outputs. */
+   U32                     recLen;
+
+   /** The number of fill bytes left out of the output. */
+   U32                     elidedBytes;
+
+   /** The number of runs of fill bytes left out of the output. */
+   U32                     elidedRuns;
+
+   /** The number of output bytes saved by leaving out the fill bytes. */
+   U32                     savedLen;
+};
+
+/**
+* Receives the records decoded from an input, instead of building an image.
+*
+* The data passed to pfnData is only valid during the call. Returning anything
+* but OK from a callback stops decoding, and that result is returned.
+*/
+typedef struct _RFT_VISITOR_ RFT_VISITOR;
+struct _RFT_VISITOR_
+{
+   /** Called with each block of data, in file order. */
+   RESULT                  (*pfnData)(void *pUser, U32 addr, const U8 *pData, U32 len);
+
+   /** Called with the program's execution starting address, or NULL to ignore it. */
+   RESULT                  (*pfnStart)(void *pUser, U32 addr);
+
+   /** Passed to each callback. */
+   void                    *pUser;
+};
+
+/** An input file loaded by RftLoadFiles(). */
+typedef struct _RFT_INPUT_ RFT_INPUT;
+struct _RFT_INPUT_
+{
+   /** The type of the input. */
+   FILE_TYPE               type;
+
+   /** The file options for this file type. */
+   const void              *pOpts;
+
+   /** The name of the input file. */
+   const char              *pName;
+
+   /** The RFT_XFORM_ transforms applied to this input as it is loaded, or 0. */
+   U32                     xform;
+};
+
+/** Statistics of the segment payloads shared by deduplication. */
+typedef struct _RFT_DEDUP_STATS_ RFT_DEDUP_STATS;
+struct _RFT_DEDUP_STATS_
+{
+   /** The number of distinct payloads stored. */
+   U32                     numBlobs;
+
+   /** The number of bytes in the distinct payloads. */
+   U32                     blobBytes;
+
+   /** The number of segments which share a payload stored before them. */
+   U32                     numShared;
+
+   /** The number of bytes which did not need to be stored again. */
+   U32                     savedBytes;
+
+   /** The number of payloads whose hash matched, but whose bytes did not. */
+   U32                     numCollisions;
+};
+
+/** Statistics of the bytes of one range, from RftAnalyze(). */
+typedef struct _RFT_RANGE_STATS_ RFT_RANGE_STATS;
+struct _RFT_RANGE_STATS_
+{
+   /** The starting address of the range. */
+   U32                     addr;
+
+   /** The length of the range, in bytes. */
+   U32                     len;
+
+   /** The number of times each byte value occurs, including 0x00 and 0xFF. */
+   U32                     counts[256];
+
+   /** The Shannon entropy of the bytes, in bits per byte, from 0 to 8. */
+   double                  entropy;
+
+   /** The address of the longest run of a single value. */
+   U32                     runAddr;
+
+   /** The length of the longest run of a single value, in bytes. */
+   U32                     runLen;
+
+   /** The value of the longest run. */
+   U8                      runValue;
+};
+
+/** A conversion context, holding the image built from all the inputs loaded. */
+typedef struct _RFT_CONTEXT_ RFT_CONTEXT;
+
+/******************************************************************************
+ Public Function Declarations
+******************************************************************************/
+
+/** Creates an empty conversion context. */
+RESULT RftOpen(RFT_CONTEXT **ppCtx);
+
+/** Releases a conversion context, and all the data loaded into it. */
+void RftClose(RFT_CONTEXT *pCtx);
+
+/** Sets the number of threads used to load, analyse and write, or 0 for one per CPU. The
+threads come from one pool shared by every context, which keeps the most threads any
+context has asked for. */
+void RftSetThreads(RFT_CONTEXT *pCtx, U32 numThreads);
+
+/** Sets whether RftWriteFile() writes through a memory mapping of the file. */
+void RftSetMapping(RFT_CONTEXT *pCtx, int useMapping);
+
+/** Sets the shortest run of a fill value which is left out of outputs, splitting
+the ranges around it. A minRun of 0 writes everything. */
+void RftSetElision(RFT_CONTEXT *pCtx, U8 fill, U32 minRun);
+
+/** Sets whether identical segment payloads loaded afterwards share memory. */
+void RftSetDedup(RFT_CONTEXT *pCtx, int useDedup);
+
+/** Sets the size of the sorted runs used to load text inputs with an external
+sort, for huge out of order inputs, or 0 to load records in place. */
+void RftSetExternalSort(RFT_CONTEXT *pCtx, U32 runLen);
+
+/** Sets the RFT_XFORM_ transforms applied to each input loaded from now on, or 0. */
+void RftSetTransform(RFT_CONTEXT *pCtx, U32 xform);
+
+/** Applies RFT_XFORM_ transforms to the whole image, in place. */
+RESULT RftTransform(RFT_CONTEXT *pCtx, U32 xform);
+
+/** Runs a script of crop, fill, poke and crc32 stages over the image, fusing them
+into as few passes over the data as it can. */
+RESULT RftRunScript(RFT_CONTEXT *pCtx, const char *pScript, U32 *pNumPasses);
+
+/** Gets the statistics of the shared segment payloads. */
+void RftGetDedupStats(const RFT_CONTEXT *pCtx, RFT_DEDUP_STATS *pStats);
+
+/** Computes the byte statistics of each range, into an array of RftGetNumRanges() entries. */
+RESULT RftAnalyze(const RFT_CONTEXT *pCtx, RFT_RANGE_STATS *pStats);
+
+/** Determines the type of an input of fileLen bytes from its first len bytes (a few KB
+is enough). If it looks like a format which cannot be loaded, UNSUPPORTED is returned
+and *ppDesc describes it. */
+RESULT RftSniff(const U8 *pBuf, U32 len, U32 fileLen, FILE_TYPE *pType, const char **ppDesc);
+
+/** Loads an input held in memory into the context. */
+RESULT RftLoadMem(RFT_CONTEXT *pCtx, FILE_TYPE type, const void *pOpts,
+   const U8 *pBuf, U32 len);
+
+/** Loads an input read from a file descriptor into the context. */
+RESULT RftLoadFd(RFT_CONTEXT *pCtx, FILE_TYPE type, const void *pOpts, int fd);
+
+/** Loads an input file into the context. */
+RESULT RftLoadFile(RFT_CONTEXT *pCtx, FILE_TYPE type, const void *pOpts, const char *pName);
+
+/** Loads several input files into the context at once, one per thread. The result,
+and any overlap reported, is the same whatever the number of threads. */
+RESULT RftLoadFiles(RFT_CONTEXT *pCtx, const RFT_INPUT *pInputs, U32 numInputs);
+
+/** Decodes an input held in memory, passing each record to a visitor. No memory
+is allocated, and raw binary data is passed without being copied. */
+RESULT RftVisitMem(FILE_TYPE type, const void *pOpts, const U8 *pBuf, U32 len,
+   const RFT_VISITOR *pVisitor);
+
+/** Decodes an input file, passing each record to a visitor. */
+RESULT RftVisitFile(FILE_TYPE type, const void *pOpts, const char *pName,
+   const RFT_VISITOR *pVisitor);
+
+/** Gets the first range loaded, in address order. Follow pNext for the others. */
+const RANGE *RftGetRanges(const RFT_CONTEXT *pCtx);
+
+/** Gets a range's data as one contiguous block, merging its segments if needed. */
+RESULT RftGetRangeData(const RANGE *pRange, const U8 **ppData);
+
+/** Gets the number of ranges loaded. */
+U32 RftGetNumRanges(const RFT_CONTEXT *pCtx);
+
+/** Gets the number of data bytes loaded. */
+U32 RftGetDataBytes(const RFT_CONTEXT *pCtx);
+
+/** Gets the program's execution starting address. */
+U32 RftGetStartAddr(const RFT_CONTEXT *pCtx);
+
+/** Gets the first error reported by the last operation on the context, or "" if
+there was none. Errors are also printed as they happen. */
+const char *RftGetLastError(const RFT_CONTEXT *pCtx);
+
+/** Gets a description of an output format. */
+const char *RftGetFormatDesc(FILE_TYPE type);
+
+/** Checks the loaded data against the limits of an output format, and plans the
+output. Release the plan with RftFreePlan(). */
+RESULT RftPlanOutput(RFT_CONTEXT *pCtx, FILE_TYPE type, const void *pOpts, OUTPUT_PLAN *pPlan);
+
+/** Releases the memory held by an output plan. */
+void RftFreePlan(OUTPUT_PLAN *pPlan);
+
+/** Writes an output file, or publishes a shared memory object. pPlan may be NULL
+to plan the output first. Files are written beside the output and then renamed over
+it, so a failed write leaves any earlier output alone. */
+RESULT RftWriteFile(RFT_CONTEXT *pCtx, FILE_TYPE type, const void *pOpts,
+   const OUTPUT_PLAN *pPlan, const char *pName);
+
+/** Writes an output to a file descriptor. pPlan may be NULL to plan the output first. */
+RESULT RftWriteFd(RFT_CONTEXT *pCtx, FILE_TYPE type, const void *pOpts,
+   const OUTPUT_PLAN *pPlan, int fd);
+
+/** Writes an output into a caller-provided buffer. pPlan may be NULL to plan the
+output first. If the buffer is too small, BUFFER_TOO_SMALL is returned and
+*pOutLen is the size needed. */
+RESULT RftWriteMem(RFT_CONTEXT *pCtx, FILE_TYPE type, const void *pOpts,
+   const OUTPUT_PLAN *pPlan, U8 *pBuf, U32 bufLen, U32 *pOutLen);
+
+#endif